@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+#
+# bench.py
+#
+# Runs c-engine over the benchmark corpus and records per-phase timing
+#
+# (C) 2024, Kenneth Roe
+#
+# GNU Affero General Public License
+#
+#     bench.py [-e engine] [-t seconds] [-o results.json] [corpus ...]
+#     bench.py --compare baseline.json results.json [--threshold pct] [--min seconds]
+#              [--total-min seconds]
+#
+# Each input is run as "c-engine -t limit -j phases.json file".  The
+# engine writes the time spent parsing, preprocessing, rewriting, in
+# the case split search and in external solvers to phases.json when it
+# exits.  The results for the whole corpus are collected into one JSON
+# file.
+#
+# The compare mode reads two result files and reports every benchmark
+# whose total time grew by more than threshold percent (and by at least
+# min seconds, so that timer noise on trivial inputs is ignored) or whose
+# answer changed.  Most of the corpus finishes in milliseconds, so the
+# time summed over the benchmarks both runs share is also checked
+# against the threshold; a slowdown spread thinly over many fast inputs
+# still shows up there.  That check uses the phase times the engine
+# reports rather than the wall clock, so process start-up is left out,
+# and the sum must also grow by at least total-min seconds.  It exits
+# with status 1 if anything regressed.
+#
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_ENGINE = os.path.join(BENCH_DIR, "..", "c-engine")
+DEFAULT_CORPUS = os.path.join(BENCH_DIR, "corpus")
+
+PHASES = ["parse", "preprocess", "rewrite", "search", "external", "other"]
+
+COUNTERS = {
+    "splits": re.compile(r"^Total splits: (\d+)", re.M),
+    "unate_splits": re.compile(r"^Unate splits: (\d+)", re.M),
+    "backjumps": re.compile(r"^Total backjumps: (\d+)", re.M),
+    "restarts": re.compile(r"^Total restarts: (\d+)", re.M),
+}
+
+
+def find_inputs(paths):
+    inputs = []
+    for path in paths:
+        if os.path.isfile(path):
+            inputs.append(path)
+            continue
+        for root, dirs, files in os.walk(path):
+            dirs.sort()
+            for f in sorted(files):
+                if f.endswith(".smt") or f.endswith(".svc"):
+                    inputs.append(os.path.join(root, f))
+    return inputs
+
+
+def expected_status(path):
+    with open(path) as f:
+        text = f.read()
+    if path.endswith(".svc"):
+        m = re.search(r"^;\s*status\s+(\w+)", text, re.M)
+        return m.group(1).upper() if m else None
+    m = re.search(r":status\s+(\w+)", text)
+    return m.group(1) if m else None
+
+
+def answer(path, output):
+    if path.endswith(".svc"):
+        words = ["VALID", "INVALID"]
+    else:
+        words = ["sat", "unsat", "unknown"]
+    found = None
+    for line in output.splitlines():
+        if line.strip() in words:
+            found = line.strip()
+    return found
+
+
+def run_one(engine, path, limit):
+    fd, phase_file = tempfile.mkstemp(suffix=".json")
+    os.close(fd)
+    os.unlink(phase_file)
+
+    start = time.time()
+    try:
+        proc = subprocess.run([engine, "-t", str(limit), "-j", phase_file, path],
+                              stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                              timeout=limit + 30)
+        output = proc.stdout.decode("latin-1")
+        status = proc.returncode
+    except subprocess.TimeoutExpired as e:
+        output = (e.stdout or b"").decode("latin-1")
+        status = None
+    wall = time.time() - start
+
+    phases = {}
+    if os.path.exists(phase_file):
+        try:
+            with open(phase_file) as f:
+                report = json.load(f)
+            phases = dict((p, v["seconds"]) for p, v in report["phases"].items())
+        except (ValueError, KeyError):
+            pass
+        os.unlink(phase_file)
+
+    result = {
+        "file": os.path.relpath(path, BENCH_DIR),
+        "logic": os.path.basename(os.path.dirname(path)),
+        "expected": expected_status(path),
+        "answer": answer(path, output),
+        "exit": status,
+        "wall": round(wall, 6),
+        "phases": phases,
+    }
+    for name, pattern in COUNTERS.items():
+        m = pattern.findall(output)
+        if m:
+            result[name] = int(m[-1])
+    if status is None or wall >= limit:
+        result["answer"] = "timeout"
+    result["correct"] = result["answer"] == result["expected"]
+
+    return result
+
+
+def run(args):
+    engine = os.path.abspath(args.engine)
+    if not os.path.exists(engine):
+        sys.stderr.write("Cannot find %s; build it with make first\n" % engine)
+        return 2
+
+    inputs = find_inputs(args.corpus or [DEFAULT_CORPUS])
+    results = []
+    for path in inputs:
+        r = run_one(engine, path, args.time)
+        results.append(r)
+        print("%-40s %-8s %9.3fs  %s" % (r["file"], r["answer"], r["wall"],
+              " ".join("%s=%.3f" % (p, r["phases"].get(p, 0.0)) for p in PHASES if r["phases"].get(p))))
+
+    wrong = [r for r in results if not r["correct"] and r["answer"] not in ("timeout", "unknown")]
+    summary = {
+        "engine": engine,
+        "time_limit": args.time,
+        "date": time.strftime("%Y-%m-%d %H:%M:%S"),
+        "total": round(sum(r["wall"] for r in results), 6),
+        "solved": len([r for r in results if r["correct"]]),
+        "count": len(results),
+        "results": results,
+    }
+    with open(args.output, "w") as f:
+        json.dump(summary, f, indent=4)
+    print("Solved %d of %d in %.3fs, results in %s" % (summary["solved"], summary["count"], summary["total"], args.output))
+
+    for r in wrong:
+        print("WRONG ANSWER: %s gave %s, expected %s" % (r["file"], r["answer"], r["expected"]))
+    return 1 if wrong else 0
+
+
+def phase_total(r):
+    # Older result files and crashed runs have no phase report
+    if r["phases"]:
+        return sum(r["phases"].values())
+    return r["wall"]
+
+
+def compare(args):
+    with open(args.compare[0]) as f:
+        base = dict((r["file"], r) for r in json.load(f)["results"])
+    with open(args.compare[1]) as f:
+        new = dict((r["file"], r) for r in json.load(f)["results"])
+
+    regressions = 0
+    shared = [name for name in sorted(new) if name in base]
+    for name in sorted(new):
+        n = new[name]
+        b = base.get(name)
+        if b is None:
+            continue
+        if b["correct"] and not n["correct"]:
+            print("REGRESSION %s: answer %s, was %s" % (name, n["answer"], b["answer"]))
+            regressions += 1
+            continue
+        delta = n["wall"] - b["wall"]
+        if delta > args.min and delta > b["wall"] * args.threshold / 100.0:
+            worst = max(PHASES, key=lambda p: n["phases"].get(p, 0.0) - b["phases"].get(p, 0.0))
+            print("REGRESSION %s: %.3fs -> %.3fs (+%.0f%%), mostly in %s" %
+                  (name, b["wall"], n["wall"], 100.0 * delta / max(b["wall"], 1e-6), worst))
+            regressions += 1
+        elif -delta > args.min and -delta > b["wall"] * args.threshold / 100.0:
+            print("improved   %s: %.3fs -> %.3fs" % (name, b["wall"], n["wall"]))
+
+    for p in PHASES:
+        bt = sum(base[name]["phases"].get(p, 0.0) for name in shared)
+        nt = sum(new[name]["phases"].get(p, 0.0) for name in shared)
+        print("%-12s %9.3fs -> %9.3fs" % (p, bt, nt))
+
+    bt = sum(base[name]["wall"] for name in shared)
+    nt = sum(new[name]["wall"] for name in shared)
+    print("%-12s %9.3fs -> %9.3fs" % ("total", bt, nt))
+
+    bt = sum(phase_total(base[name]) for name in shared)
+    nt = sum(phase_total(new[name]) for name in shared)
+    if nt - bt > args.total_min and nt - bt > bt * args.threshold / 100.0:
+        print("REGRESSION corpus phase total: %.3fs -> %.3fs (+%.0f%%)" %
+              (bt, nt, 100.0 * (nt - bt) / max(bt, 1e-6)))
+        regressions += 1
+
+    print("%d regression%s beyond %g%%" % (regressions, "" if regressions == 1 else "s", args.threshold))
+    return 1 if regressions else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the HTP benchmark corpus")
+    parser.add_argument("-e", "--engine", default=DEFAULT_ENGINE)
+    parser.add_argument("-t", "--time", type=int, default=60, help="time limit per benchmark in seconds")
+    parser.add_argument("-o", "--output", default="bench-results.json")
+    parser.add_argument("--compare", nargs=2, metavar=("BASELINE", "RESULTS"))
+    parser.add_argument("--threshold", type=float, default=10.0, help="percent slowdown counted as a regression")
+    parser.add_argument("--min", type=float, default=0.01, help="ignore per-benchmark slowdowns smaller than this many seconds")
+    parser.add_argument("--total-min", type=float, default=0.1, help="ignore corpus-wide slowdowns smaller than this many seconds")
+    parser.add_argument("corpus", nargs="*")
+    args = parser.parse_args()
+
+    if args.compare:
+        return compare(args)
+    return run(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -66,6 +66,7 @@ main ()
     struct env *env, *def ;
     struct parameter parameters[5], *params ;
     struct match_return *mr ;
+    struct add_list *al ;
     struct disc *d ;
     struct small_disc *s ;
     unsigned big1[10], big2[10], *bigres ;
@@ -1305,6 +1306,9 @@ main ()
     printf("exp = %s\n", _th_print_exp(exp)) ;
     exp = _th_transitive(env,_th_parse(env,"(preceq c a)")) ;
     printf("exp = %s\n", _th_print_exp(exp)) ;
+    for (al = _th_trans_reason(env); al != NULL; al = al->next) {
+        printf("    reason %s\n", _th_print_exp(al->e)) ;
+    }
     _th_trans_pop() ;
     _th_trans_push(env) ;
     _th_add_rule(env, _th_parse(env,"(-> (nless a 5) (True) (True))")) ;
@@ -1713,6 +1717,34 @@ char *argv[] ;
             argv += 2;
             argc -= 2;
             change = 1;
+        } else  if (argc > 2 && !strncmp(argv[1],"-j",2)) {
+            _th_phase_report(argv[2]);
+            argv += 2;
+            argc -= 2;
+            change = 1;
+        } else  if (argc > 2 && !strncmp(argv[1],"-pc",3)) {
+            _th_preprocess_cache_dir = argv[2];
+            argv += 2;
+            argc -= 2;
+            change = 1;
+        } else  if (argc > 2 && !strncmp(argv[1],"-pp",3)) {
+            if (!_th_set_preprocess_pipeline(argv[2])) {
+                printf("Unrecognized preprocessing pass in \"%s\".  Enter \"prove -h\" for options.\n", argv[2]);
+                exit(1);
+            }
+            argv += 2;
+            argc -= 2;
+            change = 1;
+        } else  if (argc > 2 && !strncmp(argv[1],"-cl",3)) {
+            _th_cycle_length_limit = atoi(argv[2]);
+            argv += 2;
+            argc -= 2;
+            change = 1;
+        } else  if (argc > 2 && !strncmp(argv[1],"-cn",3)) {
+            _th_cycle_count_limit = atoi(argv[2]);
+            argv += 2;
+            argc -= 2;
+            change = 1;
         } else  if (argc > 2 && !strncmp(argv[1],"-l",2)) {
             _th_do_learn = atoi(argv[2]);
             argv += 2;
@@ -1737,6 +1769,7 @@ char *argv[] ;
             printf("    -h   - print this message.\n");
 			printf("    -f   - print conditions in sat case\n");
             printf("    -t n - set execution time limit to n seconds.\n");
+            printf("    -j f - write a JSON summary of the time spent in each phase to f.\n");
             printf("    -l n - if n is zero disables all learning, if n > 0 enables\n");
             printf("           learning and restarts after <number> seconds.\n");
             printf("    -s   - Enables symmetry detection in the preprocessor.\n");
@@ -1748,10 +1781,27 @@ char *argv[] ;
             printf("           output file with the same name plus \".out\" and possibly\n");
             printf("           a file with the same name plus \".cnf\" if the result is a boolean\n");
             printf("           expression.  Then either Yices or MiniSat are run on the result.\n");
+            printf("    -pc d - Keep the results of -pr preprocessing in directory d and\n");
+            printf("           reuse them when the same input is run with the same options.\n");
+            printf("    -pp l - Run the preprocessing passes in the comma separated list l.\n");
+            printf("           The passes are symmetry, rewrite, variablize, nested_ite,\n");
+            printf("           unate, flower and grouping.  The default is\n");
+            printf("           symmetry,rewrite,variablize,nested_ite,rewrite,unate,rewrite,\n");
+            printf("           flower,grouping.\n");
+            printf("    -ps  - Print the time and term DAG sizes of each preprocessing pass.\n");
             printf("    -o   - Output the input file.  Useful for pretty printing.\n");
             printf("    -e   - only eliminate unates of the form \"v = e\" when running\n");
             printf("           HTP as a preprocessor.\n");
             printf("    -b   - Block big groups in the difference logic encoder\n");
+            printf("    -cl n - Only collect difference logic cycles of at most n variables.\n");
+            printf("    -cn n - Stop collecting difference logic cycles after n (default\n");
+            printf("           10000).  Zero means no limit for -cl and -cn.\n");
+            printf("    -bt  - Write the log as a binary trace to \"evidence.trc\".  Use\n");
+            printf("           tracedump to decode it.\n");
+            printf("    -a   - Handle arrays lazily by generating read over write and\n");
+            printf("           extensionality lemmas on demand.\n");
+            printf("    -rp  - Profile rewrite rules and builtin simplifiers.  A table of\n");
+            printf("           attempts, matches and cycles per rule is printed at exit.\n");
             exit(0);
         } else if (argc > 1 && !strncmp(argv[1],"-e",2)) {
             _th_equality_only = 1;
@@ -1768,6 +1818,11 @@ char *argv[] ;
             argv += 1;
             argc -= 1;
             change = 1;
+        } else if (argc > 1 && !strncmp(argv[1],"-ps",3)) {
+            _th_preprocess_report = 1;
+            argv += 1;
+            argc -= 1;
+            change = 1;
         } else if (argc > 1 && !strncmp(argv[1],"-pr",3)) {
             preprocess_flag = 2;
             argv += 1;
@@ -1778,11 +1833,26 @@ char *argv[] ;
             argv += 1;
             argc -= 1;
             change = 1;
+        } else if (argc > 1 && !strncmp(argv[1],"-bt",3)) {
+            argv += 1;
+            argc -= 1;
+            _tree_binary_trace("evidence.trc");
+            change = 1;
         } else if (argc > 1 && !strncmp(argv[1],"-b",2)) {
             argv += 1;
             argc -= 1;
             _th_block_bigs = 1;
             change = 1;
+        } else if (argc > 1 && !strncmp(argv[1],"-a",2)) {
+            argv += 1;
+            argc -= 1;
+            _th_lazy_arrays = 1;
+            change = 1;
+        } else if (argc > 1 && !strncmp(argv[1],"-rp",3)) {
+            argv += 1;
+            argc -= 1;
+            _th_profile_rules();
+            change = 1;
         } else if (argc > 1 && argv[1][0]=='-') {
             printf("Unrecognized option.  Enter \"prove -h\" for options.\n");
             exit(1);
@@ -1809,6 +1879,7 @@ char *argv[] ;
     //        gets(line) ;
     //        printf("%s\n", line) ;
     //    } while (!_th_process(line) && !feof(stdin)) ;
+    if (argc > 1) _th_phase_input(argv[1]);
     if (argc==2 && !strcmp(argv[1]+strlen(argv[1])-4,".svc")) {
         struct env *env = _th_default_env(ENVIRONMENT_SPACE);
         int res = _th_svcs(env,argv[1]);
@@ -910,7 +910,7 @@ struct add_list *build_condition_list(struct module_list *module, struct _ex_int
 struct add_list *get_rule_conditions(struct module_list *module, struct _ex_intern *rule)
 {
     struct applicable_conditions *conds;
-    int hash = (((int)rule)/4)%RULE_HASH_SIZE;
+    int hash = rule->id%RULE_HASH_SIZE;
     conds = module->applicable_rules[hash];
     while (conds != NULL) {
         if (conds->exp==rule) return conds->conditions;
@@ -116,7 +116,7 @@ void _th_pop_context()
 
 static int cmp(const void *i1,const void *i2)
 {
-    return *((const int *)i2)-*((const int *)i1) ;
+    return ((int)(*((struct _ex_intern **)i2))->id)-((int)(*((struct _ex_intern **)i1))->id) ;
 }
 
 void _th_add_cache(struct _ex_intern *exp, struct _ex_intern *cache)
@@ -137,7 +137,7 @@ void _th_flush_context()
             case 2:
                 break;
             case 3:
-                if (adds[1] < adds[2]) {
+                if (adds[1]->id < adds[2]->id) {
                     r = adds[1];
                     adds[1] = adds[2];
                     adds[2] = r;
@@ -442,11 +442,22 @@ void _th_set_cache_rewrite(struct env *env, struct _ex_intern *e, struct _ex_int
     }
 }
 
+/*
+ * True at the top level, where the fast cache in the rewrite field is
+ * used because results do not depend on a conditional or quantifier
+ * context
+ */
+int _th_cache_at_top()
+{
+    return quant_context==empty_quant && _th_cond_level()==0 ;
+}
+
 void _th_clear_cache()
 {
     while(_th_rewrite_next != NULL) {
         _th_rewrite_next->rewrite = NULL ;
         _th_rewrite_next = _th_rewrite_next->next_cache ;
     }
+    _th_invalidate_normal_forms() ;
 }
 
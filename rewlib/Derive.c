@@ -311,7 +311,7 @@ struct _ex_intern *_derive_prepare(struct env *env, struct _ex_intern *e)
         int l = _th_smaller(env,e->u.appl.args[0],e->u.appl.args[1]) ;
         int r = _th_smaller(env,e->u.appl.args[1],e->u.appl.args[0]) ;
         if (e->u.appl.args[0]->type==EXP_MARKED_VAR && e->u.appl.args[1]->type==EXP_MARKED_VAR) {
-            if (e->u.appl.args[0]<e->u.appl.args[1]) {
+            if (e->u.appl.args[0]->id < e->u.appl.args[1]->id) {
                 l = 1;
                 r = 0;
             } else {
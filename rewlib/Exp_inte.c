@@ -104,6 +104,37 @@ struct parent_stack {
 static struct parent_stack *parent_stack = NULL;
 static int parent_level = 0;
 
+/*
+ * Each change to the used_in list of a term is stamped with the next
+ * tick of used_in_clock, so a cache built from used_in lists can tell
+ * whether any of the lists it read have changed since.  _ex_release
+ * frees terms, so it also bumps _ex_used_in_generation to drop such
+ * caches entirely.
+ */
+int _ex_used_in_generation = 0;
+static unsigned used_in_clock = 0;
+static struct term_marks *used_in_changes = NULL;
+
+static void used_in_changed(struct _ex_intern *e)
+{
+    if (used_in_changes==NULL) used_in_changes = _th_new_term_marks(1);
+    _th_set_term_value(used_in_changes,e,(void *)(size_t)++used_in_clock);
+}
+
+/*
+ * Returns the tick of the last change to the used_in list of e, or 0
+ */
+unsigned _ex_used_in_changed(struct _ex_intern *e)
+{
+    if (used_in_changes==NULL) return 0;
+    return (unsigned)(size_t)_th_term_value(used_in_changes,e);
+}
+
+unsigned _ex_used_in_clock()
+{
+    return used_in_clock;
+}
+
 
 #ifdef _DEBUG
 static int integer_count ;
@@ -118,6 +149,18 @@ static int string_count ;
 #endif
 
 static struct _exp_record current, save, deleted ;
+
+/*
+ * Every term gets a dense id in creation order.  Hashing and ordering
+ * terms by id rather than by address keeps the search independent of
+ * where the allocator happens to place things.
+ */
+static unsigned next_term_id = 1;
+
+unsigned _ex_term_id_limit()
+{
+    return next_term_id;
+}
 static int push_level = 0;
 static char *temp_space_mark ;
 static int space ;
@@ -467,6 +510,7 @@ void _ex_used_in_pop()
     while (parent_updates) {
         struct add_list *a = parent_updates->e->used_in;
         parent_updates->e->used_in = parent_updates->old_adds;
+        used_in_changed(parent_updates->e);
         //if (parent_updates->e->used_level <= parent_updates->old_parent_level) {
         //    fprintf(stderr, "Illegal parent level\n");
         //    exit(1);
@@ -532,6 +576,7 @@ struct _ex_intern *_ex_intern_integer(unsigned *x)
     e->cache_bad = 0;
     e->cached_in = NULL;
     e->height = 0;
+    e->id = next_term_id++;
     e->sig = NULL;
     e->prev_term = current.last_term;
     e->next_term = NULL;
@@ -619,6 +664,7 @@ struct _ex_intern *_ex_intern_var(unsigned x)
     e->cache_bad = 0;
     e->cached_in = NULL;
     e->height = 0;
+    e->id = next_term_id++;
     e->sig = NULL;
     e->prev_term = current.last_term;
     e->next_term = NULL;
@@ -688,6 +734,7 @@ struct _ex_intern *_ex_intern_marked_var(unsigned x, int y)
     e->cache_bad = 0;
     e->cached_in = NULL;
     e->height = 0;
+    e->id = next_term_id++;
     e->sig = NULL;
     e->in_hash = 0;
     e->prev_term = e->next_term = NULL;
@@ -708,7 +755,7 @@ struct _ex_intern *_ex_intern_index(struct _ex_intern *ex, unsigned f, int t)
     struct _ex_intern *e ;
 
     /* Generate the hash value */
-    hash %= (((unsigned) ex)/4+f+t)%index_parent_size ;
+    hash %= (ex->id+f+t)%index_parent_size ;
 
     /* First, try and find the value */
     e = current.index_parent[hash] ;
@@ -751,6 +798,7 @@ struct _ex_intern *_ex_intern_index(struct _ex_intern *ex, unsigned f, int t)
     e->cache_bad = 0;
     e->cached_in = NULL;
     e->height = 0;
+    e->id = next_term_id++;
     e->sig = NULL;
     e->in_hash = 0;
     e->prev_term = e->next_term = NULL;
@@ -833,6 +881,7 @@ struct _ex_intern *_ex_intern_rational(unsigned *n, unsigned *d)
     e->cache_bad = 0;
     e->cached_in = NULL;
     e->height = 0;
+    e->id = next_term_id++;
     e->sig = NULL;
     e->in_hash = 0;
     e->prev_term = current.last_term;
@@ -884,7 +933,7 @@ struct _ex_intern *_ex_intern_appl(unsigned f,int count,struct _ex_intern **args
 #endif
 
     /* Generate the hash value */
-    for (i = 0; i < count; ++i) hash += ((unsigned)args[i])/4 ;
+    for (i = 0; i < count; ++i) hash += args[i]->id ;
     hash %= appl_parent_size ;
 
     //_ex_is_new = 0;
@@ -937,6 +986,7 @@ cont:
     e->cache_bad = 0;
     e->cached_in = NULL;
     e->height = 0;
+    e->id = next_term_id++;
     e->sig = NULL;
     e->in_hash = 0;
 #ifdef _DEBUG
@@ -982,7 +1032,7 @@ struct _ex_intern *_ex_find_equality(struct _ex_intern *left, struct _ex_intern
     //int i ;
     struct _ex_intern *e ;
 
-    hash = (INTERN_EQUAL + (((unsigned)left)/4) + (((unsigned)right)/4))%appl_parent_size;
+    hash = (INTERN_EQUAL + left->id + right->id)%appl_parent_size;
 
     e = current.appl_parent[hash] ;
     while (e != NULL) {
@@ -1020,6 +1070,7 @@ void _ex_add_used_in(struct _ex_intern *e)
         al->next = e->u.appl.args[i]->used_in;
         e->u.appl.args[i]->used_in = al;
         al->e = e;
+        used_in_changed(e->u.appl.args[i]);
     }
 }
 
@@ -1077,6 +1128,7 @@ struct _ex_intern *_ex_intern_string(char *s)
     e->cache_bad = 0;
     e->cached_in = NULL;
     e->height = 0;
+    e->id = next_term_id++;
     e->sig = NULL;
     e->in_hash = 0;
     e->prev_term = e->next_term = NULL;
@@ -1093,7 +1145,7 @@ struct _ex_intern *_ex_intern_string(char *s)
 
 static int cmp(const void *i1,const void *i2)
 {
-    return *((const int *)i2)-*((const int *)i1) ;
+    return ((int)(*((struct _ex_intern **)i2))->id)-((int)(*((struct _ex_intern **)i1))->id) ;
 }
 
 struct _ex_intern *_ex_intern_case(struct _ex_intern *exp,int count,struct _ex_intern **args)
@@ -1116,9 +1168,9 @@ cont:
     /* Generate the hash value */
     for (i = 0; i < count*2; ++i) {
         _zone_print2("%d %d", i, args[i]) ;
-        hash += ((unsigned)args[i])/4 ;
+        hash += args[i]->id ;
     }
-    hash += ((unsigned)exp)/4;
+    hash += exp->id;
     hash %= case_parent_size ;
     /* First, try and find the value */
     e = current.case_parent[hash] ;
@@ -1164,6 +1216,7 @@ cont2:
     e->cache_bad = 0;
     e->cached_in = NULL;
     e->height = 0;
+    e->id = next_term_id++;
     e->sig = NULL;
     e->in_hash = 0;
     e->prev_term = e->next_term = NULL;
@@ -1195,7 +1248,7 @@ struct _ex_intern *_ex_intern_quant(unsigned quant,int count,unsigned *args,stru
     /**********/
 
     /* Generate the hash value */
-    hash = ((unsigned)exp)/4+((unsigned)cond)/4 ;
+    hash = exp->id+cond->id ;
     for (i = 0; i < count; ++i) hash += args[i] ;
     hash %= quant_parent_size ;
 
@@ -1254,6 +1307,7 @@ cont:
     e->cache_bad = 0;
     e->cached_in = NULL;
     e->height = 0;
+    e->id = next_term_id++;
     e->sig = NULL;
     e->prev_term = current.last_term;
     e->next_term = NULL;
@@ -1340,6 +1394,8 @@ void _ex_pop()
 
 void _ex_release()
 {
+    ++_ex_used_in_generation;
+    if (used_in_changes) _th_start_traversal(used_in_changes);
     _th_alloc_release(INTERN_TEMP_SPACE,temp_space_mark) ;
     FREE(deleted.appl_parent) ;
     FREE(deleted.case_parent) ;
@@ -56,6 +56,8 @@ void _tree_set_time_limit(unsigned t);
 #define _tree_start_local(n)
 #define _tree_finish_local()
 #define _tree_print_exp(s,exp)
+#define _tree_binary_trace(n)
+#define _tree_trace_flush()
 
 #define _zone_print0(x)
 #define _zone_print1(x,a)
@@ -109,10 +111,13 @@ void _th_reference_cache(unsigned cache) ;
 void _tree_start_local(char *n);
 void _tree_finish_local();
 void _tree_print_exp(char *s, struct _ex_intern *exp);
+void _tree_binary_trace(char *n);
+void _tree_trace_flush();
 
 void _tree_set_time_limit(unsigned t);
 
 extern int _info_flag ;
+extern int _tree_binary ;
 extern int _tree_interactive, _tree_core ;
 extern int _tree_start, _tree_end ;
 extern int _tree_zone ;
@@ -314,6 +319,9 @@ struct env ;
 void _ex_used_in_push();
 void _ex_used_in_pop();
 void _ex_add_used_in(struct _ex_intern *e);
+extern int _ex_used_in_generation;
+unsigned _ex_used_in_changed(struct _ex_intern *e);
+unsigned _ex_used_in_clock();
 void _ex_push() ;
 void _ex_pop() ;
 struct _ex_intern *_ex_reintern(struct env *,struct _ex_intern *) ;
@@ -358,6 +366,7 @@ struct _ex_base {
     struct add_list *cached_in;
     int used_level;
     int height;
+    unsigned id;
     unsigned print_line ;
     unsigned cache_line;
     struct _ex_intern *print_next;
@@ -415,6 +424,7 @@ struct _ex_intern {
     struct add_list *cached_in;
     int used_level;
     int height;
+    unsigned id;
     unsigned print_line ;
     unsigned cache_line;
     struct _ex_intern *print_next;
@@ -453,6 +463,7 @@ void _th_collect_and_print_classes(struct env *env, int stop_on_errors);
 void _ex_add_term(struct _ex_intern *e);
 void _ex_delete_term(struct _ex_intern *e);
 struct _ex_intern *_ex_get_first_term();
+unsigned _ex_term_id_limit();
 
 /* parse.c */
 void _th_parse_init() ;
@@ -469,6 +480,9 @@ struct _ex_intern *_th_process_svc_script(struct env *env, char *name) ;
 extern int _th_block_complex;
 char *_th_print_exp(struct _ex_intern *exp) ;
 char *_th_tree_exp(unsigned line, struct _ex_intern *exp) ;
+void _th_fprint_exp(FILE *f, struct env *env, struct _ex_intern *exp, int shared) ;
+int _th_share_subterms(struct _ex_intern *e, struct _ex_intern ***shared) ;
+void _th_share_release() ;
 void _th_print_init() ;
 void _th_print_shutdown() ;
 void _th_print_number(unsigned *) ;
@@ -515,6 +529,7 @@ struct _ex_unifier *_th_new_unifier(unsigned) ;
 struct _ex_unifier *_th_add_pair(unsigned,struct _ex_unifier *,unsigned,struct _ex_intern *) ;
 struct _ex_unifier *_th_copy_unifier(unsigned,struct _ex_unifier *) ;
 struct _ex_unifier *_th_shallow_copy_unifier(unsigned,struct _ex_unifier *) ;
+void _th_restore_unifier(struct _ex_unifier *,struct _ex_unifier *) ;
 struct _ex_intern *_th_apply(struct _ex_unifier *,unsigned) ;
 struct _ex_intern *_th_subst(struct env *,struct _ex_unifier *,struct _ex_intern *) ;
 struct _ex_intern *_th_marked_subst(struct env *,struct _ex_unifier *,struct _ex_intern *) ;
@@ -602,6 +617,19 @@ void _th_add_find(struct env *env, struct _ex_intern *term, struct _ex_intern *f
 void _th_add_original(struct env *env, struct _ex_intern *term, struct _ex_intern *find);
 void _th_mark_inhash(struct env *env, struct _ex_intern *term);
 void _th_add_merge_explanation(struct env *env, struct _ex_intern *term, struct _ex_intern *merge, struct add_list *explanation);
+
+#define MERGE_REASON_PATH       0
+#define MERGE_REASON_CONGRUENCE 1
+
+struct merge_reason {
+    int rule;
+    struct _ex_intern *left, *right;
+    struct _ex_intern *literal;
+    int parent[2];
+} ;
+
+int _th_add_merge_reason(struct env *env, int rule, struct _ex_intern *left, struct _ex_intern *right, struct _ex_intern *literal, int parent0, int parent1);
+struct merge_reason *_th_get_merge_reason(struct env *env, int index);
 void _th_clean_cache(struct env *env);
 void _th_remove_cache(struct env *env);
 void _th_install_cache(struct env *env);
@@ -834,6 +862,8 @@ struct unify_return {
 
 int _th_equal(struct env *,struct _ex_intern *,struct _ex_intern *) ;
 struct match_return *_th_match(struct env *, struct _ex_intern *, struct _ex_intern *) ;
+struct match_cursor *_th_match_cursor(struct env *, struct _ex_intern *, struct _ex_intern *) ;
+struct _ex_unifier *_th_match_next(struct match_cursor *) ;
 int _th_much_smaller(struct env *,struct _ex_intern *,struct _ex_intern *) ;
 int _th_equal_smaller(struct env *,struct _ex_intern *,struct _ex_intern *) ;
 int _th_smaller(struct env *,struct _ex_intern *,struct _ex_intern *) ;
@@ -977,6 +1007,9 @@ int _th_add_rule(struct env *, struct _ex_intern *) ;
 void _th_transitive_init() ;
 void _th_transitive_reset() ;
 struct _ex_intern *_th_transitive(struct env *,struct _ex_intern *) ;
+int _th_trans_entails_order(struct env *env, unsigned op, struct _ex_intern *a, struct _ex_intern *b, int strict);
+struct add_list *_th_trans_explain_order(struct env *env, unsigned op, struct _ex_intern *a, struct _ex_intern *b, int strict);
+struct add_list *_th_trans_reason(struct env *env);
 int _th_is_binary_term(struct env *env, struct _ex_intern *e);
 struct _ex_intern *_th_search_equality(struct env *env, struct _ex_intern *e);
 struct _ex_intern *_th_search_less(struct env *env, struct _ex_intern *e);
@@ -1055,6 +1088,7 @@ void _th_quant_add_context_rule(unsigned, int) ;
 struct _ex_intern *_th_get_cache_rewrite(struct env *,struct _ex_intern *, int do_transitive) ;
 void _th_set_cache_rewrite(struct env *env, struct _ex_intern *, struct _ex_intern *, int do_transitive, unsigned start_cycle) ;
 void _th_clear_cache() ;
+int _th_cache_at_top() ;
 int _th_check_block(int cycle) ;
 struct _ex_intern *_th_get_context() ;
 extern struct _ex_intern *_th_context ;
@@ -1078,6 +1112,7 @@ void _th_init_rewrite(char *log);
 void _th_shutdown_rewrite();
 struct _ex_intern *_th_rewrite(struct env *, struct _ex_intern *) ;
 struct _ex_intern *_th_nc_rewrite(struct env *, struct _ex_intern *) ;
+void _th_invalidate_normal_forms() ;
 struct _ex_intern *_th_int_rewrite(struct env *, struct _ex_intern *, int) ;
 struct _ex_intern *_th_and_elaborate(struct env *, struct _ex_intern *) ;
 int _th_quant_level ;
@@ -1308,6 +1343,10 @@ struct fail_list *_th_prove(struct env *env, struct _ex_intern *e);
 #define PREPROCESS_NORUN   4
 
 int _th_preprocess(struct env *env, struct _ex_intern *e, char *write_file, char *write_d_file);
+int _th_set_preprocess_pipeline(char *spec);
+char *_th_get_preprocess_pipeline();
+extern int _th_preprocess_report;
+extern int _th_encoding_only;
 
 extern int _th_do_symmetry;
 extern int _th_do_grouping;
@@ -1325,6 +1364,7 @@ extern int _fd_combination_limit;
 struct fd_handle *_fd_solve(struct env *env, struct _ex_intern *exp);
 struct _ex_intern *_fd_get_value_n(struct env *env, struct fd_handle *fd, unsigned var, int n);
 struct _ex_intern *_fd_get_value_count(struct env *env, struct fd_handle *fd, unsigned var);
+int _fd_get_size(struct env *env, struct fd_handle *fd, unsigned var);
 void _fd_push(struct fd_handle *);
 void _fd_pop(struct fd_handle *);
 void _fd_revert(struct fd_handle *);
@@ -1353,6 +1393,7 @@ int _th_reassert_unblocked_rules(struct env *env);
 void _th_block_predicate(struct env *env, struct _ex_intern *assertion);
 struct _ex_intern *_th_simp(struct env *env, struct _ex_intern *e);
 struct add_list *_th_retrieve_explanation(struct env *env, struct _ex_intern *pred);
+struct add_list *_th_expand_merge_reasons(struct env *env, struct add_list *list);
 
 /* abstraction.c */
 struct _ex_intern *_th_abstract_condition(struct env *env, struct _ex_intern *e);
@@ -1371,6 +1412,19 @@ struct _ex_intern *_th_multiply_rationals(struct _ex_intern *a, struct _ex_inter
 struct _ex_intern *_th_divide_rationals(struct _ex_intern *a, struct _ex_intern *b);
 int _th_rational_less(struct _ex_intern *a, struct _ex_intern *b);
 
+/* bounds.c */
+struct bound_cache;
+typedef void (*_th_leaf_bounds)(struct env *env, void *data, struct _ex_intern *e, struct _ex_intern **min, struct _ex_intern **max);
+extern struct bound_cache *_th_env_bounds;
+struct bound_cache *_th_new_bound_cache(_th_leaf_bounds leaf, void *data);
+void _th_free_bound_cache(struct bound_cache *cache);
+struct _ex_intern *_th_bound_min(struct env *env, struct bound_cache *cache, struct _ex_intern *e);
+struct _ex_intern *_th_bound_max(struct env *env, struct bound_cache *cache, struct _ex_intern *e);
+void _th_bound_changed(struct bound_cache *cache, struct _ex_intern *e);
+void _th_bound_reset(struct bound_cache *cache);
+struct _ex_intern *_th_env_bound_min(struct env *env, struct _ex_intern *e);
+struct _ex_intern *_th_env_bound_max(struct env *env, struct _ex_intern *e);
+
 /* unate.c */
 struct dependencies {
     struct dependencies *next;
@@ -1400,6 +1454,7 @@ struct term_list *_th_eliminate_composite_conds(struct env *env, struct term_lis
 
 extern struct _ex_intern *_th_reduced_exp;
 struct add_list *_th_eliminate_unates(struct env *env, struct _ex_intern *e, struct term_list *terms);
+void _th_unate_pop(int level);
 struct _ex_intern *_th_reduction_score(struct env *env, struct term_list *all, struct term_list *tl, struct _ex_intern *e);
 int _th_my_contains_ite(struct _ex_intern *e);
 int _th_is_boolean_term(struct env *env, struct _ex_intern *e);
@@ -1408,6 +1463,7 @@ int _th_is_boolean_term(struct env *env, struct _ex_intern *e);
 void _th_print_trail(char *heading, struct parent_list *l);
 int _th_learn_has_non_unity(struct env *env, struct learn_info *info);
 void _th_abstract_tuples(struct env *env, struct learn_info *info);
+void _th_learn_reduce(struct env *env, struct learn_info *info);
 void _th_elim_simp_var(struct env *env, struct learn_info *info);
 void _th_elim_var(struct env *env, struct learn_info *info, unsigned var, struct _ex_intern *exp);
 int _th_solved_case(struct env *env, struct learn_info *info, struct parent_list *list);
@@ -1433,6 +1489,8 @@ struct _ex_intern *_th_get_assignment(struct env *env, struct learn_info *info,
 void _th_print_assignments(struct learn_info *info);
 int _th_learn_term_count(struct learn_info *info);
 void _th_learn_print_assignments(struct learn_info *info);
+struct add_list *_th_learn_get_assignments(struct learn_info *info);
+int _th_learn_has_term(struct learn_info *info, struct _ex_intern *e);
 void _th_learn_add_score_dependencies(struct env *env, struct learn_info *info);
 struct env *_th_learn_get_env(struct learn_info *info);
 struct _ex_intern *_th_learn_choose(struct env *env, struct learn_info *info, struct parent_list *parents);
@@ -1479,6 +1537,7 @@ struct term_list *_th_get_dependency_cache();
 
 struct mark_info *_th_term_cache_push();
 void _th_term_cache_pop(struct mark_info *);
+int _th_term_cache_level();
 
 /* smt_parser.y */
 struct _ex_intern *_th_parse_smt(struct env *env, char *name);
@@ -1504,6 +1563,12 @@ struct _ex_intern *_th_simplify_select(struct env *env, struct _ex_intern *e);
 struct _ex_intern *_th_simplify_store(struct env *env, struct _ex_intern *e);
 struct _ex_intern *_th_simplify_array_equality(struct env *env, struct _ex_intern *e);
 struct _ex_intern *_th_simplify_ee(struct env *env, struct _ex_intern *e);
+extern int _th_lazy_arrays;
+#define ARRAY_CONSISTENT 0
+#define ARRAY_LEMMAS     1
+#define ARRAY_CONFLICT   2
+void _th_array_start_proof();
+int _th_array_lemmas(struct env *env, struct learn_info *info);
 
 /* parse_yices_ce.c */
 void _th_parse_yices_ce(struct env *env, FILE *file);
@@ -1519,6 +1584,8 @@ struct _ex_intern *_th_augment_with_symmetries(struct env *env, struct _ex_inter
 
 /* grouping.c */
 extern int _th_block_bigs;
+extern int _th_cycle_length_limit;
+extern int _th_cycle_count_limit;
 struct _ex_intern *_th_simplify_groupings(struct env *env, struct _ex_intern *e, struct parent_list *unates, struct learn_info *info);
 struct _ex_intern *_th_break_flower(struct env *env, struct _ex_intern *e, struct parent_list *unates, struct learn_info *info);
 
@@ -1531,6 +1598,58 @@ struct _ex_intern *_th_variablize_functions(struct env *env, struct _ex_intern *
 int _th_is_sat(struct learn_info *info);
 void _th_print_dimacs(struct learn_info *info, FILE *file);
 
+/* aig.c */
+int _th_is_boolean_skeleton(struct env *env, struct _ex_intern *e);
+void _th_print_aig_dimacs(struct env *env, struct learn_info *info, struct _ex_intern *e, FILE *file);
+
+/* preprocess_cache.c */
+extern char *_th_preprocess_cache_dir;
+int _th_preprocess_cache_lookup(char *name, char *out_file, char *cnf_file, int *bclt);
+void _th_preprocess_cache_store(int state, char *out_file, char *cnf_file, int bclt);
+
+/* timing.c */
+#define PHASE_OTHER      0
+#define PHASE_PARSE      1
+#define PHASE_PREPROCESS 2
+#define PHASE_REWRITE    3
+#define PHASE_SEARCH     4
+#define PHASE_EXTERNAL   5
+#define PHASE_COUNT      6
+void _th_phase_init();
+void _th_phase_report(char *file);
+void _th_phase_input(char *name);
+void _th_phase_start(int phase);
+void _th_phase_end(int phase);
+double _th_phase_clock();
+
+/* profile.c */
+extern int _th_rule_profiling;
+void _th_profile_rules();
+void _th_profile_report();
+unsigned long long _th_profile_cycles();
+void _th_profile_rule_start(struct _ex_intern *rule);
+void _th_profile_rule_end();
+void _th_profile_condition(int success, unsigned long long start);
+void _th_profile_builtin_start(struct _ex_intern *e);
+void _th_profile_builtin_end(int fired);
+
+/* term_marks.c */
+struct term_marks {
+    unsigned epoch;
+    unsigned size;
+    unsigned *stamp;
+    void **value;
+    int has_values;
+};
+struct term_marks *_th_new_term_marks(int values);
+void _th_start_traversal(struct term_marks *m);
+int _th_term_marked(struct term_marks *m, struct _ex_intern *e);
+void _th_mark_term(struct term_marks *m, struct _ex_intern *e);
+void _th_unmark_term(struct term_marks *m, struct _ex_intern *e);
+int _th_visit_term(struct term_marks *m, struct _ex_intern *e);
+void *_th_term_value(struct term_marks *m, struct _ex_intern *e);
+void _th_set_term_value(struct term_marks *m, struct _ex_intern *e, void *value);
+
 /* simplex.c */
 struct simplex;
 void _th_print_simplex(struct simplex *simplex);
@@ -638,33 +638,30 @@ static struct match_return *_res_copy(struct match_return *r)
     return n ;
 }
 
-static int int_cmp(const int *x,const int *y)
-{
-    return *y-*x ;
-}
-
+/*
+ * Steps elements (a permutation of 0..size-1) to the next permutation
+ * in lexicographic order.  Returns 0 after the last one.
+ */
 static int next(elements, size)
 int elements[] ;
 int size ;
 {
-    int i, j, current, pos ;
-    for (i = size-2; i >= 0; --i) {
-         pos = i ;
-         current = size ;
-         for (j=i+1; j < size; ++j) {
-             if (elements[j] < current && elements[j] > elements[i]) {
-                 current = elements[j] ;
-                 pos = j ;
-             }
-         }
-         if (pos != i) {
-             elements[pos] = elements[i] ;
-             elements[i] = current ;
-             qsort(elements+i+1,size-i-1,sizeof(int),int_cmp) ;
-             return 1 ;
-         }
+    int i, j, t ;
+
+    for (i = size-2; i >= 0 && elements[i] > elements[i+1]; --i) ;
+    if (i < 0) return 0 ;
+
+    for (j = size-1; elements[j] < elements[i]; --j) ;
+    t = elements[i] ;
+    elements[i] = elements[j] ;
+    elements[j] = t ;
+
+    for (++i, j = size-1; i < j; ++i, --j) {
+        t = elements[i] ;
+        elements[i] = elements[j] ;
+        elements[j] = t ;
     }
-    return 0 ;
+    return 1 ;
 }
 
 #ifdef DEBUG
@@ -677,18 +674,454 @@ static void _space()
 }
 #endif
 
+/*
+ * AC matching
+ *
+ * The arguments of an AC term are treated as a multiset.  The pattern
+ * arguments are split into three groups:
+ *
+ *     - variables already bound by theta and ground arguments.  These are
+ *       removed from the subject first; there is only one way to do it.
+ *     - other non-variable arguments (slots).  Each one must match exactly
+ *       one subject argument.
+ *     - unbound variables.  Each takes one subject argument, except that
+ *       when there are more subject arguments than pattern arguments one
+ *       of them collects all of the leftovers.
+ *
+ * Before searching, a quick head symbol test builds a table of which
+ * subject arguments each slot could possibly match and a bipartite
+ * matching on that table checks that all slots can be placed at once.
+ * Slots are then placed most constrained first.  Subject arguments that
+ * are the same term, and pattern arguments that are the same term, are
+ * interchangeable, so only one of each such permutation is tried.
+ *
+ * The search is an explicit stack so that it can be suspended after each
+ * solution.  _th_match_cursor uses this to hand AC matches to the rule
+ * applier one at a time instead of building all of them up front.
+ */
+struct ac_match {
+    struct env *env;
+    struct _ex_intern *p, *e;
+    int count;
+    int *used;
+    int *dup_prev;
+    int slot_count;
+    struct _ex_intern **slots;
+    char **compat;
+    int *after;
+    int var_count;
+    struct _ex_intern **vars;
+    int collect, collector;
+    int level;
+    int *choice;
+    int *pos;
+    struct match_return **input;
+    struct match_return **saved;
+    struct match_return *base;
+};
+
+static int is_ground(struct _ex_intern *e)
+{
+    int i;
+
+    switch (e->type) {
+        case EXP_APPL:
+            if (e->is_marked_term) return 0;
+            for (i = 0; i < e->u.appl.count; ++i) {
+                if (!is_ground(e->u.appl.args[i])) return 0;
+            }
+            return 1;
+        case EXP_INTEGER:
+        case EXP_RATIONAL:
+        case EXP_STRING:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * A cheap necessary condition for _match(p,e) to succeed
+ */
+static int may_match(struct env *env, struct _ex_intern *p, struct _ex_intern *e)
+{
+    if (p->is_marked_term || p->marked_term==p) return 1;
+
+    switch (p->type) {
+        case EXP_APPL:
+            if (e->type != EXP_APPL) return 0;
+            if (p->u.appl.functor==e->u.appl.functor) {
+                if (p->u.appl.count==e->u.appl.count) return 1;
+                return p->u.appl.count < e->u.appl.count && _th_is_ac(env,p->u.appl.functor);
+            }
+            return (p->u.appl.functor==INTERN_EQUAL && e->u.appl.functor==INTERN_ORIENTED_RULE) ||
+                   (p->u.appl.functor==INTERN_ORIENTED_RULE && e->u.appl.functor==INTERN_EQUAL);
+        case EXP_VAR:
+            return 1;
+        case EXP_MARKED_VAR:
+            return e->type==EXP_MARKED_VAR || e->type==EXP_VAR;
+        case EXP_QUANT:
+            return e->type==EXP_QUANT && p->u.quant.quant==e->u.quant.quant &&
+                   p->u.quant.var_count==e->u.quant.var_count;
+        case EXP_INDEX:
+        case EXP_CASE:
+            return p->type==e->type;
+        default:
+            return p==e;
+    }
+}
+
+static struct match_return *ac_last(struct match_return *r)
+{
+    while (r->next) r = r->next;
+    return r;
+}
+
+/*
+ * Returns true if an identical unused subject argument before j (and
+ * at or after lo) has already been tried in this position
+ */
+static int ac_duplicate(struct ac_match *m, int j, int lo)
+{
+    for (j = m->dup_prev[j]; j >= lo; j = m->dup_prev[j]) {
+        if (!m->used[j]) return 1;
+    }
+    return 0;
+}
+
+static void ac_restore(struct match_return *r, struct match_return *saved)
+{
+    while (r) {
+        _th_restore_unifier(r->theta, saved->theta);
+        r = r->next;
+        saved = saved->next;
+    }
+}
+
+/*
+ * First subject argument that slot or variable k may take.  Identical
+ * slots take subject arguments in increasing order.
+ */
+static int ac_low(struct ac_match *m, int k)
+{
+    if (k < m->slot_count && m->after[k] >= 0) return m->choice[m->after[k]]+1;
+    return m->count;
+}
+
+static void ac_enter(struct ac_match *m, int k)
+{
+    m->level = k;
+    if (k < m->slot_count + m->var_count) {
+        m->choice[k] = -1;
+        m->pos[k] = ac_low(m,k);
+        m->saved[k] = _res_copy(m->input[k]);
+    }
+}
+
+/*
+ * Called when all slots and variables are placed.  The leftover subject
+ * arguments go to the collecting variable.
+ */
+static struct match_return *ac_leaf(struct ac_match *m)
+{
+    struct match_return *res = m->input[m->slot_count + m->var_count];
+    struct _ex_intern *t, **args;
+    int i, n;
+
+    if (m->collect) {
+        args = (struct _ex_intern **)_th_alloc(MATCH_SPACE,sizeof(struct _ex_intern *) * m->e->u.appl.count);
+        n = 0;
+        for (i = m->count; i < m->e->u.appl.count; ++i) {
+            if (!m->used[i]) args[n++] = m->e->u.appl.args[i];
+        }
+        if (n==0) return NULL;
+        t = (n==1) ? args[0] : _ex_intern_appl_env(m->env,m->p->u.appl.functor,n,args);
+        res = _m_match(m->env,m->vars[m->collector],t,res);
+    }
+
+    return res;
+}
+
+/*
+ * Resumes the search and returns the next list of solutions or NULL
+ * when there are no more.  The levels of the search are the slots and
+ * then the variables; input[k] holds the solutions going into level k.
+ * The unifiers in input[k] are extended in place by the levels below, so
+ * each level keeps a copy of their entry state in saved[k] and rolls
+ * back to it before each new attempt.  The returned list is only valid
+ * until the next call.
+ */
+static struct match_return *ac_next(struct ac_match *m)
+{
+    int levels = m->slot_count + m->var_count;
+    int n = m->e->u.appl.count;
+    struct match_return *tr;
+    struct _ex_intern *pat;
+    int j, k, lo;
+
+    for (;;) {
+        k = m->level;
+        if (k < 0) {
+            if (!m->collect || ++m->collector >= m->var_count) return NULL;
+            ac_restore(m->input[0], m->base);
+            ac_enter(m, 0);
+            continue;
+        }
+        if (k==levels) {
+            --m->level;
+            tr = ac_leaf(m);
+            if (tr) return tr;
+            continue;
+        }
+        if (m->choice[k] >= 0) {
+            m->used[m->choice[k]] = 0;
+            m->choice[k] = -1;
+        }
+        if (k >= m->slot_count && k-m->slot_count==m->collector) {
+            /* The collecting variable is placed at the leaf */
+            if (m->pos[k] >= n) {
+                --m->level;
+                continue;
+            }
+            m->pos[k] = n;
+            m->input[k+1] = m->input[k];
+            ac_enter(m, k+1);
+            continue;
+        }
+
+        pat = (k < m->slot_count) ? m->slots[k] : m->vars[k-m->slot_count];
+        lo = ac_low(m,k);
+        tr = NULL;
+        for (j = m->pos[k]; j < n; ++j) {
+            if (m->used[j] || (k < m->slot_count && !m->compat[k][j]) || ac_duplicate(m,j,lo)) continue;
+            ac_restore(m->input[k], m->saved[k]);
+            tr = _m_match(m->env,pat,m->e->u.appl.args[j],m->input[k]);
+            if (tr) break;
+        }
+        if (tr==NULL) {
+            --m->level;
+            continue;
+        }
+        m->used[j] = 1;
+        m->choice[k] = j;
+        m->pos[k] = j+1;
+        m->input[k+1] = tr;
+        ac_enter(m, k+1);
+    }
+}
+
+static int ac_augment(struct ac_match *m, int k, int *owner, int *visited, int stamp)
+{
+    int j;
+
+    for (j = m->count; j < m->e->u.appl.count; ++j) {
+        if (m->used[j] || !m->compat[k][j] || visited[j]==stamp) continue;
+        visited[j] = stamp;
+        if (owner[j] < 0 || ac_augment(m,owner[j],owner,visited,stamp)) {
+            owner[j] = k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int ac_feasible(struct ac_match *m)
+{
+    int n = m->e->u.appl.count;
+    int *owner = (int *)_th_alloc(MATCH_SPACE,sizeof(int) * n);
+    int *visited = (int *)_th_alloc(MATCH_SPACE,sizeof(int) * n);
+    int j, k;
+
+    for (j = 0; j < n; ++j) {
+        owner[j] = -1;
+        visited[j] = -1;
+    }
+    for (k = 0; k < m->slot_count; ++k) {
+        if (!ac_augment(m,k,owner,visited,k)) return 0;
+    }
+    return 1;
+}
+
+static int id_cmp(const void *i1, const void *i2)
+{
+    struct _ex_intern *e1 = **(struct _ex_intern ***)i1;
+    struct _ex_intern *e2 = **(struct _ex_intern ***)i2;
+
+    if (e1->id != e2->id) return (e1->id < e2->id) ? -1 : 1;
+    return (*(struct _ex_intern ***)i1 < *(struct _ex_intern ***)i2) ? -1 : 1;
+}
+
+/*
+ * Splits up the pattern and sets up the search.  Returns 0 if there
+ * can be no match.
+ */
+static int ac_setup(struct ac_match *m, struct env *env, struct _ex_intern *p, struct _ex_intern *e, struct _ex_unifier *theta)
+{
+    struct match_return *res;
+    struct _ex_intern *t, ***sorted;
+    int n = e->u.appl.count;
+    int i, j, k, d1, p1, rem, levels, *counts;
+
+    if (p->u.appl.count > n) return 0;
+
+    m->env = env;
+    m->p = p;
+    m->e = e;
+    m->count = _th_ac_arity(env,p->u.appl.functor);
+
+    res = (struct match_return *)_th_alloc(MATCH_SPACE,sizeof(struct match_return));
+    res->next = NULL;
+    res->theta = theta;
+    for (i = 0; i < m->count; ++i) {
+        res = _m_match(env,p->u.appl.args[i],e->u.appl.args[i],res);
+        if (res==NULL) return 0;
+    }
+
+    m->used = (int *)_th_alloc(MATCH_SPACE,sizeof(int) * n);
+    for (i = 0; i < n; ++i) m->used[i] = (i < m->count);
+
+    /* Link each subject argument to the previous identical one */
+    m->dup_prev = (int *)_th_alloc(MATCH_SPACE,sizeof(int) * n);
+    sorted = (struct _ex_intern ***)_th_alloc(MATCH_SPACE,sizeof(struct _ex_intern **) * n);
+    for (i = 0; i < n; ++i) sorted[i] = e->u.appl.args+i;
+    qsort(sorted,n,sizeof(struct _ex_intern **),id_cmp);
+    for (i = 0; i < n; ++i) {
+        j = sorted[i]-e->u.appl.args;
+        m->dup_prev[j] = (i > 0 && *sorted[i-1]==*sorted[i]) ? sorted[i-1]-e->u.appl.args : -1;
+    }
+
+    m->slots = (struct _ex_intern **)_th_alloc(MATCH_SPACE,sizeof(struct _ex_intern *) * p->u.appl.count);
+    m->vars = (struct _ex_intern **)_th_alloc(MATCH_SPACE,sizeof(struct _ex_intern *) * p->u.appl.count);
+    m->slot_count = m->var_count = 0;
+    rem = n - m->count;
+
+    for (i = m->count; i < p->u.appl.count; ++i) {
+        struct _ex_intern *a = p->u.appl.args[i];
+        struct _ex_intern **values = &a;
+        int value_count = 1;
+        if (a->type==EXP_VAR) {
+            get_depth1(a->u.var, &d1, &p1);
+            if (d1 != -1) {
+                m->slots[m->slot_count++] = a;
+                continue;
+            }
+            t = _th_apply(theta, a->u.var);
+            if (t==NULL) {
+                m->vars[m->var_count++] = a;
+                continue;
+            }
+            if (t->type==EXP_APPL && t->u.appl.functor==p->u.appl.functor) {
+                values = t->u.appl.args;
+                value_count = t->u.appl.count;
+            } else {
+                values = &t;
+            }
+        } else if (!is_ground(a)) {
+            m->slots[m->slot_count++] = a;
+            continue;
+        }
+        for (k = 0; k < value_count; ++k) {
+            for (j = m->count; j < n; ++j) {
+                if (!m->used[j] && e->u.appl.args[j]==values[k]) goto found;
+            }
+            if (a->type != EXP_VAR) {
+                m->slots[m->slot_count++] = a;
+                goto next_arg;
+            }
+            for (j = m->count; j < n; ++j) {
+                if (!m->used[j] && _equal(env,values[k],e->u.appl.args[j])) goto found;
+            }
+            return 0;
+found:
+            m->used[j] = 1;
+            --rem;
+        }
+next_arg:;
+    }
+
+    if (m->slot_count + m->var_count > rem) return 0;
+    m->collect = (m->var_count > 0 && m->slot_count + m->var_count < rem);
+
+    /* Order the slots most constrained first */
+    m->compat = (char **)_th_alloc(MATCH_SPACE,sizeof(char *) * m->slot_count);
+    counts = (int *)_th_alloc(MATCH_SPACE,sizeof(int) * m->slot_count);
+    for (k = 0; k < m->slot_count; ++k) {
+        m->compat[k] = (char *)_th_alloc(MATCH_SPACE,n);
+        counts[k] = 0;
+        for (j = 0; j < n; ++j) {
+            m->compat[k][j] = !m->used[j] && may_match(env,m->slots[k],e->u.appl.args[j]);
+            counts[k] += m->compat[k][j];
+        }
+        if (counts[k]==0) return 0;
+    }
+    for (k = 1; k < m->slot_count; ++k) {
+        int c = counts[k];
+        char *row = m->compat[k];
+        t = m->slots[k];
+        for (i = k; i > 0 && counts[i-1] > c; --i) {
+            counts[i] = counts[i-1];
+            m->compat[i] = m->compat[i-1];
+            m->slots[i] = m->slots[i-1];
+        }
+        counts[i] = c;
+        m->compat[i] = row;
+        m->slots[i] = t;
+    }
+
+    if (!ac_feasible(m)) return 0;
+
+    m->after = (int *)_th_alloc(MATCH_SPACE,sizeof(int) * m->slot_count);
+    for (k = 0; k < m->slot_count; ++k) {
+        m->after[k] = -1;
+        for (i = k-1; i >= 0; --i) {
+            if (m->slots[i]==m->slots[k]) {
+                m->after[k] = i;
+                break;
+            }
+        }
+    }
+
+    levels = m->slot_count + m->var_count;
+    m->choice = (int *)_th_alloc(MATCH_SPACE,sizeof(int) * (levels+1));
+    m->pos = (int *)_th_alloc(MATCH_SPACE,sizeof(int) * (levels+1));
+    m->input = (struct match_return **)_th_alloc(MATCH_SPACE,sizeof(struct match_return *) * (levels+1));
+    m->saved = (struct match_return **)_th_alloc(MATCH_SPACE,sizeof(struct match_return *) * (levels+1));
+    for (k = 0; k < levels; ++k) m->choice[k] = -1;
+
+    m->input[0] = res;
+    m->base = _res_copy(res);
+    m->collector = m->collect ? 0 : -1;
+    ac_enter(m, 0);
+
+    return 1;
+}
+
+static struct match_return *ac_match(struct env *env, struct _ex_intern *p, struct _ex_intern *e, struct _ex_unifier *theta)
+{
+    struct ac_match m;
+    struct match_return *res, *comp = NULL;
+
+    if (!ac_setup(&m,env,p,e,theta)) return NULL;
+
+    while ((res = ac_next(&m)) != NULL) {
+        res = _res_copy(res);
+        ac_last(res)->next = comp;
+        comp = res;
+    }
+
+    last = comp ? ac_last(comp) : NULL;
+    return comp;
+}
+
 static struct match_return *_match(struct env *env,
                                    struct _ex_intern *p, struct _ex_intern *e,
                                    struct _ex_unifier *theta)
 {
     int d1, p1, d2, p2 ;
-    int i, j, k, l, m, n, multi_var, count ;
-    struct match_return *res, *comp, *compl, *tr, *ir ;
-    struct _ex_intern *t ;
-    int used_vars, used_var_count, unused_vars ;
+    int i, j, k, count ;
+    struct match_return *res, *comp, *compl, *tr ;
     unsigned *fv ;
     struct _ex_unifier *u ;
-    int size, size1 ;
     
     /**********/
     
@@ -893,303 +1326,9 @@ next_set:
         if (_th_is_ac(env,p->u.appl.functor)) {
 #ifdef DEBUG
             _space() ; printf("    AC match\n") ;
+            space -= 2 ;
 #endif
-            if (p->u.appl.count > e->u.appl.count) {
-#ifdef DEBUG
-                space -= 2 ;
-#endif
-                return NULL ;
-            }
-            count = _th_ac_arity(env,p->u.appl.functor) ;
-#ifdef DEBUG
-            _space () ; printf("count = %d\n", count) ;
-#endif
-            res = (struct match_return *)_th_alloc(MATCH_SPACE,sizeof(struct match_return)) ;
-            res->next =NULL;
-            res->theta = theta;
-            comp = compl = NULL ;
-            for (i = 0; i < count; ++i) {
-                res = _m_match(env,p->u.appl.args[i],
-                    e->u.appl.args[i],res) ;
-                if (res==NULL) {
-#ifdef DEBUG
-                    space -= 2 ;
-#endif
-                    return NULL ;
-                }
-            }
-            if (p->u.appl.count==0 && e->u.appl.count==0 && count==0) {
-                goto end_case ;
-            }
-            used_vars = 0 ;
-            used_var_count = 0 ;
-            unused_vars = 0 ;
-            size = e->u.appl.count ;
-            if (p->u.appl.count > e->u.appl.count) size = p->u.appl.count ;
-            check_size(size) ;
-            for (i = count; i < e->u.appl.count; ++i) {
-                match_used[i] = 0 ;
-            }
-            for (i = count; i < p->u.appl.count; ++i) {
-                if (p->u.appl.args[i]->type == EXP_VAR) {
-                    get_depth1(p->u.appl.args[i]->u.var, &d1, &p1) ;
-                    if (d1 == -1) {
-                        if ((t = _th_apply(theta, p->u.appl.args[i]->u.var)) != NULL) {
-                            matched_var[i] = 1 ;
-                            if (t->type==EXP_APPL && t->u.appl.functor == p->u.appl.functor) {
-                                for (j = 0; j < t->u.appl.count; ++j) {
-                                    if (used_var_count >= MAX_ARGS) {
-                                        printf("AC match generated too many terms\n") ;
-                                        exit(1) ;
-                                    }
-                                    check_size(used_var_count+1);
-                                    args[used_var_count++] = t->u.appl.args[j] ;
-                                }
-                            } else {
-                                check_size(used_var_count+1);
-                                args[used_var_count++] = t;
-                            }
-                            ++used_vars ;
-                        } else {
-                            matched_var[i] = 0 ;
-                            ++unused_vars ;
-                        }
-                    } else {
-                        matched_var[i] = 0 ;
-                    }
-                } else {
-                    matched_var[i] = 0 ;
-                }
-            }
-            size1 = size;
-            if (used_var_count > size) size1 = used_var_count;
-#ifdef DEBUG
-            _space () ; printf("Step 1: %d\n", used_var_count) ;
-#endif
-            for (k = 0; k < used_var_count; ++k) {
-                l = count ;
-                while (l < e->u.appl.count) {
-                    if (match_used[l]) {
-                        ++l ;
-                        continue ;
-                    }
-                    t = args[k] ;
-                    set_start(size1) ;
-                    if (_equal(env,t,e->u.appl.args[l])) {
-                        set_start(0-size1) ;
-                        goto cont2 ;
-                    }
-                    set_start(0-size1) ;
-                    ++l ;
-                }
-#ifdef DEBUG
-                _space () ; printf("Step 1 failed returning: %x %x\n", comp, compl) ;
-                space -= 2 ;
-#endif
-                last = compl ;
-                return comp ;
-cont2:
-                match_used[l] = 1 ;
-            }
-            
-#ifdef DEBUG
-            _space() ; printf("Step 2\n") ;
-#endif
-            for (i = count; i < p->u.appl.count; ++i) {
-#ifdef DEBUG
-                _space() ; printf("Processing %d\n", i) ;
-#endif
-                if (p->u.appl.args[i]->type==EXP_VAR) {
-                    get_depth1(p->u.appl.args[i]->u.var, &d1, &p1) ;
-                    if (d1 != -1) goto qvar ;
-                } else {
-qvar:
-#ifdef DEBUG
-                _space() ; printf("  legal arg %d\n", i) ;
-#endif
-                j = count ;
-                int_res[i] = _res_copy(res) ;
-re_entry:
-                while (j < e->u.appl.count) {
-#ifdef DEBUG
-                    _space () ; printf("Sub processing %d %d\n", i, j) ;
-#endif
-                    if (match_used[j]) {
-                        ++j ;
-#ifdef DEBUG
-                        _space() ; printf("  used\n") ;
-#endif
-                        continue ;
-                    }
-#ifdef DEBUG
-                    _space() ; printf("Before match\n") ;
-#endif
-                    set_start(size1) ;
-                    if (tr = _m_match(env,p->u.appl.args[i],e->u.appl.args[j],res)) {
-                        set_start(0-size1) ;
-                        res = tr ;
-#ifdef DEBUG
-                        _space() ; printf("  success\n") ;
-#endif
-                        goto cont ;
-                    }
-                    set_start(0-size1) ;
-#ifdef DEBUG
-                    _space() ; printf("  failure\n") ;
-#endif
-                    ++j ;
-                }
-fail_point1:
-                while (--i != 0xffffffff) {
-                    if (p->u.appl.args[i]->type != EXP_VAR) {
-                        match_used[match_value[i]] = 0 ;
-                        j = match_value[i]+1 ;
-                        res = _res_copy(int_res[i]) ;
-#ifdef DEBUG
-                        _space() ; printf("Going to re_entry: %d\n", i) ;
-#endif
-                        goto re_entry ;
-                    }
-                }
-                last = compl ;
-#ifdef DEBUG
-                _space() ; printf("returning %x\n", comp) ;
-                space -= 2 ;
-#endif
-                return comp ;
-cont:
-                match_used[j] = 1 ;
-                match_value[i] = j ;
-                }
-            }
-#ifdef DEBUG
-            _space() ; printf("Step 3: %d\n", unused_vars) ;
-#endif
-            if (unused_vars > 0) {
-#ifdef DEBUG
-                _space() ; printf("multivar test %d %d %d %d\n", p->u.appl.count,used_var_count,used_vars,e->u.appl.count) ;
-#endif
-                if (p->u.appl.count+used_var_count-used_vars<e->u.appl.count) {
-                    multi_var = -1 ;
-                    ir = res ;
-fail_point3:
-                    res = _res_copy(ir) ;
-                    if (multi_var == -2) {
-#ifdef DEBUG
-                        _space() ; printf("going to fail_point 1\n") ;
-#endif
-                        goto fail_point1 ;
-                    }
-                    while (++multi_var < p->u.appl.count) {
-                        if (p->u.appl.args[multi_var]->type==EXP_VAR &&
-                            !matched_var[multi_var]) break ;
-                    }
-                    /*printf("multi_var = %d\n", multi_var) ;*/
-                    if (multi_var == p->u.appl.count) goto fail_point1 ;
-                } else {
-                    multi_var = -2 ;
-                    ir = NULL ;
-                }
-                for (m = count; m < p->u.appl.count; ++m) {
-                    if (p->u.appl.args[m]->type == EXP_VAR &&
-                        !matched_var[m] && m != multi_var) {
-                        get_depth1(p->u.appl.args[m]->u.var, &d1, &p1) ;
-                        if (d1 != -1) continue ;
-                        /*printf("Processing var %d\n", m) ;*/
-                        n = count ;
-                        int_res[m] = _res_copy(res) ;
-re_entry3:
-                        while (n < e->u.appl.count) {
-                            /*printf("Sub processing var %d %d\n", m,n) ;*/
-                            if (match_used[n]) {
-                                ++n ;
-                                /*printf("  used\n") ;*/
-                                continue ;
-                            }
-                            if (tr = _m_match(env,p->u.appl.args[m],e->u.appl.args[n],res)) {
-                                res = tr ;
-                                /*printf("  success\n") ;*/
-                                goto cont3 ;
-                            }
-                            /*printf("  failure\n") ;*/
-                            ++n ;
-                        }
-fail_point4:
-                        while (m-- > 0) {
-                            if (p->u.appl.args[m]->type == EXP_VAR &&
-                                !matched_var[m] && m != multi_var) {
-                                get_depth1(p->u.appl.args[m]->u.var, &d1, &p1) ;
-                                if (d1 != -1) continue ;
-                                match_used[match_value[m]] = 0 ;
-                                n = match_value[m]+1 ;
-                                res = _res_copy(int_res[m]) ;
-                                goto re_entry3 ;
-                            }
-                        }
-#ifdef DEBUG
-                        _space() ; printf("Going to fail point 3\n") ;
-#endif
-                        goto fail_point3 ;
-cont3:
-                        match_used[n] = 1 ;
-                        match_value[m] = n ;
-                    }
-                }
-#ifdef DEBUG
-                _space() ; printf("Done processing vars %d\n", multi_var) ;
-#endif
-                if (multi_var >= 0 && multi_var < 0x7fffffff) {
-#ifdef DEBUG
-                    _space() ; printf("Processing multivar\n") ;
-#endif
-                    p1 = used_var_count ;
-                    for (d1 = count; d1 < e->u.appl.count; ++d1) {
-#ifdef DEBUG
-                        _space() ; printf("    %d - %d\n", d1, match_used[d1]) ;
-#endif
-                        if (!match_used[d1]) args[p1++] = e->u.appl.args[d1] ;
-                    }
-#ifdef DEBUG
-                    _space() ; printf("p1, used_var_count %d %d\n", p1, used_var_count) ;
-#endif
-                    if (p1 <= used_var_count) {
-                        goto fail_point4 ;
-                    } else if (p1 == used_var_count+1) {
-                        t = args[used_var_count] ;
-                    } else {
-                        t = _ex_intern_appl_env(env,p->u.appl.functor,p1-used_var_count,args+used_var_count) ;
-                    }
-                    set_start(size) ;
-                    tr = _m_match(env,p->u.appl.args[multi_var],t,res) ;
-                    set_start(0-size) ;
-                    if (tr == NULL) {
-                        goto fail_point4 ;
-                    }
-                    res = tr ;
-                }
-                }
-#ifdef DEBUG
-                _space() ; printf("Wrap up %x %x\n", res, comp) ;
-#endif
-                if (res != NULL) {
-                    if (comp == NULL) {
-                        compl = last ;
-                    } else {
-                        last->next = comp ;
-                    }
-                    comp = res ;
-                }
-                if (unused_vars > 0) {
-#ifdef DEBUG
-                    _space() ; printf("Going to 4\n", res, comp) ;
-#endif
-                    goto fail_point4 ;
-                } else {
-#ifdef DEBUG
-                    _space() ; printf("Going to 1\n", res, comp) ;
-#endif
-                    goto fail_point1 ;
-                }
+            return ac_match(env,p,e,theta) ;
             } else if (_th_is_c(env,p->u.appl.functor)) {
 #ifdef DEBUG
                 _space() ; printf("c match\n") ;
@@ -1490,72 +1629,73 @@ struct match_return *_th_match(struct env *env,
     return _match (env, p, e, _th_new_unifier(MATCH_SPACE)) ;
 }
 
-static void unmark1_expression(struct _ex_intern *e)
+/*
+ * Lazy version of _th_match.  _th_match_next returns the matches one at
+ * a time and NULL when there are no more.  When the top of the pattern is
+ * an AC application, the multiset search is resumed on each call so a
+ * caller that stops at the first usable match never enumerates the rest.
+ * Other patterns are matched eagerly and the list is handed out one
+ * unifier at a time.  All storage is in MATCH_SPACE.
+ */
+struct match_cursor {
+    struct env *env ;
+    int lazy ;
+    struct ac_match ac ;
+    struct match_return *pending ;
+} ;
+
+static void reset_quant()
 {
-    int i ;
-
-    if (e->mark1==0) return ;
-
-    e->mark1 = 0 ;
-
-    switch(e->type) {
-
-        case EXP_APPL:
-            for (i = 0; i < e->u.appl.count; ++i) {
-                unmark1_expression(e->u.appl.args[i]) ;
-            }
-            break ;
-
-        case EXP_CASE:
-            unmark1_expression(e->u.case_stmt.exp) ;
-            for (i = 0; i < e->u.case_stmt.count*2; ++i) {
-                unmark1_expression(e->u.case_stmt.args[i]) ;
-            }
-            break ;
-
-        case EXP_QUANT:
-            unmark1_expression(e->u.quant.exp) ;
-            unmark1_expression(e->u.quant.cond) ;
-            break ;
-
-        case EXP_INDEX:
-            unmark1_expression(e->u.index.exp) ;
-            break ;
-    }
+    quant_level = 0 ;
+    quant_backup = 0 ;
+    quant_save_count = 0 ;
+    quant_stop = 0 ;
 }
 
-static void unmark2_expression(struct _ex_intern *e)
+struct match_cursor *_th_match_cursor(struct env *env,
+                                      struct _ex_intern *p, struct _ex_intern *e)
 {
-    int i ;
-
-    if (e->mark2==0) return ;
+    struct match_cursor *c = (struct match_cursor *)_th_alloc(MATCH_SPACE,sizeof(struct match_cursor)) ;
 
-    e->mark2 = 0 ;
+    reset_quant() ;
+#ifdef DEBUG
+    space = 0 ;
+#endif
+    c->env = env ;
+    c->pending = NULL ;
+    c->lazy = 0 ;
+    if (p->type==EXP_APPL && e->type==EXP_APPL &&
+        p->u.appl.functor==e->u.appl.functor &&
+        !p->is_marked_term && p->marked_term != p &&
+        _th_is_ac(env,p->u.appl.functor)) {
+        c->lazy = ac_setup(&c->ac,env,p,e,_th_new_unifier(MATCH_SPACE)) ;
+    } else {
+        c->pending = _match(env, p, e, _th_new_unifier(MATCH_SPACE)) ;
+    }
 
-    switch(e->type) {
+    return c ;
+}
 
-        case EXP_APPL:
-            for (i = 0; i < e->u.appl.count; ++i) {
-                unmark2_expression(e->u.appl.args[i]) ;
-            }
-            break ;
+struct _ex_unifier *_th_match_next(struct match_cursor *c)
+{
+    struct match_return *r ;
 
-        case EXP_CASE:
-            unmark2_expression(e->u.case_stmt.exp) ;
-            for (i = 0; i < e->u.case_stmt.count*2; ++i) {
-                unmark2_expression(e->u.case_stmt.args[i]) ;
-            }
-            break ;
+    if (c->pending==NULL && c->lazy) {
+        reset_quant() ;
+        r = ac_next(&c->ac) ;
+        if (r==NULL) {
+            c->lazy = 0 ;
+        } else {
+            /* The search reuses these unifiers when it is resumed */
+            c->pending = _res_copy(r) ;
+        }
+    }
 
-        case EXP_QUANT:
-            unmark2_expression(e->u.quant.exp) ;
-            unmark2_expression(e->u.quant.cond) ;
-            break ;
+    r = c->pending ;
+    if (r==NULL) return NULL ;
+    c->pending = r->next ;
 
-        case EXP_INDEX:
-            unmark2_expression(e->u.index.exp) ;
-            break ;
-    }
+    return r->theta ;
 }
 
 int _th_all_symbols_smaller(struct env *env,struct _ex_intern *e,unsigned s)
@@ -1593,22 +1733,18 @@ int _th_all_symbols_smaller(struct env *env,struct _ex_intern *e,unsigned s)
     }
 }
 
+static struct term_marks *smaller_marks = NULL ;
+
 static int _much_smaller(struct env *env,struct _ex_intern *e1,struct _ex_intern *e2)
 {
     int i ;
 
-    if (e2->mark2) return 1 ;
-
-    e2->mark2 = 2 ;
+    if (_th_visit_term(smaller_marks,e2)) return 1 ;
 
     switch(e2->type) {
 
         case EXP_APPL:
-            if (!_th_all_symbols_smaller(env, e1, e2->u.appl.functor)) {
-                unmark1_expression(e1) ;
-                return 0 ;
-            }
-            unmark1_expression(e1) ;
+            if (!_th_all_symbols_smaller(env, e1, e2->u.appl.functor)) return 0 ;
             for (i = 0; i < e2->u.appl.count; ++i) {
                 if (!_much_smaller(env,e1,e2->u.appl.args[i])) return 0 ;
             }
@@ -1638,8 +1774,10 @@ int _th_much_smaller(struct env *env, struct _ex_intern *e1, struct _ex_intern *
 {
     int r ;
 
+    if (smaller_marks==NULL) smaller_marks = _th_new_term_marks(0) ;
+    _th_start_traversal(smaller_marks) ;
+
     r = _much_smaller(env,e1,e2) ;
-    unmark2_expression(e2) ;
     return r ;
 }
 
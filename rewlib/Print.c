@@ -29,8 +29,22 @@ void _th_print_shutdown()
 
 int _th_pos = 0 ;
 
+/*
+ * When print_file is set, _th_fprint_exp is streaming a term.  Everything
+ * printed since print_file_start is written out whenever it grows past
+ * PRINT_FLUSH_SIZE, so the buffer stays small however large the term is.
+ */
+#define PRINT_FLUSH_SIZE 65536
+
+static FILE *print_file = NULL;
+static int print_file_start;
+
 void _th_adjust_buffer(int size)
 {
+    if (print_file && _th_pos-print_file_start >= PRINT_FLUSH_SIZE) {
+        fwrite(_th_print_buf+print_file_start,1,_th_pos-print_file_start,print_file);
+        _th_pos = print_file_start;
+    }
     if (print_size-_th_pos-size <= 0) {
         print_size += size + 1000000 ;
         _th_print_buf = REALLOC(_th_print_buf, print_size) ;
@@ -120,6 +134,106 @@ static void _print_vars(struct _ex_intern *e)
 static unsigned print_line = 0;
 static struct _ex_intern *print_next;
 
+/*
+ * Shared subterms.  share_walk visits e once, counting in the print_line
+ * field how often each compound subterm is reached.  A term is appended
+ * to share_order after its arguments the first time it is reached, so
+ * the terms reached more than once come out in post order and each one
+ * only contains shared terms that come before it.  Quantifiers and case
+ * terms bind variables, so they are counted but not entered.
+ */
+static struct _ex_intern **share_order = NULL;
+static int share_count = 0, share_size = 0;
+
+static void share_walk(struct _ex_intern *e)
+{
+    int i;
+
+    switch (e->type) {
+        case EXP_APPL:
+            if (e->u.appl.count==0) return;
+            break;
+        case EXP_INDEX:
+        case EXP_QUANT:
+        case EXP_CASE:
+            break;
+        default:
+            return;
+    }
+
+    if (e->print_line++) return;
+
+    switch (e->type) {
+        case EXP_APPL:
+            for (i = 0; i < e->u.appl.count; ++i) {
+                share_walk(e->u.appl.args[i]);
+            }
+            break;
+        case EXP_INDEX:
+            share_walk(e->u.index.exp);
+            break;
+    }
+
+    if (share_count==share_size) {
+        share_size = share_size * 2 + 1024;
+        share_order = (struct _ex_intern **)REALLOC(share_order,sizeof(struct _ex_intern *) * share_size);
+        if (share_order==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
+    }
+    share_order[share_count++] = e;
+}
+
+/*
+ * Returns in *shared the compound subterms of e that are reached more
+ * than once, in post order.  Their print_line fields stay set until
+ * _th_share_release is called; the caller may store its own value there
+ * as long as it is nonzero.
+ */
+int _th_share_subterms(struct _ex_intern *e, struct _ex_intern ***shared)
+{
+    int i, n;
+
+    _th_share_release();
+    share_walk(e);
+    n = 0;
+    for (i = 0; i < share_count; ++i) {
+        if (share_order[i]->print_line > 1) {
+            share_order[n++] = share_order[i];
+        } else {
+            share_order[i]->print_line = 0;
+        }
+    }
+    share_count = n;
+    *shared = share_order;
+
+    return n;
+}
+
+void _th_share_release()
+{
+    while (share_count) {
+        share_order[--share_count]->print_line = 0;
+    }
+}
+
+/*
+ * While _th_fprint_exp prints with sharing, the print_line field of the
+ * i-th shared term holds i * 2 + 2, plus one if it is bound with flet.
+ * print_binding is the term whose binding is being printed.
+ */
+static int print_shared = 0;
+static struct _ex_intern *print_binding;
+
+static void print_share_var(unsigned n)
+{
+    char s[20];
+
+    sprintf(s, "%c%d", (n & 1) ? '$' : '?', (n-2)/2+1);
+    print_string(s);
+}
+
 static int depth = 0;
 
 #define MAX_DEPTH 10
@@ -209,6 +323,12 @@ static void _print_exp(struct _ex_intern *e)
 		return;
 	}
 
+    if (print_shared && e->print_line > 1 && e != print_binding) {
+        print_share_var(e->print_line);
+        --depth;
+        return;
+    }
+
     switch (e->type) {
 
         case EXP_INTEGER:
@@ -420,6 +540,60 @@ char *_th_print_exp(struct _ex_intern *e)
     return _th_print_buf+_th_pos ;
 }
 
+/*
+ * Writes e to f through the print buffer without building the whole
+ * string first.  If shared is set, each subterm that occurs more than
+ * once is bound to a variable by a let (an flet if env gives it type
+ * Bool) in front of the term, so the output is linear in the size of
+ * the term DAG.
+ */
+void _th_fprint_exp(FILE *f, struct env *env, struct _ex_intern *e, int shared)
+{
+    int save_pos = _th_pos ;
+    char *mark ;
+    struct _ex_intern **order ;
+    int i, n = 0 ;
+
+    if (e==NULL) {
+        fprintf(f, "<NULL>");
+        return;
+    }
+    mark = _th_alloc_mark(PARSE_SPACE) ;
+    print_next = NULL;
+    print_file = f;
+    print_file_start = save_pos;
+    if (shared) {
+        n = _th_share_subterms(e,&order);
+        for (i = 0; i < n; ++i) {
+            order[i]->print_line = i * 2 + 2 + (env != NULL && _th_get_exp_type(env,order[i])==_ex_bool);
+        }
+        print_shared = 1;
+        for (i = 0; i < n; ++i) {
+            print_string((order[i]->print_line & 1) ? "(flet (" : "(let (");
+            print_share_var(order[i]->print_line);
+            print_char(' ');
+            print_binding = order[i];
+            _print_exp(order[i]);
+            print_string(") ");
+        }
+        print_binding = NULL;
+    }
+    _print_exp(e) ;
+    for (i = 0; i < n; ++i) print_char(')');
+    fwrite(_th_print_buf+save_pos,1,_th_pos-save_pos,f);
+    print_file = NULL;
+    if (shared) {
+        print_shared = 0;
+        _th_share_release();
+    }
+    _th_pos = save_pos ;
+    _th_alloc_release(PARSE_SPACE, mark) ;
+    while (print_next) {
+        print_next->print_line = 0;
+        print_next = print_next->print_next;
+    }
+}
+
 char *_th_tree_exp(unsigned pl, struct _ex_intern *e)
 {
     int save_pos = _th_pos ;
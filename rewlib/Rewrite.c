@@ -27,6 +27,7 @@ int _th_test_mode = 0;
 void _th_init_rewrite(char *log)
 {
     _th_alloc_init() ;
+    _th_phase_init() ;
     _tree_init(log) ;
     _th_intern_init () ;
     _th_init_bignum() ;
@@ -47,6 +48,7 @@ void _th_init_rewrite(char *log)
 
 void _th_shutdown_rewrite()
 {
+    _th_profile_report() ;
     _th_print_shutdown() ;
     _ex_shutdown() ;
     _th_cache_shutdown() ;
@@ -840,6 +842,39 @@ int both_in_big_term(struct _ex_intern *e)
     return (p1 && (p1==p2));
 }
 
+/*
+ * Normal form stamps
+ *
+ * A term that came back unchanged from a top level rewrite is stamped as
+ * a normal form.  Later rewrites of it, including ones from later calls
+ * to _th_nc_rewrite, return it at once instead of descending through its
+ * subterms again.  The stamps are the marks of a term_marks table, so any
+ * change to the rules or to the asserted facts drops all of them in O(1)
+ * through _th_invalidate_normal_forms.
+ */
+static struct term_marks *normal_forms = NULL ;
+static struct env *normal_form_env = NULL ;
+
+void _th_invalidate_normal_forms()
+{
+    if (normal_forms) _th_start_traversal(normal_forms) ;
+}
+
+static int is_normal_form(struct env *env, struct _ex_intern *e)
+{
+    return normal_forms && env==normal_form_env && _th_term_marked(normal_forms,e) ;
+}
+
+static void set_normal_form(struct env *env, struct _ex_intern *e)
+{
+    if (normal_forms==NULL) normal_forms = _th_new_term_marks(0) ;
+    if (env != normal_form_env) {
+        _th_start_traversal(normal_forms) ;
+        normal_form_env = env ;
+    }
+    _th_mark_term(normal_forms,e) ;
+}
+
 struct _ex_intern *_th_int_rewrite(struct env *env, struct _ex_intern *e, int do_transitive)
 {
     struct _ex_intern *res1, *res2, *stval, **args ;
@@ -853,6 +888,11 @@ struct _ex_intern *_th_int_rewrite(struct env *env, struct _ex_intern *e, int do
     //extern void _check_splits(struct _ex_intern *e);
     stval = e ;
 
+    if (do_transitive==1 && is_normal_form(env,e) && _th_cache_at_top()) {
+        _zone_print_exp("Normal form", e) ;
+        return e ;
+    }
+
     ++rewrite_level ;
 
     _zone_print_exp("Rewriting", e) ;
@@ -1059,7 +1099,13 @@ retry_top:
         exit(1);
     }
 #endif
-    res2 = _th_builtin(env,res1) ;
+    if (_th_rule_profiling) {
+        _th_profile_builtin_start(res1) ;
+        res2 = _th_builtin(env,res1) ;
+        _th_profile_builtin_end(res2 != NULL) ;
+    } else {
+        res2 = _th_builtin(env,res1) ;
+    }
     //if (res2) {
     //    printf("%s reduces to\n", _th_print_exp(res1));
     //    printf("    %s\n", _th_print_exp(res2));
@@ -1159,6 +1205,7 @@ finish:
         //_zone_print0("Setting 1");
         _zone_print_exp("Setting cache", e);
         _th_set_cache_rewrite(env,e,res2,do_transitive,start_cycle) ;
+        if (res2==e && do_transitive==1 && _th_cache_at_top()) set_normal_form(env,e) ;
         //_zone_print_exp("res2->rewrite", res2->rewrite);
         if (res2->can_cache && res2->rewrite==NULL) {
             //_zone_print1("*** Saving %s", _th_print_exp(res2));
@@ -1366,7 +1413,9 @@ struct _ex_intern *_th_rewrite(struct env *env, struct _ex_intern *e)
     ++r_count;
 #endif
 #ifdef LOG_REWRITE
-    fprintf(rewrite_log_file,"rewrite %d: %s\n", r_count, _th_print_exp(e));
+    fprintf(rewrite_log_file,"rewrite %d: ", r_count);
+    _th_fprint_exp(rewrite_log_file,env,e,1);
+    fprintf(rewrite_log_file,"\n");
     fflush(rewrite_log_file);
 #endif
     _zone_increment() ;
@@ -1382,7 +1431,9 @@ struct _ex_intern *_th_rewrite(struct env *env, struct _ex_intern *e)
         _tree_undent();
 #endif
 #ifdef LOG_REWRITE
-        fprintf(rewrite_log_file,"result %d: %s\n", r_count-1, _th_print_exp(res));
+        fprintf(rewrite_log_file,"result %d: ", r_count-1);
+        _th_fprint_exp(rewrite_log_file,env,res,1);
+        fprintf(rewrite_log_file,"\n");
         fflush(rewrite_log_file);
 #endif
         return res ;
@@ -1400,12 +1451,15 @@ struct _ex_intern *_th_rewrite(struct env *env, struct _ex_intern *e)
         _tree_undent();
 #endif
 #ifdef LOG_REWRITE
-        fprintf(rewrite_log_file,"result %d: %s\n", r_count-1, _th_print_exp(res));
+        fprintf(rewrite_log_file,"result %d: ", r_count-1);
+        _th_fprint_exp(rewrite_log_file,env,res,1);
+        fprintf(rewrite_log_file,"\n");
         fflush(rewrite_log_file);
 #endif
         return res ;
     }
 
+    _th_phase_start(PHASE_REWRITE);
     mark = _th_start_rewrite() ;
 	res = e;
 	e = NULL;
@@ -1420,6 +1474,7 @@ struct _ex_intern *_th_rewrite(struct env *env, struct _ex_intern *e)
 		res2 = res;
 	}
     res = _th_finish_rewrite(mark, env, res) ;
+    _th_phase_end(PHASE_REWRITE);
 
     _th_set_rewrite(res) ;
 
@@ -1434,7 +1489,9 @@ struct _ex_intern *_th_rewrite(struct env *env, struct _ex_intern *e)
     _tree_undent();
 #endif
 #ifdef LOG_REWRITE
-    fprintf(rewrite_log_file,"result %d: %s\n", r_count-1, _th_print_exp(res));
+    fprintf(rewrite_log_file,"result %d: ", r_count-1);
+    _th_fprint_exp(rewrite_log_file,env,res,1);
+    fprintf(rewrite_log_file,"\n");
     fflush(rewrite_log_file);
 #endif
     return res ;
@@ -1492,7 +1549,9 @@ struct _ex_intern *_th_nc_rewrite(struct env *env, struct _ex_intern *e)
     ++r_count;
 #endif
 #ifdef LOG_REWRITE
-    fprintf(rewrite_log_file,"rewrite %d: %s\n", r_count, _th_print_exp(e));
+    fprintf(rewrite_log_file,"rewrite %d: ", r_count);
+    _th_fprint_exp(rewrite_log_file,env,e,1);
+    fprintf(rewrite_log_file,"\n");
     fflush(rewrite_log_file);
 #endif
     _zone_increment() ;
@@ -1509,7 +1568,9 @@ struct _ex_intern *_th_nc_rewrite(struct env *env, struct _ex_intern *e)
         _tree_undent();
 #endif
 #ifdef LOG_REWRITE
-        fprintf(rewrite_log_file,"result %d: %s\n", r_count-1, _th_print_exp(res));
+        fprintf(rewrite_log_file,"result %d: ", r_count-1);
+        _th_fprint_exp(rewrite_log_file,env,res,1);
+        fprintf(rewrite_log_file,"\n");
         fflush(rewrite_log_file);
 #endif
         return res ;
@@ -1530,7 +1591,9 @@ struct _ex_intern *_th_nc_rewrite(struct env *env, struct _ex_intern *e)
         _tree_undent();
 #endif
 #ifdef LOG_REWRITE
-        fprintf(rewrite_log_file,"result %d: %s\n", r_count-1, _th_print_exp(res));
+        fprintf(rewrite_log_file,"result %d: ", r_count-1);
+        _th_fprint_exp(rewrite_log_file,env,res,1);
+        fprintf(rewrite_log_file,"\n");
         fflush(rewrite_log_file);
 #endif
         return res ;
@@ -1538,6 +1601,7 @@ struct _ex_intern *_th_nc_rewrite(struct env *env, struct _ex_intern *e)
 
     //_th_clear_cache() ;
     //_th_rewrite_next = _th_add_contexts_to_cache(env,_th_rewrite_next);
+    _th_phase_start(PHASE_REWRITE);
     mark = _th_start_rewrite() ;
 	res = e;
 	e = NULL;
@@ -1545,6 +1609,7 @@ struct _ex_intern *_th_nc_rewrite(struct env *env, struct _ex_intern *e)
     res = _th_int_rewrite(env,res,1) ;
 	_zone_exit_sub();
     res = _th_finish_rewrite(mark, env, res) ;
+    _th_phase_end(PHASE_REWRITE);
 
 #ifdef CHECK_REWRITE
     _th_set_rewrite(res) ;
@@ -1561,7 +1626,9 @@ struct _ex_intern *_th_nc_rewrite(struct env *env, struct _ex_intern *e)
     _tree_undent();
 #endif
 #ifdef LOG_REWRITE
-    fprintf(rewrite_log_file,"result %d: %s\n", r_count-1, _th_print_exp(res));
+    fprintf(rewrite_log_file,"result %d: ", r_count-1);
+    _th_fprint_exp(rewrite_log_file,env,res,1);
+    fprintf(rewrite_log_file,"\n");
     fflush(rewrite_log_file);
 #endif
     return res ;
@@ -19,17 +19,25 @@
 
 struct _ex_intern *_th_log_rewrite(struct env *env, struct _ex_intern *exp)
 {
-    fprintf(rewrite_log, "rewrite %s\n", _th_print_exp(exp)) ;
+    fprintf(rewrite_log, "rewrite ") ;
+    _th_fprint_exp(rewrite_log, env, exp, 1) ;
+    fprintf(rewrite_log, "\n") ;
     exp = _th_rewrite(env,exp) ;
-    fprintf(rewrite_log, "result %s\n", _th_print_exp(exp)) ;
+    fprintf(rewrite_log, "result ") ;
+    _th_fprint_exp(rewrite_log, env, exp, 1) ;
+    fprintf(rewrite_log, "\n") ;
     return exp ;
 }
 
 struct _ex_intern *_th_log_int_rewrite(struct env *env, struct _ex_intern *exp, int flag)
 {
-    fprintf(rewrite_log, "int_rewrite %s %d\n", _th_print_exp(exp), flag) ;
+    fprintf(rewrite_log, "int_rewrite ") ;
+    _th_fprint_exp(rewrite_log, env, exp, 1) ;
+    fprintf(rewrite_log, " %d\n", flag) ;
     exp = _th_int_rewrite(env,exp, flag) ;
-    fprintf(rewrite_log, "result %s\n", _th_print_exp(exp)) ;
+    fprintf(rewrite_log, "result ") ;
+    _th_fprint_exp(rewrite_log, env, exp, 1) ;
+    fprintf(rewrite_log, "\n") ;
     return exp ;
 }
 
@@ -53,7 +61,9 @@ void _th_log_derive_pop_release(struct env *env,unsigned char *mark)
 
 void _th_log_derive_and_add(struct env *env, struct _ex_intern *exp)
 {
-    fprintf(rewrite_log, "add %s\n", _th_print_exp(exp)) ;
+    fprintf(rewrite_log, "add ") ;
+    _th_fprint_exp(rewrite_log, env, exp, 1) ;
+    fprintf(rewrite_log, "\n") ;
     _th_derive_and_add(env,exp) ;
 }
 
@@ -81,7 +91,8 @@ void _th_log_add_attrib(int space, struct env *env, unsigned attrib, unsigned n,
                 fprintf(rewrite_log, "@%s", _th_intern_decode(params[i].u.symbol)) ;
                 break ;
             case EXP_PARAMETER:
-                fprintf(rewrite_log, "!%s", _th_print_exp(params[i].u.exp)) ;
+                fprintf(rewrite_log, "!") ;
+                _th_fprint_exp(rewrite_log, env, params[i].u.exp, 1) ;
                 break ;
             case INTEGER_LIST_PARAMETER:
             case SYMBOL_LIST_PARAMETER:
@@ -104,7 +115,9 @@ void _th_log_add_attrib(int space, struct env *env, unsigned attrib, unsigned n,
 
 void _th_log_derive_and_add_property(int space, struct env *env, struct _ex_intern *prop)
 {
-    fprintf(rewrite_log, "addp %s\n", _th_print_exp(prop)) ;
+    fprintf(rewrite_log, "addp ") ;
+    _th_fprint_exp(rewrite_log, env, prop, 1) ;
+    fprintf(rewrite_log, "\n") ;
     _th_derive_and_add_property(space,env,prop) ;
 }
 
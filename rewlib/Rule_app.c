@@ -995,7 +995,8 @@ struct _ex_intern *_th_rewrite_rule(struct env *env, struct _ex_intern *e, int d
 {
     struct small_disc *s = _th_get_forward_context_rules(env) ;
     struct disc *d = _th_get_forward_rules(env) ;
-    struct match_return *mr ;
+    struct match_cursor *cursor ;
+    struct _ex_unifier *theta ;
     struct _ex_intern *r, *r2 ;
     void *iterator ;
     struct disc_iterator di ;
@@ -1014,6 +1015,7 @@ struct _ex_intern *_th_rewrite_rule(struct env *env, struct _ex_intern *e, int d
     int back_chain_save = backchain_quant_level ;
     unsigned functor;
     int levels;
+    unsigned long long cycles ;
 
     backchain_quant_level = _th_quant_level ;
     cut_flag = 0 ;
@@ -1110,6 +1112,7 @@ struct _ex_intern *_th_rewrite_rule(struct env *env, struct _ex_intern *e, int d
             goto cont2 ;
         }
         ++r->rule_in_use ;
+        if (_th_rule_profiling) _th_profile_rule_start(rules[i]) ;
         cond = r->u.appl.args[2] ;
         if ((do_transitive & 4) && r->u.appl.args[1]==_ex_false) goto cont ;
         if ((do_transitive & 8) && r->u.appl.args[1]==_ex_true) goto cont ;
@@ -1150,8 +1153,9 @@ good: ;
 try_the_other:
         //_zone_print_exp("Matching", r->u.appl.args[0]);
         //_zone_print_exp("and", e);
-        mr = _th_match(env, r->u.appl.args[0], e) ;
-        if (mr && r->has_special_term) {
+        cursor = _th_match_cursor(env, r->u.appl.args[0], e) ;
+        theta = _th_match_next(cursor) ;
+        if (theta && r->has_special_term) {
             //struct _ex_intern *r1;
             //printf("Name away %s\n", _th_print_exp(r));
             //printf("and %s\n", _th_print_exp(e));
@@ -1163,9 +1167,10 @@ try_the_other:
             //   fflush(stdout);
             //}
             //r = r1;
-            mr = _th_match(env,r->u.appl.args[0], e) ;
+            cursor = _th_match_cursor(env, r->u.appl.args[0], e) ;
+            theta = _th_match_next(cursor) ;
         }
-        while (mr != NULL) {
+        while (theta != NULL) {
             _zone_print2("Testing rule %s with priority %d", _th_print_exp(r), priorities[i]) ;
             _tree_indent() ;
             context_set_count = 0 ;
@@ -1187,7 +1192,10 @@ try_the_other:
             } else {
                 functor = 0;
             }
-            if (u = test_condition(env, _th_subst(env,mr->theta,r->u.appl.args[2]), mr->theta, 0, 0, NULL, NULL, functor)) {
+            if (_th_rule_profiling) cycles = _th_profile_cycles() ;
+            u = test_condition(env, _th_subst(env,theta,r->u.appl.args[2]), theta, 0, 0, NULL, NULL, functor) ;
+            if (_th_rule_profiling) _th_profile_condition(u != NULL, cycles) ;
+            if (u) {
                 if (is_context[i]) {
                     _th_mark_used(env, rules[i]) ;
                 }
@@ -1220,10 +1228,11 @@ try_the_other:
                 _th_limit_term = save_limit_term ;
                 backchain_quant_level = back_chain_save ;
                 --rules[i]->rule_in_use ;
+                if (_th_rule_profiling) _th_profile_rule_end() ;
                 return r ;
             }
             cut_priority = priorities[i] ;
-            mr = mr->next ;
+            theta = _th_match_next(cursor) ;
             _tree_undent() ;
         }
         if (r2 != NULL) {
@@ -1233,6 +1242,7 @@ try_the_other:
         }
 cont:;
         --rules[i]->rule_in_use ;
+        if (_th_rule_profiling) _th_profile_rule_end() ;
 cont2:;
     }
     
@@ -1257,7 +1267,8 @@ cont2:;
 struct _ex_intern *_th_fast_rewrite_rule(struct env *env, struct _ex_intern *e, int do_transitive)
 {
     struct small_disc *s = _th_get_forward_context_rules(env) ;
-    struct match_return *mr ;
+    struct match_cursor *cursor ;
+    struct _ex_unifier *theta ;
     struct _ex_intern *r;
     void *iterator ;
     char *mark ;
@@ -1295,8 +1306,9 @@ struct _ex_intern *_th_fast_rewrite_rule(struct env *env, struct _ex_intern *e,
         if ((do_transitive & 8) && r->u.appl.args[1]==_ex_true) goto cont ;
         _zone_print_exp("Matching", r->u.appl.args[0]);
         _zone_print_exp("and", e);
-        mr = _th_match(env, r->u.appl.args[0], e) ;
-        if (mr && r->has_special_term) {
+        cursor = _th_match_cursor(env, r->u.appl.args[0], e) ;
+        theta = _th_match_next(cursor) ;
+        if (theta && r->has_special_term) {
             //struct _ex_intern *r1;
             //printf("Name away %s\n", _th_print_exp(r));
             //printf("and %s\n", _th_print_exp(e));
@@ -1308,9 +1320,10 @@ struct _ex_intern *_th_fast_rewrite_rule(struct env *env, struct _ex_intern *e,
             //   fflush(stdout);
             //}
             //r = r1;
-            mr = _th_match(env,r->u.appl.args[0], e) ;
+            cursor = _th_match_cursor(env, r->u.appl.args[0], e) ;
+            theta = _th_match_next(cursor) ;
         }
-        while (mr != NULL) {
+        while (theta != NULL) {
             _zone_print1("Testing rule %s", _th_print_exp(r)) ;
             _tree_indent() ;
 #ifdef _DEBUG
@@ -1328,20 +1341,20 @@ struct _ex_intern *_th_fast_rewrite_rule(struct env *env, struct _ex_intern *e,
 #endif
                 levels = _th_exp_depth(r);
                 _zone_print_exp("Applying", r) ;
-                r = _th_subst(env,mr->theta,r->u.appl.args[1]) ;
+                r = _th_subst(env,theta,r->u.appl.args[1]) ;
                 //if (r->type == EXP_APPL && _th_is_ac(env,r->u.appl.functor)) {
                 //    r = _th_flatten_top(env,r) ;
                 //}
                 r = _th_flatten_level(env,r,levels) ;
                 _zone_print_exp("Rewriting", e) ;
                 _zone_print_exp("to", r) ;
-                _th_zone_print_unifier(mr->theta) ;
+                _th_zone_print_unifier(theta) ;
                 _th_alloc_release(MATCH_SPACE,mark) ;
                 _tree_undent() ;
                 _tree_undent() ;
                 return r ;
             }
-            mr = mr->next ;
+            theta = _th_match_next(cursor) ;
             _tree_undent() ;
         }
 cont:;
@@ -220,6 +220,20 @@ struct _ex_unifier *_th_shallow_copy_unifier(unsigned zone, struct _ex_unifier *
     return new_unifier ;
 }
 
+/*
+ * Rolls a unifier back to the state saved in a shallow copy.  Pairs are
+ * only ever pushed onto the front of the buckets, so restoring the heads
+ * undoes any _th_add_pair calls made since the copy.
+ */
+void _th_restore_unifier(struct _ex_unifier *u, struct _ex_unifier *saved)
+{
+    int i ;
+
+    for (i = 0; i < TABLE_SIZE; ++i) {
+        u->table[i] = saved->table[i] ;
+    }
+}
+
 struct _ex_intern *_th_apply_entry(struct _entry *u,unsigned v)
 {
     if (u==NULL) return NULL ;
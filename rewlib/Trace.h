@@ -0,0 +1,58 @@
+/*
+ * Trace.h
+ *
+ * Layout of the binary trace files written by Tree.c and read back by
+ * tools/tracedump.c
+ *
+ * (C) 2024, Kenneth Roe
+ *
+ * GNU Affero General Public License
+ */
+
+/*
+ * A trace file starts with TRACE_MAGIC followed by three words giving
+ * sizeof(struct trace_slot), sizeof(long) and sizeof(void *) on the
+ * machine that wrote it.  After that come tagged records.  Each record
+ * starts with a tag word:
+ *
+ *     TRACE_DEF_FORMAT id len bytes   - text of format string id
+ *     TRACE_DEF_TERM id len bytes     - printed form of the term with id
+ *     TRACE_DEF_STRING id len bytes   - a %s argument too big for a slot
+ *     TRACE_RING count slots          - count trace_slots, oldest first
+ *
+ * Definitions are written once, the first time they are referenced,
+ * so they always precede the ring records that use them.
+ */
+#define TRACE_MAGIC "HTPTRC1"
+
+#define TRACE_DEF_FORMAT 1
+#define TRACE_DEF_TERM   2
+#define TRACE_DEF_STRING 3
+#define TRACE_RING       4
+
+/* Slot kinds */
+#define TRACE_PRINT      1
+#define TRACE_EXP        2
+
+/* Set in the kind word when the arguments did not fit in the payload */
+#define TRACE_TRUNCATED  0x100
+
+/* Set in a %s length word when the string was written as a TRACE_DEF_STRING */
+#define TRACE_STRING_REF 0x80000000
+
+#define TRACE_PAYLOAD    28
+
+/*
+ * For TRACE_PRINT the payload holds the raw printf arguments in order.
+ * Integers take one word, longs and pointers take sizeof(long) bytes
+ * rounded up to words and doubles take two words.  A %s argument is a
+ * length word followed by the bytes, or TRACE_STRING_REF|id.  For
+ * TRACE_EXP, format is the label and payload[0] is the term id.
+ */
+struct trace_slot {
+    unsigned kind;
+    int indent;
+    unsigned format;
+    unsigned zone;
+    unsigned payload[TRACE_PAYLOAD];
+};
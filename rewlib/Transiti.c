@@ -192,6 +192,7 @@ static struct trans_stack {
         int union_count ;
         struct _unions **union_ptrs ;
         struct _ex_list **term_ptrs ;
+        int order_mark ;
 #ifdef DEBUG
         int zone, subzone, count ;
 #endif
@@ -1452,6 +1453,525 @@ struct _ex_intern *_th_combine_operands(struct env *env,
     return NULL ;
 }
 
+/*
+ * Reachability index over the ordering facts in env_terms.  Each fact
+ * l < r or l <= r of a transitive order becomes an edge l -> r labeled
+ * with the order functor.  The first query from a node a computes every
+ * state reachable from a and keeps it with a as a hashed set, so asking
+ * whether a < b is entailed afterwards costs one probe.  A new edge
+ * extends the cached sets that reach its tail by searching only from
+ * the new states.  Added edges, built sets and extended sets are all
+ * recorded on a trail, and _th_trans_pop undoes the trail back to the
+ * mark saved by the matching push.
+ */
+#define ORDER_NONE   0
+#define ORDER_WEAK   1
+#define ORDER_STRICT 2
+
+#define ORDER_INCREMENT  1024
+
+/* Trail entry kinds.  Other values are the previous reach_count. */
+#define ORDER_TRAIL_EDGE  -1
+#define ORDER_TRAIL_BUILD -2
+
+struct order_edge {
+        int to ;
+        int strict ;
+        unsigned op ;
+        struct _ex_intern *fact ;
+    } ;
+
+/*
+ * A state is node * 2 + strict.  reach_states holds the states reachable
+ * from the node in the order they were found, and reach_table hashes
+ * them by index + 1.  A slot whose index is at or beyond reach_count is
+ * free, so truncating reach_count removes the newest states.
+ */
+struct order_node {
+        struct _ex_intern *e ;
+        int edge_count, edge_size ;
+        struct order_edge *edges ;
+        unsigned reach_op ;
+        int reach_valid, reach_listed ;
+        int reach_count, reach_size ;
+        int *reach_states ;
+        int *reach_table ;
+        unsigned reach_table_size ;
+    } ;
+
+struct order_trail {
+        int node ;
+        int count ;
+    } ;
+
+static struct order_node *order_nodes = NULL ;
+static int order_node_count = 0, order_node_size = 0 ;
+static int *order_map = NULL ;
+static unsigned order_map_size = 0 ;
+static struct order_trail *order_trail = NULL ;
+static int order_trail_count = 0, order_trail_size = 0 ;
+
+/* Nodes that have (or had) a reach set */
+static int *order_cached = NULL ;
+static int order_cached_count = 0, order_cached_size = 0 ;
+
+/* Search state for explanations, indexed by state */
+static unsigned *order_visit = NULL, order_stamp = 0 ;
+static int *order_parent = NULL, *order_via = NULL, *order_queue = NULL ;
+static int order_goal ;
+
+/* Atom last decided by _th_transitive from the index */
+static struct _ex_intern *order_reason_from = NULL, *order_reason_to ;
+static unsigned order_reason_op ;
+static int order_reason_strict ;
+
+static void order_grow_map()
+{
+    unsigned i, h ;
+
+    order_map_size = (order_map_size==0) ? ORDER_INCREMENT : order_map_size * 2 ;
+    order_map = (int *)REALLOC(order_map,sizeof(int) * order_map_size) ;
+    if (order_map==NULL) {
+        printf("Error in REALLOC\n") ;
+        exit(1) ;
+    }
+    memset(order_map, 0, sizeof(int) * order_map_size) ;
+    for (i = 0; i < (unsigned)order_node_count; ++i) {
+        h = (order_nodes[i].e->id * 2654435761u) & (order_map_size-1) ;
+        while (order_map[h]) h = (h+1) & (order_map_size-1) ;
+        order_map[h] = i+1 ;
+    }
+}
+
+static void order_grow_nodes()
+{
+    int i, size = order_node_size + ORDER_INCREMENT ;
+
+    order_nodes = (struct order_node *)REALLOC(order_nodes,sizeof(struct order_node) * size) ;
+    order_visit = (unsigned *)REALLOC(order_visit,sizeof(unsigned) * size * 2) ;
+    order_parent = (int *)REALLOC(order_parent,sizeof(int) * size * 2) ;
+    order_via = (int *)REALLOC(order_via,sizeof(int) * size * 2) ;
+    order_queue = (int *)REALLOC(order_queue,sizeof(int) * size * 2) ;
+    if (order_nodes==NULL || order_visit==NULL || order_parent==NULL || order_via==NULL || order_queue==NULL) {
+        printf("Error in REALLOC\n") ;
+        exit(1) ;
+    }
+    for (i = order_node_size; i < size; ++i) {
+        order_nodes[i].edge_size = 0 ;
+        order_nodes[i].edges = NULL ;
+        order_nodes[i].reach_size = 0 ;
+        order_nodes[i].reach_states = NULL ;
+        order_nodes[i].reach_table = NULL ;
+        order_nodes[i].reach_table_size = 0 ;
+        order_visit[i*2] = order_visit[i*2+1] = 0 ;
+    }
+    order_node_size = size ;
+}
+
+static int order_node(struct _ex_intern *e, int create)
+{
+    unsigned h ;
+    int n ;
+
+    if (order_map_size==0) {
+        if (!create) return -1 ;
+        order_grow_map() ;
+    }
+    h = (e->id * 2654435761u) & (order_map_size-1) ;
+    while (order_map[h]) {
+        if (order_nodes[order_map[h]-1].e==e) return order_map[h]-1 ;
+        h = (h+1) & (order_map_size-1) ;
+    }
+    if (!create) return -1 ;
+
+    if (order_node_count==order_node_size) order_grow_nodes() ;
+    n = order_node_count++ ;
+    order_nodes[n].e = e ;
+    order_nodes[n].edge_count = 0 ;
+    order_nodes[n].reach_valid = 0 ;
+    order_nodes[n].reach_listed = 0 ;
+    order_nodes[n].reach_count = 0 ;
+    order_map[h] = n+1 ;
+    if ((unsigned)order_node_count * 2 > order_map_size) order_grow_map() ;
+
+    return n ;
+}
+
+static void order_push_trail(int node, int count)
+{
+    if (order_trail_count==order_trail_size) {
+        order_trail_size += ORDER_INCREMENT ;
+        order_trail = (struct order_trail *)REALLOC(order_trail,sizeof(struct order_trail) * order_trail_size) ;
+        if (order_trail==NULL) {
+            printf("Error in REALLOC\n") ;
+            exit(1) ;
+        }
+    }
+    order_trail[order_trail_count].node = node ;
+    order_trail[order_trail_count].count = count ;
+    ++order_trail_count ;
+}
+
+static int reach_has(struct order_node *n, int state)
+{
+    unsigned h ;
+    int k ;
+
+    if (n->reach_table_size==0) return 0 ;
+    h = ((unsigned)state * 2654435761u) & (n->reach_table_size-1) ;
+    while ((k = n->reach_table[h]) > 0 && k <= n->reach_count) {
+        if (n->reach_states[k-1]==state) return 1 ;
+        h = (h+1) & (n->reach_table_size-1) ;
+    }
+    return 0 ;
+}
+
+static void reach_insert(struct order_node *n, int index)
+{
+    unsigned h = ((unsigned)n->reach_states[index] * 2654435761u) & (n->reach_table_size-1) ;
+    int k ;
+
+    while ((k = n->reach_table[h]) > 0 && k <= index) {
+        h = (h+1) & (n->reach_table_size-1) ;
+    }
+    n->reach_table[h] = index+1 ;
+}
+
+static void reach_add(struct order_node *n, int state)
+{
+    int i ;
+
+    if (n->reach_count==n->reach_size) {
+        n->reach_size = n->reach_size * 2 + 16 ;
+        n->reach_states = (int *)REALLOC(n->reach_states,sizeof(int) * n->reach_size) ;
+        if (n->reach_states==NULL) {
+            printf("Error in REALLOC\n") ;
+            exit(1) ;
+        }
+    }
+    n->reach_states[n->reach_count] = state ;
+    if ((unsigned)(n->reach_count+1) * 2 > n->reach_table_size) {
+        n->reach_table_size = (n->reach_table_size==0) ? 64 : n->reach_table_size * 2 ;
+        n->reach_table = (int *)REALLOC(n->reach_table,sizeof(int) * n->reach_table_size) ;
+        if (n->reach_table==NULL) {
+            printf("Error in REALLOC\n") ;
+            exit(1) ;
+        }
+        memset(n->reach_table, 0, sizeof(int) * n->reach_table_size) ;
+        for (i = 0; i < n->reach_count; ++i) reach_insert(n,i) ;
+    }
+    reach_insert(n,n->reach_count) ;
+    ++n->reach_count ;
+}
+
+/*
+ * Adds every state reachable from reach_states[head] onward.  The
+ * states array doubles as the search queue.
+ */
+static void reach_close(struct order_node *n, int head)
+{
+    struct order_node *m ;
+    struct order_edge *edge ;
+    int s, i, next ;
+
+    while (head < n->reach_count) {
+        s = n->reach_states[head++] ;
+        m = &order_nodes[s/2] ;
+        for (i = 0; i < m->edge_count; ++i) {
+            edge = &m->edges[i] ;
+            if (edge->op != n->reach_op) continue ;
+            next = edge->to * 2 + ((s & 1) | edge->strict) ;
+            if (!reach_has(n,next)) reach_add(n,next) ;
+        }
+    }
+}
+
+static void reach_build(int a, unsigned op)
+{
+    struct order_node *n = &order_nodes[a] ;
+
+    order_push_trail(a,ORDER_TRAIL_BUILD) ;
+    if (n->reach_table_size) memset(n->reach_table, 0, sizeof(int) * n->reach_table_size) ;
+    n->reach_op = op ;
+    n->reach_valid = 1 ;
+    n->reach_count = 0 ;
+    reach_add(n,a*2) ;
+    reach_close(n,0) ;
+
+    if (!n->reach_listed) {
+        if (order_cached_count==order_cached_size) {
+            order_cached_size += ORDER_INCREMENT ;
+            order_cached = (int *)REALLOC(order_cached,sizeof(int) * order_cached_size) ;
+            if (order_cached==NULL) {
+                printf("Error in REALLOC\n") ;
+                exit(1) ;
+            }
+        }
+        order_cached[order_cached_count++] = a ;
+        n->reach_listed = 1 ;
+    }
+}
+
+/*
+ * Extends the reach sets of op that contain the tail of the new edge
+ * from -> to.
+ */
+static void reach_extend(int from, int to, int strict, unsigned op)
+{
+    struct order_node *n ;
+    int i, f, old ;
+
+    for (i = 0; i < order_cached_count; ++i) {
+        n = &order_nodes[order_cached[i]] ;
+        if (!n->reach_valid || n->reach_op != op) continue ;
+        old = n->reach_count ;
+        for (f = 0; f < 2; ++f) {
+            if (reach_has(n,from*2+f) && !reach_has(n,to*2+(f|strict))) {
+                if (n->reach_count==old) order_push_trail(order_cached[i],old) ;
+                reach_add(n,to*2+(f|strict)) ;
+            }
+        }
+        if (n->reach_count > old) reach_close(n,old) ;
+    }
+}
+
+static void order_fact(struct env *env, struct _ex_intern *e)
+{
+    struct order_node *node ;
+    struct order_edge *edge ;
+    unsigned op, optype ;
+    int strict, from, to ;
+
+    op = get_operator(env,e,&optype) ;
+    switch (optype) {
+        case INTERN_TO:
+        case INTERN_PO:
+            strict = 1 ;
+            break ;
+        case INTERN_ETO:
+        case INTERN_EPO:
+            strict = 0 ;
+            break ;
+        default:
+            return ;
+    }
+    from = order_node(_th_get_left_operand(env,e),1) ;
+    to = order_node(_th_get_right_operand(env,e),1) ;
+
+    node = &order_nodes[from] ;
+    if (node->edge_count==node->edge_size) {
+        node->edge_size = node->edge_size * 2 + 4 ;
+        node->edges = (struct order_edge *)REALLOC(node->edges,sizeof(struct order_edge) * node->edge_size) ;
+        if (node->edges==NULL) {
+            printf("Error in REALLOC\n") ;
+            exit(1) ;
+        }
+    }
+    edge = &node->edges[node->edge_count++] ;
+    edge->to = to ;
+    edge->strict = strict ;
+    edge->op = op ;
+    edge->fact = e ;
+    order_push_trail(from,ORDER_TRAIL_EDGE) ;
+
+    reach_extend(from,to,strict,op) ;
+}
+
+static void order_undo(int mark)
+{
+    struct order_trail *t ;
+    struct order_node *n ;
+
+    while (order_trail_count > mark) {
+        t = &order_trail[--order_trail_count] ;
+        n = &order_nodes[t->node] ;
+        if (t->count==ORDER_TRAIL_EDGE) {
+            --n->edge_count ;
+        } else if (t->count==ORDER_TRAIL_BUILD) {
+            n->reach_valid = 0 ;
+            n->reach_count = 0 ;
+        } else {
+            n->reach_count = t->count ;
+        }
+    }
+}
+
+static void order_reset()
+{
+    int i ;
+
+    for (i = 0; i < order_node_size; ++i) {
+        if (order_nodes[i].edges != NULL) FREE(order_nodes[i].edges) ;
+        if (order_nodes[i].reach_states != NULL) FREE(order_nodes[i].reach_states) ;
+        if (order_nodes[i].reach_table != NULL) FREE(order_nodes[i].reach_table) ;
+        order_nodes[i].edges = NULL ;
+        order_nodes[i].edge_size = 0 ;
+        order_nodes[i].reach_states = NULL ;
+        order_nodes[i].reach_size = 0 ;
+        order_nodes[i].reach_table = NULL ;
+        order_nodes[i].reach_table_size = 0 ;
+    }
+    order_node_count = 0 ;
+    if (order_map_size) memset(order_map, 0, sizeof(int) * order_map_size) ;
+    order_trail_count = 0 ;
+    order_cached_count = 0 ;
+    order_reason_from = NULL ;
+}
+
+/*
+ * Breadth first search from node a over the edges of op, recording how
+ * each state was reached.  A strict path is found even if b is first
+ * reached by a weak one.  The state at b is left in order_goal for
+ * _th_trans_explain_order.
+ */
+static int order_search(int a, int b, unsigned op)
+{
+    int head = 0, tail = 0, s, n, i, next, result = ORDER_NONE ;
+    struct order_edge *edge ;
+
+    if (++order_stamp==0) {
+        for (i = 0; i < order_node_size * 2; ++i) order_visit[i] = 0 ;
+        order_stamp = 1 ;
+    }
+    order_visit[a*2] = order_stamp ;
+    order_queue[tail++] = a*2 ;
+    while (head < tail) {
+        s = order_queue[head++] ;
+        n = s / 2 ;
+        for (i = 0; i < order_nodes[n].edge_count; ++i) {
+            edge = &order_nodes[n].edges[i] ;
+            if (edge->op != op) continue ;
+            next = edge->to * 2 + ((s & 1) | edge->strict) ;
+            if (order_visit[next]==order_stamp) continue ;
+            order_visit[next] = order_stamp ;
+            order_parent[next] = s ;
+            order_via[next] = i ;
+            if (edge->to==b) {
+                order_goal = next ;
+                if (next & 1) return ORDER_STRICT ;
+                result = ORDER_WEAK ;
+            }
+            order_queue[tail++] = next ;
+        }
+    }
+    if (result==ORDER_WEAK) order_goal = b*2 ;
+
+    return result ;
+}
+
+static int order_query(struct _ex_intern *a, struct _ex_intern *b, unsigned op)
+{
+    struct order_node *n ;
+    int ia = order_node(a,0), ib = order_node(b,0) ;
+
+    if (ia < 0 || ib < 0 || ia==ib) return ORDER_NONE ;
+    n = &order_nodes[ia] ;
+    if (!n->reach_valid || n->reach_op != op) reach_build(ia,op) ;
+    if (reach_has(n,ib*2+1)) return ORDER_STRICT ;
+    if (reach_has(n,ib*2)) return ORDER_WEAK ;
+
+    return ORDER_NONE ;
+}
+
+/*
+ * Returns 1 if the environment facts entail a < b (strict) or a <= b
+ * for the order op.
+ */
+int _th_trans_entails_order(struct env *env, unsigned op, struct _ex_intern *a, struct _ex_intern *b, int strict)
+{
+    int r = order_query(a,b,op) ;
+
+    return strict ? (r==ORDER_STRICT) : (r != ORDER_NONE) ;
+}
+
+/*
+ * Returns the chain of environment facts that entails a < b (strict) or
+ * a <= b for the order op, in order from a to b.  Returns NULL if there
+ * is no such chain.
+ */
+struct add_list *_th_trans_explain_order(struct env *env, unsigned op, struct _ex_intern *a, struct _ex_intern *b, int strict)
+{
+    struct add_list *path = NULL, *al ;
+    int ia = order_node(a,0), ib = order_node(b,0), r, s ;
+
+    if (ia < 0 || ib < 0 || ia==ib) return NULL ;
+    r = order_search(ia,ib,op) ;
+    if (r==ORDER_NONE || (strict && r != ORDER_STRICT)) return NULL ;
+
+    for (s = order_goal; s != ia*2; s = order_parent[s]) {
+        al = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list)) ;
+        al->next = path ;
+        al->e = order_nodes[order_parent[s]/2].edges[order_via[s]].fact ;
+        path = al ;
+    }
+
+    return path ;
+}
+
+/*
+ * Returns the facts behind the last atom _th_transitive decided from
+ * the index, or NULL if the last atom was not decided that way.  If the
+ * atom was rewritten to False, the facts together with the atom are the
+ * conflict.  The chain is computed on demand and is valid until the
+ * next _th_trans_pop.
+ */
+struct add_list *_th_trans_reason(struct env *env)
+{
+    if (order_reason_from==NULL) return NULL ;
+
+    return _th_trans_explain_order(env,order_reason_op,order_reason_from,order_reason_to,order_reason_strict) ;
+}
+
+static void order_decide(unsigned op, struct _ex_intern *from, struct _ex_intern *to, int strict)
+{
+    order_reason_op = op ;
+    order_reason_from = from ;
+    order_reason_to = to ;
+    order_reason_strict = strict ;
+}
+
+/*
+ * Decides a single ordering atom from the index and remembers the
+ * path that decides it for _th_trans_reason.  Returns NULL if the
+ * index entails neither the atom nor its negation.
+ */
+static struct _ex_intern *order_entailed(struct env *env, struct _ex_intern *e)
+{
+    struct _ex_intern *l, *r ;
+    unsigned op, optype ;
+    int res ;
+
+    op = get_operator(env,e,&optype) ;
+    l = _th_get_left_operand(env,e) ;
+    r = _th_get_right_operand(env,e) ;
+    switch (optype) {
+        case INTERN_TO:
+        case INTERN_PO:
+            if (order_query(l,r,op)==ORDER_STRICT) {
+                order_decide(op,l,r,1) ;
+                return _ex_true ;
+            }
+            if ((res = order_query(r,l,op)) != ORDER_NONE) {
+                order_decide(op,r,l,res==ORDER_STRICT) ;
+                return _ex_false ;
+            }
+            break ;
+        case INTERN_ETO:
+        case INTERN_EPO:
+            if ((res = order_query(l,r,op)) != ORDER_NONE) {
+                order_decide(op,l,r,res==ORDER_STRICT) ;
+                return _ex_true ;
+            }
+            if (order_query(r,l,op)==ORDER_STRICT) {
+                order_decide(op,r,l,1) ;
+                return _ex_false ;
+            }
+            break ;
+    }
+
+    return NULL ;
+}
+
 static int is_constant(struct env *env,struct _ex_intern *e)
 {
     switch(e->type) {
@@ -1467,7 +1987,7 @@ static int is_constant(struct env *env,struct _ex_intern *e)
 static int find_env_const(struct env *env,struct _ex_intern *e)
 {
     struct _const_list *l ;
-    int bin = (((unsigned)e)/4)%TRANS_HASH_SIZE ;
+    int bin = e->id%TRANS_HASH_SIZE ;
 
     l = env_consts[bin] ;
 
@@ -1482,7 +2002,7 @@ static int find_env_const(struct env *env,struct _ex_intern *e)
 static int find_all_const(struct env *env,struct _ex_intern *e)
 {
     struct _const_list *l ;
-    int bin = (((unsigned)e)/4)%TRANS_HASH_SIZE ;
+    int bin = e->id%TRANS_HASH_SIZE ;
 
     l = all_consts[bin] ;
 
@@ -1502,7 +2022,7 @@ static struct _const_list *add_env_const(struct env *env,struct _ex_intern *e, u
     if (find_env_const(env,e)) return NULL ;
 
     l = (struct _const_list *)_th_alloc(TRANSITIVE_SPACE,sizeof(struct _const_list)) ;
-    bin = (((unsigned)e)/4)%TRANS_HASH_SIZE ;
+    bin = e->id%TRANS_HASH_SIZE ;
     l->next = env_consts[bin] ;
     l->e = e ;
     env_consts[bin] = l ;
@@ -1518,7 +2038,7 @@ static struct _const_list *add_all_const(struct env *env,struct _ex_intern *e, u
     if (find_all_const(env,e)) return 0 ;
 
     l = (struct _const_list *)_th_alloc(TRANSITIVE_SPACE,sizeof(struct _const_list)) ;
-    bin = (((unsigned)e)/4)%TRANS_HASH_SIZE ;
+    bin = e->id%TRANS_HASH_SIZE ;
     l->next = all_consts[bin] ;
     l->e = e ;
     all_consts[bin] = l ;
@@ -1529,7 +2049,7 @@ static struct _const_list *add_all_const(struct env *env,struct _ex_intern *e, u
 static int find_env_term(struct env *env,struct _ex_intern *e)
 {
     struct _ex_list *l ;
-    int bin = (((unsigned)e)/4)%TRANS_HASH_SIZE ;
+    int bin = e->id%TRANS_HASH_SIZE ;
 
     l = env_terms[bin] ;
 
@@ -1544,7 +2064,7 @@ static int find_env_term(struct env *env,struct _ex_intern *e)
 static int find_all_term(struct env *env,struct _ex_intern *e)
 {
     struct _ex_list *l ;
-    int bin = (((unsigned)e)/4)%TRANS_HASH_SIZE ;
+    int bin = e->id%TRANS_HASH_SIZE ;
 
     l = all_terms[bin] ;
 
@@ -1562,7 +2082,7 @@ static struct _term_list *find_term(struct _term_list **tl, struct env *env,
     struct _term_list *t ;
     int bin ;
 
-    bin = (((unsigned)e)/4)%TRANS_HASH_SIZE ;
+    bin = e->id%TRANS_HASH_SIZE ;
 #ifdef DEBUG
     _zone_print1("bin = %d", bin);
 #endif
@@ -1588,7 +2108,7 @@ static struct _union_list *find_union_term(struct _union_list **ul, struct env *
     struct _union_list *u ;
     int bin ;
 
-    bin = (((unsigned)e)/4)%TRANS_HASH_SIZE ;
+    bin = e->id%TRANS_HASH_SIZE ;
 
     u = ul[bin] ;
     while (u != NULL) {
@@ -1635,7 +2155,7 @@ static struct _ex_list *add_env_term(struct env *env,struct _ex_intern *e)
          (_th_get_right_operand(env,e->u.appl.args[0]) != _th_get_left_operand(env,e->u.appl.args[1]) &&
           _th_get_right_operand(env,e->u.appl.args[0]) != _th_get_right_operand(env,e->u.appl.args[1])))) bin = 3 / bin ;
     l = (struct _ex_list *)_th_alloc(TRANSITIVE_SPACE,sizeof(struct _ex_list)) ;
-    bin = (((unsigned)e)/4)%TRANS_HASH_SIZE ;
+    bin = e->id%TRANS_HASH_SIZE ;
     l->next = env_terms[bin] ;
     l->e = e ;
     env_terms[bin] = l ;
@@ -1651,6 +2171,8 @@ static struct _ex_list *add_env_term(struct env *env,struct _ex_intern *e)
     l->unused = 0 ;
     l->child1 = l->child2 = NULL ;
 
+    order_fact(env,e) ;
+
     if (op==INTERN_SUBSET && optype==INTERN_EPO) {
         if (left->type==EXP_APPL && left->u.appl.functor==INTERN_UNION) {
             for (i = 0; i < left->u.appl.count; ++i) {
@@ -1700,7 +2222,7 @@ static struct _ex_list *add_all_term(struct env *env,struct _ex_intern *e)
 #endif
 
     l = (struct _ex_list *)_th_alloc(TRANSITIVE_SPACE,sizeof(struct _ex_list)) ;
-    bin = (((unsigned)e)/4)%TRANS_HASH_SIZE ;
+    bin = e->id%TRANS_HASH_SIZE ;
     l->next = all_terms[bin] ;
     l->e = e ;
     all_terms[bin] = l ;
@@ -3813,7 +4335,7 @@ static int _th_process_rule(struct env *env,struct _ex_intern *e)
 
 static int cmp(const void *i1,const void *i2)
 {
-    return *((const int *)i2)-*((const int *)i1) ;
+    return ((int)(*((struct _ex_intern **)i2))->id)-((int)(*((struct _ex_intern **)i1))->id) ;
 }
 
 static int _th_flush_rules(struct env *env)
@@ -3823,6 +4345,7 @@ static int _th_flush_rules(struct env *env)
     struct  trans_stack *s ;
     struct _term_list *tl ;
     struct _union_list *ul ;
+    struct _ex_list *l ;
 
     //_zone_print1("flush tos start = %x\n", tos);
 
@@ -3838,9 +4361,8 @@ static int _th_flush_rules(struct env *env)
 #ifdef DEBUG
         _zone_print1("term %s", _th_print_exp(terms[i])) ;
 #endif
-        hash += (unsigned)terms[i] ;
+        hash += terms[i]->id ;
     }
-    hash /= 4 ;
     hash = hash%TRANS_HASH_SIZE ;
     s = push_hash[hash] ;
     while (s != NULL) {
@@ -3907,6 +4429,18 @@ cont:
                 tl = tl->next ;
             }
         }
+        /*
+         * s was pushed on top of the current level, so the index is
+         * brought to its state by undoing to the current mark and adding
+         * the facts s has beyond it.
+         */
+        order_undo(s->next ? s->next->order_mark : 0) ;
+        for (i = 0; i < TRANS_HASH_SIZE; ++i) {
+            for (l = env_terms[i]; l != NULL && (s->next==NULL || l != s->next->env_terms[i]); l = l->next) {
+                order_fact(env,l->e) ;
+            }
+        }
+        s->order_mark = order_trail_count ;
         tos = s ;
         push_hash = tos->push_hash ;
         term_count = 0 ;
@@ -3993,6 +4527,7 @@ void _th_trans_push(struct env *env)
         }
         push_hash[i] = NULL ;
     }
+    tos->order_mark = order_trail_count ;
     tos->term_ptrs = (struct _ex_list **)_th_alloc(TRANSITIVE_SPACE,sizeof(struct _ex_list *) * count) ;
     tos->union_ptrs = (struct _unions **)_th_alloc(TRANSITIVE_SPACE,sizeof(struct _unions *) * ucount) ;
     count = 0 ;
@@ -4088,6 +4623,7 @@ void _th_trans_pop()
             ul = ul->next ;
         }
     }
+    order_undo(tos->order_mark) ;
     tos = tos->next ;
     if (tos==NULL) {
         push_hash = root_push_hash ;
@@ -4113,6 +4649,7 @@ int _th_add_rule(struct env *env, struct _ex_intern *e)
         _tree_undent();
         return 0 ;
     }
+    _th_invalidate_normal_forms();
     l = e->u.appl.args[0] ;
     if (e->u.appl.args[1]==_ex_false) l = _ex_intern_appl1_env(env,INTERN_NOT,l) ;
     l = _th_normalize_rule(env,l,0) ;
@@ -5120,6 +5657,7 @@ void _th_transitive_init()
         env_left[i] = env_right[i] = NULL ;
         push_hash[i] = 0 ;
     }
+    order_reset() ;
 }
 
 void _th_transitive_reset()
@@ -5143,6 +5681,7 @@ void _th_transitive_reset()
         root_push_hash[i] = NULL ;
     }
     _th_alloc_release(TRANSITIVE_SPACE,NULL) ;
+    order_reset() ;
     _zone_print0("transitive reset");
     tos = NULL ;
 }
@@ -5171,6 +5710,7 @@ struct _ex_intern *_th_transitive(struct env *env, struct _ex_intern *orig)
     unsigned op, optype ;
 
     _zone_print_exp("Transitive rewrite of", orig) ;
+    order_reason_from = NULL ;
     e1 = e = _th_normalize_rule(env,orig,1);
     _zone_print_exp("normalization", e) ;
 
@@ -5202,6 +5742,21 @@ struct _ex_intern *_th_transitive(struct env *env, struct _ex_intern *orig)
         if (!ret) return NULL ;
     } else {
         if (!_th_is_binary_term(env,e)) return NULL;
+        e1 = order_entailed(env,e) ;
+        if (e1 != NULL) {
+            _zone_print_exp("Order index", e1) ;
+#ifndef FAST
+            if (_zone_active()) {
+                _tree_indent() ;
+                for (al = _th_trans_reason(env); al != NULL; al = al->next) {
+                    _zone_print_exp("reason", al->e) ;
+                }
+                _tree_undent() ;
+            }
+#endif
+            return e1 ;
+        }
+        e1 = e ;
     }
 
 #ifdef DEBUG
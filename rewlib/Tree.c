@@ -73,6 +73,7 @@ void _tree_set_time_limit(unsigned t)
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include "Trace.h"
 
 static FILE *file, *file_table ;
 int indent ;
@@ -117,6 +118,312 @@ struct table_file_record {
 
 static unsigned entry_number ;
 
+/*
+ * Binary tracing
+ *
+ * With _tree_binary set, _tree_print and friends do no formatting at
+ * all.  Each call fills in a fixed size slot of an in memory ring
+ * buffer with the indent, the zone, a format id and the raw printf
+ * arguments (terms passed to _tree_print_exp are logged by id).  Format
+ * strings and term texts go to the trace file the first time they are
+ * used.  When the ring fills up the oldest slots are overwritten; the
+ * ring is written out by _tree_trace_flush and at exit.  There is one
+ * ring, one indent and one set of format and term tables, so tracing
+ * must never be called from inside an OpenMP parallel region; the
+ * parallel loops in grouping.c only do table arithmetic.  TRACE_SERIAL
+ * stops the prover if that is ever broken.  tools/tracedump.c turns a
+ * trace file back into the indented log.
+ */
+#ifdef _OPENMP
+#include <omp.h>
+#define TRACE_SERIAL() \
+    if (omp_in_parallel()) { \
+        fprintf(stderr, "Tracing called inside a parallel region\n"); \
+        exit(1); \
+    }
+#else
+#define TRACE_SERIAL()
+#endif
+
+#define TRACE_RING_SLOTS  131072
+#define TRACE_FORMAT_HASH 4001
+
+int _tree_binary = 0;
+
+static FILE *trace_file = NULL;
+static struct trace_slot *trace_ring = NULL;
+static unsigned trace_next, trace_count;
+static unsigned trace_format_count, trace_string_count;
+static unsigned char *trace_terms_defined = NULL;
+static unsigned trace_terms_size;
+
+static struct trace_format {
+    struct trace_format *next;
+    char *format;
+    unsigned id;
+} *trace_formats[TRACE_FORMAT_HASH];
+
+static void trace_def(unsigned tag, unsigned id, char *s)
+{
+    unsigned header[3];
+
+    header[0] = tag;
+    header[1] = id;
+    header[2] = strlen(s);
+    fwrite(header,sizeof(unsigned),3,trace_file);
+    fwrite(s,1,header[2],trace_file);
+}
+
+static unsigned trace_format_id(char *format)
+{
+    unsigned hash = 0;
+    char *c;
+    struct trace_format *f;
+
+    for (c = format; *c; ++c) hash = hash * 31 + *c;
+    hash %= TRACE_FORMAT_HASH;
+
+    for (f = trace_formats[hash]; f; f = f->next) {
+        if (!strcmp(f->format,format)) return f->id;
+    }
+
+    f = (struct trace_format *)MALLOC(sizeof(struct trace_format));
+    f->next = trace_formats[hash];
+    trace_formats[hash] = f;
+    f->format = (char *)MALLOC(strlen(format)+1);
+    strcpy(f->format,format);
+    f->id = trace_format_count++;
+    trace_def(TRACE_DEF_FORMAT,f->id,format);
+
+    return f->id;
+}
+
+static unsigned trace_term_id(struct _ex_intern *e)
+{
+    if (e==NULL) return 0;
+
+    if (e->id >= trace_terms_size) {
+        unsigned size = _ex_term_id_limit() + 4096;
+        trace_terms_defined = (unsigned char *)REALLOC(trace_terms_defined,size);
+        memset(trace_terms_defined+trace_terms_size,0,size-trace_terms_size);
+        trace_terms_size = size;
+    }
+    if (!trace_terms_defined[e->id]) {
+        trace_terms_defined[e->id] = 1;
+        trace_def(TRACE_DEF_TERM,e->id,_th_print_exp(e));
+    }
+
+    return e->id;
+}
+
+static struct trace_slot *trace_new_slot(unsigned kind, char *format, int ind)
+{
+    struct trace_slot *slot = trace_ring + trace_next;
+
+    if (++trace_next==TRACE_RING_SLOTS) trace_next = 0;
+    if (trace_count < TRACE_RING_SLOTS) ++trace_count;
+
+    slot->kind = kind;
+    slot->indent = ind;
+    slot->format = trace_format_id(format);
+    slot->zone = _tree_zone;
+
+    ++line_entry;
+    ++_tree_count;
+
+    return slot;
+}
+
+static int trace_put(struct trace_slot *slot, int *n, void *data, int size)
+{
+    int words = (size+sizeof(unsigned)-1)/sizeof(unsigned);
+
+    if (*n + words > TRACE_PAYLOAD) {
+        slot->kind |= TRACE_TRUNCATED;
+        return 0;
+    }
+    memcpy(slot->payload + *n, data, size);
+    *n += words;
+
+    return 1;
+}
+
+static int trace_put_string(struct trace_slot *slot, int *n, char *s)
+{
+    unsigned len, ref;
+
+    if (s==NULL) s = "(null)";
+    len = strlen(s);
+
+    if (*n + 1 + (len+sizeof(unsigned)-1)/sizeof(unsigned) <= TRACE_PAYLOAD) {
+        trace_put(slot,n,&len,sizeof(unsigned));
+        return trace_put(slot,n,s,len);
+    }
+
+    ref = TRACE_STRING_REF | trace_string_count;
+    trace_def(TRACE_DEF_STRING,trace_string_count++,s);
+    return trace_put(slot,n,&ref,sizeof(unsigned));
+}
+
+/*
+ * Walks the conversions in format and copies each argument into the
+ * slot.  This has to agree with the argument decoding in tracedump.
+ */
+static void trace_print(char *format, va_list vaList)
+{
+    struct trace_slot *slot = trace_new_slot(TRACE_PRINT, format, indent);
+    char *f = format;
+    int n = 0;
+
+    while (*f) {
+        int longs = 0, big = 0;
+
+        if (*f++ != '%') continue;
+
+        while (*f && strchr("-+ #0123456789.*",*f)) {
+            if (*f=='*') {
+                int w = va_arg(vaList,int);
+                if (!trace_put(slot,&n,&w,sizeof(int))) return;
+            }
+            ++f;
+        }
+        while (*f && strchr("hlLqjzt",*f)) {
+            if (*f=='L' || *f=='q') big = 1;
+            if (*f!='h') ++longs;
+            ++f;
+        }
+
+        switch (*f) {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                if (longs >= 2 || big) {
+                    long long v = va_arg(vaList,long long);
+                    if (!trace_put(slot,&n,&v,sizeof(long long))) return;
+                } else if (longs) {
+                    long v = va_arg(vaList,long);
+                    if (!trace_put(slot,&n,&v,sizeof(long))) return;
+                } else {
+                    int v = va_arg(vaList,int);
+                    if (!trace_put(slot,&n,&v,sizeof(int))) return;
+                }
+                break;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                {
+                    double v = big ? (double)va_arg(vaList,long double) : va_arg(vaList,double);
+                    if (!trace_put(slot,&n,&v,sizeof(double))) return;
+                }
+                break;
+            case 's':
+                if (!trace_put_string(slot,&n,va_arg(vaList,char *))) return;
+                break;
+            case 'p':
+                {
+                    void *v = va_arg(vaList,void *);
+                    if (!trace_put(slot,&n,&v,sizeof(void *))) return;
+                }
+                break;
+            case 'n':
+                va_arg(vaList,int *);
+                break;
+        }
+        if (*f) ++f;
+    }
+}
+
+static void trace_exp(char *c, struct _ex_intern *exp)
+{
+    struct trace_slot *slot = trace_new_slot(TRACE_EXP, c, indent);
+
+    slot->payload[0] = trace_term_id(exp);
+}
+
+void _tree_trace_flush()
+{
+    unsigned header[2];
+    unsigned first;
+
+    if (trace_file==NULL) return;
+
+    header[0] = TRACE_RING;
+    header[1] = trace_count;
+    fwrite(header,sizeof(unsigned),2,trace_file);
+
+    first = (trace_count < TRACE_RING_SLOTS) ? 0 : trace_next;
+    if (first + trace_count > TRACE_RING_SLOTS) {
+        fwrite(trace_ring+first,sizeof(struct trace_slot),TRACE_RING_SLOTS-first,trace_file);
+        fwrite(trace_ring,sizeof(struct trace_slot),trace_next,trace_file);
+    } else {
+        fwrite(trace_ring+first,sizeof(struct trace_slot),trace_count,trace_file);
+    }
+    fflush(trace_file);
+
+    trace_next = trace_count = 0;
+}
+
+static void trace_shutdown()
+{
+    if (trace_file==NULL) return;
+
+    _tree_trace_flush();
+    fclose(trace_file);
+    trace_file = NULL;
+    _tree_binary = 0;
+}
+
+void _tree_binary_trace(char *n)
+{
+    unsigned header[3];
+
+    trace_file = fopen(n,"wb");
+    if (trace_file==NULL) {
+        fprintf(stderr, "Cannot open trace file %s\n", n);
+        exit(1);
+    }
+
+    fwrite(TRACE_MAGIC,1,sizeof(TRACE_MAGIC),trace_file);
+    header[0] = sizeof(struct trace_slot);
+    header[1] = sizeof(long);
+    header[2] = sizeof(void *);
+    fwrite(header,sizeof(unsigned),3,trace_file);
+
+    trace_ring = (struct trace_slot *)MALLOC(sizeof(struct trace_slot) * TRACE_RING_SLOTS);
+    trace_terms_size = 4096;
+    trace_terms_defined = (unsigned char *)MALLOC(trace_terms_size);
+    memset(trace_terms_defined,0,trace_terms_size);
+    trace_next = trace_count = 0;
+    _tree_binary = 1;
+
+    atexit(trace_shutdown);
+}
+
+/*
+ * Text logging formats into a buffer that grows as needed
+ */
+static char *line_buffer = NULL;
+static int line_size = 0;
+
+static char *format_line(char *format, va_list vaList)
+{
+    va_list copy;
+    int len;
+
+    if (line_buffer==NULL) {
+        line_size = 4096;
+        line_buffer = (char *)MALLOC(line_size);
+    }
+
+    va_copy(copy, vaList);
+    len = vsnprintf(line_buffer, line_size, format, copy);
+    va_end(copy);
+
+    if (len >= line_size) {
+        line_size = len + 1;
+        line_buffer = (char *)REALLOC(line_buffer,line_size);
+        vsnprintf(line_buffer, line_size, format, vaList);
+    }
+
+    return line_buffer;
+}
+
 void _tree_init(char *n)
 {
     char name[100] ;
@@ -183,10 +490,13 @@ void _tree_shutdown()
         fclose(file) ;
         fclose(file_table) ;
     }
+
+    trace_shutdown();
 }
 
 void _tree_indent()
 {
+    TRACE_SERIAL();
     ++indent ;
 }
 
@@ -197,6 +507,7 @@ int _tree_get_indent()
 
 void _tree_undent()
 {
+    TRACE_SERIAL();
     --indent ;
     if (indent < 0) {
         fprintf(stderr, "Error in indenting\n");
@@ -214,6 +525,13 @@ void write_line(char *line, int indent)
 {
     struct table_file_record tab ;
 
+    if (_tree_binary) {
+        struct trace_slot *slot = trace_new_slot(TRACE_PRINT, "%s", indent);
+        int n = 0;
+        trace_put_string(slot,&n,line);
+        return;
+    }
+
     if (file==NULL) return;
 
     tab.line = ftell(file) ;
@@ -281,18 +599,16 @@ void _tree_print(char *format, ...)
 
     //if (check_env) valid_env(check_env);
 
+    TRACE_SERIAL();
     va_start (vaList, format) ;
-    if (_tree_interactive) {
+    if (_tree_binary) {
+        trace_print(format, vaList) ;
+    } else if (_tree_interactive) {
         vprintf(format, vaList) ;
     } else {
-        static char line[50000000], *l, *c ;
+        char *line, *l, *c ;
         int pre, details ;
-        vsprintf(line, format, vaList) ;
-        if (strlen(line) > 50000000) {
-			fprintf(stderr, "Line too long in _tree_print\n") ;
-			fflush(stderr) ;
-			exit(1);
-		}
+        line = format_line(format, vaList) ;
         //printf("indent,line:%d,%s\n", indent, line);
         l = line ;
         while (*l) {
@@ -353,6 +669,11 @@ void _tree_print(char *format, ...)
 void _tree_print_exp(char *c, struct _ex_intern *exp)
 {
     char *s;
+    TRACE_SERIAL();
+    if (_tree_binary) {
+        trace_exp(c, exp);
+        return;
+    }
     s = _th_print_exp(exp);
 	_tree_print("%s: %s", c, s);
 }
@@ -453,21 +774,22 @@ void _zone_print(char *format, ...)
     //if (check_env) valid_env(check_env);
 
     if (_zone_active()) {
-        static char line[50000000], *l ;
+        char *line, *l ;
         int pre ;
         int details = 0 ;
+        if (_tree_binary) {
+            va_start (vaList, format) ;
+            trace_print(format, vaList) ;
+            va_end (vaList) ;
+            return ;
+        }
         while (last_print < indent - 1) {
             write_line("", last_print++) ;
         }
 		pre = 0 ;
         va_start (vaList, format) ;
-        vsprintf(line, format, vaList) ;
+        line = format_line(format, vaList) ;
         va_end (vaList) ;
-        if (strlen(line) > 50000000) {
-			fprintf(stderr, "Line too long in _tree_print\n") ;
-			fflush(stderr) ;
-			exit(1) ;
-		}
         l = line ;
         while (strlen(l) > LIMIT) {
             char x = l[LIMIT] ;
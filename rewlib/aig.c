@@ -0,0 +1,466 @@
+/*
+ * aig.c
+ *
+ * And-inverter graph for the boolean skeleton of a theorem and a
+ * Tseitin style CNF encoder for it
+ *
+ * (C) 2024, Kenneth Roe
+ *
+ * GNU Affero General Public License
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "Globals.h"
+#include "Intern.h"
+
+/*
+ * A pure boolean theorem (and, or, not, ite, xor and equality between
+ * boolean terms over boolean variables) is turned into an and-inverter
+ * graph.  Every node is a two input AND gate.  Edges are literals: the
+ * node index shifted left one bit with the low bit set when the edge is
+ * inverted.  Node 0 is the constant, so literal 0 is false and literal
+ * 1 is true.
+ *
+ * Gates are structurally hashed on their (ordered) inputs so that equal
+ * subterms share one node, and the constructor folds constants and
+ * the trivial cases x&x and x&~x.
+ *
+ * The CNF uses the Plaisted-Greenbaum polarity optimization: a gate
+ * that is only needed true gets only the clauses forcing its inputs
+ * and a gate only needed false only the clause forcing it false.
+ * Chains of positive AND gates with a single fanout are collapsed into
+ * one wide gate so that big conjunctions do not introduce a variable
+ * for every binary node.
+ */
+struct aig_node {
+    unsigned left, right;
+    struct _ex_intern *input;
+    unsigned next;
+    unsigned refs;
+    int polarity;
+    int var;
+};
+
+#define AIG_HASH 65536
+
+#define POLARITY_POS 1
+#define POLARITY_NEG 2
+
+#define LIT_NODE(l) ((l) >> 1)
+#define LIT_NEG(l)  ((l) & 1)
+#define LIT_FALSE   0
+#define LIT_TRUE    1
+
+static struct aig_node *nodes = NULL;
+static unsigned node_count, node_size;
+static unsigned aig_hash[AIG_HASH];
+
+static struct term_marks *aig_lits = NULL;
+
+static int *clauses = NULL;
+static int clause_size, clause_pos, clause_count;
+static int var_count;
+
+static unsigned *gate_inputs = NULL;
+static int gate_size, gate_top;
+
+static unsigned new_node(unsigned left, unsigned right, struct _ex_intern *input)
+{
+    if (node_count >= node_size) {
+        node_size = node_size * 2 + 1024;
+        nodes = (struct aig_node *)REALLOC(nodes,sizeof(struct aig_node) * node_size);
+        if (nodes==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
+    }
+    nodes[node_count].left = left;
+    nodes[node_count].right = right;
+    nodes[node_count].input = input;
+    nodes[node_count].next = 0;
+    nodes[node_count].refs = 0;
+    nodes[node_count].polarity = 0;
+    nodes[node_count].var = 0;
+
+    return node_count++;
+}
+
+static void reset_aig()
+{
+    if (aig_lits==NULL) aig_lits = _th_new_term_marks(1);
+    _th_start_traversal(aig_lits);
+
+    memset(aig_hash, 0, sizeof(aig_hash));
+    node_count = 0;
+    new_node(0, 0, NULL);
+
+    clause_pos = 0;
+    clause_count = 0;
+    var_count = 0;
+}
+
+static unsigned aig_and(unsigned a, unsigned b)
+{
+    unsigned h, n;
+
+    if (a==LIT_FALSE || b==LIT_FALSE) return LIT_FALSE;
+    if (a==LIT_TRUE) return b;
+    if (b==LIT_TRUE || a==b) return a;
+    if (a==(b^1)) return LIT_FALSE;
+
+    if (a > b) {
+        unsigned t = a;
+        a = b;
+        b = t;
+    }
+
+    h = ((a * 31) + b) % AIG_HASH;
+    for (n = aig_hash[h]; n; n = nodes[n].next) {
+        if (nodes[n].left==a && nodes[n].right==b) return n << 1;
+    }
+
+    n = new_node(a, b, NULL);
+    nodes[n].next = aig_hash[h];
+    aig_hash[h] = n;
+
+    return n << 1;
+}
+
+static unsigned aig_or(unsigned a, unsigned b)
+{
+    return aig_and(a^1, b^1)^1;
+}
+
+static unsigned aig_xor(unsigned a, unsigned b)
+{
+    return aig_or(aig_and(a, b^1), aig_and(a^1, b));
+}
+
+static unsigned aig_ite(unsigned c, unsigned t, unsigned e)
+{
+    return aig_or(aig_and(c, t), aig_and(c^1, e));
+}
+
+static int is_bool_var(struct env *env, struct _ex_intern *e)
+{
+    struct _ex_intern *t;
+
+    if (e->type != EXP_VAR) return 0;
+    t = _th_get_var_type(env,e->u.var);
+
+    return t==NULL || t==_ex_bool;
+}
+
+static int is_skeleton(struct env *env, struct _ex_intern *e)
+{
+    int i;
+
+    if (_th_visit_term(aig_lits,e)) return 1;
+
+    if (e==_ex_true || e==_ex_false) return 1;
+    if (e->type==EXP_VAR) return is_bool_var(env,e);
+    if (e->type != EXP_APPL) return 0;
+
+    switch (e->u.appl.functor) {
+        case INTERN_AND:
+        case INTERN_OR:
+        case INTERN_NOT:
+        case INTERN_ITE:
+        case INTERN_XOR:
+            break;
+        case INTERN_EQUAL:
+            /*
+             * Only an equality whose sides are themselves boolean
+             * skeletons; (= x y) over integer variables is a theory atom.
+             */
+            for (i = 0; i < e->u.appl.count; ++i) {
+                struct _ex_intern *a = e->u.appl.args[i];
+                if (a->type==EXP_VAR && !is_bool_var(env,a)) return 0;
+            }
+            break;
+        default:
+            return 0;
+    }
+    if (e->u.appl.functor==INTERN_ITE && e->u.appl.count != 3) return 0;
+
+    for (i = 0; i < e->u.appl.count; ++i) {
+        if (!is_skeleton(env,e->u.appl.args[i])) return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Returns 1 if e is built only from boolean connectives over boolean
+ * variables, that is, if it can be handed to a SAT solver as is.
+ */
+int _th_is_boolean_skeleton(struct env *env, struct _ex_intern *e)
+{
+    if (aig_lits==NULL) aig_lits = _th_new_term_marks(1);
+    _th_start_traversal(aig_lits);
+
+    return is_skeleton(env,e);
+}
+
+static unsigned build(struct _ex_intern *e)
+{
+    unsigned l;
+    int i;
+
+    if (e==_ex_true) return LIT_TRUE;
+    if (e==_ex_false) return LIT_FALSE;
+
+    if (_th_term_marked(aig_lits,e)) return (unsigned)(long)_th_term_value(aig_lits,e);
+
+    if (e->type==EXP_VAR) {
+        l = new_node(0, 0, e) << 1;
+    } else {
+        switch (e->u.appl.functor) {
+            case INTERN_NOT:
+                l = build(e->u.appl.args[0])^1;
+                break;
+            case INTERN_AND:
+                l = LIT_TRUE;
+                for (i = 0; i < e->u.appl.count && l != LIT_FALSE; ++i) {
+                    l = aig_and(l, build(e->u.appl.args[i]));
+                }
+                break;
+            case INTERN_OR:
+                l = LIT_FALSE;
+                for (i = 0; i < e->u.appl.count && l != LIT_TRUE; ++i) {
+                    l = aig_or(l, build(e->u.appl.args[i]));
+                }
+                break;
+            case INTERN_ITE:
+                l = aig_ite(build(e->u.appl.args[0]), build(e->u.appl.args[1]), build(e->u.appl.args[2]));
+                break;
+            case INTERN_XOR:
+                l = LIT_FALSE;
+                for (i = 0; i < e->u.appl.count; ++i) {
+                    l = aig_xor(l, build(e->u.appl.args[i]));
+                }
+                break;
+            case INTERN_EQUAL:
+                l = LIT_TRUE;
+                for (i = 1; i < e->u.appl.count; ++i) {
+                    l = aig_and(l, aig_xor(build(e->u.appl.args[0]), build(e->u.appl.args[i]))^1);
+                }
+                break;
+            default:
+                fprintf(stderr, "Non boolean term in AIG %s\n", _th_print_exp(e));
+                exit(1);
+        }
+    }
+
+    _th_set_term_value(aig_lits,e,(void *)(long)l);
+
+    return l;
+}
+
+static void add_lit(int lit)
+{
+    if (clause_pos >= clause_size) {
+        clause_size = clause_size * 2 + 4096;
+        clauses = (int *)REALLOC(clauses,sizeof(int) * clause_size);
+        if (clauses==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
+    }
+    clauses[clause_pos++] = lit;
+    if (lit==0) ++clause_count;
+}
+
+static int node_var(unsigned n)
+{
+    if (nodes[n].var==0) nodes[n].var = ++var_count;
+    return nodes[n].var;
+}
+
+static int dimacs_lit(unsigned l)
+{
+    int v = node_var(LIT_NODE(l));
+
+    return LIT_NEG(l) ? -v : v;
+}
+
+static void count_refs(unsigned n)
+{
+    if (nodes[n].refs++ || nodes[n].input || n==0) return;
+    count_refs(LIT_NODE(nodes[n].left));
+    count_refs(LIT_NODE(nodes[n].right));
+}
+
+/*
+ * Collects the inputs of the wide AND gate rooted at n into
+ * gate_inputs starting at position pos.  A positive edge to a gate
+ * used only here is absorbed into the wide gate.
+ */
+static int collect_inputs(unsigned l, int pos, int root)
+{
+    unsigned n = LIT_NODE(l);
+
+    if (root || (!LIT_NEG(l) && nodes[n].input==NULL && n != 0 && nodes[n].refs==1)) {
+        pos = collect_inputs(nodes[n].left, pos, 0);
+        return collect_inputs(nodes[n].right, pos, 0);
+    }
+
+    if (pos >= gate_size) {
+        gate_size = gate_size * 2 + 256;
+        gate_inputs = (unsigned *)REALLOC(gate_inputs,sizeof(unsigned) * gate_size);
+        if (gate_inputs==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
+    }
+    gate_inputs[pos++] = l;
+
+    return pos;
+}
+
+static void encode(unsigned n, int polarity)
+{
+    int start, end, i;
+
+    if (nodes[n].input || n==0) return;
+
+    polarity &= ~nodes[n].polarity;
+    if (polarity==0) return;
+    nodes[n].polarity |= polarity;
+
+    /*
+     * gate_inputs is used as a stack by the recursive calls, so the
+     * inputs of this gate go on top of whatever the callers hold.
+     */
+    start = gate_top;
+    end = collect_inputs(n << 1, start, 1);
+    gate_top = end;
+
+    if (polarity & POLARITY_POS) {
+        for (i = start; i < end; ++i) {
+            add_lit(-node_var(n));
+            add_lit(dimacs_lit(gate_inputs[i]));
+            add_lit(0);
+        }
+    }
+    if (polarity & POLARITY_NEG) {
+        add_lit(node_var(n));
+        for (i = start; i < end; ++i) {
+            add_lit(-dimacs_lit(gate_inputs[i]));
+        }
+        add_lit(0);
+    }
+
+    for (i = start; i < end; ++i) {
+        unsigned l = gate_inputs[i];
+        int p = polarity;
+        if (LIT_NEG(l)) p = ((polarity & POLARITY_POS) ? POLARITY_NEG : 0) | ((polarity & POLARITY_NEG) ? POLARITY_POS : 0);
+        encode(LIT_NODE(l), p);
+    }
+
+    gate_top = start;
+}
+
+/*
+ * Literal for an atom of a learned clause.  Variables share their node
+ * with the occurrences in the theorem.
+ */
+static unsigned input_lit(struct _ex_intern *e)
+{
+    unsigned l;
+
+    if (e->type==EXP_APPL && e->u.appl.functor==INTERN_NOT) return input_lit(e->u.appl.args[0])^1;
+    if (e==_ex_true) return LIT_TRUE;
+    if (e==_ex_false) return LIT_FALSE;
+
+    if (_th_term_marked(aig_lits,e)) return (unsigned)(long)_th_term_value(aig_lits,e);
+
+    l = new_node(0, 0, e) << 1;
+    _th_set_term_value(aig_lits,e,(void *)(long)l);
+
+    return l;
+}
+
+static void add_learned_clauses(struct learn_info *info, int emit)
+{
+    struct _ex_intern *t;
+    unsigned l;
+    int i;
+
+    t = _th_get_first_neg_tuple(info);
+    while (t) {
+        for (i = 0; i < t->u.appl.count; ++i) {
+            l = input_lit(t->u.appl.args[i]);
+            if (!emit) {
+                count_refs(LIT_NODE(l));
+            } else if (l==LIT_TRUE) {
+                break;
+            } else if (l != LIT_FALSE) {
+                encode(LIT_NODE(l), POLARITY_POS|POLARITY_NEG);
+            }
+        }
+        if (emit && i==t->u.appl.count) {
+            for (i = 0; i < t->u.appl.count; ++i) {
+                l = input_lit(t->u.appl.args[i]);
+                if (l != LIT_FALSE) add_lit(dimacs_lit(l));
+            }
+            add_lit(0);
+        }
+        t = _th_get_next_neg_tuple(info);
+    }
+}
+
+/*
+ * Writes a DIMACS file for the learned clauses in info together with
+ * the boolean formula e, which must satisfy _th_is_boolean_skeleton.
+ * The formula is asserted true.  A comment line gives the atom of each
+ * input variable.
+ */
+void _th_print_aig_dimacs(struct env *env, struct learn_info *info, struct _ex_intern *e, FILE *file)
+{
+    unsigned root;
+    int i, ands;
+
+    reset_aig();
+
+    root = build(e);
+    count_refs(LIT_NODE(root));
+    add_learned_clauses(info, 0);
+
+    if (root==LIT_FALSE) {
+        int v = ++var_count;
+        add_lit(v);
+        add_lit(0);
+        add_lit(-v);
+        add_lit(0);
+    } else if (root != LIT_TRUE) {
+        encode(LIT_NODE(root), LIT_NEG(root) ? POLARITY_NEG : POLARITY_POS);
+        add_lit(dimacs_lit(root));
+        add_lit(0);
+    }
+    add_learned_clauses(info, 1);
+
+    ands = 0;
+    for (i = 1; i < (int)node_count; ++i) {
+        if (nodes[i].input==NULL) ++ands;
+    }
+    _zone_print3("AIG: %d nodes, %d and gates, %d variables", node_count-1, ands, var_count);
+    _zone_print1("AIG: %d clauses", clause_count);
+
+    fprintf(file, "c HTP generated dimacs file\n");
+    for (i = 1; i < (int)node_count; ++i) {
+        if (nodes[i].input && nodes[i].var) {
+            fprintf(file, "c %d ", nodes[i].var);
+            _th_fprint_exp(file,env,nodes[i].input,1);
+            fprintf(file, "\n");
+        }
+    }
+    fprintf(file, "p cnf %d %d\n", var_count, clause_count);
+    for (i = 0; i < clause_pos; ++i) {
+        if (clauses[i]==0) {
+            fprintf(file, "0\n");
+        } else {
+            fprintf(file, "%d ", clauses[i]);
+        }
+    }
+}
@@ -12,6 +12,8 @@
 #include "Globals.h"
 #include "Intern.h"
 
+int _th_lazy_arrays = 0;
+
 struct _ex_intern *_th_simplify_select(struct env *env, struct _ex_intern *e)
 {
     struct _ex_intern *f = e->u.appl.args[0];
@@ -26,6 +28,20 @@ struct _ex_intern *_th_simplify_select(struct env *env, struct _ex_intern *e)
         }
     }
 #endif
+    if (f->type==EXP_APPL && f->u.appl.functor==INTERN_STORE && _th_lazy_arrays) {
+        /*
+         * With lazy arrays only decided index comparisons are simplified.  The
+         * remaining read-over-write cases are left to _th_array_lemmas.
+         */
+        struct _ex_intern *test = _ex_intern_appl2_env(env,INTERN_EQUAL,e->u.appl.args[1],f->u.appl.args[1]);
+        test = _th_nc_rewrite(env,test);
+        if (test==_ex_true) {
+            return f->u.appl.args[2];
+        } else if (test==_ex_false) {
+            return _ex_intern_appl2_env(env,INTERN_SELECT,f->u.appl.args[0],e->u.appl.args[1]);
+        }
+        return NULL;
+    }
     if (f->type==EXP_APPL && f->u.appl.functor==INTERN_STORE) {
         struct _ex_intern *test = _ex_intern_appl2_env(env,INTERN_EQUAL,e->u.appl.args[1],f->u.appl.args[1]);
         return _ex_intern_appl3_env(env,INTERN_ITE,
@@ -48,7 +64,7 @@ struct _ex_intern *_th_simplify_store(struct env *env, struct _ex_intern *e)
 
     f = e->u.appl.args[0];
     if (f->type==EXP_APPL && f->u.appl.functor==INTERN_STORE &&
-        ((int)f->u.appl.args[1]) > ((int)e->u.appl.args[1]) &&
+        f->u.appl.args[1]->id > e->u.appl.args[1]->id &&
         _th_nc_rewrite(env,_ex_intern_appl2_env(env,INTERN_EQUAL,e->u.appl.args[1],f->u.appl.args[1]))==_ex_false) {
         return _ex_intern_appl3_env(env,INTERN_STORE,
                    _ex_intern_appl3_env(env,INTERN_STORE,f->u.appl.args[0],e->u.appl.args[1],e->u.appl.args[2]),
@@ -63,6 +79,8 @@ struct _ex_intern *_th_simplify_array_equality(struct env *env, struct _ex_inter
     struct _ex_intern *l = e->u.appl.args[0];
     struct _ex_intern *r = e->u.appl.args[1];
 
+    if (_th_lazy_arrays) return NULL;
+
     if (l->type != EXP_APPL || r->type != EXP_APPL ||
         l->u.appl.functor != INTERN_STORE || r->u.appl.functor != INTERN_STORE) {
         return NULL;
@@ -97,7 +115,7 @@ struct _ex_intern *_th_simplify_ee(struct env *env, struct _ex_intern *e)
 
     if (i != j) return _ex_intern_appl_env(env,INTERN_EE,j,args);
 
-    if (((int)args[1]) < ((int)args[0])) {
+    if (args[1]->id < args[0]->id) {
         struct _ex_intern *x = args[0];
         args[0] = args[1];
         args[1] = x;
@@ -126,3 +144,361 @@ struct _ex_intern *_th_simplify_ee(struct env *env, struct _ex_intern *e)
 
     return NULL;
 }
+
+/*
+ * Lazy array decision procedure
+ *
+ * When _th_lazy_arrays is set, select over store is not expanded into an ite
+ * during rewriting.  Instead, each time the search reaches a complete
+ * assignment, _th_array_lemmas builds the congruence closure of the assigned
+ * equalities using the root_var tables in env.c and checks the read-over-write
+ * and extensionality axioms against it.  Only instances that the current model
+ * does not already satisfy are added to the learned tuples.
+ */
+static struct _ex_intern *array_trail;
+static struct add_list *select_terms;
+static struct add_list *store_terms;
+static struct add_list *array_equalities;
+static struct add_list *extensionality_done = NULL;
+static struct add_list *new_indices;
+
+static int is_array_term(struct env *env, struct _ex_intern *e)
+{
+    struct _ex_intern *t;
+
+    switch (e->type) {
+        case EXP_VAR:
+            return _th_get_var_type(env,e->u.var)==_ex_array;
+        case EXP_APPL:
+            if (e->u.appl.functor==INTERN_STORE) return 1;
+            t = _th_get_type(env,e->u.appl.functor);
+            return t != NULL && t->type==EXP_APPL && t->u.appl.count > 1 && t->u.appl.args[1]==_ex_array;
+        default:
+            return 0;
+    }
+}
+
+static struct add_list *add_term(struct add_list *list, struct _ex_intern *e)
+{
+    struct add_list *a = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
+    a->next = list;
+    a->e = e;
+    return a;
+}
+
+static void collect_array_terms(struct env *env, struct _ex_intern *e)
+{
+    int i;
+
+    if (e->user2) return;
+    e->user2 = _ex_true;
+    e->next_cache = array_trail;
+    array_trail = e;
+
+    if (e->type != EXP_APPL) return;
+
+    switch (e->u.appl.functor) {
+        case INTERN_SELECT:
+            select_terms = add_term(select_terms,e);
+            break;
+        case INTERN_STORE:
+            store_terms = add_term(store_terms,e);
+            break;
+        case INTERN_EQUAL:
+            if (is_array_term(env,e->u.appl.args[0]) || is_array_term(env,e->u.appl.args[1])) {
+                array_equalities = add_term(array_equalities,e);
+            }
+            break;
+    }
+
+    for (i = 0; i < e->u.appl.count; ++i) {
+        collect_array_terms(env,e->u.appl.args[i]);
+    }
+}
+
+static void clear_array_marks()
+{
+    while (array_trail) {
+        struct _ex_intern *n = array_trail->next_cache;
+        array_trail->user2 = NULL;
+        array_trail->next_cache = NULL;
+        array_trail = n;
+    }
+}
+
+/*
+ * Equality atoms are shared with the learned tuples, so use the existing
+ * orientation if the atom is already known and a canonical one otherwise.
+ */
+static struct _ex_intern *array_equal(struct env *env, struct learn_info *info, struct _ex_intern *l, struct _ex_intern *r)
+{
+    struct _ex_intern *e = _ex_intern_appl2_env(env,INTERN_EQUAL,l,r);
+    struct _ex_intern *f = _ex_intern_appl2_env(env,INTERN_EQUAL,r,l);
+
+    if (_th_learn_has_term(info,e)) return e;
+    if (_th_learn_has_term(info,f)) return f;
+
+    return (_th_term_compare(env,l,r) < 0)?f:e;
+}
+
+static int model_equal(struct env *env, struct _ex_intern *l, struct _ex_intern *r)
+{
+    if (l==r) return 1;
+    return _th_equality_status(REWRITE_SPACE,env,l,r);
+}
+
+/*
+ * Lemmas are added as learned tuples, which are sets of literals that cannot
+ * all hold.  A lemma is built from conditions that hold in the current model
+ * plus the negation of the conclusion.  "definite" is cleared when a condition
+ * is only true by default (not entailed), in which case the lemma can be
+ * satisfied by further splitting rather than refuting the branch.
+ */
+struct array_lemma {
+    struct add_list *literals;
+    int definite;
+};
+
+static void add_condition(struct env *env, struct learn_info *info, struct array_lemma *lemma,
+                          struct _ex_intern *l, struct _ex_intern *r, int sign)
+{
+    int status;
+
+    if (l==r) return;
+
+    status = model_equal(env,l,r);
+    if (sign) {
+        lemma->literals = add_term(lemma->literals,array_equal(env,info,l,r));
+        if (status != 1) lemma->definite = 0;
+    } else {
+        lemma->literals = add_term(lemma->literals,_ex_intern_appl1_env(env,INTERN_NOT,array_equal(env,info,l,r)));
+        if (status != -1) lemma->definite = 0;
+    }
+}
+
+static int lemma_falsified(struct env *env, struct learn_info *info, struct add_list *literals)
+{
+    struct _ex_intern *e, *value;
+
+    while (literals) {
+        e = literals->e;
+        value = _th_get_assignment(env,info,e);
+        if (e->type==EXP_APPL && e->u.appl.functor==INTERN_NOT) {
+            if (value != _ex_false) return 0;
+        } else {
+            if (value != _ex_true) return 0;
+        }
+        literals = literals->next;
+    }
+
+    return 1;
+}
+
+static int add_lemma(struct env *env, struct learn_info *info, struct array_lemma *lemma,
+                     struct _ex_intern *l, struct _ex_intern *r)
+{
+    add_condition(env,info,lemma,l,r,0);
+
+#ifndef FAST
+    if (_zone_active()) {
+        struct add_list *a = lemma->literals;
+        _zone_print1("Array lemma %d", lemma->definite);
+        _tree_indent();
+        while (a) {
+            _zone_print_exp("literal", a->e);
+            a = a->next;
+        }
+        _tree_undent();
+    }
+#endif
+
+    /*
+     * A lemma that is already learned only refutes the assignment if every
+     * one of its literals is assigned true.  Otherwise the learned tuple
+     * already covers this instance.
+     */
+    if (_th_add_tuple_from_list(env,info,lemma->literals)==0) {
+        return lemma_falsified(env,info,lemma->literals)?ARRAY_CONFLICT:ARRAY_CONSISTENT;
+    }
+
+    return lemma->definite?ARRAY_CONFLICT:ARRAY_LEMMAS;
+}
+
+/*
+ * Read over write for sel = select(b,j) against st = store(a,i,v) where b is
+ * equal to st in the model:
+ *     b=st & i=j  -> select(b,j) = v
+ *     b=st & i!=j -> select(b,j) = select(a,j)
+ */
+static int check_read_over_write(struct env *env, struct learn_info *info, struct _ex_intern *sel, struct _ex_intern *st)
+{
+    struct _ex_intern *b = sel->u.appl.args[0];
+    struct _ex_intern *j = sel->u.appl.args[1];
+    struct _ex_intern *a = st->u.appl.args[0];
+    struct _ex_intern *i = st->u.appl.args[1];
+    struct _ex_intern *v = st->u.appl.args[2];
+    struct _ex_intern *other;
+    struct array_lemma lemma;
+
+    if (model_equal(env,b,st) != 1) return ARRAY_CONSISTENT;
+
+    lemma.literals = NULL;
+    lemma.definite = 1;
+    add_condition(env,info,&lemma,b,st,1);
+
+    if (model_equal(env,i,j)==1) {
+        if (model_equal(env,sel,v)==1) return ARRAY_CONSISTENT;
+        add_condition(env,info,&lemma,i,j,1);
+        return add_lemma(env,info,&lemma,sel,v);
+    }
+
+    other = _ex_intern_appl2_env(env,INTERN_SELECT,a,j);
+    if (model_equal(env,sel,other)==1) return ARRAY_CONSISTENT;
+
+    /* select(a,j) may be new, in which case it is checked in later rounds */
+    collect_array_terms(env,other);
+
+    add_condition(env,info,&lemma,i,j,0);
+    return add_lemma(env,info,&lemma,sel,other);
+}
+
+/*
+ * The index sort comes from the declaration of select in env.c
+ */
+static struct _ex_intern *array_index_type(struct env *env)
+{
+    struct _ex_intern *t = _th_get_type(env,INTERN_SELECT);
+
+    if (t != NULL && t->type==EXP_APPL && t->u.appl.count > 0 &&
+        t->u.appl.args[0]->type==EXP_APPL && t->u.appl.args[0]->u.appl.count > 1) {
+        return t->u.appl.args[0]->u.appl.args[1];
+    }
+
+    return _ex_int;
+}
+
+/*
+ * Extensionality: a != b implies select(a,k) != select(b,k) for a fresh k.
+ * Each array disequality only needs its witness once.  The checks run
+ * inside a derive push, so the type of k is recorded in new_indices and
+ * set once the push is undone.
+ */
+static int check_extensionality(struct env *env, struct learn_info *info, struct _ex_intern *eq)
+{
+    struct add_list *d;
+    struct _ex_intern *k, *sl, *sr;
+    struct array_lemma lemma;
+    char name[40];
+    static int index_count = 0;
+
+    d = extensionality_done;
+    while (d) {
+        if (d->e==eq) return ARRAY_CONSISTENT;
+        d = d->next;
+    }
+    d = (struct add_list *)_th_alloc(HEURISTIC_SPACE,sizeof(struct add_list));
+    d->next = extensionality_done;
+    d->e = eq;
+    extensionality_done = d;
+
+    /* _th_new_term_var names are reused after a pop, so use a private counter */
+    sprintf(name, "_array_index%d", index_count++);
+    k = _ex_intern_var(_th_intern(name));
+    new_indices = add_term(new_indices,k);
+    sl = _ex_intern_appl2_env(env,INTERN_SELECT,eq->u.appl.args[0],k);
+    sr = _ex_intern_appl2_env(env,INTERN_SELECT,eq->u.appl.args[1],k);
+
+    lemma.literals = add_term(NULL,_ex_intern_appl1_env(env,INTERN_NOT,eq));
+    lemma.definite = 0;
+    lemma.literals = add_term(lemma.literals,array_equal(env,info,sl,sr));
+
+    _zone_print_exp("Extensionality lemma", eq);
+    _th_add_tuple_from_list(env,info,lemma.literals);
+
+    return ARRAY_LEMMAS;
+}
+
+/*
+ * Called at the start of each proof.  The witnesses recorded for array
+ * disequalities belong to the learned tuples of the previous proof.
+ */
+void _th_array_start_proof()
+{
+    extensionality_done = NULL;
+}
+
+int _th_array_lemmas(struct env *env, struct learn_info *info)
+{
+    struct add_list *assigned, *a, *s, *t, *checked;
+    char *mark = _th_alloc_mark(REWRITE_SPACE);
+    int res = ARRAY_CONSISTENT;
+
+    _zone_print0("Checking array axioms");
+    _tree_indent();
+
+    select_terms = store_terms = array_equalities = NULL;
+    new_indices = NULL;
+    array_trail = NULL;
+    assigned = _th_learn_get_assignments(info);
+
+    _th_derive_push(env);
+    for (a = assigned; a; a = a->next) {
+        struct _ex_intern *e = a->e;
+        int neg = 0;
+        if (e->type==EXP_APPL && e->u.appl.functor==INTERN_NOT) {
+            e = e->u.appl.args[0];
+            neg = 1;
+        }
+        collect_array_terms(env,e);
+        if (e->type==EXP_APPL && e->u.appl.functor==INTERN_EQUAL) {
+            if (neg ? _th_add_inequality(REWRITE_SPACE,env,e->u.appl.args[0],e->u.appl.args[1])
+                    : _th_add_equality(REWRITE_SPACE,env,e->u.appl.args[0],e->u.appl.args[1])) {
+                /* Plain congruence conflict; the assignment is not a model */
+                _zone_print_exp("Inconsistent equality model at", e);
+                res = ARRAY_CONFLICT;
+                goto done;
+            }
+        }
+    }
+
+    /*
+     * Checking read over write adds the select(a,j) terms it creates to the
+     * front of select_terms, so repeat until a round adds nothing.
+     */
+    checked = NULL;
+    while (select_terms != checked) {
+        struct add_list *head = select_terms;
+        for (s = head; s != checked; s = s->next) {
+            for (t = store_terms; t; t = t->next) {
+                res |= check_read_over_write(env,info,s->e,t->e);
+                if (res & ARRAY_CONFLICT) goto done;
+            }
+        }
+        checked = head;
+    }
+
+    for (a = assigned; a; a = a->next) {
+        struct _ex_intern *e = a->e;
+        if (e->type==EXP_APPL && e->u.appl.functor==INTERN_NOT &&
+            e->u.appl.args[0]->type==EXP_APPL && e->u.appl.args[0]->u.appl.functor==INTERN_EQUAL) {
+            for (s = array_equalities; s; s = s->next) {
+                if (s->e==e->u.appl.args[0]) {
+                    res |= check_extensionality(env,info,s->e);
+                    break;
+                }
+            }
+        }
+    }
+
+done:
+    _th_derive_pop(env);
+    for (a = new_indices; a; a = a->next) {
+        _th_set_var_type(env,a->e->u.var,array_index_type(env));
+    }
+    clear_array_marks();
+    _th_alloc_release(REWRITE_SPACE,mark);
+    _tree_undent();
+    _zone_print1("Array check result %d", res);
+
+    return (res & ARRAY_CONFLICT)?ARRAY_CONFLICT:res;
+}
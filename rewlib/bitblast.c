@@ -445,420 +445,26 @@ struct _ex_intern *_th_bit_blast(struct env *env, struct _ex_intern *e)
 	return e;
 }
 
-static struct _ex_intern *add_values(struct _ex_intern *a, struct _ex_intern *b)
-{
-	return _ex_intern_integer(_th_big_add(a->u.integer,b->u.integer));
-}
-
 static struct _ex_intern *res_min, *res_max;
-static void multiply_ranges(struct env *env, struct _ex_intern *min1, struct _ex_intern *min2, struct _ex_intern *max1, struct _ex_intern *max2)
-{
-	static struct _ex_intern *zero = NULL;
-
-	if (zero==NULL) zero = _ex_intern_small_integer(0);
-
-	_zone_print0("multiply ranges");
-	_tree_indent();
-	_zone_print_exp("min1 =", min1);
-	_zone_print_exp("max1 =", max1);
-	_zone_print_exp("min2 =", min2);
-	_zone_print_exp("max2 =", max2);
-    _tree_undent();
-
-	if ((min1==zero && max1==zero) || (min2==zero && max2==zero)) {
-		res_min = res_max = zero;
-	} else if (min2==NULL && max2==NULL) {
-		res_min = res_max = NULL;
-	} else if (min1==NULL) {
-		if (max1==NULL) {
-			res_min = res_max = NULL;
-		} else if (_th_big_is_negative(max1->u.integer)) {
-			if (min2==NULL) {
-				if (_th_big_is_negative(max2->u.integer)) {
-					res_max = NULL;
-					res_min = _ex_intern_integer(_th_big_multiply(max1->u.integer,max2->u.integer));
-				} else {
-					res_min = res_max = NULL;
-				}
-			} else if (_th_big_is_negative(min2->u.integer)) {
-				if (max2==zero || _th_big_is_negative(max2->u.integer)) {
-					res_max = NULL;
-					res_min = _ex_intern_integer(_th_big_multiply(max1->u.integer,max2->u.integer));
-				} else {
-					res_min = res_max = NULL;
-				}
-			}
-		} else {
-			if (min2==NULL || max2==NULL) {
-				res_min = res_max = NULL;
-			} else if (_th_big_is_negative(min2->u.integer) && _th_big_is_negative(max2->u.integer)) {
-				res_max = NULL;
-				res_min = _ex_intern_integer(_th_big_multiply(min2->u.integer,max1->u.integer));
-			} else if (!_th_big_is_negative(min2->u.integer) && !_th_big_is_negative(max2->u.integer)) {
-				res_min = NULL;
-				res_max = _ex_intern_integer(_th_big_multiply(max1->u.integer,max2->u.integer));
-			} else {
-				res_min = res_max = NULL;
-			}
-		}
-	} else if (_th_big_is_negative(min1->u.integer)) {
-		if (max1==NULL) {
-			if (min2==NULL || max2==NULL) {
-				res_min = res_max = NULL;
-			} else if (_th_big_is_negative(min2->u.integer) && _th_big_is_negative(max2->u.integer)) {
-				res_min = NULL;
-				res_max = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-			} else if (!_th_big_is_negative(min2->u.integer) && !_th_big_is_negative(max2->u.integer)) {
-				res_max = NULL;
-				res_min = _ex_intern_integer(_th_big_multiply(min1->u.integer,max2->u.integer));
-			} else {
-				res_min = res_max = NULL;
-			}
-		} else if (_th_big_is_negative(max1->u.integer)) {
-			if (min2 != NULL) {
-				if (_th_big_is_negative(min2->u.integer)) {
-					res_max = _ex_intern_integer(_th_big_multiply(min2->u.integer,max1->u.integer));
-				} else {
-					res_max = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-				}
-			} else {
-				res_max = NULL;
-			}
-			if (max2 != NULL) {
-				if (_th_big_is_negative(max2->u.integer)) {
-					res_min = _ex_intern_integer(_th_big_multiply(max2->u.integer,min1->u.integer));
-				} else {
-					res_min = _ex_intern_integer(_th_big_multiply(max2->u.integer,max1->u.integer));
-				}
-			} else {
-				res_min = NULL;
-			}
-		} else {
-			if (min2==NULL || max2==NULL) {
-				res_min = res_max = NULL;
-			} else {
-				if (_th_big_is_negative(min2->u.integer)) {
-					if (_th_big_is_negative(max2->u.integer)) {
-						res_min = _ex_intern_integer(_th_big_multiply(max1->u.integer,min2->u.integer));
-						res_max = _ex_intern_integer(_th_big_multiply(min1->u.integer,min2->u.integer));
-					} else {
-						struct _ex_intern *c1, *c2;
-						c1 = _ex_intern_integer(_th_big_multiply(max1->u.integer,max2->u.integer));
-						c2 = _ex_intern_integer(_th_big_multiply(min1->u.integer,min2->u.integer));
-						if (_th_big_less(c1->u.integer,c2->u.integer)) {
-							res_max = c2;
-						} else {
-							res_max = c1;
-						}
-						c1 = _ex_intern_integer(_th_big_multiply(max1->u.integer,min2->u.integer));
-						c2 = _ex_intern_integer(_th_big_multiply(min1->u.integer,max2->u.integer));
-						if (_th_big_less(c1->u.integer,c2->u.integer)) {
-							res_min = c1;
-						} else {
-							res_min = c2;
-						}
-					}
-				} else {
-					res_min = _ex_intern_integer(_th_big_multiply(min1->u.integer,max2->u.integer));
-					res_max = _ex_intern_integer(_th_big_multiply(max1->u.integer,max2->u.integer));
-				}
-			}
-		}
-	} else {
-		if (max1==NULL) {
-			if (min2 != NULL) {
-				if (max2 != NULL) {
-					if (_th_big_is_negative(min2->u.integer) && _th_big_is_negative(max2->u.integer)) {
-						res_max = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-						res_min = NULL;
-					} else if (!_th_big_is_negative(min2->u.integer) && !_th_big_is_negative(max2->u.integer)) {
-						res_max = NULL;
-						res_min = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-					} else {
-						res_min = res_max = NULL;
-					}
-				} else {
-					if (_th_big_is_negative(min2->u.integer)) {
-						res_min = res_max = NULL;
-					} else {
-					    res_min = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-                        res_max = NULL;
-					}
-				}
-			} else {
-				if (!_th_big_is_negative(max2->u.integer)) {
-					res_min = res_max = NULL;
-				} else {
-				    res_max = _ex_intern_integer(_th_big_multiply(max2->u.integer,min1->u.integer));
-					res_min = NULL;
-				}
-			}
-		} else {
-			if (min2 != NULL) {
-				if (_th_big_is_negative(min2->u.integer)) {
-					res_min = _ex_intern_integer(_th_big_multiply(min2->u.integer,max1->u.integer));
-				} else {
-					res_min = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-				}
-			}
-			if (max2 != NULL) {
-				if (_th_big_is_negative(max2->u.integer)) {
-					res_max = _ex_intern_integer(_th_big_multiply(max2->u.integer,min1->u.integer));
-				} else {
-					res_max = _ex_intern_integer(_th_big_multiply(max2->u.integer,max1->u.integer));
-				}
-			}
-		}
-	}
-}
-
-static void divide_ranges(struct env *env, struct _ex_intern *min1, struct _ex_intern *max1, struct _ex_intern *min2, struct _ex_intern *max2)
-{
-	static struct _ex_intern *zero = NULL;
 
-	if (zero==NULL) zero = _ex_intern_small_integer(0);
-
-	_zone_print_exp("divide min1", min1);
-	_zone_print_exp("divide max1", max1);
-	_zone_print_exp("divide min2", min2);
-	_zone_print_exp("divide max2", max2);
-
-    if (max2 != NULL && _th_big_is_negative(max2->u.integer) && (min2==NULL || _th_big_is_negative(min2->u.integer))) {
-		if (min1==NULL) {
-			res_max = NULL;
-		} else {
-		    res_max = _ex_intern_integer(_th_big_divide(min1->u.integer, max2->u.integer));
-		}
-		if (max1==NULL) {
-			res_min = NULL;
-		} else {
-		    res_min = _ex_intern_integer(_th_big_divide(max1->u.integer, max2->u.integer));
-		}
-	} else if (min2 != NULL && !_th_big_is_negative(min2->u.integer) && min2 != zero) {
-		if (min1==NULL) {
-			res_min = NULL;
-		} else {
-		    res_min = _ex_intern_integer(_th_big_divide(min1->u.integer, min2->u.integer));
-		}
-		if (max1==NULL) {
-			res_max = NULL;
-		} else {
-		    res_max = _ex_intern_integer(_th_big_divide(max1->u.integer, min2->u.integer));
-		}
-	} else {
-		res_min = min1;
-		res_max = max1;
-	}
-}
-
-static struct _ex_intern *_th_compute_max(struct env *env, struct _ex_intern *e);
-
-static unsigned zero[2] = { 1, 0 }, one[2]  = { 1, 1 };
+static unsigned zero[2] = { 1, 0 };
 
+/*
+ * Integer bounds come from the memoized analysis in bounds.c, which
+ * is invalidated as the min and max tables of the environment change.
+ */
 static struct _ex_intern *_th_compute_min(struct env *env, struct _ex_intern *e)
 {
-	struct _ex_intern *total, *r, *rm, *total_max, *lb;
-	int i;
+	if (e->type==EXP_INTEGER) return e;
 
-	if (e->type==EXP_INTEGER) {
-		return e;
-	} else {
-        lb = _th_get_lower_bound(env,e);
-	}
-
-	switch (e->type) {
-		case EXP_APPL:
-			switch (e->u.appl.functor) {
-			    case INTERN_NAT_PLUS:
-					_zone_print0("plus min");
-					_tree_indent();
-					total = _th_compute_min(env,e->u.appl.args[0]);
-					_tree_undent();
-					_zone_print_exp("total =", total);
-					if (total==NULL) return NULL;
-					for (i = 1; i < e->u.appl.count; ++i) {
-						_tree_indent();
-						r = _th_compute_min(env,e->u.appl.args[i]);
-						_tree_undent();
-						_zone_print_exp("r =", r);
-						if (r==NULL) return NULL;
-						total = add_values(total, r);
-					}
-					if (total==NULL || (lb != NULL && _th_big_less(total->u.integer, lb->u.integer))) {
-						return lb;
-					} else {
-					    return total;
-					}
-				case INTERN_NAT_TIMES:
-					_zone_print0("times min");
-					_tree_indent();
-					total = _th_compute_min(env,e->u.appl.args[0]);
-					total_max = _th_compute_max(env,e->u.appl.args[0]);
-					_tree_undent();
-					_zone_print_exp("total =", total);
-					_zone_print_exp("total_max =", total_max);
-					for (i = 1; i < e->u.appl.count; ++i) {
-						if (total==NULL && total_max==NULL) return NULL;
-						_tree_indent();
-						r = _th_compute_min(env,e->u.appl.args[i]);
-						rm = _th_compute_max(env,e->u.appl.args[i]);
-						_tree_undent();
-						_zone_print_exp("r =", r);
-						_zone_print_exp("rm =", rm);
-						multiply_ranges(env,r,total,rm,total_max);
-						_zone_print_exp("res_min =", res_min);
-						_zone_print_exp("res_max =", res_max);
-						total = res_min;
-						total_max = res_max;
-					}
-					if (total==NULL || (lb != NULL && _th_big_less(total->u.integer, lb->u.integer))) {
-						return lb;
-					} else {
-					    return total;
-					}
-				case INTERN_NAT_MOD:
-					if (e->u.appl.args[1]->type==EXP_INTEGER) {
-						total = _th_compute_max(env,e->u.appl.args[0]);
-						r = e->u.appl.args[1];
-						if (_th_big_less(r->u.integer,one)) return lb;
-						if (r==NULL || (total != NULL && _th_big_less(r->u.integer,total->u.integer))) {
-							if (lb==NULL || (total != NULL && _th_big_less(lb->u.integer,total->u.integer))) {
-								return total;
-							} else {
-								return lb;
-							}
-						} else {
-							if (lb==NULL || (r != NULL && _th_big_less(lb->u.integer,r->u.integer))) {
-								return r;
-							} else {
-								return lb;
-							}
-						}
-					} else {
-						return lb;
-					}
-				case INTERN_NAT_DIVIDE:
-					_zone_print0("divide");
-					_tree_indent();
-					divide_ranges(env,_th_compute_min(env,e->u.appl.args[0]),
-						              _th_compute_max(env,e->u.appl.args[0]),
-						              _th_compute_min(env,e->u.appl.args[1]),
-						              _th_compute_max(env,e->u.appl.args[1]));
-					_tree_undent();
-					if (res_min == NULL || (lb != NULL && _th_big_less(res_min->u.integer,lb->u.integer))) {
-						return lb;
-					} else {
-					    return res_min;
-					}
-				default:
-					return lb;
-			}
-		default:
-			return lb;
-	}
+	return _th_env_bound_min(env,e);
 }
 
 static struct _ex_intern *_th_compute_max(struct env *env, struct _ex_intern *e)
 {
-	struct _ex_intern *total, *r, *rm, *total_max, *ub;
-	int i;
+	if (e->type==EXP_INTEGER) return e;
 
-	if (e->type==EXP_INTEGER) {
-		return e;
-	} else {
-        ub = _th_get_upper_bound(env,e);
-	}
-
-	switch (e->type) {
-		case EXP_APPL:
-			switch (e->u.appl.functor) {
-			    case INTERN_NAT_PLUS:
-					_zone_print0("plus max");
-					_tree_indent();
-					total = _th_compute_max(env,e->u.appl.args[0]);
-					_tree_undent();
-					_zone_print_exp("total =", total);
-					if (total==NULL) return NULL;
-					for (i = 1; i < e->u.appl.count; ++i) {
-						_tree_indent();
-						r = _th_compute_max(env,e->u.appl.args[i]);
-						_tree_undent();
-						_zone_print_exp("r =", r);
-						if (r==NULL) return NULL;
-						total = add_values(total, r);
-					}
-					if (total==NULL || (ub != NULL && _th_big_less(ub->u.integer,total->u.integer))) {
-						return ub;
-					} else {
-					    return total;
-					}
-				case INTERN_NAT_TIMES:
-					_zone_print0("compute times max");
-					_tree_indent();
-					total = _th_compute_min(env,e->u.appl.args[0]);
-					total_max = _th_compute_max(env,e->u.appl.args[0]);
-					_tree_undent();
-					_zone_print_exp("total =", total);
-					_zone_print_exp("total_max =", total_max);
-					for (i = 1; i < e->u.appl.count; ++i) {
-						if (total==NULL && total_max==NULL) return NULL;
-						_tree_indent();
-						r = _th_compute_min(env,e->u.appl.args[i]);
-						rm = _th_compute_max(env,e->u.appl.args[i]);
-						_tree_undent();
-						_zone_print_exp("r =", r);
-						_zone_print_exp("rm ", rm);
-						multiply_ranges(env,r,total,rm,total_max);
-						_zone_print_exp("res_min =", res_min);
-						_zone_print_exp("res_max =", res_max);
-						total = res_min;
-						total_max = res_max;
-					}
-					if (total_max==NULL || (ub != NULL && _th_big_less(ub->u.integer,total_max->u.integer))) {
-						return ub;
-					} else {
-					    return total_max;
-					}
-				case INTERN_NAT_MOD:
-					if (e->u.appl.args[1]->type==EXP_INTEGER) {
-						total = _th_compute_max(env,e->u.appl.args[0]);
-						r = e->u.appl.args[1];
-						if (_th_big_less(r->u.integer,one)) return ub;
-						if (r==NULL || (total != NULL && _th_big_less(total->u.integer,r->u.integer))) {
-							if (ub==NULL || (total != NULL && _th_big_less(total->u.integer,ub->u.integer))) {
-								return total;
-							} else {
-								return ub;
-							}
-						} else {
-							if (ub==NULL || (r != NULL && _th_big_less(r->u.integer,ub->u.integer))) {
-								return r;
-							} else {
-								return ub;
-							}
-						}
-					} else {
-						return ub;
-					}
-				case INTERN_NAT_DIVIDE:
-					_zone_print0("divide_ranges max");
-					_tree_indent();
-					divide_ranges(env,_th_compute_min(env,e->u.appl.args[0]),
-						              _th_compute_max(env,e->u.appl.args[0]),
-						              _th_compute_min(env,e->u.appl.args[1]),
-						              _th_compute_max(env,e->u.appl.args[1]));
-					_tree_undent();
-					if (res_max==NULL || (ub != NULL && _th_big_less(ub->u.integer,res_max->u.integer))) {
-						return ub;
-					} else {
-					    return res_max;
-					}
-				default:
-					return ub;
-			}
-		default:
-			return ub;
-	}
+	return _th_env_bound_max(env,e);
 }
 
 int _th_rational_less(struct _ex_intern *a, struct _ex_intern *b)
@@ -0,0 +1,493 @@
+/*
+ * bounds.c
+ *
+ * Memoized interval bounds for integer terms
+ *
+ * (C) 2024, Kenneth Roe
+ *
+ * GNU Affero General Public License
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "Globals.h"
+#include "Intern.h"
+
+/*
+ * Computes an interval [min, max] for an integer term from bounds on
+ * its leaves.  The leaf bounds come from a callback, so the same engine
+ * serves the bounds in the environment (bitblast.c) and the domains of
+ * the FD solver (fd.c).  The callback is asked about every term that is
+ * not an integer constant, and its answer is intersected with what is
+ * derived from the arguments of nplus, ntimes, ndivide and nmod.
+ *
+ * Results are cached per term id, so a term shared in the DAG is only
+ * analyzed once.  Values are kept as ints and only become interned
+ * bignums if an operation overflows.  Each entry records the cached
+ * terms that were computed from it.  When the bound of a leaf changes,
+ * _th_bound_changed invalidates the entry for the leaf and everything
+ * above it; _th_bound_reset drops the whole cache at once by bumping
+ * its generation.
+ */
+#define BOUND_INF   0
+#define BOUND_SMALL 1
+#define BOUND_BIG   2
+
+struct bound {
+    int kind;
+    int value;                  /* BOUND_SMALL: the value, BOUND_INF: the sign */
+    struct _ex_intern *big;
+};
+
+struct bound_parent {
+    struct bound_parent *next;
+    struct bound_entry *entry;
+};
+
+struct bound_entry {
+    struct _ex_intern *e;
+    unsigned generation;
+    int valid;
+    struct bound min, max;
+    struct bound_parent *parents;
+};
+
+struct bound_cache {
+    _th_leaf_bounds leaf;
+    void *data;
+    struct env *env;
+    unsigned generation;
+    unsigned size;
+    struct bound_entry **entries;
+};
+
+struct bound_cache *_th_env_bounds = NULL;
+
+static struct bound infinite(int sign)
+{
+    struct bound b;
+
+    b.kind = BOUND_INF;
+    b.value = sign;
+    b.big = NULL;
+
+    return b;
+}
+
+static struct bound small(int value)
+{
+    struct bound b;
+
+    b.kind = BOUND_SMALL;
+    b.value = value;
+    b.big = NULL;
+
+    return b;
+}
+
+static struct bound from_big(unsigned *n)
+{
+    struct bound b;
+
+    if (n[0]==1) return small((int)n[1]);
+
+    b.kind = BOUND_BIG;
+    b.value = 0;
+    b.big = _ex_intern_integer(n);
+
+    return b;
+}
+
+static struct bound from_long(long long v)
+{
+    unsigned n[3];
+
+    if (v >= -0x7fffffffLL-1 && v <= 0x7fffffffLL) return small((int)v);
+
+    n[0] = 2;
+    n[1] = (unsigned)v;
+    n[2] = (unsigned)(v >> 32);
+
+    return from_big(n);
+}
+
+/*
+ * Bound from a term returned by a leaf callback.  NULL and non integer
+ * bounds are treated as missing, which is infinite on that side.
+ */
+static struct bound from_term(struct _ex_intern *e, int sign)
+{
+    if (e==NULL || e->type != EXP_INTEGER) return infinite(sign);
+
+    return from_big(e->u.integer);
+}
+
+static struct _ex_intern *to_term(struct bound b)
+{
+    switch (b.kind) {
+        case BOUND_SMALL:
+            return _ex_intern_small_integer(b.value);
+        case BOUND_BIG:
+            return b.big;
+        default:
+            return NULL;
+    }
+}
+
+static unsigned *to_big(struct bound *b, unsigned *buffer)
+{
+    if (b->kind==BOUND_BIG) return b->big->u.integer;
+
+    buffer[0] = 1;
+    buffer[1] = (unsigned)b->value;
+
+    return buffer;
+}
+
+static int sign(struct bound b)
+{
+    switch (b.kind) {
+        case BOUND_INF:
+            return b.value;
+        case BOUND_SMALL:
+            return (b.value > 0) - (b.value < 0);
+        default:
+            return _th_big_is_negative(b.big->u.integer) ? -1 : 1;
+    }
+}
+
+static int less(struct bound a, struct bound b)
+{
+    unsigned ba[2], bb[2];
+
+    if (a.kind==BOUND_INF || b.kind==BOUND_INF) {
+        int sa = (a.kind==BOUND_INF) ? a.value * 2 : 0;
+        int sb = (b.kind==BOUND_INF) ? b.value * 2 : 0;
+        return sa < sb;
+    }
+    if (a.kind==BOUND_SMALL && b.kind==BOUND_SMALL) return a.value < b.value;
+
+    return _th_big_less(to_big(&a,ba),to_big(&b,bb));
+}
+
+static struct bound add(struct bound a, struct bound b)
+{
+    unsigned ba[2], bb[2];
+
+    if (a.kind==BOUND_INF) return a;
+    if (b.kind==BOUND_INF) return b;
+    if (a.kind==BOUND_SMALL && b.kind==BOUND_SMALL) return from_long((long long)a.value + b.value);
+
+    return from_big(_th_big_add(to_big(&a,ba),to_big(&b,bb)));
+}
+
+static struct bound negate(struct bound a)
+{
+    unsigned zero[2] = { 1, 0 }, ba[2];
+
+    if (a.kind==BOUND_INF) return infinite(-a.value);
+    if (a.kind==BOUND_SMALL) return from_long(-(long long)a.value);
+
+    return from_big(_th_big_sub(zero,to_big(&a,ba)));
+}
+
+/*
+ * Product of two interval end points.  An infinite end point times zero
+ * is zero since the end point is only a limit.
+ */
+static struct bound multiply(struct bound a, struct bound b)
+{
+    unsigned ba[2], bb[2];
+    int s = sign(a) * sign(b);
+
+    if (s==0) return small(0);
+    if (a.kind==BOUND_INF || b.kind==BOUND_INF) return infinite(s);
+    if (a.kind==BOUND_SMALL && b.kind==BOUND_SMALL) return from_long((long long)a.value * b.value);
+
+    return from_big(_th_big_multiply(to_big(&a,ba),to_big(&b,bb)));
+}
+
+/*
+ * Quotient of two end points where b is not zero.
+ */
+static struct bound divide(struct bound a, struct bound b)
+{
+    unsigned ba[2], bb[2];
+
+    if (b.kind==BOUND_INF) return small(0);
+    if (a.kind==BOUND_INF) return infinite(a.value * sign(b));
+    if (a.kind==BOUND_SMALL && b.kind==BOUND_SMALL) return from_long((long long)a.value / b.value);
+
+    return from_big(_th_big_divide(to_big(&a,ba),to_big(&b,bb)));
+}
+
+static void hull(struct bound *min, struct bound *max, struct bound *corners, int count)
+{
+    int i;
+
+    *min = *max = corners[0];
+    for (i = 1; i < count; ++i) {
+        if (less(corners[i],*min)) *min = corners[i];
+        if (less(*max,corners[i])) *max = corners[i];
+    }
+}
+
+static struct bound_entry *lookup(struct env *env, struct bound_cache *cache, struct _ex_intern *e);
+
+static void add_parent(struct bound_entry *child, struct bound_entry *parent)
+{
+    struct bound_parent *p = (struct bound_parent *)MALLOC(sizeof(struct bound_parent));
+
+    p->next = child->parents;
+    p->entry = parent;
+    child->parents = p;
+}
+
+static void compute(struct env *env, struct bound_cache *cache, struct bound_entry *entry, int is_new)
+{
+    struct _ex_intern *e = entry->e, *lmin, *lmax;
+    struct bound_entry *a, *b;
+    struct bound corners[4], min, max;
+    int i;
+
+    if (e->type==EXP_INTEGER) {
+        entry->min = entry->max = from_big(e->u.integer);
+        entry->generation = cache->generation;
+        entry->valid = 1;
+        return;
+    }
+
+    min = infinite(-1);
+    max = infinite(1);
+
+    if (e->type==EXP_APPL) {
+        switch (e->u.appl.functor) {
+            case INTERN_NAT_PLUS:
+                min = max = small(0);
+                for (i = 0; i < e->u.appl.count; ++i) {
+                    a = lookup(env,cache,e->u.appl.args[i]);
+                    if (is_new) add_parent(a,entry);
+                    min = add(min,a->min);
+                    max = add(max,a->max);
+                }
+                break;
+            case INTERN_NAT_TIMES:
+                min = max = small(1);
+                for (i = 0; i < e->u.appl.count; ++i) {
+                    a = lookup(env,cache,e->u.appl.args[i]);
+                    if (is_new) add_parent(a,entry);
+                    corners[0] = multiply(min,a->min);
+                    corners[1] = multiply(min,a->max);
+                    corners[2] = multiply(max,a->min);
+                    corners[3] = multiply(max,a->max);
+                    hull(&min,&max,corners,4);
+                }
+                break;
+            case INTERN_NAT_DIVIDE:
+                if (e->u.appl.count != 2) break;
+                a = lookup(env,cache,e->u.appl.args[0]);
+                b = lookup(env,cache,e->u.appl.args[1]);
+                if (is_new) {
+                    add_parent(a,entry);
+                    add_parent(b,entry);
+                }
+                if (sign(b->min) > 0 || sign(b->max) < 0) {
+                    corners[0] = divide(a->min,b->min);
+                    corners[1] = divide(a->min,b->max);
+                    corners[2] = divide(a->max,b->min);
+                    corners[3] = divide(a->max,b->max);
+                    hull(&min,&max,corners,4);
+                } else {
+                    /* The divisor may be negative, so only |x/y| <= |x| is known */
+                    corners[0] = a->min;
+                    corners[1] = a->max;
+                    corners[2] = negate(a->min);
+                    corners[3] = negate(a->max);
+                    hull(&min,&max,corners,4);
+                }
+                break;
+            case INTERN_NAT_MOD:
+                if (e->u.appl.count != 2 || e->u.appl.args[1]->type != EXP_INTEGER) break;
+                a = lookup(env,cache,e->u.appl.args[0]);
+                b = lookup(env,cache,e->u.appl.args[1]);
+                if (is_new) {
+                    add_parent(a,entry);
+                    add_parent(b,entry);
+                }
+                if (sign(b->min) <= 0) break;
+                max = add(b->min,small(-1));
+                if (sign(a->min) >= 0) {
+                    min = small(0);
+                    if (less(a->max,b->min)) {
+                        min = a->min;
+                        max = a->max;
+                    }
+                } else {
+                    min = negate(max);
+                }
+                break;
+        }
+    }
+
+    (*cache->leaf)(env,cache->data,e,&lmin,&lmax);
+    corners[0] = from_term(lmin,-1);
+    corners[1] = from_term(lmax,1);
+    if (less(min,corners[0])) min = corners[0];
+    if (less(corners[1],max)) max = corners[1];
+
+    entry->min = min;
+    entry->max = max;
+    entry->generation = cache->generation;
+    entry->valid = 1;
+}
+
+static struct bound_entry *lookup(struct env *env, struct bound_cache *cache, struct _ex_intern *e)
+{
+    struct bound_entry *entry;
+    int is_new = 0;
+
+    if (e->id >= cache->size) {
+        unsigned s = e->id * 2 + 1024;
+        cache->entries = (struct bound_entry **)REALLOC(cache->entries,sizeof(struct bound_entry *) * s);
+        if (cache->entries==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
+        memset(cache->entries + cache->size, 0, sizeof(struct bound_entry *) * (s - cache->size));
+        cache->size = s;
+    }
+
+    entry = cache->entries[e->id];
+    if (entry==NULL) {
+        entry = (struct bound_entry *)MALLOC(sizeof(struct bound_entry));
+        entry->e = e;
+        entry->valid = 0;
+        entry->parents = NULL;
+        cache->entries[e->id] = entry;
+        is_new = 1;
+    } else if (entry->valid && entry->generation==cache->generation) {
+        return entry;
+    }
+
+    compute(env,cache,entry,is_new);
+
+    return entry;
+}
+
+struct bound_cache *_th_new_bound_cache(_th_leaf_bounds leaf, void *data)
+{
+    struct bound_cache *cache = (struct bound_cache *)MALLOC(sizeof(struct bound_cache));
+
+    cache->leaf = leaf;
+    cache->data = data;
+    cache->env = NULL;
+    cache->generation = 1;
+    cache->size = 0;
+    cache->entries = NULL;
+
+    return cache;
+}
+
+void _th_free_bound_cache(struct bound_cache *cache)
+{
+    struct bound_parent *p, *n;
+    unsigned i;
+
+    for (i = 0; i < cache->size; ++i) {
+        if (cache->entries[i]) {
+            for (p = cache->entries[i]->parents; p; p = n) {
+                n = p->next;
+                FREE(p);
+            }
+            FREE(cache->entries[i]);
+        }
+    }
+    if (cache->entries) FREE(cache->entries);
+    FREE(cache);
+}
+
+void _th_bound_reset(struct bound_cache *cache)
+{
+    if (cache) ++cache->generation;
+}
+
+/*
+ * The leaf bound of e changed.  Invalidates e and every cached term that
+ * was computed from it.  A valid entry only depends on valid entries, so
+ * the walk stops at entries that are already invalid.
+ */
+void _th_bound_changed(struct bound_cache *cache, struct _ex_intern *e)
+{
+    struct bound_entry **stack, *entry;
+    struct bound_parent *p;
+    int top, size;
+
+    if (cache==NULL || e->id >= cache->size || cache->entries[e->id]==NULL) return;
+
+    entry = cache->entries[e->id];
+    if (!entry->valid || entry->generation != cache->generation) return;
+
+    size = 64;
+    stack = (struct bound_entry **)MALLOC(sizeof(struct bound_entry *) * size);
+    top = 0;
+    entry->valid = 0;
+    stack[top++] = entry;
+    while (top > 0) {
+        entry = stack[--top];
+        for (p = entry->parents; p; p = p->next) {
+            if (p->entry->valid && p->entry->generation==cache->generation) {
+                p->entry->valid = 0;
+                if (top==size) {
+                    size *= 2;
+                    stack = (struct bound_entry **)REALLOC(stack,sizeof(struct bound_entry *) * size);
+                    if (stack==NULL) {
+                        printf("Error in REALLOC\n");
+                        exit(1);
+                    }
+                }
+                stack[top++] = p->entry;
+            }
+        }
+    }
+    FREE(stack);
+}
+
+static void check_env(struct env *env, struct bound_cache *cache)
+{
+    if (cache->env != env) {
+        cache->env = env;
+        ++cache->generation;
+    }
+}
+
+struct _ex_intern *_th_bound_min(struct env *env, struct bound_cache *cache, struct _ex_intern *e)
+{
+    check_env(env,cache);
+    return to_term(lookup(env,cache,e)->min);
+}
+
+struct _ex_intern *_th_bound_max(struct env *env, struct bound_cache *cache, struct _ex_intern *e)
+{
+    check_env(env,cache);
+    return to_term(lookup(env,cache,e)->max);
+}
+
+static void env_leaf(struct env *env, void *data, struct _ex_intern *e, struct _ex_intern **min, struct _ex_intern **max)
+{
+    *min = _th_get_lower_bound(env,e);
+    *max = _th_get_upper_bound(env,e);
+}
+
+/*
+ * Bounds from the min and max tables of env
+ */
+struct _ex_intern *_th_env_bound_min(struct env *env, struct _ex_intern *e)
+{
+    if (_th_env_bounds==NULL) _th_env_bounds = _th_new_bound_cache(env_leaf,NULL);
+    return _th_bound_min(env,_th_env_bounds,e);
+}
+
+struct _ex_intern *_th_env_bound_max(struct env *env, struct _ex_intern *e)
+{
+    if (_th_env_bounds==NULL) _th_env_bounds = _th_new_bound_cache(env_leaf,NULL);
+    return _th_bound_max(env,_th_env_bounds,e);
+}
@@ -213,14 +213,8 @@ static struct _ex_intern *analyze_and_split(struct env *env, struct fd_handle *f
     pos = -1;
 
     for (i = 0; i < count; ++i) {
-		struct _ex_intern *cnt = _fd_get_value_count(env,fd,vars[i]);
-		int count;
-		if (cnt->u.integer[0]==1 && cnt->u.integer[1] < 0x7fffffff &&
-			cnt->u.integer[1] > 1) {
-			count = (int)cnt->u.integer[1];
-		} else {
-			count = 0;
-		}
+		int count = _fd_get_size(env,fd,vars[i]);
+		if (count <= 1) count = 0;
         if (count > 0 && (pos < 0 || count < min_cases)) {
             min_cases = count;
             pos = i;
@@ -248,10 +242,10 @@ static struct _ex_intern *process_children(struct env *env, struct fd_handle *fd
 {
     struct _ex_intern *t, *f;
 	struct _ex_intern *value;
-    struct _ex_intern *count = _fd_get_value_count(env,fd,var);
+    int count = _fd_get_size(env,fd,var);
 
-	_zone_print3("Process children %s %d %s", _th_intern_decode(var), v, _th_print_exp(count));
-	if (v < (int)count->u.integer[1]) {
+	_zone_print3("Process children %s %d %d", _th_intern_decode(var), v, count);
+	if (v < count) {
 		value = _fd_get_value_n(env,fd,var,v);
         _zone_print2("Processing case %s=%s", _th_intern_decode(var), _th_print_exp(value));
         _tree_indent();
@@ -4383,6 +4377,29 @@ backjump_start:
 
 	printf("indent a %d\n", _tree_get_indent());
     pos_split = split = _th_learn_choose_signed(env,info,p,_th_random_probability);
+    if (split==NULL && _th_lazy_arrays) {
+        /* Complete assignment--check it against the array axioms */
+        int res = _th_array_lemmas(env,info);
+        if (res==ARRAY_LEMMAS) goto backjump_start;
+        if (res==ARRAY_CONFLICT) {
+            /*
+             * The violated lemma is in the learned tuples; analyze it like
+             * any other tuple conflict so the callers can backjump to
+             * backjump_start at the decision it depends on.
+             */
+            _tree_print0("Array conflict");
+            if (new_learn) {
+                do_backjump = _th_learn(env,info,p,list,1);
+                ++conflict_count;
+                ++backjump_count;
+                _th_learn_increase_bump(learn,_th_bump_decay);
+                if (conflict_count >= conflict_limit) do_restart = 1;
+            }
+            _tree_undent();
+            _th_alloc_release(REWRITE_SPACE,mark);
+            return fl;
+        }
+    }
     if (split==NULL) {
 		struct fail_list *f;
 //#ifndef FAST
@@ -4714,6 +4731,7 @@ struct fail_list *sat_prove_front(struct env *env, struct parent_list *p, struct
 			_tree_print0("Restarting");
 			_tree_indent();
     		++restart_count;
+            if (learn) _th_learn_reduce(env,learn);
 		}
 	} while (do_restart);
 	_tree_undent();
@@ -5088,6 +5106,9 @@ struct fail_list *_th_prove(struct env *env, struct _ex_intern *e)
     _th_clear_dependency_cache();
     mark = _th_alloc_mark(REWRITE_SPACE);
 
+    /* The caller charges the whole proof to the search phase; the
+     * simplification done before the SAT search proper is preprocessing */
+    _th_phase_start(PHASE_PREPROCESS);
 	if (_th_do_symmetry) e = _th_augment_with_symmetries(env,e);
 	e = _th_nc_rewrite(env,e);
     if (!strcmp(_th_get_logic_name(),"QF_UFLIA")) e = _th_variablize_functions(env,e);
@@ -5100,6 +5121,7 @@ struct fail_list *_th_prove(struct env *env, struct _ex_intern *e)
     solved_cases = 0;
     learned_unates = 0;
     info = _th_new_learn_info(env);
+    _th_array_start_proof();
     e = _th_remove_nested_ite(env,info,e,NULL);
 	e = _th_nc_rewrite(env,e);
 	theorem = e;
@@ -5119,6 +5141,7 @@ struct fail_list *_th_prove(struct env *env, struct _ex_intern *e)
     //_tree_print_exp("yices ce value(res) 2", _th_yices_ce_value(env,res));
     ///_tree_print_exp("yices ce value(res) again", _th_yices_ce_value(env,res));
     if (e==_ex_false) {
+        _th_phase_end(PHASE_PREPROCESS);
         return NULL;
     } else {
         trail = eliminate_booleans(env,info,trail);
@@ -5143,13 +5166,17 @@ struct fail_list *_th_prove(struct env *env, struct _ex_intern *e)
     e = _th_nc_rewrite(env,e);
     e = _th_simp(env,e);
 	if (e==_ex_true) {
+        _th_phase_end(PHASE_PREPROCESS);
 		return NULL;
 	}
     _th_add_to_learn(env,info,e,trail);
 	e = _ex_false;
     _th_derive_push(env);
 	//ne_test3(env);
+    _th_phase_end(PHASE_PREPROCESS);
+    _th_phase_start(PHASE_SEARCH);
     res = sat_prove_front(env,trail,info,NULL,1);
+    _th_phase_end(PHASE_SEARCH);
     _th_derive_pop(env);
 #ifdef XX
 	do {
@@ -5306,12 +5333,257 @@ int is_boolean_expression(struct _ex_intern *e)
 	return res;
 }
 
+/*
+ * Preprocessing pass manager
+ *
+ * _th_preprocess runs the theorem through a pipeline of passes.  The
+ * default pipeline is the fixed sequence the preprocessor has always
+ * used; -pp replaces it with a comma separated list of pass names.  Each
+ * pass still checks its own enabling flag (_th_do_symmetry, _th_do_unate
+ * and so on), so naming a pass only decides where it runs.
+ *
+ * Passes flagged PASS_IDEMPOTENT are pure functions of their input and
+ * the pipeline state that reach a fixpoint in one run.  Such a pass is
+ * skipped when its input is the term it produced or was given last time
+ * and the pipeline state is the same.  Since terms are hash consed this
+ * is a pointer comparison.  The pipeline state is whether the rewrite
+ * pass has been turned into a no-op by the unate pass in encoding only
+ * mode.
+ *
+ * Only rewrite is flagged.  symmetry and variablize introduce fresh
+ * terms each time they run, and nested_ite, unate, flower and grouping
+ * add to the learned clauses or the trail, so running them again is not
+ * the same as reusing their last result.
+ *
+ * The time and the size of the term DAG before and after are recorded
+ * for every pass and printed with -ps.
+ */
+#define PASS_IDEMPOTENT 1
+
+#define MAX_PIPELINE 64
+
+struct preprocess_pass {
+    char *name;
+    struct _ex_intern *(*run)(struct env *env, struct _ex_intern *e);
+    int flags;
+    unsigned runs, skips;
+    double time;
+    unsigned size_in, size_out;
+    struct _ex_intern *last_in, *last_out;
+    int last_state;
+};
+
+static int unate_ran;
+
+static int pipeline_state()
+{
+    return _th_encoding_only && unate_ran;
+}
+
+static struct _ex_intern *pass_symmetry(struct env *env, struct _ex_intern *e)
+{
+    if (!_th_do_symmetry) return e;
+    return _th_augment_with_symmetries(env,e);
+}
+
+static struct _ex_intern *pass_rewrite(struct env *env, struct _ex_intern *e)
+{
+    /* In encoding only mode the input is passed on after the unate pass */
+    if (_th_encoding_only && unate_ran) return e;
+    return _th_nc_rewrite(env,e);
+}
+
+static struct _ex_intern *pass_variablize(struct env *env, struct _ex_intern *e)
+{
+    if (strcmp(_th_get_logic_name(),"QF_UFLIA")) return e;
+    return _th_variablize_functions(env,e);
+}
+
+static struct _ex_intern *pass_nested_ite(struct env *env, struct _ex_intern *e)
+{
+    return _th_remove_nested_ite(env,info,e,NULL);
+}
+
+static struct _ex_intern *pass_orig;
+
+static struct _ex_intern *pass_unate(struct env *env, struct _ex_intern *e)
+{
+    if (_th_do_unate) {
+        theorem = e;
+        _th_derive_push(env);
+        e = preprocess(env,e,NULL,NULL, info, NULL, 1);
+        _th_derive_pop(env);
+    }
+    unate_ran = 1;
+    if (_th_encoding_only) return pass_orig;
+    return e;
+}
+
+static struct _ex_intern *pass_flower(struct env *env, struct _ex_intern *e)
+{
+    if (e==_ex_true || !strcmp(_th_get_logic_name(),"QF_UF")) return e;
+    if (!_th_do_break_flower || !_th_is_difference_logic()) return e;
+    return _th_break_flower(env,e,trail,info);
+}
+
+static struct _ex_intern *pass_grouping(struct env *env, struct _ex_intern *e)
+{
+    if (e==_ex_true || !strcmp(_th_get_logic_name(),"QF_UF")) return e;
+    if (!_th_do_grouping) return e;
+    return _th_simplify_groupings(env,e,trail,info);
+}
+
+static struct preprocess_pass passes[] = {
+    { "symmetry", pass_symmetry, 0 },
+    { "rewrite", pass_rewrite, PASS_IDEMPOTENT },
+    { "variablize", pass_variablize, 0 },
+    { "nested_ite", pass_nested_ite, 0 },
+    { "unate", pass_unate, 0 },
+    { "flower", pass_flower, 0 },
+    { "grouping", pass_grouping, 0 },
+    { NULL }
+};
+
+static char *default_pipeline = "symmetry,rewrite,variablize,nested_ite,rewrite,unate,rewrite,flower,grouping";
+
+static int pipeline[MAX_PIPELINE];
+static int pipeline_length = -1;
+static char *pipeline_spec = NULL;
+
+int _th_preprocess_report = 0;
+
+/*
+ * Sets the pipeline from a comma separated list of pass names.  Returns
+ * 0 if a name is not recognized.
+ */
+int _th_set_preprocess_pipeline(char *spec)
+{
+    char *c = spec, *end;
+    int i, len, count = 0;
+
+    while (*c) {
+        for (end = c; *end && *end != ','; ++end);
+        len = end-c;
+        for (i = 0; passes[i].name; ++i) {
+            if (strlen(passes[i].name)==len && !strncmp(passes[i].name,c,len)) break;
+        }
+        if (passes[i].name==NULL || count >= MAX_PIPELINE) return 0;
+        pipeline[count++] = i;
+        c = (*end) ? end+1 : end;
+    }
+
+    pipeline_length = count;
+    pipeline_spec = spec;
+    return 1;
+}
+
+char *_th_get_preprocess_pipeline()
+{
+    return pipeline_spec ? pipeline_spec : default_pipeline;
+}
+
+static struct term_marks *dag_marks = NULL;
+
+static unsigned dag_size(struct _ex_intern *e)
+{
+    unsigned size;
+    int i;
+
+    if (_th_visit_term(dag_marks,e)) return 0;
+
+    size = 1;
+    switch (e->type) {
+        case EXP_APPL:
+            for (i = 0; i < e->u.appl.count; ++i) {
+                size += dag_size(e->u.appl.args[i]);
+            }
+            break;
+        case EXP_QUANT:
+            size += dag_size(e->u.quant.exp);
+            size += dag_size(e->u.quant.cond);
+            break;
+        case EXP_CASE:
+            size += dag_size(e->u.case_stmt.exp);
+            for (i = 0; i < e->u.case_stmt.count*2; ++i) {
+                size += dag_size(e->u.case_stmt.args[i]);
+            }
+            break;
+        case EXP_INDEX:
+            size += dag_size(e->u.index.exp);
+            break;
+    }
+
+    return size;
+}
+
+static unsigned term_dag_size(struct _ex_intern *e)
+{
+    if (dag_marks==NULL) dag_marks = _th_new_term_marks(0);
+    _th_start_traversal(dag_marks);
+    return dag_size(e);
+}
+
+static struct _ex_intern *run_pipeline(struct env *env, struct _ex_intern *e)
+{
+    struct preprocess_pass *p;
+    unsigned size = term_dag_size(e);
+    double start;
+    int i;
+
+    if (pipeline_length < 0) _th_set_preprocess_pipeline(default_pipeline);
+
+    for (p = passes; p->name; ++p) {
+        p->last_in = p->last_out = NULL;
+    }
+    pass_orig = e;
+    unate_ran = 0;
+
+    for (i = 0; i < pipeline_length; ++i) {
+        p = passes + pipeline[i];
+        if ((p->flags & PASS_IDEMPOTENT) && (e==p->last_in || e==p->last_out) &&
+            p->last_state==pipeline_state()) {
+            _tree_print1("Skipping pass %s", p->name);
+            ++p->skips;
+            e = p->last_out;
+            continue;
+        }
+        _tree_print1("Pass %s", p->name);
+        _tree_indent();
+        start = _th_phase_clock();
+        p->last_in = e;
+        p->last_state = pipeline_state();
+        p->size_in = size;
+        e = (*p->run)(env,e);
+        p->time += _th_phase_clock() - start;
+        p->last_out = e;
+        if (e != p->last_in) size = term_dag_size(e);
+        p->size_out = size;
+        ++p->runs;
+        _tree_undent();
+        _tree_print2("%d nodes to %d nodes", p->size_in, p->size_out);
+    }
+
+    return e;
+}
+
+static void print_pass_report()
+{
+    struct preprocess_pass *p;
+
+    fprintf(stderr, "%-12s %6s %6s %10s %10s %10s\n", "pass", "runs", "skips", "seconds", "size in", "size out");
+    for (p = passes; p->name; ++p) {
+        if (p->runs==0 && p->skips==0) continue;
+        fprintf(stderr, "%-12s %6u %6u %10.3f %10u %10u\n", p->name, p->runs, p->skips, p->time, p->size_in, p->size_out);
+    }
+}
+
 int _th_preprocess(struct env *env, struct _ex_intern *e, char *write_file, char *write_d_file)
 {
     struct _ex_intern *res;
     char *mark;
     FILE *f;
     struct _ex_intern *orig = e;
+    struct _ex_intern *skeleton = NULL;
     int state = PREPROCESS_DEFAULT;
 
     //if (xx==NULL) xx = _th_parse(env,"(|| (BmainB_46_f_lt_4 cnf_140 (rplus #2/1 BmainB_46_iBOT)) cnf_131 (BmainB_46_f_lt_3 (rplus #29/1 BmainB_46_iBOT) cnf_48) (not cnf_61))");
@@ -5320,85 +5592,19 @@ int _th_preprocess(struct env *env, struct _ex_intern *e, char *write_file, char
     //setup_check(env);
     _th_clear_dependency_cache();
 
-    if (_th_do_symmetry) {
-        e = _th_augment_with_symmetries(env,e);
-    }
-
     mark = _th_alloc_mark(REWRITE_SPACE);
     _tree_print_exp("e", e);
-    //_tree_print_exp("yices ce value(e) 1", _th_yices_ce_value(env,e));
-    //printf("Here0\n");
-    //fflush(stdout);
-    e = _th_nc_rewrite(env,e);
-    //printf("Here0a\n");
-    //fflush(stdout);
-    //_tree_print0("Variablize function");
-    //_tree_indent();
-    if (!strcmp(_th_get_logic_name(),"QF_UFLIA")) e = _th_variablize_functions(env,e);
-    //_tree_undent();
-    //printf("Here1\n");
-    //fflush(stdout);
-    //e = _th_nc_rewrite(env,e);
     info = _th_new_learn_info(env);
-    //printf("Here1a\n");
-    //fflush(stdout);
-    //_tree_print0("Remove nested ite");
-    //_tree_indent();
-    e = _th_remove_nested_ite(env,info,e,NULL);
-    //_tree_undent();
-    //printf("Here1b\n");
-    //fflush(stdout);
-    e = _th_nc_rewrite(env,e);
-    //printf("Here1c\n");
-    //fflush(stdout);
-    //_th_print_state(env,NULL,_ex_intern_appl1_env(env,INTERN_NOT,e),fopen("state1.out","w"),_th_get_name(),_th_get_status_name(),_th_get_logic_name());
-    //_tree_print_exp("yices ce value(e) 2", _th_yices_ce_value(env,e));
-    //_zone_increment();
-    //e = _th_simp(env,e);
-    //printf("Here2\n");
-    //fflush(stdout);
-    //if (_th_do_break_flower) e = _th_break_flower(env,e,NULL);
-    //if (_th_do_grouping) e = _th_simplify_groupings(env,e,NULL);
-    //_th_print_state(env,NULL,_ex_intern_appl1_env(env,INTERN_NOT,e),fopen("state2.out","w"),_th_get_name(),_th_get_status_name(),_th_get_logic_name());
-    //_th_print_state(env,NULL,_ex_intern_appl1_env(env,INTERN_NOT,e),fopen("neq048a.smt","w"),_th_get_name(),_th_get_status_name(),_th_get_logic_name());
-    //exit(1);
-    //_th_alloc_release(REWRITE_SPACE,mark);
     split_count = 0;
     unate_count = 0;
     elimination_count = 0;
     solved_cases = 0;
     learned_unates = 0;
     theorem = e;
-    //check_explanations(env);
-    //f = fopen("yices.ce","r");
-    //_th_parse_yices_ce(env,f);
-    //fclose(f);
-    //_tree_print_exp("yices ce value(e) 3", _th_yices_ce_value(env,e));
-    //printf("Here3\n");
-    //fflush(stdout);
-    if (_th_do_unate) {
-        //printf("This is a test\n");
-        _th_derive_push(env);
-        res = preprocess(env,e,NULL,NULL, info, NULL, 1);
-        _th_derive_pop(env);
-    } else {
-        res = e;
-    }
-    //printf("Here4\n");
-    //fflush(stdout);
-    //_tree_print_exp("yices ce value(res)", _th_yices_ce_value(env,res));
-    //_tree_print1("Elimination splits: %d", elimination_count);
-    if (_th_encoding_only) {
-        res = orig;
-    } else {
-        res = _th_nc_rewrite(env,res);
-    }
-    if (res != _ex_true && strcmp(_th_get_logic_name(),"QF_UF")) {
-        if (_th_do_break_flower && _th_is_difference_logic()) {
-            res = _th_break_flower(env,res,trail,info);
-        }
-        if (_th_do_grouping) res = _th_simplify_groupings(env,res,trail,info);
-    }
+
+    res = run_pipeline(env,e);
+    if (_th_preprocess_report) print_pass_report();
+
     //printf("Adding to learn %s\n", _th_print_exp(res));
     //printf("Here5\n");
     //fflush(stdout);
@@ -5418,12 +5624,15 @@ int _th_preprocess(struct env *env, struct _ex_intern *e, char *write_file, char
         trail = NULL;
     }
 	//_tree_print("Here2");
-    if (res != _ex_true && res != _ex_false && is_boolean_expression(res) && _th_is_sat(info) && trail==NULL) {
+    if (res != _ex_true && res != _ex_false && _th_is_boolean_skeleton(env,res) && _th_is_sat(info) && trail==NULL) {
         //_tree_print0("add to learn");
 		//_tree_print("Here3");
-        _tree_indent();
-        _th_add_to_learn(env,info,res,trail);
-        _tree_undent();
+        /*
+         * The theorem is pure boolean structure, so it is encoded
+         * through the AIG when the DIMACS file is written rather than
+         * added to the learned clauses.
+         */
+        skeleton = res;
         res = _ex_false;
 		state = PREPROCESS_CNF;
     }
@@ -5441,7 +5650,7 @@ int _th_preprocess(struct env *env, struct _ex_intern *e, char *write_file, char
         } else {
             f = stdout;
         }
-        _th_print_dimacs(info,f);
+        _th_print_aig_dimacs(env,info,_ex_intern_appl1_env(env,INTERN_NOT,skeleton),f);
         if (write_d_file) fclose(f);
     } else {
         if (write_file) {
@@ -142,7 +142,7 @@ static int unary_cached = 1;
 
 static struct add_list *generate_unary_descendents(struct env *env, struct _ex_intern *rule, struct add_list *tail)
 {
-	int hash = (((int)rule)/4)%RULE_HASH_SIZE;
+	int hash = rule->id%RULE_HASH_SIZE;
     struct rule_info *r = unary_rule_table[hash];
     struct add_list *adds, *a, *ret, *ap;
     int i;
@@ -271,7 +271,7 @@ static struct add_list fail;
 
 static struct add_list *generate_binary_descendents(struct env *env, struct _ex_intern *rule1, struct _ex_intern *rule2, struct add_list *tail)
 {
-	int hash = (((int)rule1)/4+((int)rule2)/4)%RULE_HASH_SIZE;
+	int hash = (rule1->id+rule2->id)%RULE_HASH_SIZE;
     struct rule_info *r = binary_rule_table[hash];
     struct add_list *adds, *a, *ret, *ap;
     int i;
@@ -1604,7 +1604,7 @@ static struct add_list *augment_neg_store(struct env *env, struct _ex_intern *l,
 
 struct _ex_intern *_th_add_to_ee(struct env *env, struct _ex_intern *ee, struct _ex_intern *t)
 {
-    struct _ex_intern **args = ALLOCA(sizeof(ee->u.appl.count+1));
+    struct _ex_intern **args = ALLOCA(sizeof(struct _ex_intern *) * (ee->u.appl.count+1));
     int i, j;
     int done;
 
@@ -1617,7 +1617,7 @@ struct _ex_intern *_th_add_to_ee(struct env *env, struct _ex_intern *ee, struct
 
     done = 0;
     for (j = 2, i = 2; i < ee->u.appl.count; ++i) {
-        if (!done && ((int)ee->u.appl.args[i]) > ((int)t)) {
+        if (!done && ee->u.appl.args[i]->id > t->id) {
             args[j++] = t;
             done = 1;
         }
@@ -2323,6 +2323,7 @@ true_case:
                             return 1;
                         } else if (x != _ex_true) {
                             _th_add_cache_assignment(env,x,_ex_true);
+                            _th_invalidate_normal_forms();
                         }
                         if (r==r->rewrite) {
                             r = NULL;
@@ -2364,6 +2365,7 @@ false_case:
                             return 1;
                         } else if (x != _ex_false) {
                             _th_add_cache_assignment(env,x,_ex_false);
+                            _th_invalidate_normal_forms();
                         }
                         if (r==r->rewrite) {
                             r = NULL;
@@ -2402,6 +2404,7 @@ false_case:
                             return 1;
                         }
                         _th_add_cache_assignment(env,f,_ex_false);
+                        _th_invalidate_normal_forms();
                         _zone_print_exp("Adding to queue", g);
                         //printf("Processing parent %s\n", _th_print_exp(e));
                         _tree_indent();
@@ -2445,6 +2448,7 @@ cont:
                 
                 //invalidate_term(env,f);
                 _th_add_cache_assignment(env,f,_ex_false);
+                _th_invalidate_normal_forms();
                 if (l->type==EXP_APPL && r->type==EXP_APPL &&
                     l->u.appl.functor==r->u.appl.functor &&
                     l->u.appl.count==r->u.appl.count) {
@@ -2467,6 +2471,7 @@ cont:
                             return 1;
                         }
                         _th_add_cache_assignment(env,f,_ex_false);
+                        _th_invalidate_normal_forms();
                         _zone_print_exp("Adding to queue", g);
                         //printf("Processing parent %s\n", _th_print_exp(e));
                         _tree_indent();
@@ -2533,6 +2538,7 @@ cont:
                 }
                 if (l==r) goto true_case;
                 _th_add_cache_assignment(env,e,_ex_intern_appl2_env(env,INTERN_EQUAL,l,r));
+                _th_invalidate_normal_forms();
             }
         } else if (e->rewrite==NULL) {
             struct add_list *parents;
@@ -2833,6 +2839,7 @@ static struct _ex_intern *signature(struct env *env, struct _ex_intern *e)
 static struct add_list *ret_expl;
 
 static struct add_list *quick_explanation(struct env *env, struct _ex_intern *left, struct _ex_intern *right, struct add_list *explanation);
+static struct add_list *lazy_explanation(struct env *env, struct _ex_intern *left, struct _ex_intern *right, struct add_list *explanation);
 
 static struct _ex_intern *signature_expl(struct env *env, struct _ex_intern *e, struct add_list *expl);
 
@@ -2860,7 +2867,7 @@ static struct _ex_intern *simp_expl(struct env *env, struct _ex_intern *e, struc
         e = e->find;
         _zone_print_exp("Find", e);
     }
-    expl = quick_explanation(env,e,f,expl);
+    expl = lazy_explanation(env,e,f,expl);
 
     if (!e->in_hash) {
         _th_mark_inhash(env,e);
@@ -3219,6 +3226,70 @@ static struct add_list *quick_explanation(struct env *env, struct _ex_intern *le
     return explanation;
 }
 
+/*
+ * An explanation entry that is an integer n stands for merge reason n of
+ * the environment (see _th_add_merge_reason).  No literal is ever an
+ * integer, so the two cannot be confused.  The integer terms are cached
+ * by index so that recording a reason does not go through the hash table.
+ */
+static struct _ex_intern **reason_tags;
+static int reason_tag_size;
+
+static struct add_list *add_reason(struct env *env, int index, struct add_list *explanation)
+{
+    struct add_list *expl;
+
+    if (index >= reason_tag_size) {
+        int i, size = index + 1000;
+        reason_tags = (struct _ex_intern **)REALLOC(reason_tags,sizeof(struct _ex_intern *) * size);
+        if (reason_tags==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
+        for (i = reason_tag_size; i < size; ++i) {
+            reason_tags[i] = NULL;
+        }
+        reason_tag_size = size;
+    }
+    if (reason_tags[index]==NULL) reason_tags[index] = _ex_intern_small_integer(index);
+
+    expl = (struct add_list *)_th_alloc(_th_get_space(env),sizeof(struct add_list));
+    expl->next = explanation;
+    expl->e = reason_tags[index];
+
+    return expl;
+}
+
+static int is_reason(struct _ex_intern *e)
+{
+    return e->type==EXP_INTEGER;
+}
+
+static int reason_index(struct _ex_intern *e)
+{
+    return (int)e->u.integer[1];
+}
+
+static int path_reason(struct env *env, struct _ex_intern *left, struct _ex_intern *right)
+{
+    if (left==right) return -1;
+    return _th_add_merge_reason(env,MERGE_REASON_PATH,left,right,NULL,-1,-1);
+}
+
+/*
+ * Records that left and right are in the same merge tree without walking
+ * the path between them.  Merge edges are only removed by backtracking,
+ * which also pops the reason, so the path still exists when
+ * _th_retrieve_explanation expands it.  Most explanations built during
+ * propagation are never retrieved.
+ */
+static struct add_list *lazy_explanation(struct env *env, struct _ex_intern *left, struct _ex_intern *right, struct add_list *explanation)
+{
+    if (left==right) return explanation;
+
+    return add_reason(env,path_reason(env,left,right),explanation);
+}
+
 static int do_assert(struct env *env, struct _ex_intern *pred, struct _ex_intern *orig, struct add_list *explanation);
 
 struct add_list *contradiction;
@@ -3291,11 +3362,35 @@ void print_explanation(struct env *env, struct _ex_intern *left, struct _ex_inte
     _tree_undent();
 }
 
+static void print_reason(struct env *env, int index)
+{
+    struct merge_reason *r;
+
+    if (index < 0) return;
+
+    r = _th_get_merge_reason(env,index);
+    _tree_print1("Reason %d", index);
+    _tree_indent();
+    if (r->rule==MERGE_REASON_CONGRUENCE) {
+        _tree_print_exp("Congruence", r->literal);
+        print_reason(env,r->parent[0]);
+        print_reason(env,r->parent[1]);
+    } else {
+        print_explanation(env,r->left,r->right);
+    }
+    _tree_undent();
+}
+
 void print_explanation_list(struct env *env, struct add_list *elist)
 {
     struct _ex_intern *left, *right;
 
     while (elist) {
+        if (is_reason(elist->e)) {
+            print_reason(env,reason_index(elist->e));
+            elist = elist->next;
+            continue;
+        }
         _zone_print_exp("Term", elist->e);
         _tree_indent();
         if (elist->e->type==EXP_APPL) {
@@ -3724,8 +3819,7 @@ static int merge(struct env *env, struct _ex_intern *left, struct _ex_intern *ri
                         }
                         ee->next = ex;
                     }
-                    expl = quick_explanation(env,l,e,expl);
-                    expl = quick_explanation(env,r,e->sig,expl);
+                    expl = add_reason(env,_th_add_merge_reason(env,MERGE_REASON_CONGRUENCE,e,e->sig,x,path_reason(env,l,e),path_reason(env,r,e->sig)),expl);
 #ifndef FAST
                     if (_zone_active()) {
                         _tree_print0("Explanation");
@@ -3814,7 +3908,7 @@ static int add_implications(struct env *env, struct _ex_intern *e)
         _zone_print_exp("Adding implications for", e);
         _tree_indent();
         parents = _th_collect_impacted_terms(env,e);
-        if (e->u.appl.functor!=INTERN_EQUAL) _th_prepare_quick_implications(env,e);
+        if (parents && e->u.appl.functor!=INTERN_EQUAL) _th_prepare_quick_implications(env,e);
         //check_missed_term(env,parents);
         list = NULL;
         while (parents) {
@@ -3881,7 +3975,7 @@ static int add_implications(struct env *env, struct _ex_intern *e)
             } else {
                 _zone_print_exp("Case 2", l);
                 while (l->find != l) l = l->find;
-                list->expl = quick_explanation(env,l,list->r,list->expl);
+                list->expl = lazy_explanation(env,l,list->r,list->expl);
             }
             //printf("    %s reduces to", _th_print_exp(e));
             //printf(" %s\n", _th_print_exp(l));
@@ -4656,6 +4750,20 @@ struct add_list *merge_explanation(struct env *env, struct _ex_intern *left, str
     return explanation;
 }
 
+static struct add_list *expand_reason(struct env *env, int index, struct add_list *tail)
+{
+    struct merge_reason *r;
+
+    if (index < 0) return tail;
+
+    r = _th_get_merge_reason(env,index);
+    if (r->rule==MERGE_REASON_CONGRUENCE) {
+        tail = expand_reason(env,r->parent[0],tail);
+        return expand_reason(env,r->parent[1],tail);
+    }
+    return merge_explanation(env,r->left,r->right,tail);
+}
+
 struct add_list *add_explanation_list(struct env *env, struct add_list *elist, struct add_list *tail)
 {
     struct _ex_intern *left, *right;
@@ -4667,6 +4775,11 @@ struct add_list *add_explanation_list(struct env *env, struct add_list *elist, s
         if (!elist->e->user2) {
             elist->e->user2 = trail;
             trail = elist->e;
+            if (is_reason(elist->e)) {
+                tail = expand_reason(env,reason_index(elist->e),tail);
+                elist = elist->next;
+                continue;
+            }
             if (elist->e->type==EXP_APPL) {
                 if (elist->e->u.appl.functor==INTERN_NOT) {
                     left = elist->e->u.appl.args[0];
@@ -4735,6 +4848,49 @@ struct add_list *_th_retrieve_explanation(struct env *env, struct _ex_intern *pr
     return ret;
 }
 
+/*
+ * Replaces the merge reasons in an explanation list read directly off a
+ * term with the literals they stand for.  Lists without reasons are
+ * returned unchanged.
+ */
+struct add_list *_th_expand_merge_reasons(struct env *env, struct add_list *list)
+{
+    struct add_list *a, *ret;
+    struct _ex_intern *t;
+
+    a = list;
+    while (a && !is_reason(a->e)) {
+        a = a->next;
+    }
+    if (a==NULL) return list;
+
+    trail = _ex_true;
+    ret = NULL;
+    while (list) {
+        if (is_reason(list->e)) {
+            if (!list->e->user2) {
+                list->e->user2 = trail;
+                trail = list->e;
+                ret = expand_reason(env,reason_index(list->e),ret);
+            }
+        } else {
+            a = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
+            a->next = ret;
+            a->e = list->e;
+            ret = a;
+        }
+        list = list->next;
+    }
+
+    while (trail != _ex_true) {
+        t = trail->user2;
+        trail->user2 = NULL;
+        trail = t;
+    }
+
+    return ret;
+}
+
 static int add_context_rules(struct env *env, struct context_data *data)
 {
 	int i;
@@ -36,28 +36,19 @@ int _th_is_sat(struct learn_info *info)
     return 1;
 }
 
-struct _ex_intern *trail = NULL;
+static struct term_marks *var_numbers = NULL;
 
 void _th_print_dimacs(struct learn_info *info, FILE *file)
 {
     struct _ex_intern *t, *e;
     int i, count, vars, neg;
 
-    t = _th_get_first_neg_tuple(info);
-    while (t) {
-        if (t->type==EXP_APPL && t->u.appl.functor==INTERN_OR) {
-            for (i = 0; i < t->u.appl.count; ++i) {
-                e = t->u.appl.args[i];
-                if (e->type==EXP_APPL && e->u.appl.functor==INTERN_NOT) e = e->u.appl.args[0];
-                e->user2 = 0;
-            }
-        }
-        t = _th_get_next_neg_tuple(info);
-    }
+    if (var_numbers==NULL) var_numbers = _th_new_term_marks(1);
+    _th_start_traversal(var_numbers);
 
     count = 0;
-    trail = NULL;
     vars = 0;
+    fprintf(file, "c HTP generated dimacs file\n");
 
     t = _th_get_first_neg_tuple(info);
     while (t) {
@@ -66,16 +57,16 @@ void _th_print_dimacs(struct learn_info *info, FILE *file)
             for (i = 0; i < t->u.appl.count; ++i) {
                 e = t->u.appl.args[i];
                 if (e->type==EXP_APPL && e->u.appl.functor==INTERN_NOT) e = e->u.appl.args[0];
-                if (!e->user2) {
-                    e->next_cache = trail;
-                    trail = e;
-                    e->user2 = (struct _ex_intern *)++vars;
+                if (!_th_term_marked(var_numbers,e)) {
+                    _th_set_term_value(var_numbers,e,(void *)(long)++vars);
+                    fprintf(file, "c %d ", vars);
+                    _th_fprint_exp(file,NULL,e,1);
+                    fprintf(file, "\n");
                 }
             }
         }
         t = _th_get_next_neg_tuple(info);
     }
-    fprintf(file, "c HTP generated dimacs file\n");
     fprintf(file, "p cnf %d %d\n", vars, count);
 
     t = _th_get_first_neg_tuple(info);
@@ -91,16 +82,11 @@ void _th_print_dimacs(struct learn_info *info, FILE *file)
                 } else {
                     neg = 1;
                 }
-                fprintf(file, "%d ", ((int)e->user2));
+                fprintf(file, "%d ", ((int)(long)_th_term_value(var_numbers,e)));
             }
             fprintf(file, "0\n");
         }
         t = _th_get_next_neg_tuple(info);
     }
-
-    while (trail) {
-        trail->user2 = NULL;
-        trail = trail->next_cache;
-    }
 }
 
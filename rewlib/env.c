@@ -138,6 +138,7 @@ struct diff_node {
 	struct _ex_intern *eq_offset;
 	struct diff_node *move, *move_back;
     int visited;
+    int impact_mark;
 };
 
 struct diff_edge {
@@ -171,6 +172,7 @@ struct context_stack {
     struct term_group **term_groups;
     struct term_group **term_functors;
     struct cache_info *head;
+    int merge_reason_count;
 } ;
 
 #define TERM_HASH 1023
@@ -263,6 +265,8 @@ struct env {
     int slack;
     int vars_fully_connected;
     struct simplex *simplex;
+    struct merge_reason *merge_reasons;
+    int merge_reason_count, merge_reason_size;
 #ifdef CHECK_CACHE
     int cache_installed;
 #endif
@@ -1678,7 +1682,7 @@ cont2:
 
     while (p) {
         if (_th_extract_relationship(env,p->split) && _th_is_equal_term==0) {
-            hash = (((int)_th_left)/4)%DIFF_NODE_HASH;
+            hash = _th_left->id%DIFF_NODE_HASH;
             node = env->diff_node_table[hash];
             while (node && node->e != _th_left) node = node->next;
             if (!node) {
@@ -1721,12 +1725,12 @@ struct _ex_intern *_th_get_quick_implication(struct env *env, struct _ex_intern
     if (!_th_extract_relationship(env,e)) return NULL;
     //_zone_print0("Here2");
 
-    hash = (((int)_th_left)/4)%DIFF_NODE_HASH;
+    hash = _th_left->id%DIFF_NODE_HASH;
     node = env->diff_node_table[hash];
     while (node && node->e != _th_left) node = node->next;
     if (node==NULL) return NULL;
     _zone_print0("Here3");
-    rhash = (((int)_th_right)/4)%DIFF_NODE_HASH;
+    rhash = _th_right->id%DIFF_NODE_HASH;
     rnode = env->diff_node_table[rhash];
     while (rnode && rnode->e != _th_right) rnode = rnode->next;
     if (rnode==NULL) return NULL;
@@ -2390,8 +2394,8 @@ struct add_list *_th_prepare_quick_implications(struct env *env, struct _ex_inte
 
     _zone_print0("_th_get_implications");
 
-    hash = (((int)_th_left)/4)%DIFF_NODE_HASH;
-    rhash = (((int)_th_right)/4)%DIFF_NODE_HASH;
+    hash = _th_left->id%DIFF_NODE_HASH;
+    rhash = _th_right->id%DIFF_NODE_HASH;
     node = env->diff_node_table[hash];
     rnode = env->diff_node_table[rhash];
     while (node && node->e != _th_left) node = node->next;
@@ -2504,7 +2508,7 @@ void _th_prepare_node_implications(struct env *env, struct _ex_intern *e)
     //fflush(stdout);
 
     if (!_th_extract_relationship(env,e)) return;
-    hash = (((int)_th_right)/4)%DIFF_NODE_HASH;
+    hash = _th_right->id%DIFF_NODE_HASH;
     node = env->diff_node_table[hash];
     while (node && node->e != _th_right) node = node->next;
 
@@ -2776,7 +2780,7 @@ void dump_state(struct env *env, struct parent_list *list)
     int i;
     struct diff_node *n;
     //struct _ex_intern *e = _ex_intern_var(_th_intern("cvclZero"));
-    //int hash = (((int)e)/4)%DIFF_NODE_HASH;
+    //int hash = e->id%DIFF_NODE_HASH;
     struct parent_list *p;
 
     fprintf(f, "(benchmark dump.smt\n");
@@ -2806,7 +2810,7 @@ int has_bad_model(struct env *env, struct parent_list *list)
     int i;
     struct diff_node *n;
     struct _ex_intern *e = _ex_intern_var(_th_intern("cvclZero"));
-    int hash = (((int)e)/4)%DIFF_NODE_HASH;
+    int hash = e->id%DIFF_NODE_HASH;
     struct parent_list *p;
 
     for (i = 0; i < DIFF_NODE_HASH; ++i) {
@@ -2831,11 +2835,11 @@ int has_bad_model(struct env *env, struct parent_list *list)
         if (_th_extract_relationship(env,p->split) && _th_is_equal_term==0) {
             struct _ex_intern *t, *lv, *rv;
 
-            hash = (((int)_th_left)/4)%DIFF_NODE_HASH;
+            hash = _th_left->id%DIFF_NODE_HASH;
             n = env->diff_node_table[hash];
             while (n && n->e != _th_left) n = n->next;
             lv = n->bottom;
-            hash = (((int)_th_right)/4)%DIFF_NODE_HASH;
+            hash = _th_right->id%DIFF_NODE_HASH;
             n = env->diff_node_table[hash];
             while (n && n->e != _th_right) n = n->next;
             rv = n->bottom;
@@ -2859,8 +2863,8 @@ int has_bad_model(struct env *env, struct parent_list *list)
 
 static struct add_list *check_for_contradiction(struct env *env)
 {
-    int hash = (((int)_th_left)/4)%DIFF_NODE_HASH;
-    int rhash = (((int)_th_right)/4)%DIFF_NODE_HASH;
+    int hash = _th_left->id%DIFF_NODE_HASH;
+    int rhash = _th_right->id%DIFF_NODE_HASH;
     int i;
     struct diff_node *node;
     struct diff_node *rnode;
@@ -2937,8 +2941,8 @@ static struct add_list *check_for_contradiction(struct env *env)
 
 static struct add_list *check_for_ne(struct env *env)
 {
-    int hash = (((int)_th_left)/4)%DIFF_NODE_HASH;
-    int rhash = (((int)_th_right)/4)%DIFF_NODE_HASH;
+    int hash = _th_left->id%DIFF_NODE_HASH;
+    int rhash = _th_right->id%DIFF_NODE_HASH;
     int i;
     struct diff_node *node;
     struct diff_node *rnode;
@@ -3217,7 +3221,7 @@ void check_less(struct env *env, char *place)
     if (ct->find != ct) return;
     if (ct->in_hash==0) return;
 
-    hash = (((int)ct->u.appl.args[0])/4)%DIFF_NODE_HASH;
+    hash = ct->u.appl.args[0]->id%DIFF_NODE_HASH;
 
     n = env->diff_node_table[hash];
     while (n && n->e != ct->u.appl.args[0]) n = n->next;
@@ -3237,8 +3241,8 @@ void check_less(struct env *env, char *place)
 
 static int add_inequality(struct env *env, struct _ex_intern *explanation, struct add_list **expl)
 {
-    int hash = (((int)_th_left)/4)%DIFF_NODE_HASH;
-    int rhash = (((int)_th_right)/4)%DIFF_NODE_HASH;
+    int hash = _th_left->id%DIFF_NODE_HASH;
+    int rhash = _th_right->id%DIFF_NODE_HASH;
     struct diff_node *node = env->diff_node_table[hash];
     struct diff_node *rnode = env->diff_node_table[rhash];
     struct diff_edge *edge;
@@ -3266,6 +3270,7 @@ static int add_inequality(struct env *env, struct _ex_intern *explanation, struc
 		node->eq_merge = NULL;
 		node->eq_explanation = NULL;
 		node->move = node->move_back = NULL;
+        node->impact_mark = 0;
         _zone_print0("Adding_node");
         //printf("Adding node %x %d\n", node, hash);
     }
@@ -3282,6 +3287,7 @@ static int add_inequality(struct env *env, struct _ex_intern *explanation, struc
 		rnode->eq_merge = NULL;
 		rnode->eq_explanation = NULL;
 		rnode->move = rnode->move_back = NULL;
+        rnode->impact_mark = 0;
         _zone_print0("Adding rnode");
         //printf("Adding rnode %x %d\n", rnode, rhash);
     }
@@ -3349,8 +3355,8 @@ static int add_inequality(struct env *env, struct _ex_intern *explanation, struc
 
 static int add_not_equal(struct env *env, struct _ex_intern *explanation,struct add_list **expl)
 {
-    int hash = (((int)_th_left)/4)%DIFF_NODE_HASH;
-    int rhash = (((int)_th_right)/4)%DIFF_NODE_HASH;
+    int hash = _th_left->id%DIFF_NODE_HASH;
+    int rhash = _th_right->id%DIFF_NODE_HASH;
     struct diff_node *node = env->diff_node_table[hash];
     struct diff_node *rnode = env->diff_node_table[rhash];
 	struct diff_node *m1, *m2;
@@ -3379,6 +3385,7 @@ static int add_not_equal(struct env *env, struct _ex_intern *explanation,struct
 		node->eq_merge = NULL;
 		node->eq_explanation = NULL;
 		node->move = node->move_back = NULL;
+        node->impact_mark = 0;
         _zone_print0("Adding_node");
         //printf("Adding node %x %d\n", node, hash);
     }
@@ -3395,6 +3402,7 @@ static int add_not_equal(struct env *env, struct _ex_intern *explanation,struct
 		rnode->eq_merge = NULL;
 		rnode->eq_explanation = NULL;
 		rnode->move = rnode->move_back = NULL;
+        rnode->impact_mark = 0;
         _zone_print0("Adding rnode");
         //printf("Adding rnode %x %d\n", rnode, rhash);
     }
@@ -3581,12 +3589,19 @@ cont1:;
 
 static struct add_list *explanation;
 
+/*
+ * The collection passes below mark nodes with impact_stamp rather than
+ * visited so that the marks never need to be cleared by sweeping the
+ * whole difference table.
+ */
+static int impact_stamp = 0;
+
 static struct add_list *collect_right(struct env *env, struct diff_node *node, struct add_list *tail)
 {
     struct add_list *n = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
     struct diff_edge *e;
 
-    if (node->visited) return tail;
+    if (node->impact_mark==impact_stamp) return tail;
 
     n->next = tail;
     n->e = node->e;
@@ -3594,7 +3609,7 @@ static struct add_list *collect_right(struct env *env, struct diff_node *node, s
         fprintf(stderr, "Null expression 1\n");
         exit(1);
     }
-    node->visited = 1;
+    node->impact_mark = impact_stamp;
 
     e = node->edges;
     while (e) {
@@ -3610,8 +3625,8 @@ static struct add_list *collect_left(struct env *env, struct diff_node *node, st
     struct add_list *n = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
     struct diff_edge *e;
 
-    if (node->visited) return tail;
-    node->visited = 1;
+    if (node->impact_mark==impact_stamp) return tail;
+    node->impact_mark = impact_stamp;
 
     n->next = tail;
     n->e = node->e;
@@ -3630,11 +3645,153 @@ static struct add_list *collect_left(struct env *env, struct diff_node *node, st
 
 static struct _ex_intern *user2_trail = NULL;
 
+/*
+ * Watch lists for _th_collect_impacted_terms.  The atoms (< and ==
+ * terms) that can change when the bounds of a difference node term
+ * change are the ones reachable through its used_in parents, looking
+ * through up to two levels of sums and products.  Rather than walking
+ * these parents on every assertion, each term keeps the list of atoms
+ * watching it, together with the terms whose used_in lists were read
+ * to build it.  The list is rebuilt only when one of those used_in
+ * lists has changed since, as told by _ex_used_in_changed.  When terms
+ * are released (_ex_used_in_generation moves) all the lists are freed.
+ *
+ * The difference nodes reached from an assertion are exactly the terms
+ * whose bounds it can tighten, so the watches on terms also stand for
+ * watches on their bounds.
+ */
+struct impact_watch {
+    struct impact_watch *next;
+    struct _ex_intern *e;
+    unsigned built;
+    int count, size;
+    struct _ex_intern **atoms;
+    int source_count, source_size;
+    struct _ex_intern **sources;
+};
+
+#define IMPACT_WATCH_HASH 1021
+
+static struct impact_watch *impact_watches[IMPACT_WATCH_HASH];
+static int impact_watch_generation = 0;
+
+static struct _ex_intern **add_watch_term(struct _ex_intern **terms, int *count, int *size, struct _ex_intern *e)
+{
+    if (*count==*size) {
+        *size = *size * 2 + 4;
+        terms = (struct _ex_intern **)REALLOC(terms,sizeof(struct _ex_intern *) * *size);
+        if (terms==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
+    }
+    terms[(*count)++] = e;
+
+    return terms;
+}
+
+static void free_impact_watches()
+{
+    struct impact_watch *w, *n;
+    int i;
+
+    for (i = 0; i < IMPACT_WATCH_HASH; ++i) {
+        for (w = impact_watches[i]; w; w = n) {
+            n = w->next;
+            if (w->atoms) FREE(w->atoms);
+            if (w->sources) FREE(w->sources);
+            FREE(w);
+        }
+        impact_watches[i] = NULL;
+    }
+}
+
+static int impact_watch_valid(struct impact_watch *w)
+{
+    int i;
+
+    for (i = 0; i < w->source_count; ++i) {
+        if (_ex_used_in_changed(w->sources[i]) > w->built) return 0;
+    }
+
+    return 1;
+}
+
+static void collect_watch_atoms(struct impact_watch *w, struct _ex_intern *e, int depth)
+{
+    struct add_list *l = e->used_in;
+
+    w->sources = add_watch_term(w->sources,&w->source_count,&w->source_size,e);
+    while (l) {
+        struct _ex_intern *p = l->e;
+        if (!p->user2) {
+            p->user2 = user2_trail;
+            user2_trail = p;
+            if (p->type==EXP_APPL) {
+                if (p->u.appl.functor==INTERN_RAT_LESS || p->u.appl.functor==INTERN_EQUAL) {
+                    w->atoms = add_watch_term(w->atoms,&w->count,&w->size,p);
+                }
+                if ((depth==0 && (p->u.appl.functor==INTERN_RAT_PLUS || p->u.appl.functor==INTERN_RAT_TIMES)) ||
+                    (depth==1 && p->u.appl.functor==INTERN_RAT_PLUS)) {
+                    collect_watch_atoms(w,p,depth+1);
+                }
+            }
+        }
+        l = l->next;
+    }
+}
+
+static struct impact_watch *get_impact_watch(struct _ex_intern *e)
+{
+    int hash = e->id%IMPACT_WATCH_HASH;
+    struct impact_watch *w;
+
+    if (impact_watch_generation != _ex_used_in_generation) {
+        free_impact_watches();
+        impact_watch_generation = _ex_used_in_generation;
+    }
+
+    w = impact_watches[hash];
+    while (w && w->e != e) w = w->next;
+
+    if (w==NULL) {
+        w = (struct impact_watch *)MALLOC(sizeof(struct impact_watch));
+        if (w==NULL) {
+            printf("Error in MALLOC\n");
+            exit(1);
+        }
+        w->next = impact_watches[hash];
+        impact_watches[hash] = w;
+        w->e = e;
+        w->size = w->source_size = 0;
+        w->atoms = w->sources = NULL;
+        w->source_count = 0;
+    } else if (impact_watch_valid(w)) {
+        return w;
+    }
+
+    w->built = _ex_used_in_clock();
+    w->count = w->source_count = 0;
+    user2_trail = _ex_true;
+    _ex_true->user2 = NULL;
+    e->user2 = user2_trail;
+    user2_trail = e;
+    collect_watch_atoms(w,e,0);
+    while (user2_trail) {
+        struct _ex_intern *n = user2_trail->user2;
+        user2_trail->user2 = NULL;
+        user2_trail = n;
+    }
+
+    return w;
+}
+
 struct add_list *_th_collect_impacted_terms(struct env *env, struct _ex_intern *e)
 {
     int i;
     struct diff_node *node, *rnode;
-    struct add_list *res, *l, *l2, *l3, *l4, *r;
+    struct add_list *res, *l, *r;
+    struct impact_watch *w;
     int hash;
     int rhash;
 
@@ -3643,16 +3800,8 @@ struct add_list *_th_collect_impacted_terms(struct env *env, struct _ex_intern *
     if (!_th_extract_relationship(env,e)) return NULL;
     //if (_th_is_equal_term) return NULL;
 
-    hash = (((int)_th_left)/4)%DIFF_NODE_HASH;
-    rhash = (((int)_th_right)/4)%DIFF_NODE_HASH;
-
-    for (i = 0; i < DIFF_NODE_HASH; ++i) {
-        node = env->diff_node_table[i];
-        while (node) {
-            node->visited = 0;
-            node = node->next;
-        }
-    }
+    hash = _th_left->id%DIFF_NODE_HASH;
+    rhash = _th_right->id%DIFF_NODE_HASH;
 
     _zone_print1("Hash %d", hash);
     _zone_print1("RHash %d", rhash);
@@ -3665,21 +3814,13 @@ struct add_list *_th_collect_impacted_terms(struct env *env, struct _ex_intern *
     while (rnode && rnode->e != _th_right) rnode = rnode->next;
 
     l = NULL;
+    ++impact_stamp;
     if (rnode) l = collect_right(env, rnode, l);
-    for (i = 0; i < DIFF_NODE_HASH; ++i) {
-        struct diff_node *node = env->diff_node_table[i];
-        while (node) {
-            node->visited = 0;
-            node = node->next;
-        }
-    }
+    ++impact_stamp;
     if (node) l = collect_left(env, node, l);
-    for (i = 0; i < DIFF_NODE_HASH; ++i) {
-        node = env->diff_node_table[i];
-        while (node) {
-            node->visited = 0;
-            node = node->next;
-        }
+
+    for (r = l; r; r = r->next) {
+        get_impact_watch(r->e);
     }
 
     user2_trail = _ex_true;
@@ -3688,54 +3829,15 @@ struct add_list *_th_collect_impacted_terms(struct env *env, struct _ex_intern *
     res = NULL;
     while (l != NULL) {
         //_zone_print_exp("Collecting for term", l->e);
-        if (!l->e->user2) {
-            l->e->user2 = user2_trail;
-            user2_trail = l->e;
-            l2 = l->e->used_in;
-            while (l2) {
-                if (!l2->e->user2) {
-                    l2->e->user2 = user2_trail;
-                    user2_trail = l2->e;
-                    if (l2->e->type==EXP_APPL && (l2->e->u.appl.functor==INTERN_RAT_LESS || l2->e->u.appl.functor==INTERN_EQUAL)) {
-                        r = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
-                        r->next = res;
-                        res = r;
-                        res->e = l2->e;
-                    }
-                    if (l2->e->type==EXP_APPL && (l2->e->u.appl.functor==INTERN_RAT_PLUS || l2->e->u.appl.functor==INTERN_RAT_TIMES)) {
-                        l3 = l2->e->used_in;
-                        while (l3) {
-                            if (!l3->e->user2) {
-                                l3->e->user2 = user2_trail;
-                                user2_trail = l3->e;
-                                if (l3->e->type==EXP_APPL && (l3->e->u.appl.functor==INTERN_RAT_LESS || l3->e->u.appl.functor==INTERN_EQUAL)) {
-                                    r = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
-                                    r->next = res;
-                                    res = r;
-                                    res->e = l3->e;
-                                }
-                                if (l3->e->type==EXP_APPL && l3->e->u.appl.functor==INTERN_RAT_PLUS) {
-                                    l4 = l3->e->used_in;
-                                    while (l4) {
-                                        if (!l4->e->user2) {
-                                            l4->e->user2 = user2_trail;
-                                            user2_trail = l4->e;
-                                            if (l4->e->type==EXP_APPL && (l4->e->u.appl.functor==INTERN_RAT_LESS || l4->e->u.appl.functor==INTERN_EQUAL)) {
-                                                r = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
-                                                r->next = res;
-                                                res = r;
-                                                res->e = l4->e;
-                                            }
-                                        }
-                                        l4 = l4->next;
-                                    }
-                                }
-                            }
-                            l3 = l3->next;
-                        }
-                    }
-                }
-                l2 = l2->next;
+        w = get_impact_watch(l->e);
+        for (i = 0; i < w->count; ++i) {
+            if (!w->atoms[i]->user2) {
+                w->atoms[i]->user2 = user2_trail;
+                user2_trail = w->atoms[i];
+                r = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
+                r->next = res;
+                res = r;
+                res->e = w->atoms[i];
             }
         }
         l = l->next;
@@ -3754,8 +3856,8 @@ int check_for_fill(struct env *env, struct add_list **expl)
     struct _ex_intern *large;
     struct _ex_intern *pos;
     struct add_list *smalle, *largee;
-    int hash = (((int)_th_left)/4)%DIFF_NODE_HASH;
-    int rhash = (((int)_th_right)/4)%DIFF_NODE_HASH;
+    int hash = _th_left->id%DIFF_NODE_HASH;
+    int rhash = _th_right->id%DIFF_NODE_HASH;
     struct diff_node *node = env->diff_node_table[hash];
     struct diff_node *rnode = env->diff_node_table[rhash];
     struct diff_edge *edge;
@@ -4245,6 +4347,7 @@ void _th_add_merge_explanation(struct env *env, struct _ex_intern *term, struct
         //if (env != 0x2e2594 && _tree_zone > 479000) exit(1);
     //}
 
+    _th_invalidate_normal_forms();
     if (env->head==NULL) {
         env->head = env->tail = n;
         n->next = n->prev = NULL;
@@ -4272,6 +4375,47 @@ void _th_add_merge_explanation(struct env *env, struct _ex_intern *term, struct
     }
 }
 
+/*
+ * Merge reasons are the compact explanations recorded by the congruence
+ * closure code in crewrite.c.  They live on a per environment trail that
+ * _th_pop_context_rules truncates, so an index stays valid for as long as
+ * the merges whose explanations refer to it.
+ */
+int _th_add_merge_reason(struct env *env, int rule, struct _ex_intern *left, struct _ex_intern *right, struct _ex_intern *literal, int parent0, int parent1)
+{
+    struct merge_reason *r;
+
+    if (env->merge_reason_count==env->merge_reason_size) {
+        env->merge_reason_size += 1000;
+        env->merge_reasons = (struct merge_reason *)REALLOC(env->merge_reasons,sizeof(struct merge_reason) * env->merge_reason_size);
+        if (env->merge_reasons==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
+    }
+
+    r = env->merge_reasons + env->merge_reason_count;
+    r->rule = rule;
+    r->left = left;
+    r->right = right;
+    r->literal = literal;
+    r->parent[0] = parent0;
+    r->parent[1] = parent1;
+
+    return env->merge_reason_count++;
+}
+
+struct merge_reason *_th_get_merge_reason(struct env *env, int index)
+{
+#ifndef FAST
+    if (index < 0 || index >= env->merge_reason_count) {
+        fprintf(stderr, "Illegal merge reason %d\n", index);
+        exit(1);
+    }
+#endif
+    return env->merge_reasons + index;
+}
+
 static struct _ex_intern *t1, *t2;
 
 void check_terms()
@@ -4500,6 +4644,7 @@ void _th_add_signature(struct env *env, struct _ex_intern *term, struct _ex_inte
     //    if (sig==_ex_false) exit(1);
     //}
 
+    _th_invalidate_normal_forms();
     if (env->head==NULL) {
         env->head = env->tail = n;
         n->next = n->prev = NULL;
@@ -4605,6 +4750,7 @@ void _th_add_find(struct env *env, struct _ex_intern *term, struct _ex_intern *f
     //    printf("Assigning to false find\n");
     //    exit(1);
     //}
+    _th_invalidate_normal_forms();
     if (env->head==NULL) {
         env->head = env->tail = n;
         n->next = n->prev = NULL;
@@ -4656,6 +4802,7 @@ void _th_add_original(struct env *env, struct _ex_intern *term, struct _ex_inter
     //    printf("Assigning to false find\n");
     //    exit(1);
     //}
+    _th_invalidate_normal_forms();
     if (env->head==NULL) {
         env->head = env->tail = n;
         n->next = n->prev = NULL;
@@ -4702,6 +4849,7 @@ void _th_mark_bad(struct env *env, struct _ex_intern *term)
 
     //printf("n = %x\nenv->head = %x\n", n, env->head);
 
+    _th_invalidate_normal_forms();
     if (env->head==NULL) {
         env->head = env->tail = n;
         n->next = n->prev = NULL;
@@ -4773,6 +4921,7 @@ void _th_mark_inhash(struct env *env, struct _ex_intern *term)
 
     //printf("Marking in hash %d %s\n", _tree_zone, _th_print_exp(term));
 
+    _th_invalidate_normal_forms();
     if (env->head==NULL) {
         env->head = env->tail = n;
         n->next = n->prev = NULL;
@@ -4803,6 +4952,7 @@ void _th_remove_cache(struct env *env)
 #ifdef CHECK_CACHE
     env->cache_installed = 0;
 #endif
+    _th_invalidate_normal_forms();
     c = env->head;
     //printf("*** Start remove ***\n");
     while (c) {
@@ -4832,6 +4982,7 @@ void _th_remove_cache(struct env *env)
 void clean_cache(struct env *env)
 {
     struct cache_info *c;
+    _th_invalidate_normal_forms();
     c = env->head;
     while (c) {
         _th_add_cache_assignment(env,c->term,NULL);
@@ -4855,6 +5006,7 @@ void _th_install_cache(struct env *env)
     //    printf("HACK CHECK OFF\n");
     //}
 
+    _th_invalidate_normal_forms();
     c = env->tail;
     //printf("*** Start install ***\n");
     while (c) {
@@ -4933,7 +5085,7 @@ void _th_clean_cache(struct env *env)
 
 static struct root_var *find_root_var(int s, struct env *env, struct _ex_intern *var)
 {
-    int hash = (((int)var)/4)%TERM_HASH;
+    int hash = var->id%TERM_HASH;
 
     struct root_var *v = env->root_vars[hash];
 
@@ -6437,7 +6589,7 @@ int _th_term_compare(struct env *env, struct _ex_intern *term1, struct _ex_inter
         case EXP_RATIONAL:
             if (term2->type==EXP_INTEGER) return -1;
             if (term2->type!=EXP_RATIONAL) return 1;
-            return (((int)term1) < ((int)term2))?1:-1;
+            return (term1->id < term2->id)?1:-1;
         case EXP_STRING:
             if (term2->type==EXP_INTEGER || term2->type==EXP_RATIONAL) return -1;
             if (term2->type!=EXP_STRING) return 1;
@@ -6556,7 +6708,7 @@ int _th_term_cmp(struct _ex_intern **t1, struct _ex_intern **t2)
             return -1;
         } else {
             //_zone_print1("diff %d", (((int)*t2)-((int)*t1)));
-            return ((int)*t2)-((int)*t1);
+            return ((int)(*t2)->id)-((int)(*t1)->id);
         }
     }
 }
@@ -6951,6 +7103,8 @@ struct env *_th_new_empty_env(int s, int size)
 	e->max_table = (struct min_max_list **)_th_alloc(s,sizeof(struct min_max_list *) * MIN_MAX_HASH);
     e->diff_node_table = NULL;
     e->simplex = NULL;
+    e->merge_reasons = NULL;
+    e->merge_reason_count = e->merge_reason_size = 0;
 	for (i = 0; i < MIN_MAX_HASH; ++i) {
 		e->min_table[i] = e->max_table[i] = NULL;
 	}
@@ -7000,7 +7154,7 @@ static void add_to_operand_table(int s, struct env *env, struct _ex_intern *rule
 	if (_th_is_binary_term(env,e)) {
 		struct _ex_intern *l = _th_unmark_vars(env,_th_get_left_operand(env,e));
 		struct _ex_intern *r = _th_unmark_vars(env,_th_get_right_operand(env,e));
-		int hash = (((int)l)/4+((int)r)/4)%RULE_OPERAND_HASH;
+		int hash = (l->id+r->id)%RULE_OPERAND_HASH;
 		struct rule_double_operand_list *rol;
         //_zone_print_exp("Adding prop expression", e);
         //_zone_print_exp("left ",l);
@@ -7018,7 +7172,7 @@ static void add_to_operand_table(int s, struct env *env, struct _ex_intern *rule
             if (l->type != EXP_APPL || l->u.appl.functor != INTERN_NAT_PLUS) {
                 struct rule_operand_list *rol;
                 l = _th_get_core(env,l);
-                hash = (((int)l)/4)%RULE_OPERAND_HASH;
+                hash = l->id%RULE_OPERAND_HASH;
                 rol = (struct rule_operand_list *)_th_alloc(s,sizeof(struct rule_operand_list));
                 rol->next = env->rule_operand_table[hash];
                 env->rule_operand_table[hash] = rol;
@@ -7029,7 +7183,7 @@ static void add_to_operand_table(int s, struct env *env, struct _ex_intern *rule
             if (r->type != EXP_APPL || r->u.appl.functor != INTERN_NAT_PLUS) {
                 struct rule_operand_list *rol;
                 r = _th_get_core(env,r);
-                hash = (((int)r)/4)%RULE_OPERAND_HASH;
+                hash = r->id%RULE_OPERAND_HASH;
                 rol = (struct rule_operand_list *)_th_alloc(s,sizeof(struct rule_operand_list));
                 rol->next = env->rule_operand_table[hash];
                 env->rule_operand_table[hash] = rol;
@@ -7117,7 +7271,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
             //printf("    Here10\n");
             if (f->u.appl.args[0]->type==EXP_INTEGER || f->u.appl.args[0]->type==EXP_RATIONAL) {
                 struct _ex_intern *exp = _th_unmark_vars(env,f->u.appl.args[1]);
-                int hash = (((int)exp)/4)%MIN_MAX_HASH;
+                int hash = exp->id%MIN_MAX_HASH;
                 struct min_max_list *min = env->min_table[hash];
                 //fprintf(stderr, "Adding min %s\n", _th_print_exp(f));
                 while (min != NULL) {
@@ -7131,6 +7285,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
                     min->next = env->min_table[hash];
                     env->min_table[hash] = min;
                     min->exp = exp;
+                    _th_bound_changed(_th_env_bounds,exp);
                     min->value = f->u.appl.args[0];
                     if (min->value->type==EXP_INTEGER) {
                         min->value = _ex_intern_integer(_th_big_add(min->value->u.integer,_ex_one->u.integer));
@@ -7143,7 +7298,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
                 }
             } else if (f->u.appl.args[1]->type==EXP_INTEGER || f->u.appl.args[1]->type==EXP_RATIONAL) {
                 struct _ex_intern *exp = _th_unmark_vars(env,f->u.appl.args[0]);
-                int hash = (((int)exp)/4)%MIN_MAX_HASH;
+                int hash = exp->id%MIN_MAX_HASH;
                 struct min_max_list *max = env->max_table[hash];
                 //fprintf(stderr, "Adding max %s\n", _th_print_exp(f));
                 while (max != NULL) {
@@ -7157,6 +7312,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
                     max->next = env->max_table[hash];
                     env->max_table[hash] = max;
                     max->exp = exp;
+                    _th_bound_changed(_th_env_bounds,exp);
                     max->value = f->u.appl.args[1];
                     if (max->value->type==EXP_INTEGER) {
                         max->value = _ex_intern_integer(_th_big_sub(max->value->u.integer,_ex_one->u.integer));
@@ -7180,7 +7336,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
                 int hash;
                 struct min_max_list *m;
                 h = _th_unmark_vars(env,h);
-                hash = (((int)h)/4)%MIN_MAX_HASH;
+                hash = h->id%MIN_MAX_HASH;
                 m = env->max_table[hash];
                 fv = _th_get_free_vars(e, &count);
                 if (count) return;
@@ -7193,6 +7349,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
                     m->next = env->max_table[hash];
                     env->max_table[hash] = m;
                     m->exp = h;
+                    _th_bound_changed(_th_env_bounds,h);
                     m->value = g;
                     m->inclusive = 1;
                 }
@@ -7206,6 +7363,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
                     m->next = env->min_table[hash];
                     env->min_table[hash] = m;
                     m->exp = h;
+                    _th_bound_changed(_th_env_bounds,h);
                     m->value = g;
                     m->inclusive = 1;
                 }
@@ -7221,7 +7379,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
             if (f->u.appl.args[0]->type==EXP_INTEGER || f->u.appl.args[0]->type==EXP_RATIONAL) {
                 struct _ex_intern *m = f->u.appl.args[0];
                 struct _ex_intern *exp = _th_unmark_vars(env,f->u.appl.args[1]);
-                int hash = (((int)exp)/4)%MIN_MAX_HASH;
+                int hash = exp->id%MIN_MAX_HASH;
                 struct min_max_list *max = env->max_table[hash];
                 while (max != NULL) {
                     if (max->exp==exp) break;
@@ -7234,6 +7392,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
                     max->next = env->max_table[hash];
                     env->max_table[hash] = max;
                     max->exp = exp;
+                    _th_bound_changed(_th_env_bounds,exp);
                     max->value = m;
                     max->inclusive = 1;
                     //printf("Adding min %s\n", _th_print_exp(min->exp));
@@ -7242,7 +7401,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
             } else if (f->u.appl.args[1]->type==EXP_INTEGER || f->u.appl.args[1]->type==EXP_RATIONAL) {
                 struct _ex_intern *m = f->u.appl.args[1];
                 struct _ex_intern *exp = _th_unmark_vars(env,f->u.appl.args[0]);
-                int hash = (((int)exp)/4)%MIN_MAX_HASH;
+                int hash = exp->id%MIN_MAX_HASH;
                 struct min_max_list *min = env->min_table[hash];
                 while (min != NULL) {
                     if (min->exp==exp) break;
@@ -7255,6 +7414,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
                     min->next = env->min_table[hash];
                     env->min_table[hash] = min;
                     min->exp = exp;
+                    _th_bound_changed(_th_env_bounds,exp);
                     min->value = m;
                     min->inclusive = 1;
                 }
@@ -7270,7 +7430,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
         g = e->u.appl.args[1];
         h = e->u.appl.args[0];
         h = _th_unmark_vars(env,h);
-        hash = (((int)h)/4)%MIN_MAX_HASH;
+        hash = h->id%MIN_MAX_HASH;
         m = env->max_table[hash];
         while (m != NULL) {
             if (m->exp==h) break;
@@ -7281,6 +7441,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
             m->next = env->max_table[hash];
             env->max_table[hash] = m;
             m->exp = h;
+            _th_bound_changed(_th_env_bounds,h);
             m->value = g;
             m->inclusive = 1;
         }
@@ -7294,6 +7455,7 @@ static void add_to_min_max_tables(int s, struct env *env, struct _ex_intern *e)
             m->next = env->min_table[hash];
             env->min_table[hash] = m;
             m->exp = h;
+            _th_bound_changed(_th_env_bounds,h);
             m->value = g;
             m->inclusive = 1;
         }
@@ -7389,6 +7551,7 @@ static void _add_property(int s, struct env *env, struct _ex_intern *e, int prio
 
 void _th_add_property(struct env *env, struct _ex_intern *e)
 {
+    _th_invalidate_normal_forms();
     if (e->type==EXP_APPL &&
         e->u.appl.functor == INTERN_PRIORITY &&
         e->u.appl.count == 2 &&
@@ -7721,7 +7884,7 @@ int _th_add_predicate(struct env *env, struct _ex_intern *e, struct add_list **e
 
 struct _ex_intern *_th_get_first_rule_by_operands(struct env *env, struct _ex_intern *l, struct _ex_intern *r, struct rule_double_operand_list **iter)
 {
-	int hash = (((int)l)/4+((int)r)/4)%RULE_OPERAND_HASH;
+	int hash = (l->id+r->id)%RULE_OPERAND_HASH;
 	struct rule_double_operand_list *rol = env->rule_double_operand_table[hash];
 
 	while (rol) {
@@ -7752,7 +7915,7 @@ struct _ex_intern *_th_get_next_rule_by_operands(struct _ex_intern *l, struct _e
 
 struct _ex_intern *_th_get_first_rule_by_operand(struct env *env, struct _ex_intern *oper, struct rule_operand_list **iter)
 {
-	int hash = (((int)oper)/4)%RULE_OPERAND_HASH;
+	int hash = oper->id%RULE_OPERAND_HASH;
 	struct rule_operand_list *rol = env->rule_operand_table[hash];
 
 	while (rol) {
@@ -7814,7 +7977,7 @@ struct _ex_intern *_th_get_upper_bound(struct env *env, struct _ex_intern *var)
 	int hash;
 	struct min_max_list *m;
 	//var = _th_mark_vars(env,var);
-	hash = (((int)var)/4)%MIN_MAX_HASH;
+	hash = var->id%MIN_MAX_HASH;
 	m = env->max_table[hash];
 
 	while (m != NULL) {
@@ -7833,7 +7996,7 @@ struct _ex_intern *_th_get_lower_bound(struct env *env, struct _ex_intern *var)
 	int hash;
 	struct min_max_list *m;
 	//var = _th_mark_vars(env,var);
-	hash = (((int)var)/4)%MIN_MAX_HASH;
+	hash = var->id%MIN_MAX_HASH;
 	m = env->min_table[hash];
 
 	while (m != NULL) {
@@ -7849,6 +8012,7 @@ struct _ex_intern *_th_get_lower_bound(struct env *env, struct _ex_intern *var)
 
 int _th_add_context_property(struct env *env, struct _ex_intern *e)
 {
+    _th_invalidate_normal_forms();
     if (e->type==EXP_APPL &&
         e->u.appl.functor == INTERN_PRIORITY &&
         e->u.appl.count == 2 &&
@@ -8539,7 +8703,7 @@ void _th_env_init()
 
 static int cmp(const void *i1,const void *i2)
 {
-    return *((const int *)i2)-*((const int *)i1) ;
+    return ((int)(*((struct _ex_intern **)i2))->id)-((int)(*((struct _ex_intern **)i1))->id) ;
 }
 
 
@@ -9008,6 +9172,7 @@ struct diff_node *copy_diff_nodes(struct env *env, struct diff_node *d)
 	n->eq_offset = d->eq_offset;
 	n->move = NULL;
 	n->move_back = d;
+	n->impact_mark = 0;
 	d->move = n;
     n->next = copy_diff_nodes(env,d->next);
 
@@ -9117,6 +9282,7 @@ void _th_push_context_rules(struct env *env)
     env->apply_context_properties = _th_push_small(env->space,env->apply_context_properties) ;
     env->context_stack = cs ;
     cs->slack = env->slack;
+    cs->merge_reason_count = env->merge_reason_count;
 	cs->min_table = env->min_table;
 	cs->max_table = env->max_table;
     cs->diff_node_table = env->diff_node_table;
@@ -9245,6 +9411,7 @@ void _th_pop_context_rules(struct env *env)
 	add_left = add_right = add_e = NULL;
 #endif
 
+    _th_invalidate_normal_forms();
     if (env->simplex) _th_simplex_pop(env->simplex);
 
     //if (rt==NULL) rt = _th_parse(env,"(rless x_9 x_8)");
@@ -9264,6 +9431,7 @@ void _th_pop_context_rules(struct env *env)
 	env->default_type = env->context_stack->default_type;
     env->min_table = env->context_stack->min_table;
     env->max_table = env->context_stack->max_table;
+    _th_bound_reset(_th_env_bounds);
     env->diff_node_table = env->context_stack->diff_node_table;
     if (env->diff_node_table) {
 #ifdef XX
@@ -9287,6 +9455,9 @@ void _th_pop_context_rules(struct env *env)
 	env->var_solve_table = env->context_stack->var_solve_table;
     env->rewrite_chain = env->context_stack->rewrite_chain;
     env->slack = env->context_stack->slack;
+    if (env->context_stack->merge_reason_count < env->merge_reason_count) {
+        env->merge_reason_count = env->context_stack->merge_reason_count;
+    }
     env->term_groups = env->context_stack->term_groups;
     env->term_functors = env->context_stack->term_functors;
     for (i = 0; i < TERM_HASH; ++i) {
@@ -10044,10 +10215,14 @@ struct add_list *_th_rollback(struct env *env, struct _ex_intern *rule)
         env->default_type = env->context_stack->default_type;
         env->min_table = env->context_stack->min_table;
         env->max_table = env->context_stack->max_table;
+        _th_bound_reset(_th_env_bounds);
         env->rule_operand_table = env->context_stack->rule_operand_table;
         env->rule_double_operand_table = env->context_stack->rule_double_operand_table;
         env->var_solve_table = env->context_stack->var_solve_table;
         env->rewrite_chain = env->context_stack->rewrite_chain;
+        if (env->context_stack->merge_reason_count < env->merge_reason_count) {
+            env->merge_reason_count = env->context_stack->merge_reason_count;
+        }
         //fprintf(stderr, "Assigning rewrite_chain 1 %x %x\n", env, env->rewrite_chain);
         env->context_stack = env->context_stack->next;
     } else {
@@ -10074,6 +10249,7 @@ struct add_list *_th_rollback(struct env *env, struct _ex_intern *rule)
 	    for (i = 0; i < MIN_MAX_HASH; ++i) {
 		    env->min_table[i] = env->max_table[i] = NULL;
         }
+        _th_bound_reset(_th_env_bounds);
     }
 
     return a;
@@ -178,7 +178,7 @@ static int prec_compare(struct env *env, struct _ex_intern *e, struct _ex_intern
 {
     _zone_print0("comparison");
     _tree_indent();
-    if (((unsigned)e)<((unsigned)f)) {
+    if (e->id < f->id) {
         struct _ex_intern *cmp = _ex_intern_appl2_env(env,INTERN_ORDER_CACHE,e,f) ;
         if (cmp->rewrite) {
             _tree_undent();
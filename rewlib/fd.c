@@ -23,6 +23,7 @@ struct range_list {
 #define RANGE_FRAGMENTS 3
 #define RANGE_FILLED    4
 #define RANGE_NONE      5
+#define RANGE_NATIVE    6
 
 struct variable_info {
 	unsigned var;
@@ -40,7 +41,11 @@ struct variable_info {
 			unsigned bits;
 		} bits;
 		struct range_list *fragments;
-
+		struct nv {
+			int base, lo, hi, size;
+			int word_count;
+			unsigned *words;
+		} native;
 	} u;
 };
 
@@ -60,6 +65,7 @@ struct fd_handle {
 	struct variable_info *vars;
 	int constraint_count;
 	struct constraint_info *constraints;
+	int trail_mark;
 };
 
 static struct _ex_intern *new_na;
@@ -547,6 +553,8 @@ static struct _ex_intern *min_value(struct fd_handle *fd, unsigned var)
 					return add_small(fd->vars[i].u.bits.base,small_bit(fd->vars[i].u.bits.bits));
 				case RANGE_FRAGMENTS:
 					return fd->vars[i].u.fragments->low;
+				case RANGE_NATIVE:
+					return _ex_intern_small_integer(fd->vars[i].u.native.lo);
 				case RANGE_NONE:
 					return NULL;
 				default:
@@ -581,6 +589,8 @@ static struct _ex_intern *max_value(struct fd_handle *fd, unsigned var)
 						r = r->next;
 					}
 					return r->high;
+				case RANGE_NATIVE:
+					return _ex_intern_small_integer(fd->vars[i].u.native.hi);
 				default:
 					fprintf(stderr, "Internal error: max_value: Illegal range type\n");
 					exit(1);
@@ -591,355 +601,340 @@ static struct _ex_intern *max_value(struct fd_handle *fd, unsigned var)
 	exit(1);
 }
 
-static struct _ex_intern *add_values(struct _ex_intern *a, struct _ex_intern *b)
+/*
+ * Bounds of expressions over the variable domains are memoized in a
+ * bound cache (bounds.c).  The entries for a variable and the
+ * expressions above it are invalidated when its domain narrows, and the
+ * whole cache is dropped when the domains are restored.
+ */
+static struct bound_cache *bounds = NULL;
+static struct fd_handle *bounds_fd = NULL;
+
+static void fd_leaf(struct env *env, void *data, struct _ex_intern *e, struct _ex_intern **min, struct _ex_intern **max)
 {
-	return _ex_intern_integer(_th_big_add(a->u.integer,b->u.integer));
+	if (e->type==EXP_VAR) {
+		*min = min_value(bounds_fd, e->u.var);
+		*max = max_value(bounds_fd, e->u.var);
+	} else {
+		*min = *max = NULL;
+	}
 }
 
-static struct _ex_intern *res_min, *res_max;
-static void multiply_ranges(struct env *env, struct _ex_intern *min1, struct _ex_intern *min2, struct _ex_intern *max1, struct _ex_intern *max2)
+static void use_bounds(struct fd_handle *fd)
 {
-	static struct _ex_intern *zero = NULL;
+	if (bounds==NULL) bounds = _th_new_bound_cache(fd_leaf,NULL);
+	if (bounds_fd != fd) {
+		bounds_fd = fd;
+		_th_bound_reset(bounds);
+	}
+}
 
-	if (zero==NULL) zero = _ex_intern_small_integer(0);
+static void domain_changed(struct fd_handle *fd, unsigned var)
+{
+	if (bounds_fd==fd) _th_bound_changed(bounds,_ex_intern_var(var));
+}
 
-	_zone_print0("multiply ranges");
-	_tree_indent();
-	_zone_print_exp("min1 =", min1);
-	_zone_print_exp("max1 =", max1);
-	_zone_print_exp("min2 =", min2);
-	_zone_print_exp("max2 =", max2);
-    _tree_undent();
+static struct _ex_intern *compute_min(struct env *env, struct fd_handle *fd, struct _ex_intern *e)
+{
+	if (e->type==EXP_INTEGER) return e;
 
-	if ((min1==zero && max1==zero) || (min2==zero && max2==zero)) {
-		res_min = res_max = zero;
-	} else if (min2==NULL && max2==NULL) {
-		res_min = res_max = NULL;
-	} else if (min1==NULL) {
-		if (max1==NULL) {
-			res_min = res_max = NULL;
-		} else if (_th_big_is_negative(max1->u.integer)) {
-			if (min2==NULL) {
-				if (_th_big_is_negative(max2->u.integer)) {
-					res_max = NULL;
-					res_min = _ex_intern_integer(_th_big_multiply(max1->u.integer,max2->u.integer));
-				} else {
-					res_min = res_max = NULL;
-				}
-			} else if (_th_big_is_negative(min2->u.integer)) {
-				if (max2==zero || _th_big_is_negative(max2->u.integer)) {
-					res_max = NULL;
-					res_min = _ex_intern_integer(_th_big_multiply(max1->u.integer,max2->u.integer));
-				} else {
-					res_min = res_max = NULL;
-				}
-			}
-		} else {
-			if (min2==NULL || max2==NULL) {
-				res_min = res_max = NULL;
-			} else if (_th_big_is_negative(min2->u.integer) && _th_big_is_negative(max2->u.integer)) {
-				res_max = NULL;
-				res_min = _ex_intern_integer(_th_big_multiply(min2->u.integer,max1->u.integer));
-			} else if (!_th_big_is_negative(min2->u.integer) && !_th_big_is_negative(max2->u.integer)) {
-				res_min = NULL;
-				res_max = _ex_intern_integer(_th_big_multiply(max1->u.integer,max2->u.integer));
-			} else {
-				res_min = res_max = NULL;
-			}
-		}
-	} else if (_th_big_is_negative(min1->u.integer)) {
-		if (max1==NULL) {
-			if (min2==NULL || max2==NULL) {
-				res_min = res_max = NULL;
-			} else if (_th_big_is_negative(min2->u.integer) && _th_big_is_negative(max2->u.integer)) {
-				res_min = NULL;
-				res_max = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-			} else if (!_th_big_is_negative(min2->u.integer) && !_th_big_is_negative(max2->u.integer)) {
-				res_max = NULL;
-				res_min = _ex_intern_integer(_th_big_multiply(min1->u.integer,max2->u.integer));
-			} else {
-				res_min = res_max = NULL;
-			}
-		} else if (_th_big_is_negative(max1->u.integer)) {
-			if (min2 != NULL) {
-				if (_th_big_is_negative(min2->u.integer)) {
-					res_max = _ex_intern_integer(_th_big_multiply(min2->u.integer,max1->u.integer));
-				} else {
-					res_max = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-				}
-			} else {
-				res_max = NULL;
-			}
-			if (max2 != NULL) {
-				if (_th_big_is_negative(max2->u.integer)) {
-					res_min = _ex_intern_integer(_th_big_multiply(max2->u.integer,min1->u.integer));
-				} else {
-					res_min = _ex_intern_integer(_th_big_multiply(max2->u.integer,max1->u.integer));
-				}
-			} else {
-				res_min = NULL;
-			}
-		} else {
-			if (min2==NULL || max2==NULL) {
-				res_min = res_max = NULL;
-			} else {
-				if (_th_big_is_negative(min2->u.integer)) {
-					if (_th_big_is_negative(max2->u.integer)) {
-						res_min = _ex_intern_integer(_th_big_multiply(max1->u.integer,min2->u.integer));
-						res_max = _ex_intern_integer(_th_big_multiply(min1->u.integer,min2->u.integer));
-					} else {
-						struct _ex_intern *c1, *c2;
-						c1 = _ex_intern_integer(_th_big_multiply(max1->u.integer,max2->u.integer));
-						c2 = _ex_intern_integer(_th_big_multiply(min1->u.integer,min2->u.integer));
-						if (_th_big_less(c1->u.integer,c2->u.integer)) {
-							res_max = c2;
-						} else {
-							res_max = c1;
-						}
-						c1 = _ex_intern_integer(_th_big_multiply(max1->u.integer,min2->u.integer));
-						c2 = _ex_intern_integer(_th_big_multiply(min1->u.integer,max2->u.integer));
-						if (_th_big_less(c1->u.integer,c2->u.integer)) {
-							res_min = c1;
-						} else {
-							res_min = c2;
-						}
-					}
-				} else {
-					res_min = _ex_intern_integer(_th_big_multiply(min1->u.integer,max2->u.integer));
-					res_max = _ex_intern_integer(_th_big_multiply(max1->u.integer,max2->u.integer));
-				}
-			}
-		}
-	} else {
-		if (max1==NULL) {
-			if (min2 != NULL) {
-				if (max2 != NULL) {
-					if (_th_big_is_negative(min2->u.integer) && _th_big_is_negative(max2->u.integer)) {
-						res_max = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-						res_min = NULL;
-					} else if (!_th_big_is_negative(min2->u.integer) && !_th_big_is_negative(max2->u.integer)) {
-						res_max = NULL;
-						res_min = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-					} else {
-						res_min = res_max = NULL;
-					}
-				} else {
-					if (_th_big_is_negative(min2->u.integer)) {
-						res_min = res_max = NULL;
-					} else {
-					    res_min = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-                        res_max = NULL;
-					}
-				}
-			} else {
-				if (!_th_big_is_negative(max2->u.integer)) {
-					res_min = res_max = NULL;
-				} else {
-				    res_max = _ex_intern_integer(_th_big_multiply(max2->u.integer,min1->u.integer));
-					res_min = NULL;
-				}
-			}
-		} else {
-			if (min2 != NULL) {
-				if (_th_big_is_negative(min2->u.integer)) {
-					res_min = _ex_intern_integer(_th_big_multiply(min2->u.integer,max1->u.integer));
-				} else {
-					res_min = _ex_intern_integer(_th_big_multiply(min2->u.integer,min1->u.integer));
-				}
-			}
-			if (max2 != NULL) {
-				if (_th_big_is_negative(max2->u.integer)) {
-					res_max = _ex_intern_integer(_th_big_multiply(max2->u.integer,min1->u.integer));
-				} else {
-					res_max = _ex_intern_integer(_th_big_multiply(max2->u.integer,max1->u.integer));
-				}
-			}
+	use_bounds(fd);
+	return _th_bound_min(env,bounds,e);
+}
+
+static struct _ex_intern *compute_max(struct env *env, struct fd_handle *fd, struct _ex_intern *e)
+{
+	if (e->type==EXP_INTEGER) return e;
+
+	use_bounds(fd);
+	return _th_bound_max(env,bounds,e);
+}
+
+static unsigned bit_mask[33] = {
+    0x1, 0x3, 0x7, 0xf, 0x1f, 0x3f, 0x7f, 0xff,
+    0x1ff, 0x3ff, 0x7ff, 0xfff, 0x1fff, 0x3fff, 0x7fff, 0xffff,
+	0x1ffff, 0x3ffff, 0x7ffff, 0xfffff, 0x1fffff, 0x3fffff, 0x7fffff, 0xffffff,
+	0x1ffffff, 0x3ffffff, 0x7ffffff, 0xfffffff, 0x1fffffff, 0x3fffffff, 0x7fffffff,0xffffffff };
+
+/*
+ * Native domains
+ *
+ * A variable whose bounds are known and fit in a machine word gets a
+ * RANGE_NATIVE domain: a bitset over [base, base+32*word_count) plus
+ * the current lo, hi and size.  Pruning the domain is then a few word
+ * operations and needs no interned terms.  Once a single value is left
+ * the variable is switched to RANGE_FILLED so the rest of the solver
+ * sees the usual form.
+ *
+ * The words of a domain are shared by all copies made by _fd_push.
+ * Every change to a word is recorded on the trail, and _fd_revert and
+ * _fd_pop undo the changes made since the matching _fd_push.  lo, hi
+ * and size live in the variable_info, which _fd_push copies anyway.
+ */
+#define FD_NATIVE_LIMIT 65536
+
+static unsigned **trail_words = NULL;
+static unsigned *trail_values = NULL;
+static int trail_count = 0, trail_size = 0;
+
+static int *queue = NULL;
+static int queue_head, queue_count, queue_size = 0;
+
+static void set_word(unsigned *w, unsigned value)
+{
+	if (*w==value) return;
+
+	if (trail_count==trail_size) {
+		trail_size = trail_size * 2 + 1024;
+		trail_words = (unsigned **)REALLOC(trail_words,sizeof(unsigned *) * trail_size);
+		trail_values = (unsigned *)REALLOC(trail_values,sizeof(unsigned) * trail_size);
+		if (trail_words==NULL || trail_values==NULL) {
+			printf("Error in REALLOC\n");
+			exit(1);
 		}
 	}
+	trail_words[trail_count] = w;
+	trail_values[trail_count++] = *w;
+	*w = value;
 }
 
-static void divide_ranges(struct env *env, struct _ex_intern *min1, struct _ex_intern *max1, struct _ex_intern *min2, struct _ex_intern *max2)
+static void undo_trail(int mark)
 {
-	static struct _ex_intern *zero = NULL;
+	while (trail_count > mark) {
+		--trail_count;
+		*trail_words[trail_count] = trail_values[trail_count];
+	}
+}
 
-	if (zero==NULL) zero = _ex_intern_small_integer(0);
+static int bit_count(unsigned w)
+{
+	w = w - ((w >> 1) & 0x55555555);
+	w = (w & 0x33333333) + ((w >> 2) & 0x33333333);
+	w = (w + (w >> 4)) & 0x0f0f0f0f;
+	return (w * 0x01010101) >> 24;
+}
 
-	_zone_print_exp("divide min1", min1);
-	_zone_print_exp("divide max1", max1);
-	_zone_print_exp("divide min2", min2);
-	_zone_print_exp("divide max2", max2);
+/*
+ * Converts an integer term to an int, clamping values that do not fit
+ * in a word.
+ */
+static int small_value(struct _ex_intern *e)
+{
+	if (e->u.integer[0]==1) return (int)e->u.integer[1];
+	return _th_big_is_negative(e->u.integer) ? -0x7fffffff : 0x7fffffff;
+}
 
-    if (max2 != NULL && _th_big_is_negative(max2->u.integer) && (min2==NULL || _th_big_is_negative(min2->u.integer))) {
-		if (min1==NULL) {
-			res_max = NULL;
-		} else {
-		    res_max = _ex_intern_integer(_th_big_divide(min1->u.integer, max2->u.integer));
-		}
-		if (max1==NULL) {
-			res_min = NULL;
-		} else {
-		    res_min = _ex_intern_integer(_th_big_divide(max1->u.integer, max2->u.integer));
-		}
-	} else if (min2 != NULL && !_th_big_is_negative(min2->u.integer) && min2 != zero) {
-		if (min1==NULL) {
-			res_min = NULL;
-		} else {
-		    res_min = _ex_intern_integer(_th_big_divide(min1->u.integer, min2->u.integer));
-		}
-		if (max1==NULL) {
-			res_max = NULL;
-		} else {
-		    res_max = _ex_intern_integer(_th_big_divide(max1->u.integer, min2->u.integer));
+static int init_native(struct variable_info *info, struct _ex_intern *min, struct _ex_intern *max)
+{
+	int lo, hi, i;
+
+	if (min==NULL || max==NULL || min->u.integer[0] != 1 || max->u.integer[0] != 1) return 0;
+
+	lo = (int)min->u.integer[1];
+	hi = (int)max->u.integer[1];
+	if (hi < lo || (unsigned)(hi - lo) >= FD_NATIVE_LIMIT) return 0;
+
+	info->range_type = RANGE_NATIVE;
+	info->u.native.base = lo;
+	info->u.native.lo = lo;
+	info->u.native.hi = hi;
+	info->u.native.size = hi - lo + 1;
+	info->u.native.word_count = (hi - lo) / 32 + 1;
+	info->u.native.words = (unsigned *)_th_alloc(REWRITE_SPACE,sizeof(unsigned) * info->u.native.word_count);
+	for (i = 0; i < info->u.native.word_count; ++i) {
+		info->u.native.words[i] = 0xffffffff;
+	}
+	info->u.native.words[i-1] = bit_mask[(hi - lo) % 32];
+
+	return 1;
+}
+
+static int native_contains(struct variable_info *info, int value)
+{
+	unsigned d;
+
+	if (value < info->u.native.lo || value > info->u.native.hi) return 0;
+	d = (unsigned)(value - info->u.native.base);
+
+	return (info->u.native.words[d / 32] >> (d % 32)) & 1;
+}
+
+/*
+ * Recomputes lo and hi after bits have been cleared and switches to
+ * RANGE_NONE or RANGE_FILLED when at most one value is left.
+ */
+static void native_bounds(struct variable_info *info)
+{
+	unsigned *words = info->u.native.words;
+	unsigned d, w;
+
+	if (info->u.native.size==0) {
+		info->range_type = RANGE_NONE;
+		return;
+	}
+
+	d = (unsigned)(info->u.native.lo - info->u.native.base);
+	w = words[d / 32] >> (d % 32);
+	while (w==0) {
+		d = (d / 32 + 1) * 32;
+		w = words[d / 32];
+	}
+	while ((w & 1)==0) {
+		w >>= 1;
+		++d;
+	}
+	info->u.native.lo = info->u.native.base + (int)d;
+
+	d = (unsigned)(info->u.native.hi - info->u.native.base);
+	w = words[d / 32] & bit_mask[d % 32];
+	while (w==0) {
+		d = (d / 32) * 32 - 1;
+		w = words[d / 32];
+	}
+	d = (d / 32) * 32 + large_bit(w);
+	info->u.native.hi = info->u.native.base + (int)d;
+
+	if (info->u.native.size==1) {
+		info->range_type = RANGE_FILLED;
+		info->u.range.min = info->u.range.max = _ex_intern_small_integer(info->u.native.lo);
+	}
+}
+
+/*
+ * Clears the values in [low, high] without updating lo and hi.
+ * Returns the number of values removed.
+ */
+static int clear_range(struct variable_info *info, int low, int high)
+{
+	unsigned a, b, k, mask, w;
+	int removed = 0;
+
+	if (low < info->u.native.lo) low = info->u.native.lo;
+	if (high > info->u.native.hi) high = info->u.native.hi;
+	if (high < low) return 0;
+
+	a = (unsigned)(low - info->u.native.base);
+	b = (unsigned)(high - info->u.native.base);
+	for (k = a / 32; k <= b / 32; ++k) {
+		mask = 0xffffffff;
+		if (k==a / 32) mask &= ~((1u << (a % 32)) - 1);
+		if (k==b / 32) mask &= bit_mask[b % 32];
+		w = info->u.native.words[k];
+		if (w & mask) {
+			removed += bit_count(w & mask);
+			set_word(&info->u.native.words[k], w & ~mask);
 		}
-	} else {
-		res_min = min1;
-		res_max = max1;
 	}
+	info->u.native.size -= removed;
+
+	return removed;
 }
 
-static struct _ex_intern *compute_max(struct env *env, struct fd_handle *fd, struct _ex_intern *e);
+static int native_clear(struct variable_info *info, int low, int high)
+{
+	if (clear_range(info, low, high)==0) return 0;
+	native_bounds(info);
 
-static struct _ex_intern *compute_min(struct env *env, struct fd_handle *fd, struct _ex_intern *e)
+	return 1;
+}
+
+static int native_restrict(struct variable_info *info, int min, int max)
 {
-	struct _ex_intern *total, *r, *rm, *total_max;
-	int i;
+	int removed = 0;
 
-	switch (e->type) {
-	    case EXP_INTEGER:
-			return e;
-		case EXP_VAR:
-			return min_value(fd, e->u.var);
-		case EXP_APPL:
-			switch (e->u.appl.functor) {
-			    case INTERN_NAT_PLUS:
-					_zone_print0("plus min");
-					_tree_indent();
-					total = compute_min(env,fd,e->u.appl.args[0]);
-					_tree_undent();
-					_zone_print1("total =", total);
-					if (total==NULL) return NULL;
-					for (i = 1; i < e->u.appl.count; ++i) {
-						_tree_indent();
-						r = compute_min(env,fd,e->u.appl.args[i]);
-						_tree_undent();
-						_zone_print_exp("r =", r);
-						if (r==NULL) return NULL;
-						total = add_values(total, r);
-					}
-					return total;
-				case INTERN_NAT_TIMES:
-					_zone_print0("times min");
-					_tree_indent();
-					total = compute_min(env,fd,e->u.appl.args[0]);
-					total_max = compute_max(env,fd,e->u.appl.args[0]);
-					_tree_undent();
-					_zone_print_exp("total =", total);
-					_zone_print_exp("total_max =", total_max);
-					for (i = 1; i < e->u.appl.count; ++i) {
-						if (total==NULL && total_max==NULL) return NULL;
-						_tree_indent();
-						r = compute_min(env,fd,e->u.appl.args[i]);
-						rm = compute_max(env,fd,e->u.appl.args[i]);
-						_tree_undent();
-						_zone_print_exp("r =", r);
-						_zone_print_exp("rm =", rm);
-						multiply_ranges(env,r,total,rm,total_max);
-						_zone_print_exp("res_min =", res_min);
-						_zone_print_exp("res_max =", res_max);
-						total = res_min;
-						total_max = res_max;
-					}
-					return total;
-				case INTERN_NAT_DIVIDE:
-					_zone_print0("divide");
-					_tree_indent();
-					divide_ranges(env,compute_min(env,fd,e->u.appl.args[0]),
-						              compute_max(env,fd,e->u.appl.args[0]),
-						              compute_min(env,fd,e->u.appl.args[1]),
-						              compute_max(env,fd,e->u.appl.args[1]));
-					_tree_undent();
-					return res_min;
-				default:
-					return NULL;
-			}
-		default:
-			return NULL;
+	if (min > info->u.native.lo) removed += clear_range(info, info->u.native.lo, min - 1);
+	if (max < info->u.native.hi) removed += clear_range(info, max + 1, info->u.native.hi);
+	if (removed==0) return 0;
+	native_bounds(info);
+
+	return 1;
+}
+
+/*
+ * Keeps only the values whose bit is set in mask, which is laid out
+ * like the words of the domain.
+ */
+static int native_and(struct variable_info *info, unsigned *mask)
+{
+	unsigned k, w;
+	int removed = 0;
+
+	for (k = 0; k < (unsigned)info->u.native.word_count; ++k) {
+		w = info->u.native.words[k];
+		if (w & ~mask[k]) {
+			removed += bit_count(w & ~mask[k]);
+			set_word(&info->u.native.words[k], w & mask[k]);
+		}
 	}
+	if (removed==0) return 0;
+
+	info->u.native.size -= removed;
+	native_bounds(info);
+
+	return 1;
 }
 
-static struct _ex_intern *compute_max(struct env *env, struct fd_handle *fd, struct _ex_intern *e)
+/*
+ * Returns the 32 bits of the domain starting at value start.  Values
+ * outside of the domain read as 0.
+ */
+static unsigned native_bits(struct variable_info *info, int start)
 {
-	struct _ex_intern *total, *r, *rm, *total_max;
-	int i;
+	int d = start - info->u.native.base;
+	int k, s;
+	unsigned lo, hi;
 
-	switch (e->type) {
-	    case EXP_INTEGER:
-			return e;
-		case EXP_VAR:
-			return max_value(fd, e->u.var);
-		case EXP_APPL:
-			switch (e->u.appl.functor) {
-			    case INTERN_NAT_PLUS:
-					_zone_print0("plus max");
-					_tree_indent();
-					total = compute_max(env,fd,e->u.appl.args[0]);
-					_tree_undent();
-					_zone_print_exp("total =", total);
-					if (total==NULL) return NULL;
-					for (i = 1; i < e->u.appl.count; ++i) {
-						_tree_indent();
-						r = compute_max(env,fd,e->u.appl.args[i]);
-						_tree_undent();
-						_zone_print_exp("r =", r);
-						if (r==NULL) return NULL;
-						total = add_values(total, r);
-					}
-					return total;
-				case INTERN_NAT_TIMES:
-					_zone_print0("compute times max");
-					_tree_indent();
-					total = compute_min(env,fd,e->u.appl.args[0]);
-					total_max = compute_max(env,fd,e->u.appl.args[0]);
-					_tree_undent();
-					_zone_print_exp("total =", total);
-					_zone_print_exp("total_max =", total_max);
-					for (i = 1; i < e->u.appl.count; ++i) {
-						if (total==NULL && total_max==NULL) return NULL;
-						_tree_indent();
-						r = compute_min(env,fd,e->u.appl.args[i]);
-						rm = compute_max(env,fd,e->u.appl.args[i]);
-						_tree_undent();
-						_zone_print_exp("r =", r);
-						_zone_print_exp("rm ", rm);
-						multiply_ranges(env,r,total,rm,total_max);
-						_zone_print_exp("res_min =", res_min);
-						_zone_print_exp("res_max =", res_max);
-						total = res_min;
-						total_max = res_max;
-					}
-					return total_max;
-				case INTERN_NAT_DIVIDE:
-					_zone_print0("divide_ranges max");
-					_tree_indent();
-					divide_ranges(env,compute_min(env,fd,e->u.appl.args[0]),
-						              compute_max(env,fd,e->u.appl.args[0]),
-						              compute_min(env,fd,e->u.appl.args[1]),
-						              compute_max(env,fd,e->u.appl.args[1]));
-					_tree_undent();
-					return res_max;
-				default:
-					return NULL;
-			}
-		default:
-			return NULL;
+	if (d <= -32 || d >= info->u.native.word_count * 32) return 0;
+
+	k = (d >= 0) ? d / 32 : -1;
+	s = d - k * 32;
+	lo = (k >= 0) ? info->u.native.words[k] : 0;
+	hi = (k + 1 < info->u.native.word_count) ? info->u.native.words[k+1] : 0;
+
+	if (s==0) return lo;
+	return (lo >> s) | (hi << (32 - s));
+}
+
+/*
+ * Restricts var to values x such that x - offset is in the domain of vi.
+ * Both domains must be native.
+ */
+static int native_restrict_variable(struct variable_info *var, struct variable_info *vi, int offset)
+{
+	unsigned *mask = (unsigned *)ALLOCA(sizeof(unsigned) * var->u.native.word_count);
+	int k;
+
+	for (k = 0; k < var->u.native.word_count; ++k) {
+		mask[k] = native_bits(vi, var->u.native.base + k * 32 - offset);
 	}
+
+	return native_and(var, mask);
 }
 
-static unsigned bit_mask[33] = {
-    0x1, 0x3, 0x7, 0xf, 0x1f, 0x3f, 0x7f, 0xff,
-    0x1ff, 0x3ff, 0x7ff, 0xfff, 0x1fff, 0x3fff, 0x7fff, 0xffff,
-	0x1ffff, 0x3ffff, 0x7ffff, 0xfffff, 0x1fffff, 0x3fffff, 0x7fffff, 0xffffff,
-	0x1ffffff, 0x3ffffff, 0x7ffffff, 0xfffffff, 0x1fffffff, 0x3fffffff, 0x7fffffff,0xffffffff };
+static int native_value_n(struct variable_info *info, int n)
+{
+	unsigned k, w;
+	int c;
+
+	for (k = 0; k < (unsigned)info->u.native.word_count; ++k) {
+		w = info->u.native.words[k];
+		c = bit_count(w);
+		if (n < c) {
+			int d = 0;
+			while (1) {
+				if (w & 1) {
+					if (n==0) return info->u.native.base + (int)k * 32 + d;
+					--n;
+				}
+				w >>= 1;
+				++d;
+			}
+		}
+		n -= c;
+	}
+
+	return info->u.native.hi + 1;
+}
 
 static int restrict_range(struct variable_info *info, struct _ex_intern *min, struct _ex_intern *max)
 {
@@ -1010,6 +1005,10 @@ static int restrict_range(struct variable_info *info, struct _ex_intern *min, st
 				f->high = max;
 			}
 			return range_changed;
+		case RANGE_NATIVE:
+			return native_restrict(info,
+			                       (min==NULL) ? info->u.native.lo : small_value(min),
+			                       (max==NULL) ? info->u.native.hi : small_value(max));
 		case RANGE_BITS:
 			if (max != NULL && _th_big_less(max->u.integer,info->u.bits.base->u.integer)) {
 				info->range_type = RANGE_NONE;
@@ -1079,6 +1078,8 @@ static int contains_value(struct variable_info *info, struct _ex_intern *value)
 				//_zone_print3("testing bits %x %d %x\n", info->u.bits.bits, d[1], (info->u.bits.bits>>d[1]));
 				return d[0]==1 && d[1] < 32 && ((info->u.bits.bits>>d[1])&1);
 			}
+		case RANGE_NATIVE:
+			return value->u.integer[0]==1 && native_contains(info,(int)value->u.integer[1]);
 		default:
 			fprintf(stderr, "contains_value: Internal error: Illegal range_type\n");
 			exit(1);
@@ -1215,12 +1216,40 @@ static int restrict_bits(struct variable_info *info, struct _ex_intern *base, un
 			}
 	        info->u.bits.base = _ex_intern_integer(_th_big_add(info->u.bits.base->u.integer,increment));
 			return range_changed;
+		case RANGE_NATIVE:
+			if (bits==0 || base->u.integer[0] != 1) {
+				info->range_type = RANGE_NONE;
+				return 1;
+			} else {
+				int b = (int)base->u.integer[1], k, shift;
+				unsigned *mask = (unsigned *)ALLOCA(sizeof(unsigned) * info->u.native.word_count);
+				for (k = 0; k < info->u.native.word_count; ++k) {
+					shift = info->u.native.base + k * 32 - b;
+					if (shift >= 32 || shift <= -32) {
+						mask[k] = 0;
+					} else if (shift >= 0) {
+						mask[k] = bits >> shift;
+					} else {
+						mask[k] = bits << -shift;
+					}
+				}
+				return native_and(info, mask);
+			}
 		default:
 			fprintf(stderr, "restrict_bits: Internal error: Illegal range_type\n");
 			exit(1);
 	}
 }
 
+static int shifted_value(struct _ex_intern *e, int offset)
+{
+	long long v = (long long)small_value(e) + offset;
+
+	if (v > 0x7fffffff) return 0x7fffffff;
+	if (v < -0x7fffffff) return -0x7fffffff;
+	return (int)v;
+}
+
 static int restrict_range_list(struct variable_info *info, struct range_list *list, struct _ex_intern *offset)
 {
 	struct range_list *f, *fn, *fs, *fp;
@@ -1389,6 +1418,35 @@ static int restrict_range_list(struct variable_info *info, struct range_list *li
 				return 0;
 			}
 
+		case RANGE_NATIVE:
+			/*
+			 * Clear the gaps between the fragments, from the lowest
+			 * value up.
+			 */
+			{
+				int o = small_value(offset), next = info->u.native.lo, low, removed = 0;
+				while (list != NULL) {
+					if (list->low != NULL) {
+						low = shifted_value(list->low,o);
+						if (low > next) removed += clear_range(info, next, low - 1);
+					}
+					if (list->high==NULL) {
+						next = 0x7fffffff;
+						break;
+					}
+					next = shifted_value(list->high,o);
+					if (next==0x7fffffff) break;
+					++next;
+					list = list->next;
+				}
+				if (next <= info->u.native.hi) removed += clear_range(info, next, info->u.native.hi);
+				if (removed) {
+					native_bounds(info);
+					range_changed = 1;
+				}
+			}
+			return range_changed;
+
 		default:
 			fprintf(stderr, "restrict_range_list: Internal error: illegal range type\n");
 			exit(1);
@@ -1504,6 +1562,9 @@ static int exclude_value(struct variable_info *info, struct _ex_intern *value)
 				f = f->next;
 			}
 			return 0;
+		case RANGE_NATIVE:
+			if (value->u.integer[0] != 1) return 0;
+			return native_clear(info, (int)value->u.integer[1], (int)value->u.integer[1]);
 		default:
 			fprintf(stderr, "restrict_range_list: Internal error: illegal range type\n");
 			exit(1);
@@ -1517,12 +1578,20 @@ static int restrict_variable(struct variable_info *var, struct variable_info *vi
 	    case RANGE_NONE:
 			return 0;
 		case RANGE_FILLED:
-			if (contains_value(var,vi->u.range.min)) {
-				return 0;
+			min = _ex_intern_integer(_th_big_add(vi->u.range.min->u.integer,offset->u.integer));
+			if (contains_value(var,min)) {
+				return restrict_range(var,min,min);
 			} else {
 				var->range_type = RANGE_NONE;
 				return 1;
 			}
+		case RANGE_NATIVE:
+			if (var->range_type==RANGE_NATIVE && offset->u.integer[0]==1) {
+				return native_restrict_variable(var,vi,(int)offset->u.integer[1]);
+			}
+			min = _ex_intern_integer(_th_big_add(_ex_intern_small_integer(vi->u.native.lo)->u.integer,offset->u.integer));
+			max = _ex_intern_integer(_th_big_add(_ex_intern_small_integer(vi->u.native.hi)->u.integer,offset->u.integer));
+			return restrict_range(var,min,max);
 		case RANGE_BITS:
 			return restrict_bits(var,
 				       _ex_intern_integer(_th_big_add(vi->u.bits.base->u.integer,offset->u.integer)),
@@ -1574,6 +1643,9 @@ void _print_range(struct variable_info *var)
 	    case RANGE_FILLED:
 		    _tree_print_exp("exact value", var->u.range.min);
 		    break;
+	    case RANGE_NATIVE:
+		    _tree_print3("%d..%d (%d values)", var->u.native.lo, var->u.native.hi, var->u.native.size);
+		    break;
 		case RANGE_NONE:
 			_tree_print0("No legal value");
 			break;
@@ -1634,12 +1706,36 @@ struct _ex_intern *_fd_get_value_count(struct env *env, struct fd_handle *fd, un
 				bits >>= 1;
 			}
 			return _ex_intern_small_integer(i);
+		case RANGE_NATIVE:
+			return _ex_intern_small_integer(v->u.native.size);
 		default:
 			fprintf(stderr, "Internal error: _fd_get_value_count: Illegal range type\n");
 			exit(1);
 	}
 }
 
+/*
+ * Returns the number of values left for var, or -1 if the domain is
+ * unbounded or too large to count in an int.
+ */
+int _fd_get_size(struct env *env, struct fd_handle *fd, unsigned var)
+{
+	struct _ex_intern *count;
+	int i;
+
+	for (i = 0; i < fd->var_count; ++i) {
+		if (fd->vars[i].var==var) {
+			if (fd->vars[i].range_type==RANGE_NATIVE) return fd->vars[i].u.native.size;
+			break;
+		}
+	}
+
+	count = _fd_get_value_count(env,fd,var);
+	if (count==NULL || count->u.integer[0] != 1 || count->u.integer[1] >= 0x7fffffff) return -1;
+
+	return (int)count->u.integer[1];
+}
+
 static int equal_ranges(struct variable_info *var1, struct variable_info *var2)
 {
 	struct range_list *f1, *f2;
@@ -1667,6 +1763,9 @@ static int equal_ranges(struct variable_info *var1, struct variable_info *var2)
 			}
 			if (f1 || f2) return 0;
 			return 1;
+		case RANGE_NATIVE:
+			return var1->u.native.words==var2->u.native.words &&
+				   var1->u.native.size==var2->u.native.size;
 		default:
 			return 0;
 	}
@@ -1957,6 +2056,7 @@ static int exact_restriction(struct fd_handle *fd, struct env *env, struct const
 	int *indices, i;
     char *mark;
     struct _ex_intern *r;
+    unsigned *keep = NULL;
 	mark = _th_alloc_mark(MATCH_SPACE);
 
 	_zone_print0("Exact restriction");
@@ -1969,6 +2069,10 @@ static int exact_restriction(struct fd_handle *fd, struct env *env, struct const
 	}
 
 	old_var = *var;
+	if (old_var.range_type==RANGE_NATIVE) {
+		keep = (unsigned *)ALLOCA(sizeof(unsigned) * old_var.u.native.word_count);
+		memset(keep, 0, sizeof(unsigned) * old_var.u.native.word_count);
+	}
 	var->range_type = RANGE_NONE;
 	i = 0;
 	while (i < ci->var_count) {
@@ -1996,7 +2100,12 @@ static int exact_restriction(struct fd_handle *fd, struct env *env, struct const
 		}
 		if (contains_value(&old_var,r)) {
 			_zone_print_exp("Adding value", r);
-			add_value(var,r);
+			if (keep) {
+				unsigned d = (unsigned)((int)r->u.integer[1] - old_var.u.native.base);
+				keep[d / 32] |= (1u << (d % 32));
+			} else {
+				add_value(var,r);
+			}
 #ifndef FAST
             if (_zone_active() && !strcmp(_th_intern_decode(var->var),"d")) {
 			    _tree_indent();
@@ -2021,6 +2130,10 @@ static int exact_restriction(struct fd_handle *fd, struct env *env, struct const
 	_th_alloc_release(MATCH_SPACE, mark);
 
 	_tree_undent();
+	if (keep) {
+		*var = old_var;
+		return native_and(var,keep);
+	}
 	return !equal_ranges(var,&old_var);
 }
 
@@ -2044,11 +2157,54 @@ static int combination_count(struct fd_handle *fd, struct env *env, struct const
 
 int _fd_combination_limit = 10000;
 
+static void schedule(struct fd_handle *fd, int c)
+{
+	if (fd->constraints[c].needs_propagation) return;
+	fd->constraints[c].needs_propagation = 1;
+	queue[(queue_head + queue_count++) % queue_size] = c;
+}
+
+/*
+ * Recognizes a right hand side of the form y, y+c or c+y where y has a
+ * native domain.  Returns the variable info for y and sets offset to c.
+ */
+static struct variable_info *offset_form(struct fd_handle *fd, struct constraint_info *ci, struct _ex_intern *rhs, struct _ex_intern **offset)
+{
+	struct _ex_intern *y;
+	int i;
+
+	if (rhs->type==EXP_VAR) {
+		y = rhs;
+		*offset = _ex_intern_small_integer(0);
+	} else if (rhs->type==EXP_APPL && rhs->u.appl.functor==INTERN_NAT_PLUS && rhs->u.appl.count==2) {
+		if (rhs->u.appl.args[0]->type==EXP_INTEGER && rhs->u.appl.args[1]->type==EXP_VAR) {
+			y = rhs->u.appl.args[1];
+			*offset = rhs->u.appl.args[0];
+		} else if (rhs->u.appl.args[1]->type==EXP_INTEGER && rhs->u.appl.args[0]->type==EXP_VAR) {
+			y = rhs->u.appl.args[0];
+			*offset = rhs->u.appl.args[1];
+		} else {
+			return NULL;
+		}
+	} else {
+		return NULL;
+	}
+
+	for (i = 0; i < ci->var_count; ++i) {
+		if (fd->vars[ci->vars[i]].var==y->u.var) {
+			if (fd->vars[ci->vars[i]].range_type != RANGE_NATIVE) return NULL;
+			return &fd->vars[ci->vars[i]];
+		}
+	}
+
+	return NULL;
+}
+
 static int propagate_constraint(struct fd_handle *fd, struct env *env, struct constraint_info *ci)
 {
-	struct _ex_intern *e = ci->constraint, *rhs, *min, *max;
+	struct _ex_intern *e = ci->constraint, *rhs, *min, *max, *offset;
     int change;
-    struct variable_info *var;
+    struct variable_info *var, *vi;
     static unsigned increment[2] = { 1, 1 };
 	unsigned v;
     int vindex, i, count;
@@ -2097,6 +2253,14 @@ static int propagate_constraint(struct fd_handle *fd, struct env *env, struct co
 		    break;
 	    case INTERN_EQUAL:
 		case INTERN_ORIENTED_RULE:
+			/*
+			 * x = y + c on native domains is a shifted intersection,
+			 * which is exact and much cheaper than enumerating.
+			 */
+			if (var->range_type==RANGE_NATIVE && (vi = offset_form(fd,ci,rhs,&offset)) != NULL) {
+				change = restrict_variable(var,vi,offset);
+				goto cont;
+			}
 			if (combination_count(fd,env,ci) <= _fd_combination_limit) {
 				//printf("Combination count %d\n", combination_count(fd,env,ci));
 				change = exact_restriction(fd,env,ci);
@@ -2160,8 +2324,9 @@ cont:
 			_print_range(var);
 		}
 #endif
+		domain_changed(fd,var->var);
 		for (i = 0; i < var->effects_count; ++i) {
-			fd->constraints[var->effects_constraint[i]].needs_propagation = 1;
+			schedule(fd,var->effects_constraint[i]);
 		}
 		if (var->range_type==RANGE_FILLED) {
 		    struct _ex_unifier *u = _th_new_unifier(REWRITE_SPACE);
@@ -2180,18 +2345,26 @@ cont:
 	return 0;
 }
 
+/*
+ * Propagates the scheduled constraints until the queue is empty.  A
+ * constraint is only queued once, so the queue never holds more than
+ * constraint_count entries.
+ */
 static int propagate_constraints(struct env *env, struct fd_handle *fd)
 {
-	int i, changed;
-
-	changed = 1;
-	while (changed) {
-		changed = 0;
-		for (i = 0; i < fd->constraint_count; ++i) {
-			if (fd->constraints[i].needs_propagation) {
-				if (propagate_constraint(fd,env,&fd->constraints[i])) return 1;
-				changed = 1;
+	int c;
+
+	while (queue_count > 0) {
+		c = queue[queue_head];
+		queue_head = (queue_head + 1) % queue_size;
+		--queue_count;
+		if (propagate_constraint(fd,env,&fd->constraints[c])) {
+			while (queue_count > 0) {
+				fd->constraints[queue[queue_head]].needs_propagation = 0;
+				queue_head = (queue_head + 1) % queue_size;
+				--queue_count;
 			}
+			return 1;
 		}
 	}
 	return 0;
@@ -2249,7 +2422,7 @@ struct fd_handle *_fd_solve(struct env *env, struct _ex_intern *exp)
 	unsigned *fv, *vars;
     int count, i, j, k, ccount, l, m;
     struct fd_handle *fd;
-    struct _ex_intern **args, *na, *e;
+    struct _ex_intern **args, *na, *e, *min, *max;
     struct _ex_intern *context_rules = _th_get_context_rule_set(env);
 
 	_zone_print0("fd solve");
@@ -2351,9 +2524,32 @@ cont:;
 cont2:;
 		}
         fd->vars[i].effects_count = k;
-		fd->vars[i].range_type = RANGE_MIN_MAX;
-		fd->vars[i].u.range.min = _th_get_min(env,context_rules,exp,fd->vars[i].var);
-		fd->vars[i].u.range.max = _th_get_max(env,context_rules,exp,fd->vars[i].var);
+		min = _th_get_min(env,context_rules,exp,fd->vars[i].var);
+		max = _th_get_max(env,context_rules,exp,fd->vars[i].var);
+		if (min==NULL) min = _th_env_bound_min(env,_ex_intern_var(fd->vars[i].var));
+		if (max==NULL) max = _th_env_bound_max(env,_ex_intern_var(fd->vars[i].var));
+		if (!init_native(&fd->vars[i],min,max)) {
+			fd->vars[i].range_type = RANGE_MIN_MAX;
+			fd->vars[i].u.range.min = min;
+			fd->vars[i].u.range.max = max;
+		}
+	}
+
+	trail_count = 0;
+	fd->trail_mark = 0;
+	bounds_fd = NULL;
+	if (queue_size < fd->constraint_count) {
+		queue_size = fd->constraint_count;
+		queue = (int *)REALLOC(queue,sizeof(int) * queue_size);
+		if (queue==NULL) {
+			printf("Error in REALLOC\n");
+			exit(1);
+		}
+	}
+	queue_head = queue_count = 0;
+	for (i = 0; i < fd->constraint_count; ++i) {
+		fd->constraints[i].needs_propagation = 0;
+		schedule(fd,i);
 	}
 
 #ifndef FAST
@@ -2400,6 +2596,7 @@ void _fd_push(struct fd_handle *fd)
 	int i;
 	struct fd_handle *n =(struct fd_handle *)_th_alloc(REWRITE_SPACE, sizeof(struct fd_handle));
 
+	fd->trail_mark = trail_count;
 	memcpy(n,fd,sizeof(struct fd_handle));
 	fd->vars = (struct variable_info *)_th_alloc(REWRITE_SPACE,sizeof(struct variable_info) * n->var_count);
 	memcpy(fd->vars,n->vars,sizeof(struct variable_info) * n->var_count);
@@ -2416,7 +2613,9 @@ void _fd_push(struct fd_handle *fd)
 
 void _fd_pop(struct fd_handle *fd)
 {
+	undo_trail(fd->next->trail_mark);
 	memcpy(fd,fd->next,sizeof(struct fd_handle));
+	if (bounds_fd==fd) _th_bound_reset(bounds);
 }
 
 void _fd_revert(struct fd_handle *fd)
@@ -2424,7 +2623,9 @@ void _fd_revert(struct fd_handle *fd)
 	int i;
 
 	struct fd_handle *n = fd->next;
+	undo_trail(n->trail_mark);
 	memcpy(fd,fd->next,sizeof(struct fd_handle));
+	if (bounds_fd==fd) _th_bound_reset(bounds);
 	fd->vars = (struct variable_info *)_th_alloc(REWRITE_SPACE,sizeof(struct variable_info) * n->var_count);
 	memcpy(fd->vars,n->vars,sizeof(struct variable_info) * n->var_count);
 	fd->constraints = (struct constraint_info *)_th_alloc(REWRITE_SPACE,sizeof(struct constraint_info) * n->constraint_count);
@@ -2494,6 +2695,9 @@ struct _ex_intern *_fd_get_value_n(struct env *env, struct fd_handle *fd, unsign
 			}
 			increment[1] = i;
 			return _ex_intern_integer(_th_big_add(v->u.bits.base->u.integer,increment));
+		case RANGE_NATIVE:
+			if (n >= v->u.native.size) return NULL;
+			return _ex_intern_small_integer(native_value_n(v,n));
 		default:
 			fprintf(stderr, "Internal error: _fd_get_value_count: Illegal range type\n");
 			exit(1);
@@ -2516,7 +2720,7 @@ int _fd_instantiate(struct env *env, struct fd_handle *fd, unsigned var, struct
 		}
 	}
 
-	u = _th_add_pair(REWRITE_SPACE,u,v->var,v->u.range.min);
+	u = _th_add_pair(REWRITE_SPACE,u,v->var,value);
 	for (i = 0; i < v->effects_count; ++i) {
 		struct constraint_info *ci = &fd->constraints[v->effects_constraint[i]];
 		ci->constraint = _th_rewrite(env, _th_subst(env,u,ci->constraint));
@@ -2528,13 +2732,14 @@ int _fd_instantiate(struct env *env, struct fd_handle *fd, unsigned var, struct
 
 	v->range_type = RANGE_FILLED;
 	v->u.range.min = value;
+	domain_changed(fd,var);
 
 #ifndef FAST
     if (_zone_active()) _fd_print(env,fd);
 #endif
 
 	for (i = 0; i < v->effects_count; ++i) {
-		fd->constraints[v->effects_constraint[i]].needs_propagation = 1;
+		schedule(fd,v->effects_constraint[i]);
 	}
 
 	i = propagate_constraints(env,fd);
@@ -2568,6 +2773,8 @@ struct _ex_intern *_fd_get_min_value(struct env *env, struct fd_handle *fd, unsi
 			return v->u.fragments->low;
 		case RANGE_BITS:
 			return v->u.bits.base;
+		case RANGE_NATIVE:
+			return _ex_intern_small_integer(v->u.native.lo);
 		default:
 			fprintf(stderr, "Internal error: fd_get_min_value: Illegal range type\n");
 			exit(1);
@@ -2611,6 +2818,8 @@ struct _ex_intern *_fd_get_max_value(struct env *env, struct fd_handle *fd, unsi
 			}
 			increment[1] = (unsigned)i;
 			return _ex_intern_integer(_th_big_add(v->u.bits.base->u.integer,increment));
+		case RANGE_NATIVE:
+			return _ex_intern_small_integer(v->u.native.hi);
 		default:
 			fprintf(stderr, "Internal error: fd_get_max_value: Illegal range type\n");
 			exit(1);
@@ -2633,6 +2842,7 @@ struct _ex_intern *_fd_get_min_open(struct env *env, struct fd_handle *fd, unsig
 	    case RANGE_FILLED:
 		case RANGE_NONE:
 		case RANGE_BITS:
+		case RANGE_NATIVE:
 			return NULL;
 		case RANGE_MIN_MAX:
 			if (v->u.range.min==NULL) {
@@ -2669,6 +2879,7 @@ struct _ex_intern *_fd_get_max_open(struct env *env, struct fd_handle *fd, unsig
 	    case RANGE_FILLED:
 		case RANGE_NONE:
 		case RANGE_BITS:
+		case RANGE_NATIVE:
 			return NULL;
 		case RANGE_MIN_MAX:
 			if (v->u.range.max==NULL) {
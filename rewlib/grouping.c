@@ -12,6 +12,9 @@
 #include <string.h>
 #include "Globals.h"
 #include "Intern.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 static struct _ex_intern *trail = NULL;
 
@@ -50,27 +53,27 @@ static int is_a_bool(struct env *env, struct _ex_intern *e)
     return 0;
 }
 
+/* The signs each term has been collected with */
+static struct term_marks *collected = NULL;
+
 static void collect_terms(struct env *env, struct _ex_intern *e, int sign)
 {
-    int i;
+    int i, s;
     struct signed_list *a;
     struct signed_list *prev = NULL;
 
-    if (e->user2) {
-        if (sign&((int)e->user1)) return;
+    s = (int)(long)_th_term_value(collected,e);
+    if (s) {
+        if (sign&s) return;
         prev = terms;
         while (prev && prev->e != e) {
             prev = prev->next;
         }
-        e->user1 = sign = 3;
-    } else {
-        e->user2 = trail;
-        e->user1 = sign;
-        trail = e;
+        sign = 3;
     }
+    _th_set_term_value(collected,e,(void *)(long)sign);
 
     //printf("Processing %s\n", _th_print_exp(e));
-    //printf("    user2 %s\n", _th_print_exp(e->user2));
 
     ++collect;
 
@@ -1542,14 +1545,20 @@ int valid_cycle_to_add(struct cycles *cycles, struct group_list *groups, struct
     return 1;
 }
 
+/* The edge_node created for each edge term */
+static struct term_marks *edge_nodes = NULL;
+
 void add_cycle_edges(struct env *env, struct cycles *cycles)
 {
     struct cycles *c = cycles;
 
+    if (edge_nodes==NULL) edge_nodes = _th_new_term_marks(1);
+    _th_start_traversal(edge_nodes);
+
     while (c) {
         struct node_list *n = c->path;
         while (n) {
-            struct edge_node *edge = (struct edge_node *)n->edge->e->user2;
+            struct edge_node *edge = (struct edge_node *)_th_term_value(edge_nodes,n->edge->e);
             struct edge_list *nedge;
             nedge = (struct edge_list *)_th_alloc(REWRITE_SPACE,sizeof(struct edge_list));
             nedge->next = c->edges;
@@ -1588,19 +1597,12 @@ void add_cycle_edges(struct env *env, struct cycles *cycles)
                 nedge->node->v1 = v1;
                 nedge->node->v2 = v2;
                 nedge->node->edge_in_tree = 0;
-                n->edge->e->next_cache = trail;
-                trail = n->edge->e;
-                n->edge->e->user2 = (struct _ex_intern *)nedge->node;
+                _th_set_term_value(edge_nodes,n->edge->e,nedge->node);
             }
             n = n->next;
         }
         c = c->next;
     }
-
-    while (trail) {
-        trail->user2 = NULL;
-        trail = trail->next_cache;
-    }
 }
 
 static struct cycles *old_collect_all_cycles(struct env *env, struct group_list *groups)
@@ -1663,51 +1665,123 @@ static struct cycles *old_collect_all_cycles(struct env *env, struct group_list
 
 }
 
-struct edge_pair_list {
-    struct edge_pair_list *next;
-    struct signed_list *edge1, *edge2;
-    unsigned common_vertex, edge1_vertex, edge2_vertex;
-    int touched;
-    int searched;
-};
+/*
+ * Shortest path lengths between the variables of the group graph.  The
+ * graph is sparse, so the lengths come from a breadth first search from
+ * each variable rather than a cubic relaxation, and they are kept in a
+ * heap allocated matrix of shorts.  The adjacency lists keep one edge
+ * for each pair of variables, the first group between them.
+ *
+ * A search only reads the adjacency lists and writes its own row of the
+ * matrix, so when the engine is built with OpenMP the sources are spread
+ * across threads.  Each thread has its own slice of the queue.
+ */
+#define NO_PATH 0xffff
 
-struct vertex_edge_trail {
-    struct vertex_edge_trail *next;
-    unsigned vertex;
+struct distance_edge {
+    struct distance_edge *next;
+    int to;
     struct signed_list *edge;
 };
 
-struct path_table {
-    struct path_table *next;
-    unsigned var;
-    struct node_list *path;
-    int length;
-};
-
 struct distance_table {
-    struct distance_table *next;
-    unsigned var;
-    int index;
-    struct path_table *table;
+    int count;
+    unsigned *vars;
+    int *hash, hash_size, *hash_next;
+    struct distance_edge **edges;
+    unsigned short *distance;
 };
 
+static int distance_index(struct distance_table *dt, unsigned var)
+{
+    int i = dt->hash[var % dt->hash_size];
+
+    while (i >= 0 && dt->vars[i] != var) {
+        i = dt->hash_next[i];
+    }
+
+    return i;
+}
+
+static int add_distance_var(struct distance_table *dt, unsigned var)
+{
+    int i = distance_index(dt, var);
+
+    if (i >= 0) return i;
+
+    i = dt->count++;
+    dt->vars[i] = var;
+    dt->hash_next[i] = dt->hash[var % dt->hash_size];
+    dt->hash[var % dt->hash_size] = i;
+    dt->edges[i] = NULL;
+
+    return i;
+}
+
+static void add_distance_edge(struct distance_table *dt, int from, int to, struct signed_list *edge)
+{
+    struct distance_edge *e;
+
+    if (from==to) return;
+    for (e = dt->edges[from]; e; e = e->next) {
+        if (e->to==to) return;
+    }
+
+    e = (struct distance_edge *)_th_alloc(REWRITE_SPACE,sizeof(struct distance_edge));
+
+    e->next = dt->edges[from];
+    e->to = to;
+    e->edge = edge;
+    dt->edges[from] = e;
+}
+
+static void distance_search(struct distance_table *dt, int s, int *queue)
+{
+    struct distance_edge *e;
+    unsigned short *d = dt->distance + s * dt->count;
+    int head, tail, i;
+
+    for (i = 0; i < dt->count; ++i) {
+        d[i] = NO_PATH;
+    }
+    d[s] = 0;
+    queue[0] = s;
+    head = 0;
+    tail = 1;
+    while (head < tail) {
+        int v = queue[head++];
+        for (e = dt->edges[v]; e; e = e->next) {
+            if (d[e->to]==NO_PATH) {
+                d[e->to] = (d[v] < NO_PATH-1) ? d[v]+1 : NO_PATH-1;
+                queue[tail++] = e->to;
+            }
+        }
+    }
+}
+
 static struct distance_table *build_distance_table(struct group_list *list)
 {
-    struct distance_table *table, *t, *tt;
+    struct distance_table *dt;
     struct group_list *l;
     unsigned v1, v2, *fv;
-    struct path_table *p;
-    struct node_list *n, *node, *pp, *nn;
-    struct node_list ***path_table;
-    int **distance, i, j, v1i,v2i;
-    int count, index;
+    int *queue, threads;
+    int count, size, i, s;
 
-	//printf("\n    **** Building distance table ****\n\n");
+    size = 0;
+    for (l = list; l; l = l->next) size += 2;
 
-    l = list;
-    table = NULL;
-    index = 0;
-    while (l) {
+    dt = (struct distance_table *)_th_alloc(REWRITE_SPACE,sizeof(struct distance_table));
+    dt->count = 0;
+    dt->hash_size = size+1;
+    dt->vars = (unsigned *)_th_alloc(REWRITE_SPACE,sizeof(unsigned) * (size+1));
+    dt->hash_next = (int *)_th_alloc(REWRITE_SPACE,sizeof(int) * (size+1));
+    dt->hash = (int *)_th_alloc(REWRITE_SPACE,sizeof(int) * dt->hash_size);
+    dt->edges = (struct distance_edge **)_th_alloc(REWRITE_SPACE,sizeof(struct distance_edge *) * (size+1));
+    for (i = 0; i < dt->hash_size; ++i) {
+        dt->hash[i] = -1;
+    }
+
+    for (l = list; l; l = l->next) {
         fv = _th_get_free_vars(l->group->e,&count);
         v1 = fv[0];
         if (count > 1) {
@@ -1715,748 +1789,224 @@ static struct distance_table *build_distance_table(struct group_list *list)
         } else {
             v2 = 0;
         }
-        t = table;
-        while (t) {
-            if (t->var==v1) goto cont1;
-            t = t->next;
-        }
-        t = (struct distance_table *)_th_alloc(REWRITE_SPACE,sizeof(struct distance_table));
-        t->next = table;
-        table = t;
-        t->index = index++;
-        t->var = v1;
-        t->table = NULL;
-        //printf("Adding var %s %d\n", _th_intern_decode(v1), t->index);
-cont1:
-        t = table;
-        while (t) {
-            if (t->var==v2) goto cont2;
-            t = t->next;
-        }
-        t = (struct distance_table *)_th_alloc(REWRITE_SPACE,sizeof(struct distance_table));
-        t->next = table;
-        table = t;
-        t->index = index++;
-        t->var = v2;
-        t->table = NULL;
-        //printf("Adding var %s %d\n", _th_intern_decode(v2), t->index);
-cont2:
-        l = l->next;
+        add_distance_var(dt, v1);
+        add_distance_var(dt, v2);
     }
-
-    distance = (int **)ALLOCA(sizeof(int *) * index);
-    path_table = (struct node_list ***)ALLOCA(sizeof(struct node_list **) * index);
-
-    for (i = 0; i < index; ++i) {
-        distance[i] = (int *)ALLOCA(sizeof(int) *index);
-        path_table[i] = (struct node_list **)ALLOCA(sizeof(struct node_list *) * index);
-        for (j = 0; j < index; ++j) {
-            if (i==j) {
-                distance[i][j] = 0;
-            } else {
-                distance[i][j] = 10000000;
-            }
-            path_table[i][j] = NULL;
+    for (l = list; l; l = l->next) {
+        int v1i, v2i;
+        fv = _th_get_free_vars(l->group->e,&count);
+        v1 = fv[0];
+        if (count > 1) {
+            v2 = fv[1];
+        } else {
+            v2 = 0;
         }
+        v1i = distance_index(dt, v1);
+        v2i = distance_index(dt, v2);
+        add_distance_edge(dt, v1i, v2i, l->group);
+        add_distance_edge(dt, v2i, v1i, l->group);
     }
-	
-    l = list;
-	while (l) {
-		fv = _th_get_free_vars(l->group->e,&count);
-		v1 = fv[0];
-		if (count > 1) {
-			v2 = fv[1];
-		} else {
-			v2 = 0;
-		}
-		tt = table;
-		while (tt) {
-			if (tt->var==v1) v1i = tt->index;
-			if (tt->var==v2) v2i = tt->index;
-			tt = tt->next;
-		}
-		//printf("Adding edge %d %d\n", v1i, v2i);
-
-		distance[v1i][v2i] = distance[v2i][v1i] = 1;
-		n = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-		n->next = NULL;
-		n->edge = l->group;
-		n->var = v1;
-		path_table[v1i][v2i] = n;
-
-		n = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-		n->next = NULL;
-		n->edge = l->group;
-		n->var = v2;
-		path_table[v2i][v1i] = n;
-
-		l = l->next;
-	}
 
-    t = table;
-    while (t) {
-		for (i = 0; i < index; ++i) {
-			for (j = 0; j < index; ++j) {
-				if (distance[i][t->index]+distance[t->index][j] < distance[i][j]) {
-					distance[i][j] = distance[i][t->index]+distance[t->index][j];
-					//printf("Shortening %d to %d with %d\n", i, j, t->index);
-					pp = NULL;
-					n = path_table[i][t->index];
-					while (n) {
-						nn = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-						if (pp) {
-							pp->next = nn;
-						} else {
-							node = nn;
-						}
-						nn->edge = n->edge;
-						nn->var = n->var;
-						pp = nn;
-						n = n->next;
-					}
-					if (pp) {
-						pp->next = path_table[t->index][j];
-					} else {
-						node = path_table[t->index][j];
-					}
-					//printf("Assigning %x to path_table[%d][%d]\n", node, i, t->index);
-					path_table[i][t->index] = node;
-				}
-			}
-		}
-		t = t->next;
-	}
-
-#ifdef OLD
-	t = table;
-    while (t) {
-        printf("*** CHECKING VAR %s %d ***\n", _th_intern_decode(t->var), t->index);
-        l = list;
-        while (l) {
-            fv = _th_get_free_vars(l->group->e,&count);
-            v1 = fv[0];
-            if (count > 1) {
-                v2 = fv[1];
-            } else {
-                v2 = 0;
-            }
-            tt = table;
-            while (tt) {
-                if (tt->var==v1) v1i = tt->index;
-                if (tt->var==v2) v2i = tt->index;
-                tt = tt->next;
-            }
-            printf("Adding edge %s %d %s %d\n", _th_intern_decode(v1), v1i, _th_intern_decode(v2), v2i);
-            if (v1==t->var) {
-                for (i = 0; i < index; ++i) {
-                    if (v1i != i && distance[v1i][i] > distance[v2i][i]+1) {
-                        distance[v1i][i] = distance[v2i][i]+1;
-                        n = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-                        n->next = path_table[v2i][i];
-                        n->edge = l->group;
-                        n->var = v1;
-                        printf("    Shortening path 1 from %s to (%d) to %d\n", _th_intern_decode(v1), i, distance[v1i][i]);
-                        path_table[v1i][i] = n;
-#ifdef XX
-                        tt = table;
-                        if (n==NULL) {
-                            printf("NULL exit\n");
-                            exit(1);
-                        }
-                        while (tt) {
-                            if (tt->index==v1i && path_table[v1i][i]->var != tt->var) {
-                                printf("tt->var = %s\n", _th_intern_decode(tt->var));
-                                printf("n->var = %s\n", _th_intern_decode(n->var));
-                                exit(1);
-                            }
-                            tt = tt->next;
-                        }
-#endif
-                    }
-                    if (v1i != i && distance[i][v1i] > distance[i][v2i]+1 && path_table[i][v2i]) {
-                        distance[i][v1i] = distance[i][v2i]+1;
-                        pp = NULL;
-                        n = path_table[i][v2i];
-                        while (n) {
-                            nn = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-                            if (pp) {
-                                pp->next = nn;
-                            } else {
-                                node = nn;
-                            }
-                            nn->edge = n->edge;
-                            nn->var = n->var;
-                            pp = nn;
-                            n = n->next;
-                        }
-                        n = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-                        n->next = NULL;
-                        if (pp) {
-                            pp->next = n;
-                        } else {
-                            node = n;
-                        }
-                        n->edge = l->group;
-                        n->var = v2;
-                        path_table[i][v1i] = node;
-                        printf("    Shortening path 2 from (%d) to %s to %d\n", i, _th_intern_decode(v1), distance[v1i][i]);
-#ifdef XX
-                        if (node==NULL) {
-                            printf("NULL exit\n");
-                            exit(1);
-                        }
-                        tt = table;
-                        while (tt) {
-                            if (tt->index==i && path_table[i][v1i]->var != tt->var) {
-                                printf("tt->var = %s\n", _th_intern_decode(tt->var));
-                                printf("node->var = %s\n", _th_intern_decode(node->var));
-                                exit(1);
-                            }
-                            tt = tt->next;
-                        }
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#else
+    threads = 1;
 #endif
-                    }
-                }
 
-            }
-            if (v2==t->var) {
-                for (i = 0; i < index; ++i) {
-					printf("Testing v1i=%d v2i=%d i=%d %d %d\n", v1i, v2i, i, distance[v2i][i], distance[v1i][i]);
-                    if (v2i != i && distance[v2i][i] > distance[v1i][i]+1) {
-                        distance[v2i][i] = distance[v1i][i]+1;
-                        n = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-                        n->next = path_table[v1i][i];
-                        n->edge = l->group;
-                        n->var = v2;
-                        path_table[v2i][i] = n;
-                        printf("    Shortening path 3 from %s to (%d,%d) to %d\n", _th_intern_decode(v2), v2i,i, distance[v2i][i]);
-#ifdef XX
-                        if (n==NULL) {
-                            printf("NULL exit\n");
-                            exit(1);
-                        }
-                        tt = table;
-                        while (tt) {
-                            if (tt->index==v2i && path_table[v2i][i]->var != tt->var) {
-                                exit(1);
-                            }
-                            tt = tt->next;
-                        }
-#endif
-                    }
-					printf("Testing b v1i=%d v2i=%d i=%d %d %d\n", v1i, v2i, i, distance[i][v1i], distance[i][v2i]);
-                    if (v1i != i && distance[i][v1i] > distance[i][v2i]+1) {
-                        distance[i][v1i] = distance[i][v2i]+1;
-                        pp = NULL;
-                        n = path_table[i][v2i];
-                        printf("i, v1i = %d %d\n", i, v1i);
-                        if (n) printf("n->var = %s\n", _th_intern_decode(n->var));
-                        while (n) {
-                            nn = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-                            if (pp) {
-                                pp->next = nn;
-                            } else {
-                                node = nn;
-                            }
-                            nn->edge = n->edge;
-                            nn->var = n->var;
-                            pp = nn;
-                            n = n->next;
-                        }
-                        n = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-                        n->next = NULL;
-                        if (pp) {
-                            pp->next = n;
-                        } else {
-                            node = n;
-                        }
-                        n->edge = l->group;
-                        n->var = v1;
-                        path_table[i][v2i] = node;
-                        printf("    Shortening path 4 from (%d) to %s to %d\n", i, _th_intern_decode(v2), distance[v2i][i]);
-#ifdef XX
-                        if (node==NULL) {
-                            printf("NULL exit\n");
-                            exit(1);
-                        }
-                        tt = table;
-                        while (tt) {
-                            if (tt->index==i && path_table[i][v2i]->var != tt->var) {
-                                printf("tt->var = %s\n", _th_intern_decode(tt->var));
-                                printf("node->var = %s\n", _th_intern_decode(node->var));
-                                exit(1);
-                            }
-                            tt = tt->next;
-                        }
-#endif
-                    }
-                }
+    dt->distance = (unsigned short *)MALLOC(sizeof(unsigned short) * dt->count * dt->count);
+    queue = (int *)MALLOC(sizeof(int) * (dt->count+1) * threads);
+    if (dt->distance==NULL || queue==NULL) {
+        printf("Error in MALLOC\n");
+        exit(1);
+    }
 
-            }
-            l = l->next;
-        }
-        for (i = 0; i < index; ++i) {
-            for (j = 0; j < index; ++j) {
-                if (i != j) {
-                    if (distance[i][j] > distance[i][t->index]+distance[t->index][j]) {
-                        distance[i][j] = distance[i][t->index]+distance[t->index][j];
-                        pp = NULL;
-                        n = path_table[i][t->index];
-                        while (n) {
-                            nn = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-                            if (pp) {
-                                pp->next = nn;
-                            } else {
-                                node = nn;
-                            }
-                            nn->edge = n->edge;
-                            nn->var = n->var;
-                            pp = nn;
-                            n = n->next;
-                        }
-                        if (pp) {
-                            pp->next = path_table[t->index][j];
-                        } else {
-                            node = path_table[t->index][j];
-                        }
-#ifdef XX
-                        if (node==NULL) {
-                            printf("NULL exit 3\n");
-                            exit(1);
-                        }
-#endif
-                        path_table[i][j] = node;
-                    }
-                }
-            }
-        }
-        t = t->next;
+    /* distance_search must not trace; see TRACE_SERIAL in Tree.c */
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,16) if (dt->count >= 256)
+    for (s = 0; s < dt->count; ++s) {
+        distance_search(dt, s, queue + omp_get_thread_num() * (dt->count+1));
+    }
+#else
+    for (s = 0; s < dt->count; ++s) {
+        distance_search(dt, s, queue);
     }
 #endif
 
-    t = table;
-    while (t) {
-        //printf("Table for var %s\n", _th_intern_decode(t->var));
-        for (i = 0; i < index; ++i) {
-            if (distance[t->index][i] < 10000000) {
-                struct node_list *path;
-                p = (struct path_table *)_th_alloc(REWRITE_SPACE,sizeof(struct path_table));
-                p->next = t->table;
-                t->table = p;
-                p->length = distance[t->index][i];
-                p->path = path_table[t->index][i];
-                tt = table;
-                while (tt) {
-                    if (tt->index==i) {
-                        p->var = tt->var;
-                    }
-                    tt = tt->next;
-                }
-                //printf("    to %s is %d\n", _th_intern_decode(p->var), p->length);
-#ifdef XX
-                path = p->path;
-                while (path) {
-                    printf("        node %s\n", _th_intern_decode(path->var));
-                    path = path->next;
-                }
-#endif
-            }
-        }
-        t = t->next;
-    }
-    //fflush(stdout);
+    FREE(queue);
 
-    return table;
+    return dt;
 }
 
-static struct signed_list *find_edge(struct group_list *list, unsigned v1, unsigned v2)
+static void free_distance_table(struct distance_table *dt)
 {
-    while (list) {
-        if (list->count==1) {
-            if (v1==0) {
-                v1 = v2;
-            } else if (v2!=0) {
-                goto cont;
-            }
-            if (v1 != list->fv[0]) goto cont;
-            return list->group;
-        }
-        if ((v1==list->fv[0] && v2==list->fv[1]) || (v1==list->fv[1] && v2==list->fv[0])) return list->group;
-cont:
-        list = list->next;
-    }
-    return NULL;
+    FREE(dt->distance);
 }
 
-static int in_vertex_trail(unsigned vertex, struct vertex_edge_trail *t)
-{
-    while (t) {
-        if (t->vertex==vertex) return 1;
-        t = t->next;
-    }
-
-    return 0;
-}
+/*
+ * Chordless cycle enumeration
+ *
+ * Every chordless cycle of the group graph is generated once, from its
+ * smallest vertex s (in the order of the distance table) and in the
+ * direction in which the vertex after s is smaller than the vertex
+ * before it.  So there is no need to compare each new cycle against
+ * the cycles already found.
+ *
+ * From s the search extends induced paths s,u1,...,uk through vertices
+ * larger than s.  block[v] counts the path vertices other than s and
+ * the last one that are adjacent to v.  A vertex with a non zero count
+ * would make a chord, so it is never added.  A vertex adjacent to s
+ * closes a cycle and is not extended further.  The search uses an
+ * explicit stack, so its depth does not depend on the cycle length.
+ *
+ * _th_cycle_length_limit bounds the number of vertices in a cycle.
+ * The distance table gives a lower bound on the length of any cycle
+ * through a path, which prunes paths that cannot close in time.
+ * _th_cycle_count_limit bounds the number of cycles collected.  Zero
+ * means no limit for either.  The searches from different start
+ * vertices share nothing except the output list.
+ */
+int _th_cycle_length_limit = 0;
+int _th_cycle_count_limit = 10000;
 
-static struct node_list *get_path(unsigned v1, unsigned v2, int max_path, struct distance_table *dt)
+static struct cycles *add_chordless_cycle(struct distance_table *dt, int *path, struct signed_list **via, int length, struct signed_list *closing, struct cycles *cycles)
 {
-    struct path_table *p;
+    struct node_list *nodes, *n;
+    struct cycles *c;
+    int i;
 
-    while (dt && dt->var != v1) {
-        dt = dt->next;
+    nodes = NULL;
+    for (i = length-1; i >= 0; --i) {
+        n = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
+        n->next = nodes;
+        n->var = dt->vars[path[i]];
+        n->edge = (i==length-1) ? closing : via[i+1];
+        nodes = n;
     }
-    if (dt==NULL) return NULL;
 
-    p = dt->table;
-    while (p && p->var != v2) {
-        p = p->next;
-    }
-	if (p==NULL) return NULL;
+    c = (struct cycles *)_th_alloc(REWRITE_SPACE,sizeof(struct cycles));
+    c->next = cycles;
+    c->path = nodes;
+    c->edges = NULL;
+    c->parent = NULL;
+    c->children = NULL;
+    c->number = (cycles==NULL) ? 1 : cycles->number+1;
 
-	_tree_print3("Path %s %s is %d\n", _th_intern_decode(v1), _th_intern_decode(v2), p->length);
-    if (p->length <= max_path) return p->path;
-    
-    return NULL;
+    return c;
 }
 
-static int has_big_chord(struct distance_table *dt, struct node_list *cycle)
+static void block_neighbors(struct distance_table *dt, int *block, int v, int delta)
 {
-    int count = 0, count1, count2;
-    struct node_list *c = cycle;
-    struct distance_table *d;
-    struct path_table *p;
+    struct distance_edge *e;
 
-    while (c) {
-        ++count;
-        c = c->next;
+    for (e = dt->edges[v]; e; e = e->next) {
+        block[e->to] += delta;
     }
+}
 
-    while (cycle) {
-        c = cycle->next;
-        count1 = 1;
-        count2 = count-1;
-        while (c) {
-            int cnt = count1;
-            if (count2 < cnt) cnt = count2;
-            d = dt;
-            while (d && d->var != cycle->var) {
-                d = d->next;
-            }
-            p = d->table;
-            while (p && p->var != c->var) {
-                p = p->next;
-            }
-            if (p && p->length < cnt) return 1;
-            c = c->next;
-        }
-        cycle = cycle->next;
+static struct cycles *enumerate_chordless_cycles(struct distance_table *dt)
+{
+    struct cycles *cycles = NULL;
+    struct signed_list **adjacent_s, **via;
+    struct distance_edge **iter, *e;
+    int *path, *block, *on_path;
+    int s, depth, v, count, limit, n = dt->count;
+
+    path = (int *)MALLOC(sizeof(int) * (n+1));
+    block = (int *)MALLOC(sizeof(int) * (n+1));
+    on_path = (int *)MALLOC(sizeof(int) * (n+1));
+    via = (struct signed_list **)MALLOC(sizeof(struct signed_list *) * (n+1));
+    adjacent_s = (struct signed_list **)MALLOC(sizeof(struct signed_list *) * (n+1));
+    iter = (struct distance_edge **)MALLOC(sizeof(struct distance_edge *) * (n+1));
+    if (path==NULL || block==NULL || on_path==NULL || via==NULL || adjacent_s==NULL || iter==NULL) {
+        printf("Error in MALLOC\n");
+        exit(1);
+    }
+    for (v = 0; v < n; ++v) {
+        block[v] = 0;
+        on_path[v] = 0;
+        adjacent_s[v] = NULL;
     }
 
-    return 0;
-}
-
-#define PAIR_HASH_SIZE 1024
+    limit = _th_cycle_length_limit;
+    if (limit <= 0 || limit > n) limit = n;
+    count = 0;
 
-static struct cycles *find_big_cycles(unsigned p_vertex, unsigned vertex, struct edge_pair_list *phash[], struct vertex_edge_trail *trail, struct group_list *groups, struct distance_table *dt, struct cycles *cycles)
-{
-    struct vertex_edge_trail *t = trail, *tt;
-    struct edge_pair_list *p, *pp;
-    struct node_list *path;
-    //int has_chord;
-    int len = 0;
+    for (s = 0; s < n; ++s) {
+        for (e = dt->edges[s]; e; e = e->next) {
+            if (adjacent_s[e->to]==NULL) adjacent_s[e->to] = e->edge;
+        }
 
-    _tree_print2("Finding big cycle %s %s", _th_intern_decode(p_vertex), _th_intern_decode(vertex));
-    _tree_indent();
+        path[0] = s;
+        on_path[s] = 1;
+        iter[0] = dt->edges[s];
+        depth = 0;
 
-    while (t) {
-        //printf("Testing vertex %d %s\n", len, _th_intern_decode(t->vertex));
-        if (path = get_path(vertex,t->vertex,len,dt)) {
-            struct node_list *n, *nodes, *pn;
-            struct cycles *c;
-            //printf("Adding big cycle %d %s %s\n", len, _th_intern_decode(vertex), _th_intern_decode(t->vertex));
-            _tree_print1("Wrap back to %s", _th_intern_decode(t->vertex));
-            nodes = NULL;
-            tt = trail;
-            while (tt != t) {
-                //printf("    1 %s\n", _th_intern_decode(tt->vertex));
-                n = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-                n->next = nodes;
-                if (nodes==NULL) pn = n;
-                n->edge = tt->edge;
-                n->var = tt->vertex;
-                nodes = n;
-                tt = tt->next;
+        while (depth >= 0) {
+            e = iter[depth];
+            if (e==NULL) {
+                /* Backtrack */
+                on_path[path[depth]] = 0;
+                --depth;
+                if (depth > 0) block_neighbors(dt, block, path[depth], -1);
+                continue;
             }
-            //printf("    2 %s\n", _th_intern_decode(tt->vertex));
-            n = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-            n->next = nodes;
-            if (nodes==NULL) pn = n;
-            n->edge = tt->edge;
-            n->var = tt->vertex;
-            nodes = n;
-            pn->next = path;
-            //while (path) {
-            //    n = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-            //    n->next = NULL;
-            //    n->edge = path->edge;
-            //    n->var = path->var;
-            //    printf("    3 %s\n", _th_intern_decode(path->var));
-            //    nodes = n;
-            //    path = path->next;
-            //}
-            //printf("    %s\n", _th_intern_decode(t->vertex));
-            //fflush(stdout);
-            if (valid_cycle_to_add(cycles,groups,nodes) && !has_big_chord(dt, nodes)) {
-                c = (struct cycles *)_th_alloc(REWRITE_SPACE,sizeof(struct cycles));
-                c->next = cycles;
-                c->path = nodes;
-                c->edges = NULL;
-                c->parent = NULL;
-                c->children = NULL;
-                if (c->next==NULL) {
-                    c->number = 1;
-                } else {
-                    c->number = c->next->number + 1;
-                }
-#ifndef FAST
-                _tree_indent();
-                while (nodes) {
-                    _tree_print1("v %s", _th_intern_decode(nodes->var));
-                    nodes = nodes->next;
+            iter[depth] = e->next;
+            v = e->to;
+
+            if (v <= s || on_path[v] || block[v]) continue;
+
+            if (depth > 0 && adjacent_s[v]) {
+                /* v closes the cycle s,...,path[depth],v */
+                if (path[1] < v && depth+2 <= limit) {
+                    path[depth+1] = v;
+                    via[depth+1] = e->edge;
+                    cycles = add_chordless_cycle(dt, path, via, depth+2, adjacent_s[v], cycles);
+                    if (_th_cycle_count_limit > 0 && ++count >= _th_cycle_count_limit) {
+                        _tree_print1("Cycle limit of %d reached", count);
+                        goto done;
+                    }
                 }
-                _tree_undent();
-#endif
-                cycles = c;
+                continue;
             }
-            _tree_undent();
-            return cycles;
+
+            if (depth+1 + dt->distance[v * dt->count + s] > limit) continue;
+
+            if (depth > 0) block_neighbors(dt, block, path[depth], 1);
+            ++depth;
+            path[depth] = v;
+            via[depth] = e->edge;
+            on_path[v] = 1;
+            iter[depth] = dt->edges[v];
         }
-        ++len;
-        t = t->next;
-    }
-    //printf("trail size %d\n", len);
 
-    p = phash[vertex%PAIR_HASH_SIZE];
-	pp = NULL;
-    //printf("find big cycles %s %s\n", _th_intern_decode(p_vertex), _th_intern_decode(vertex));
-    while (p) {
-        if (p->edge1_vertex==p_vertex && p->common_vertex==vertex && !p->searched) {
-            t = (struct vertex_edge_trail *)_th_alloc(REWRITE_SPACE,sizeof(struct vertex_edge_trail));
-            t->next = trail;
-            t->vertex = vertex;
-            t->edge = p->edge2;
-            p->touched = 1;
-            //printf("    Checking edge %s %s %s\n", _th_intern_decode(p->edge1_vertex), _th_intern_decode(p->common_vertex), _th_intern_decode(p->edge2_vertex));
-            cycles = find_big_cycles(vertex,p->edge2_vertex,phash,t,groups,dt,cycles);
-            p->searched = 1;
-			if (pp) {
-				pp->next = p->next;
-			} else {
-				phash[vertex%PAIR_HASH_SIZE] = p->next;
-			}
-        } else if (p->edge2_vertex==p_vertex && p->common_vertex==vertex && !p->searched) {
-            t = (struct vertex_edge_trail *)_th_alloc(REWRITE_SPACE,sizeof(struct vertex_edge_trail));
-            t->next = trail;
-            t->vertex = vertex;
-            t->edge = p->edge1;
-            p->touched = 1;
-            //printf("    Checking edge %s %s %s\n", _th_intern_decode(p->edge2_vertex), _th_intern_decode(p->common_vertex), _th_intern_decode(p->edge1_vertex));
-            cycles = find_big_cycles(vertex,p->edge1_vertex,phash,t,groups,dt,cycles);
-            p->searched = 1;
-			if (pp) {
-				pp->next = p->next;
-			} else {
-				phash[vertex%PAIR_HASH_SIZE] = p->next;
-			}
-		} else {
-		    pp = p;
-		}
-        p = p->next;
+        for (e = dt->edges[s]; e; e = e->next) {
+            adjacent_s[e->to] = NULL;
+        }
     }
 
-    _tree_undent();
+done:
+    FREE(path);
+    FREE(block);
+    FREE(on_path);
+    FREE(via);
+    FREE(adjacent_s);
+    FREE(iter);
 
     return cycles;
 }
 
 static struct cycles *collect_all_cycles(struct env *env, struct group_list *groups)
 {
-    struct group_list *g1 = groups, *g2;
-    unsigned g1v1, g1v2, g2v1, g2v2, *fv;
-    struct edge_pair_list *pairs, *p, *pp, *phash[PAIR_HASH_SIZE];
-    struct cycles *c, *cycles;
-    int count, i;
     struct distance_table *dt = build_distance_table(groups);
+    struct cycles *cycles;
+#ifndef FAST
+    struct cycles *c;
+#endif
 
     _tree_print0("Collect all cycles");
     _tree_indent();
 
-    pairs = NULL;
-
-    while (g1) {
-        fv = _th_get_free_vars(g1->group->e,&count);
-        g1v1 = fv[0];
-        if (count > 1) {
-            g1v2 = fv[1];
-        } else {
-            g1v2 = 0;
-        }
-        g2 = groups;
-        while (g2) {
-            fv = _th_get_free_vars(g2->group->e,&count);
-            g2v1 = fv[0];
-            if (count > 1) {
-                g2v2 = fv[1];
-            } else {
-                g2v2 = 0;
-            }
-            //p = NULL;
-            if (g1v1==g2v1 && g1v2!=g2v2) {
-                p = (struct edge_pair_list *)_th_alloc(REWRITE_SPACE,sizeof(struct edge_pair_list));
-                p->next = pairs;
-                pairs = p;
-                p->edge1 = g1->group;
-                p->edge2 = g2->group;
-                p->common_vertex = g1v1;
-                p->edge1_vertex = g1v2;
-                p->edge2_vertex = g2v2;
-                p->touched = 0;
-                p->searched = 0;
-            } else if (g1v1==g2v2 && g1v2!=g2v1) {
-                p = (struct edge_pair_list *)_th_alloc(REWRITE_SPACE,sizeof(struct edge_pair_list));
-                p->next = pairs;
-                pairs = p;
-                p->edge1 = g1->group;
-                p->edge2 = g2->group;
-                p->common_vertex = g1v1;
-                p->edge1_vertex = g1v2;
-                p->edge2_vertex = g2v1;
-                p->touched = 0;
-                p->searched = 0;
-            } else if (g1v2==g2v1 && g1v1!=g2v2) {
-                p = (struct edge_pair_list *)_th_alloc(REWRITE_SPACE,sizeof(struct edge_pair_list));
-                p->next = pairs;
-                pairs = p;
-                p->edge1 = g1->group;
-                p->edge2 = g2->group;
-                p->common_vertex = g2v1;
-                p->edge1_vertex = g1v1;
-                p->edge2_vertex = g2v2;
-                p->touched = 0;
-                p->searched = 0;
-            } else if (g1v2==g2v2 && g1v1!=g2v1) {
-                p = (struct edge_pair_list *)_th_alloc(REWRITE_SPACE,sizeof(struct edge_pair_list));
-                p->next = pairs;
-                pairs = p;
-                p->edge1 = g1->group;
-                p->edge2 = g2->group;
-                p->common_vertex = g1v2;
-                p->edge1_vertex = g1v1;
-                p->edge2_vertex = g2v1;
-                p->touched = 0;
-                p->searched = 0;
-            }
-            //if (p) {
-            //    if (p->edge1_vertex==NULL || p->edge2_vertex==NULL || p->common_vertex==NULL) {
-            //        fprintf(stderr, "NULL vertex\n");
-            //        exit(1);
-            //    }
-            //}
-            g2 = g2->next;
-        }
-        g1 = g1->next;
-    }
-
-    cycles = NULL;
-    count = 0;
-
-	for (i = 0; i < PAIR_HASH_SIZE; ++i) {
-		phash[i] = NULL;
-	}
-
-	pp = NULL;
-	p = pairs;
-	while (p) {
-		struct signed_list *edge = find_edge(groups,p->edge1_vertex,p->edge2_vertex);
-		if (edge) {
-			struct node_list *n1, *n2, *n3;
-			if (pp) {
-				pp->next = p->next;
-			} else {
-				pairs = p->next;
-			}
-			n1 = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-			n2 = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-			n3 = (struct node_list *)_th_alloc(REWRITE_SPACE,sizeof(struct node_list));
-			n1->next = n2;
-			n2->next = n3;
-			n3->next = NULL;
-			n1->edge = p->edge1;
-			n1->var = p->edge1_vertex;
-			n2->edge = p->edge2;
-			n2->var = p->common_vertex;
-			n3->edge = edge;
-			n3->var = p->edge2_vertex;
-			if (valid_cycle_to_add(cycles, groups, n1)) {
-				_tree_print3("Adding triangle %s %s %s", _th_intern_decode(n1->var), _th_intern_decode(n2->var), _th_intern_decode(n3->var));
-				c = (struct cycles *)_th_alloc(REWRITE_SPACE,sizeof(struct cycles));
-				c->next = cycles;
-				c->path = n1;
-				c->number = ++count;
-				c->edges = NULL;
-				c->parent = NULL;
-				c->children = NULL;
-				cycles = c;
-			}
-		} else {
-			pp = p;
-		}
-		p = p->next;
-	}
-
-#ifdef XX
-    p = pairs;
-    while (p) {
-        printf("Pair %s %s %s\n", _th_intern_decode(p->edge1_vertex), _th_intern_decode(p->common_vertex), _th_intern_decode(p->edge2_vertex));
-        p = p->next;
-    }
-    fflush(stdout);
-#endif
-    p = pairs;
-	while (p) {
-		int hash = p->common_vertex%PAIR_HASH_SIZE;
-        pp = p->next;
-		p->next = phash[hash];
-		phash[hash] = p;
-		p = pp;
-	}
-
-	for (i = 0; i < PAIR_HASH_SIZE; ++i) {
-		p = phash[i];
-		//count = 0;
-		while (p) {
-			if (!p->touched) {
-				struct vertex_edge_trail *trail, *t;
-				t = (struct vertex_edge_trail *)ALLOCA(sizeof(struct vertex_edge_trail));
-				t->next = NULL;
-				t->vertex = p->edge1_vertex;
-				t->edge = p->edge1;
-				trail = (struct vertex_edge_trail *)ALLOCA(sizeof(struct vertex_edge_trail));
-				trail->next = t;
-				trail->vertex = p->common_vertex;
-				trail->edge = p->edge2;
-				//printf("Starting search %s %s %s\n", _th_intern_decode(p->edge1_vertex), _th_intern_decode(p->common_vertex), _th_intern_decode(p->edge2_vertex));
-				p->touched = 1;
-				cycles = find_big_cycles(p->common_vertex,p->edge2_vertex,phash,trail,groups,dt,cycles);
-				//++count;
-				//if (count%500==0) printf("count = %d\n", count);
-			}
-			p = p->next;
-		}
-	}
-	//printf("count = %d\n", count);
-    //printf("Done\n");
-    //fflush(stdout);
+    cycles = enumerate_chordless_cycles(dt);
 
 #ifndef FAST
     c = cycles;
@@ -2475,6 +2025,8 @@ static struct cycles *collect_all_cycles(struct env *env, struct group_list *gro
 
     _tree_undent();
 
+    free_distance_table(dt);
+
     add_cycle_edges(env,cycles);
 
     return cycles;
@@ -5589,17 +5141,11 @@ struct _ex_intern *_th_simplify_groupings(struct env *env, struct _ex_intern *e,
     //fflush(stdout);
 
     terms = NULL;
-    trail = _ex_true;
-    _ex_true->user2 = NULL;
+    if (collected==NULL) collected = _th_new_term_marks(1);
+    _th_start_traversal(collected);
 
     collect_terms(env,e,1);
 
-    while (trail) {
-        struct _ex_intern *t = trail->user2;
-        trail->user2 = NULL;
-        trail = t;
-    }
-
     f = _th_get_first_neg_tuple(info);
     while (f) {
         if (f->type==EXP_APPL && f->u.appl.functor==INTERN_OR) {
@@ -5954,6 +5500,9 @@ struct _ex_intern *_th_break_flower(struct env *env, struct _ex_intern *e, struc
 
     //check_user2(env, "begin");
 
+    terms = NULL;
+    if (collected==NULL) collected = _th_new_term_marks(1);
+    _th_start_traversal(collected);
     collect_terms(env,e,1);
     f = _th_get_first_neg_tuple(info);
     fve = e;
@@ -18,6 +18,7 @@ struct tuple {
     struct tuple *next;
     int size;
     int abstract_skip;
+    int subsumed;
     struct _ex_intern **terms;
     struct tuple **term_next;
     struct term_info_list **term_info;
@@ -32,6 +33,7 @@ struct tuple {
     struct tuple *var2_next;
     struct tuple *unate_next;
     struct tuple *unate_prev;
+    unsigned long long sig;
 };
 
 #define TERM_HASH 127
@@ -69,6 +71,9 @@ struct term_info_list {
     int decision_level;
     int passed;
 	double pos_score, neg_score;
+    struct tuple *reason;
+    int trail_index;
+    int min_stamp, min_state;
 };
 
 struct assignments {
@@ -113,7 +118,7 @@ struct _ex_intern *_th_get_next_neg_tuple(struct learn_info *info)
     struct _ex_intern **args, *r;
     int i;
 
-    while (current != NULL && current->abstract_skip) {
+    while (current != NULL && (current->abstract_skip || current->subsumed)) {
         current = current->next;
     }
 
@@ -137,7 +142,7 @@ struct _ex_intern *_th_get_next_neg_tuple(struct learn_info *info)
 struct _ex_intern *_th_get_first_neg_tuple(struct learn_info *info)
 {
     current = info->tuples;
-    while (current != NULL && current->abstract_skip) {
+    while (current != NULL && (current->abstract_skip || current->subsumed)) {
         current = current->next;
     }
     return _th_get_next_neg_tuple(info);
@@ -232,6 +237,31 @@ void _th_learn_print_assignments(struct learn_info *info)
     }
 }
 
+struct add_list *_th_learn_get_assignments(struct learn_info *info)
+{
+    int i;
+    struct add_list *ret = NULL, *a;
+
+    for (i = 0; i < TERM_HASH; ++i) {
+        struct term_info_list *t = info->tuples_by_term[i];
+        while (t) {
+            if (t->assignment) {
+                a = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
+                a->next = ret;
+                ret = a;
+                if (t->assignment==_ex_true) {
+                    a->e = t->term;
+                } else {
+                    a->e = _ex_intern_appl1_env(info->env,INTERN_NOT,t->term);
+                }
+            }
+            t = t->next;
+        }
+    }
+
+    return ret;
+}
+
 struct _ex_intern *_th_add_learn_terms(struct learn_info *info, struct _ex_intern *e)
 {
     int i;
@@ -267,7 +297,7 @@ static int ucmp(const void *i1,const void *i2)
 {
     struct _ex_intern *e1 = *((struct _ex_intern **)i1);
     struct _ex_intern *e2 = *((struct _ex_intern **)i2);
-    return ((int)e2)-((int)e1);
+    return ((int)e2->id)-((int)e1->id);
 }
 
 static int cmp(const void *i1,const void *i2)
@@ -276,11 +306,65 @@ static int cmp(const void *i1,const void *i2)
     struct _ex_intern *e2 = *((struct _ex_intern **)i2);
     if (e1->type==EXP_APPL && e1->u.appl.functor==INTERN_NOT) e1 = e1->u.appl.args[0];
     if (e2->type==EXP_APPL && e2->u.appl.functor==INTERN_NOT) e2 = e2->u.appl.args[0];
-    return ((int)e2)-((int)e1);
+    return ((int)e2->id)-((int)e1->id);
 }
 
 static int added_unate_tuple;
 
+/*
+ * Each tuple carries a 64 bit signature with one bit set for each of its
+ * terms.  A tuple can only be a sublist of a set of terms if its
+ * signature is covered by the signature of the set, which rules out most
+ * tuples before sublist is called.
+ */
+#define TERM_SIG(e) (1ULL << ((e)->id & 63))
+
+static unsigned long long tuple_signature(int count, struct _ex_intern **terms)
+{
+    unsigned long long sig = 0;
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        sig |= TERM_SIG(terms[i]);
+    }
+
+    return sig;
+}
+
+int sublist(int count1, struct _ex_intern **list1, int count2, struct _ex_intern **list2);
+
+/*
+ * Subsumption.  Any tuple that contains all the terms of another tuple
+ * is implied by it.  Such a tuple must contain the first term of the
+ * smaller tuple, so only that term's occurrence list, starting at c, is
+ * checked.  Subsumed tuples are marked so that they are left out when
+ * the tuples are written as clauses.  They stay on the watch lists,
+ * which have no way to unlink a tuple.
+ */
+static void mark_subsumed(struct tuple *tuple, struct tuple *c, int index)
+{
+    int in;
+
+    while (c) {
+        in = c->term_next_index[index];
+        if (c != tuple && !c->subsumed && c->size > tuple->size && (tuple->sig & ~c->sig)==0 &&
+            sublist(tuple->size,tuple->terms,c->size,c->terms)) {
+            _zone_print1("Subsumed tuple %x", c);
+            c->subsumed = 1;
+        }
+        c = c->term_next[index];
+        index = in;
+    }
+}
+
+/*
+ * Backward subsumption of the older tuples by a new one
+ */
+static void skip_subsumed(struct tuple *tuple)
+{
+    mark_subsumed(tuple, tuple->term_next[0], tuple->term_next_index[0]);
+}
+
 void validate_learn(struct learn_info *info)
 {
     static int got_info = 0;
@@ -298,7 +382,7 @@ static struct term_info_list *get_term_info(struct env *env, struct learn_info *
     int hash;
 
     if (term->type==EXP_APPL && term->u.appl.functor==INTERN_NOT) term = term->u.appl.args[0];
-    hash = (((int)term)/4)%TERM_HASH;
+    hash = term->id%TERM_HASH;
 
     t = learn->tuples_by_term[hash];
     while (t != NULL) {
@@ -323,6 +407,9 @@ static struct term_info_list *get_term_info(struct env *env, struct learn_info *
     t->true_implications = t->false_implications = 0;
     t->var1_list = NULL;
     t->var2_list = NULL;
+    t->reason = NULL;
+    t->trail_index = 0;
+    t->min_stamp = 0;
 
     return t;
 #ifdef OLD
@@ -334,7 +421,7 @@ static struct term_info_list *get_term_info(struct env *env, struct learn_info *
 
     if (term->type==EXP_APPL && term->u.appl.functor==INTERN_NOT) term = term->u.appl.args[0];
     //_tree_print_exp("Original", term);
-    hash = (((int)term)/4)%TERM_HASH;
+    hash = term->id%TERM_HASH;
 
     t = learn->tuples_by_term[hash];
     while (t != NULL) {
@@ -345,7 +432,7 @@ static struct term_info_list *get_term_info(struct env *env, struct learn_info *
     if (term->original) _zone_print1("original type %d", term->original->type);
     _zone_print_exp("get_term_info: Original", term->original);
     if (term->original) term = term->original;
-    hash = (((int)term)/4)%TERM_HASH;
+    hash = term->id%TERM_HASH;
     t = learn->tuples_by_term[hash];
     while (t != NULL) {
         if (t->term==term) return t;
@@ -528,6 +615,7 @@ static int add_group(struct env *env, struct learn_info *learn, int count, struc
     struct _ex_intern *base;
     struct tuple *tuple;
     int disagree_count;
+    unsigned long long sig;
 
     added_unate_tuple = 0;
 
@@ -571,6 +659,7 @@ static int add_group(struct env *env, struct learn_info *learn, int count, struc
     _tree_undent();
 
     qsort(terms,count,sizeof(struct _ex_intern *),cmp);
+    sig = tuple_signature(count,terms);
 
     //_tree_print0("Sorted");
     //_tree_indent();
@@ -582,7 +671,7 @@ static int add_group(struct env *env, struct learn_info *learn, int count, struc
 
     base = terms[0];
     if (base->type==EXP_APPL && base->u.appl.functor==INTERN_NOT) base = base->u.appl.args[0];
-    hash = (((int)base)/4)%TERM_HASH;
+    hash = base->id%TERM_HASH;
     //_tree_print("hash 0 %d", hash);
     t = learn->tuples_by_term[hash];
     while (t != NULL && t->term != base) {
@@ -593,7 +682,7 @@ static int add_group(struct env *env, struct learn_info *learn, int count, struc
         tuple = t->tuple;
         while (tuple) {
             int in;
-            if (tuple->size==count) {
+            if (tuple->size==count && tuple->sig==sig) {
                 for (i = 0; i < count; ++i) {
                     if (terms[i] != tuple->terms[i]) goto cont;
                 }
@@ -660,10 +749,14 @@ cont:
         t->true_implications = t->false_implications = 0;
         t->var1_list = NULL;
         t->var2_list = NULL;
+        t->reason = NULL;
+        t->trail_index = 0;
+        t->min_stamp = 0;
 		++learn->term_count;
     }
     tuple = (struct tuple *)_th_alloc(HEURISTIC_SPACE,sizeof(struct tuple));
     tuple->abstract_skip = 0;
+    tuple->subsumed = 0;
     tuple->unate_next = tuple->unate_prev = NULL;
     tuple->terms = terms;
     tuple->term_next = (struct tuple **)_th_alloc(HEURISTIC_SPACE,sizeof(struct tuple *) * count);
@@ -675,6 +768,7 @@ cont:
     tuple->term_next_index[0] = t->index;
     tuple->term_info[0] = t;
     tuple->size = count;
+    tuple->sig = sig;
     tuple->add_mode = add_mode;
     if (tuple->size==1) added_unate_tuple = 1;
     tuple->from_implication = 0;
@@ -699,7 +793,7 @@ cont:
     for (i = 1; i < count; ++i) {
         base = terms[i];
         if (base->type==EXP_APPL && base->u.appl.functor==INTERN_NOT) base = base->u.appl.args[0];
-        hash = (((int)base)/4)%TERM_HASH;
+        hash = base->id%TERM_HASH;
         //_tree_print2("hash %d %d", i, hash);
         t = learn->tuples_by_term[hash];
         while (t != NULL && t->term != base) {
@@ -724,6 +818,9 @@ cont:
             t->true_implications = t->false_implications = 0;
             t->var1_list = NULL;
             t->var2_list = NULL;
+            t->reason = NULL;
+            t->trail_index = 0;
+            t->min_stamp = 0;
     		++learn->term_count;
         }
         tuple->term_next[i] = t->tuple;
@@ -745,6 +842,7 @@ cont:
 		}
         t->reject_count = 0;
     }
+    skip_subsumed(tuple);
 
     disagree_count = 0;
     for (i = 0; i < tuple->size; ++i) {
@@ -802,6 +900,7 @@ cont1:
             tuple->unate_next->unate_prev = tuple;
         }
         t = tuple->term_info[tuple->var1];
+        t->reason = tuple;
         if (tuple->terms[tuple->var1]->type==EXP_APPL && tuple->terms[tuple->var1]->u.appl.functor==INTERN_NOT) {
             ++t->true_implications;
         } else {
@@ -836,6 +935,87 @@ vsids:
     return 1;
 }
 
+/*
+ * Self subsuming strengthening.  If tuple contains a and another tuple d
+ * is the complement of a plus terms that are all in tuple, resolving
+ * the two gives tuple without a.  Returns the position of a, or -1.
+ */
+static int strengthen_position(struct tuple *tuple)
+{
+    struct tuple *d;
+    struct _ex_intern *a, *na;
+    int i, j, k, index, in;
+
+    for (i = 0; i < tuple->size; ++i) {
+        a = tuple->terms[i];
+        d = tuple->term_info[i]->tuple;
+        index = tuple->term_info[i]->index;
+        while (d) {
+            in = d->term_next_index[index];
+            na = d->terms[index];
+            if (d != tuple && !d->subsumed && !d->abstract_skip && d->size <= tuple->size && na != a &&
+                ((d->sig & ~TERM_SIG(na)) & ~tuple->sig)==0) {
+                for (j = 0, k = 0; j < d->size; ++j) {
+                    if (j==index) continue;
+                    while (k < tuple->size && (k==i || tuple->terms[k] != d->terms[j])) ++k;
+                    if (k==tuple->size) break;
+                    ++k;
+                }
+                if (j==d->size) return i;
+            }
+            d = d->term_next[index];
+            index = in;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Periodic reduction of the tuple database, called by the search at each
+ * restart.  Every live tuple subsumes the tuples that contain it, which
+ * catches the pairs that were added in the other order (forward
+ * subsumption).  A tuple that can be strengthened is replaced by the
+ * shorter tuple, which add_group then marks as subsuming it.
+ */
+static struct _ex_intern **reduce_args = NULL;
+static int reduce_size = 0;
+
+void _th_learn_reduce(struct env *env, struct learn_info *info)
+{
+    struct tuple *t, *first = info->tuples;
+    int i, j, p, subsumed = 0, strengthened = 0;
+
+    for (t = first; t; t = t->next) {
+        if (t->subsumed || t->abstract_skip || t->from_implication) continue;
+        mark_subsumed(t, t->term_info[0]->tuple, t->term_info[0]->index);
+    }
+
+    for (t = first; t; t = t->next) {
+        if (t->subsumed || t->abstract_skip || t->from_implication || t->size < 2) continue;
+        p = strengthen_position(t);
+        if (p < 0) continue;
+        if (t->size > reduce_size) {
+            reduce_size = t->size;
+            reduce_args = (struct _ex_intern **)REALLOC(reduce_args,sizeof(struct _ex_intern *) * reduce_size);
+            if (reduce_args==NULL) {
+                printf("Error in REALLOC\n");
+                exit(1);
+            }
+        }
+        for (i = 0, j = 0; i < t->size; ++i) {
+            if (i != p) reduce_args[j++] = t->terms[i];
+        }
+        _zone_print_exp("Strengthening by removing", t->terms[p]);
+        if (add_group(env,info,j,reduce_args,t->add_mode)) ++strengthened;
+    }
+
+    for (t = info->tuples; t; t = t->next) {
+        if (t->subsumed) ++subsumed;
+    }
+    _zone_print2("Reduced tuples: %d subsumed, %d strengthened", subsumed, strengthened);
+}
+
 void _th_abstract_tuples(struct env *env, struct learn_info *info)
 {
     struct tuple *c;
@@ -1003,7 +1183,7 @@ void add_pair(struct env *env, struct learn_info *learn, struct _ex_intern *e1,
     e2base = e2;
     if (e2base->type==EXP_APPL && e2base->u.appl.functor==INTERN_NOT) e2base = e2base->u.appl.args[0];
 
-    if (((int)e2base) > ((int)e1base)) {
+    if (e2base->id > e1base->id) {
         struct _ex_intern *t = e1;
         e1 = e2;
         e2 = t;
@@ -1012,7 +1192,7 @@ void add_pair(struct env *env, struct learn_info *learn, struct _ex_intern *e1,
         e2base = t;
     }
 
-    hash = (((int)e1base)/4)%TERM_HASH;
+    hash = e1base->id%TERM_HASH;
 
     ti = learn->tuples_by_term[hash];
     while (ti != NULL && ti->term != e1base) {
@@ -1043,11 +1223,15 @@ void add_pair(struct env *env, struct learn_info *learn, struct _ex_intern *e1,
         ti->reject_count = 0;
         ti->var1_list = NULL;
         ti->var2_list = NULL;
+        ti->reason = NULL;
+        ti->trail_index = 0;
+        ti->min_stamp = 0;
     }
 
     if (t==NULL) {
         t = (struct tuple *)_th_alloc(HEURISTIC_SPACE,sizeof(struct tuple));
         t->abstract_skip = 0;
+        t->subsumed = 0;
         t->unate_next = t->unate_prev = NULL;
         t->next = learn->tuples;
         learn->tuples = t;
@@ -1059,11 +1243,12 @@ void add_pair(struct env *env, struct learn_info *learn, struct _ex_intern *e1,
         t->term_next[0] = ti->tuple;
         t->term_next_index[0] = ti->index;
         t->size = 2;
+        t->sig = tuple_signature(2,t->terms);
         t->from_implication = 1;
         t->used_count = 0;
         ti->tuple = t;
         ti->index = 0;
-        hash = (((int)e2base)/4)%TERM_HASH;
+        hash = e2base->id%TERM_HASH;
         ti = learn->tuples_by_term[hash];
         while (ti != NULL && ti->term != e2base) {
             ti = ti->next;
@@ -1080,6 +1265,9 @@ void add_pair(struct env *env, struct learn_info *learn, struct _ex_intern *e1,
             ti->count = 0;
             ti->reject_count = 0;
             ti->var1_list = ti->var2_list = NULL;
+            ti->reason = NULL;
+            ti->trail_index = 0;
+            ti->min_stamp = 0;
         }
         t->term_next[1] = ti->tuple;
         t->term_next_index[1] = ti->index;
@@ -1248,6 +1436,11 @@ cont:
     }
 }
 
+int _th_learn_has_term(struct learn_info *info, struct _ex_intern *e)
+{
+    return get_term_info(info->env, info, e, 0) != NULL;
+}
+
 struct _ex_intern *_th_get_assignment(struct env *env, struct learn_info *info, struct _ex_intern *e)
 {
     struct term_info_list *ti;
@@ -1269,6 +1462,13 @@ struct _ex_intern *_th_get_assignment(struct env *env, struct learn_info *info,
     return ti->assignment;
 }
 
+/*
+ * Every assignment gets the next trail index.  When a tuple becomes unate
+ * the implied term records the tuple as its reason, so that conflict
+ * analysis can find antecedants without searching.
+ */
+static int trail_stamp = 0;
+
 int add_assignment(struct env *env, struct learn_info *info, struct term_info_list *ti, struct _ex_intern *value, int d)
 {
     struct tuple *tuple;
@@ -1288,8 +1488,10 @@ int add_assignment(struct env *env, struct learn_info *info, struct term_info_li
 
     if (ti->assignment) {
         if (value==ti->assignment) return 0;
+        ti->trail_index = ++trail_stamp;
         ti->assignment = value;
     } else {
+        ti->trail_index = ++trail_stamp;
         ti->assignment = value;
         tuple = ti->var1_list;
         while (tuple) {
@@ -1367,6 +1569,7 @@ int add_assignment(struct env *env, struct learn_info *info, struct term_info_li
                         tuple->unate_next->unate_prev = tuple;
                     }
                     t = tuple->term_info[tuple->var2];
+                    t->reason = tuple;
                     if (tuple->terms[tuple->var2]->type==EXP_APPL && tuple->terms[tuple->var2]->u.appl.functor==INTERN_NOT) {
                         //_tree_print_exp("Increment true", t->term);
                         ++t->true_implications;
@@ -1485,6 +1688,7 @@ cont1:
                         tuple->unate_next->unate_prev = tuple;
                     }
                     t = tuple->term_info[tuple->var1];
+                    t->reason = tuple;
                     if (tuple->terms[tuple->var1]->type==EXP_APPL && tuple->terms[tuple->var1]->u.appl.functor==INTERN_NOT) {
                         //_tree_print_exp("Increment true", t->term);
                         ++t->true_implications;
@@ -1656,6 +1860,7 @@ void _th_delete_assignment(struct env *env, struct learn_info *info, struct _ex_
                         tuple->unate_next->unate_prev = tuple;
                     }
                     t = tuple->term_info[tuple->var1];
+                    t->reason = tuple;
                     if (tuple->terms[tuple->var1]->type==EXP_APPL && tuple->terms[tuple->var1]->u.appl.functor==INTERN_NOT) {
                         ++t->true_implications;
                     } else {
@@ -1716,6 +1921,7 @@ void _th_delete_assignment(struct env *env, struct learn_info *info, struct _ex_
                         tuple->unate_next->unate_prev = tuple;
                     }
                     t = tuple->term_info[tuple->var1];
+                    t->reason = tuple;
                     if (tuple->terms[tuple->var1]->type==EXP_APPL && tuple->terms[tuple->var1]->u.appl.functor==INTERN_NOT) {
                         ++t->true_implications;
                     } else {
@@ -2106,7 +2312,7 @@ static int share_variables(struct learn_info *info, struct _ex_intern *t1, struc
     int count;
     unsigned *fv;
     int i;
-    int hash = (((int)t1)+((int)t2))%SHARE_SIZE;
+    int hash = (t1->id+t2->id)%SHARE_SIZE;
     int res = 0;
     struct pair_list *p = info->share_hash[hash];
 
@@ -2473,6 +2679,7 @@ static int domain_antecedant(struct env *env, struct learn_info *info, struct pa
 			}
 		}
 	}
+    explanation = _th_expand_merge_reasons(env,explanation);
     _tree_print_exp("Retrieving explanation for", e);
     if (explanation==NULL || (e->type==EXP_APPL &&
         (e->u.appl.functor==INTERN_AND || e->u.appl.functor==INTERN_OR || e->u.appl.functor==INTERN_ITE) && explanation->next==NULL &&
@@ -3696,6 +3903,37 @@ static int exp_antecedant(struct env *env, struct learn_info *info, struct paren
 }
 #endif
 
+/*
+ * Returns the reason recorded for the assignment of ti if it still
+ * implies that assignment, that is if the tuple contains the complement
+ * of the assigned literal and all its other terms are true.  With
+ * ordered set, the other terms must also have been assigned before ti,
+ * which keeps the reasons followed by minimize_learned acyclic.
+ */
+static struct tuple *valid_reason(struct term_info_list *ti, int ordered)
+{
+    struct tuple *t = ti->reason;
+    struct term_info_list *o;
+    int i, neg, found = 0;
+
+    if (t==NULL || ti->assignment==NULL) return NULL;
+
+    for (i = 0; i < t->size; ++i) {
+        o = t->term_info[i];
+        neg = (t->terms[i]->type==EXP_APPL && t->terms[i]->u.appl.functor==INTERN_NOT);
+        if (o==ti) {
+            if ((ti->assignment==_ex_true) != neg) return NULL;
+            found = 1;
+        } else {
+            if (o->assignment==NULL) return NULL;
+            if ((o->assignment==_ex_true) == neg) return NULL;
+            if (ordered && o->trail_index > ti->trail_index) return NULL;
+        }
+    }
+
+    return found?t:NULL;
+}
+
 static struct tuple *find_antecedant(struct learn_info *info, struct parent_list *list, struct _ex_intern *e)
 {
     struct term_info_list *ti;
@@ -3706,6 +3944,17 @@ static struct tuple *find_antecedant(struct learn_info *info, struct parent_list
     //printf("find_antecedant %s\n", _th_print_exp(e));
     ti = get_term_info(NULL, info, e, 1);
 
+    t = valid_reason(ti, 0);
+    if (t) {
+        for (j = 0; j < t->size; ++j) {
+            if (t->term_info[j]->passed || t->terms[j]==e) break;
+        }
+        if (j==t->size) {
+            _zone_print1("Recorded reason %x", t);
+            return t;
+        }
+    }
+
     t = ti->tuple;
     i = ti->index;
 
@@ -3744,6 +3993,111 @@ cont:
 }
 
 
+/*
+ * Learned clause minimization.  A term of a learned tuple can be dropped
+ * when the other terms of its reason are either in the tuple or can
+ * themselves be dropped.  Reasons are only followed back along the
+ * trail, so the tuple that is left is still contradictory.
+ */
+#define MINIMIZE_DEPTH 32
+
+/*
+ * Returns the learn term for literal e, looking through a negation and
+ * the original of a rewritten term.
+ */
+static struct term_info_list *literal_info(struct env *env, struct learn_info *info, struct _ex_intern *e)
+{
+    if (e->type==EXP_APPL && e->u.appl.functor==INTERN_NOT) e = e->u.appl.args[0];
+    if (e->original) e = e->original;
+    return get_term_info(env,info,e,0);
+}
+
+static int min_stamp = 0;
+
+static int redundant_term(struct term_info_list *ti, int depth)
+{
+    struct tuple *t;
+    int i;
+
+    if (ti->min_stamp==min_stamp) return ti->min_state;
+    ti->min_stamp = min_stamp;
+    ti->min_state = 0;
+
+    if (depth==0) return 0;
+    t = valid_reason(ti, 1);
+    if (t==NULL) return 0;
+
+    for (i = 0; i < t->size; ++i) {
+        if (t->term_info[i] != ti && !redundant_term(t->term_info[i], depth-1)) return 0;
+    }
+
+    ti->min_state = 1;
+    return 1;
+}
+
+static int minimize_learned(struct env *env, struct learn_info *info, int count, struct _ex_intern **args)
+{
+    struct term_info_list **tis = (struct term_info_list **)ALLOCA(sizeof(struct term_info_list *) * count);
+    struct tuple *t;
+    int i, j, k;
+
+    ++min_stamp;
+    for (i = 0; i < count; ++i) {
+        tis[i] = literal_info(env,info,args[i]);
+        if (tis[i]==NULL || tis[i]->assignment==NULL ||
+            (tis[i]->assignment==_ex_true) == (args[i]->type==EXP_APPL && args[i]->u.appl.functor==INTERN_NOT)) {
+            tis[i] = NULL;
+        } else {
+            tis[i]->min_stamp = min_stamp;
+            tis[i]->min_state = 1;
+        }
+    }
+
+    j = 0;
+    for (i = 0; i < count; ++i) {
+        if (tis[i] && (t = valid_reason(tis[i], 1))) {
+            for (k = 0; k < t->size; ++k) {
+                if (t->term_info[k] != tis[i] && !redundant_term(t->term_info[k], MINIMIZE_DEPTH)) break;
+            }
+            if (k==t->size) {
+                _zone_print_exp("Minimized", args[i]);
+                continue;
+            }
+        }
+        args[j++] = args[i];
+    }
+
+    return j;
+}
+
+/*
+ * The first UIP is reached when the literal about to be resolved away is
+ * the only one left in the tuple that was assigned at its decision level.
+ */
+static int at_first_uip(struct env *env, struct learn_info *info, struct _ex_intern *test, int count, struct _ex_intern **args)
+{
+    struct term_info_list *ti = literal_info(env,info,test);
+    struct term_info_list *o;
+    int i, n;
+
+    if (ti==NULL || ti->assignment==NULL) return 0;
+
+    for (i = 0, n = 0; i < count; ++i) {
+        o = literal_info(env,info,args[i]);
+        if (o && o->assignment && o->decision_level==ti->decision_level) ++n;
+    }
+
+    return n <= 1;
+}
+
+/*
+ * Conflict analysis.  args is a tuple whose literals all hold.  The trail
+ * in list is walked from the newest assignment back to the decision of
+ * the current level.  Each literal of the tuple that was implied is
+ * resolved away with its antecedant until only one literal of its
+ * decision level is left (the first UIP), or the decision itself is
+ * reached.  The result is minimized and added as a learned tuple.
+ */
 int learn_contradiction(struct env *env, struct learn_info *info, struct parent_list *list, int count, struct _ex_intern **args)
 {
     struct tuple *t;
@@ -3774,36 +4128,91 @@ int learn_contradiction(struct env *env, struct learn_info *info, struct parent_
             if (test->original) test = test->original;
         }
         for (i = 0; i < count; ++i) {
-            if (args[i]==test) goto cont;
+            if (args[i]==test) break;
         }
-        ti = get_term_info(env,info,test,0);
-        if (ti) ti->passed = 1;
-        list = list->next;
-    }
-    while (list) {
-        list->used_in_learn = 0;
-		_tree_print_exp("Processing list term %s", list->split);
+        if (i==count) {
+            ti = get_term_info(env,info,test,0);
+            if (ti) ti->passed = 1;
+            list = list->next;
+            continue;
+        }
+        if (at_first_uip(env,info,test,count,args)) {
+            _zone_print_exp("First UIP", test);
+            break;
+        }
+
+        //printf("Find antecedant 1\n");
+        t = find_antecedant(info,list->next,test);
+#ifdef DOMAIN_PROPAGATE
+        if (t==NULL) {
+            if (list->unate==2) {
+                struct _ex_intern *x;
+                if (list->split->type != EXP_APPL || list->split->u.appl.functor != INTERN_NOT) {
+                    x = _ex_intern_appl1_env(env,INTERN_NOT,list->split);
+                } else {
+                    x = list->split->u.appl.args[0];
+                }
+                exp_antecedant(env,info,list->next,x);
+                if (n_tuple) {
+                    t = n_tuple;
+                }
+            } else {
+                if (domain_antecedant(env,info,list->next,list->split)) {
+                    t = n_tuple;
+                }
+            }
+        }
+#endif
+        if (t==NULL) {
+            return 0;
+        }
+#ifndef FAST
+        //if (_zone_active) {
+            _tree_print0("with");
+            _tree_indent();
+            for (i = 0; i < t->size; ++i) {
+                _tree_print_exp("r", t->terms[i]);
+            }
+            _tree_undent();
+        //}
+#endif
+        args2 = (struct _ex_intern **)ALLOCA(sizeof(struct _ex_intern *) * (t->size+count));
+        j = 0;
+        e = list->split;
+        if (e->type==EXP_APPL && e->u.appl.functor==INTERN_NOT) e = e->u.appl.args[0];
+
         for (i = 0; i < count; ++i) {
-			//_tree_print2("args[%d] = %s", i, _th_print_exp(args[i]));
-            if (args[i]==list->split) {
-                list->used_in_learn = 1;
-                goto cont1;
+            if (args[i] != e && (args[i]->type != EXP_APPL || args[i]->u.appl.functor != INTERN_NOT || args[i]->u.appl.args[0] != e)) {
+                args2[j++] = args[i];
             }
         }
-cont1:
+        l = j;
+        for (i = 0; i < t->size; ++i) {
+            if (t->terms[i] != e && (t->terms[i]->type != EXP_APPL || t->terms[i]->u.appl.functor != INTERN_NOT || t->terms[i]->u.appl.args[0] != e)) {
+                for (k = 0; k < l; ++k) {
+                    if (args2[k]==t->terms[i]) goto cont2;
+                }
+                args2[j++] = t->terms[i];
+cont2:;
+            }
+        }
+        ti = get_term_info(env,info,list->split,0);
+        ti->passed = 1;
+        args = args2;
+        count = j;
         list = list->next;
     }
-    while (list && list != info->unate_tail) {
+    count = minimize_learned(env,info,count,args);
+    while (list) {
         list->used_in_learn = 0;
 		_tree_print_exp("Processing list term %s", list->split);
         for (i = 0; i < count; ++i) {
 			//_tree_print2("args[%d] = %s", i, _th_print_exp(args[i]));
             if (list->split==args[i]) {
                 list->used_in_learn = 1;
-                goto cont3;
+                break;
             }
         }
-cont3:
         list = list->next;
     }
     for (i = 0; i < count; ++i) {
@@ -3824,71 +4233,6 @@ cont3:
     } else {
         return -1;
     }
-cont:
-    //no_recurse = 0;
-    //printf("Find antecedant 1\n");
-    t = find_antecedant(info,list->next,test);
-#ifdef DOMAIN_PROPAGATE
-    if (t==NULL) {
-        if (list->unate==2) {
-            //struct parent_list l;
-            //l.next = list;
-            //l.exp = _ex_true;
-            //l.unate = 2;
-            //l.used_in_learn = 1;
-            struct _ex_intern *x;
-            if (list->split->type != EXP_APPL || list->split->u.appl.functor != INTERN_NOT) {
-                x = _ex_intern_appl1_env(env,INTERN_NOT,list->split);
-            } else {
-                x = list->split->u.appl.args[0];
-            }
-            exp_antecedant(env,info,list->next,x);
-            if (n_tuple) {
-                t = n_tuple;
-            }
-        } else {
-            if (domain_antecedant(env,info,list->next,list->split)) {
-                t = n_tuple;
-            }
-        }
-    }
-#endif
-    if (t==NULL) {
-        return 0;
-    }
-#ifndef FAST
-    //if (_zone_active) {
-        _tree_print0("with");
-        _tree_indent();
-        for (i = 0; i < t->size; ++i) {
-            _tree_print_exp("r", t->terms[i]);
-        }
-        _tree_undent();
-    //}
-#endif
-    args2 = (struct _ex_intern **)ALLOCA(sizeof(struct _ex_intern *) * (t->size+count));
-    j = 0;
-    e = list->split;
-    if (e->type==EXP_APPL && e->u.appl.functor==INTERN_NOT) e = e->u.appl.args[0];
-
-    for (i = 0; i < count; ++i) {
-        if (args[i] != e && (args[i]->type != EXP_APPL || args[i]->u.appl.functor != INTERN_NOT || args[i]->u.appl.args[0] != e)) {
-            args2[j++] = args[i];
-        }
-    }
-    l = j;
-    for (i = 0; i < t->size; ++i) {
-        if (t->terms[i] != e && (t->terms[i]->type != EXP_APPL || t->terms[i]->u.appl.functor != INTERN_NOT || t->terms[i]->u.appl.args[0] != e)) {
-            for (k = 0; k < l; ++k) {
-                if (args2[k]==t->terms[i]) goto cont2;
-            }
-            args2[j++] = t->terms[i];
-cont2:;
-        }
-    }
-    ti = get_term_info(env,info,list->split,0);
-    ti->passed = 1;
-    return learn_contradiction(env, info, list->next, j, args2);
 }
 
 void check_assignments(struct learn_info *info, struct parent_list *list)
@@ -4411,7 +4755,7 @@ int _th_learn_score(struct env *env, struct learn_info *info, struct _ex_intern
 
     if (term->type==EXP_APPL && term->u.appl.functor==INTERN_NOT) term = term->u.appl.args[0];
 
-    hash = (((int)term)/4)%TERM_HASH;
+    hash = term->id%TERM_HASH;
     //_tree_print1("hash = %d", hash);
     t = info->tuples_by_term[hash];
     while (t && t->term != term) {
@@ -4798,7 +5142,7 @@ cont:
         _zone_print2("i = %d %s", i, _th_print_exp(args[i]));
         e = args[i];
         if (e->type==EXP_APPL && e->u.appl.functor==INTERN_NOT) e = e->u.appl.args[0];
-        hash = (((int)e)/4)%TERM_HASH;
+        hash = e->id%TERM_HASH;
         t = info->tuples_by_term[hash];
         while (t != NULL && t->term != e) {
             t = t->next;
@@ -4938,6 +5282,7 @@ int _th_solved_case(struct env *env, struct learn_info *info, struct parent_list
     struct term_info_list *t;
     struct tuple *tuple;
     int index;
+    unsigned long long sig;
 
     //printf("Entering _th_solved_case\n");
     //fflush(stdout);
@@ -4958,11 +5303,12 @@ int _th_solved_case(struct env *env, struct learn_info *info, struct parent_list
         l =l->next;
     }
     qsort(args,count,sizeof(struct _ex_intern *),cmp);
+    sig = tuple_signature(count,args);
 
     for (i = 0; i < count-1; ++i) {
         e = args[i];
         if (e->type==EXP_APPL && e->u.appl.functor==INTERN_NOT) e = e->u.appl.args[0];
-        hash = (((int)e)/4)%TERM_HASH;
+        hash = e->id%TERM_HASH;
         t = info->tuples_by_term[hash];
         while (t != NULL && t->term != e) {
             t = t->next;
@@ -4973,7 +5319,7 @@ int _th_solved_case(struct env *env, struct learn_info *info, struct parent_list
             while (tuple) {
                 int nin = tuple->term_next_index[index];
                 //printf("tuple, index, size = %x %d %d\n", tuple, index, tuple->size);
-                if (index == 0) {
+                if (index == 0 && (tuple->sig & ~sig)==0) {
                     if (sublist(tuple->size,tuple->terms,count-i,args+i)) {
                         ++tuple->used_count;
                         //printf("Exiting _th_solved_case (solved)\n");
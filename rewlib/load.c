@@ -233,7 +233,9 @@ int _th_svcs(struct env *env, char *file)
     struct _ex_intern *e;
     int ret;
     _th_derive_push(env);
+    _th_phase_start(PHASE_PARSE);
     e = _th_process_svc_script(env, file);
+    _th_phase_end(PHASE_PARSE);
     //e2 = _th_parse_smt();
     //e2 = e2->u.appl.args[0]->u.appl.args[0];
     //diff(e,e2,NULL);
@@ -244,7 +246,9 @@ int _th_svcs(struct env *env, char *file)
         //e = _th_nc_rewrite(env,e);
         //e = _th_bit_blast(env,e);
         //printf("*** bit_blast %s\n", _th_print_exp(e));
+        _th_phase_start(PHASE_SEARCH);
         f = _th_prove(env,e);
+        _th_phase_end(PHASE_SEARCH);
         if (f) {
             _tree_print0("Failed nodes");
             printf("INVALID\n");
@@ -270,7 +274,9 @@ int _th_smt(struct env *env, char *name, int print_failures)
     struct _ex_intern *e;
     int ret;
     _th_derive_push(env);
+    _th_phase_start(PHASE_PARSE);
     e = _th_parse_smt(env,name);
+    _th_phase_end(PHASE_PARSE);
     //_th_parse_yices_ce(env,fopen("yices.ce","r"));
     if (e != NULL) {
         struct fail_list *f;
@@ -279,7 +285,9 @@ int _th_smt(struct env *env, char *name, int print_failures)
         //e = _th_bit_blast(env,e);
         //printf("*** bit_blast %s\n", _th_print_exp(e));
         //fprintf(stderr, "_th_smt: env = %x\n", env);
+        _th_phase_start(PHASE_SEARCH);
         f = _th_prove(env,e);
+        _th_phase_end(PHASE_SEARCH);
 		if (f) {
 			if (print_failures) {
 				while (f) {
@@ -427,10 +435,17 @@ int _th_smt_autorun(struct env *env, char *name)
     int ret;
     char *f, *d;
     char write_file[200], write_d_file[200];
-    int state;
+    int state, bclt;
     _th_derive_push(env);
 
+    if (name != NULL && (state = _th_preprocess_cache_lookup(name,write_file,write_d_file,&bclt)) >= 0) {
+        e = NULL;
+        goto solve;
+    }
+
+    _th_phase_start(PHASE_PARSE);
     e = _th_parse_smt(env,name);
+    _th_phase_end(PHASE_PARSE);
     //_th_parse_yices_ce(env,fopen("yices.ce","r"));
     if (e != NULL) {
         //printf("*** Initial: %s\n", _th_print_exp(e));
@@ -451,15 +466,26 @@ int _th_smt_autorun(struct env *env, char *name)
             printf("Here1\n");
             _th_do_symmetry = 1;
         }
+        _th_phase_start(PHASE_PREPROCESS);
         state = _th_preprocess(env,e,f,d);
+        _th_phase_end(PHASE_PREPROCESS);
+        bclt = _th_is_bclt_logic();
+        if (name != NULL) _th_preprocess_cache_store(state,write_file,write_d_file,bclt);
         //printf("state = %d\n", state);
+solve:
         if (state==PREPROCESS_CNF) {
+            _th_phase_start(PHASE_EXTERNAL);
             state = run_minisat(write_d_file);
+            _th_phase_end(PHASE_EXTERNAL);
         } else if (state==PREPROCESS_DEFAULT) {
-            if (_th_is_bclt_logic()) {
+            if (bclt) {
+                _th_phase_start(PHASE_EXTERNAL);
                 state = run_bclt(write_file);
+                _th_phase_end(PHASE_EXTERNAL);
             } else {
+                _th_phase_start(PHASE_EXTERNAL);
                 state = run_yices(write_file);
+                _th_phase_end(PHASE_EXTERNAL);
             }
         }
         if (state==PREPROCESS_SAT) {
@@ -507,7 +533,9 @@ int _th_preprocess_smt(struct env *env, char *name)
     int ret;
     _th_derive_push(env);
 
+    _th_phase_start(PHASE_PARSE);
     e = _th_parse_smt(env,name);
+    _th_phase_end(PHASE_PARSE);
 
     //_th_parse_yices_ce(env,fopen("yices.ce","r"));
     if (e != NULL) {
@@ -525,7 +553,9 @@ int _th_preprocess_smt(struct env *env, char *name)
             sprintf(write_d_file, "%s.cnf", name);
             d = write_d_file;
         }
+        _th_phase_start(PHASE_PREPROCESS);
         _th_preprocess(env,e,f,d);
+        _th_phase_end(PHASE_PREPROCESS);
         ret = 0;
     } else {
         printf("Illegal SMT input\n");
@@ -565,7 +595,9 @@ int _th_print_smt(struct env *env, char *name)
     char write_file[200];
     int ret;
     _th_derive_push(env);
+    _th_phase_start(PHASE_PARSE);
     e = _th_parse_smt(env,name);
+    _th_phase_end(PHASE_PARSE);
     if (e != NULL) {
         //struct _ex_intern *nenv = _th_default_env(ENVIRONMENT_SPACE);
         if (name==NULL) {
@@ -780,7 +812,9 @@ cont:
 				//e = _th_nc_rewrite(env,e);
 				//e = _th_bit_blast(env,e);
 				//printf("*** bit_blast %s\n", _th_print_exp(e));
+				_th_phase_start(PHASE_SEARCH);
 				f = _th_prove(env,e);
+				_th_phase_end(PHASE_SEARCH);
                 if (f) {
                     printf("INVALID\n");
                     _tree_print0("Failed nodes");
@@ -222,7 +222,7 @@ void _th_parse_yices_ce(struct env *env, FILE *file)
             int x = atoi(line+2);
             sprintf(name, "x_%d", x);
             e = _th_parse(env,name);
-            hash = (((int)e)/4)%CE_HASH_SIZE;
+            hash = e->id%CE_HASH_SIZE;
             n = (struct ce_list *)malloc(sizeof(struct ce_list));
             n->text = strdup(name);
             n->next = ce_table[hash];
@@ -248,7 +248,7 @@ void _th_parse_yices_ce(struct env *env, FILE *file)
             int x = atoi(line+1);
             sprintf(name, "%c%d", line[0], x);
             e = _th_parse(env,name);
-            hash = (((int)e)/4)%CE_HASH_SIZE;
+            hash = e->id%CE_HASH_SIZE;
             n = (struct ce_list *)malloc(sizeof(struct ce_list));
             n->text = strdup(name);
             n->next = ce_table[hash];
@@ -280,7 +280,7 @@ void _th_parse_yices_ce(struct env *env, FILE *file)
                 c += 2;
                 while (*c==' ') ++c;
                 e = convert_rat(env,_th_parse(env,c));
-                hash = (((int)e)/4)%CE_HASH_SIZE;
+                hash = e->id%CE_HASH_SIZE;
                 n = (struct ce_list *)malloc(sizeof(struct ce_list));
                 n->text = strdup(c);
                 n->next = ce_table[hash];
@@ -337,7 +337,7 @@ void _th_parse_yices_ce(struct env *env, FILE *file)
                 c += 2;
                 while (*c==' ') ++c;
                 e = convert_rat(env,_th_parse(env,c));
-                hash = (((int)e)/4)%CE_HASH_SIZE;
+                hash = e->id%CE_HASH_SIZE;
                 n = (struct ce_list *)malloc(sizeof(struct ce_list));
                 n->text = strdup(c);
                 n->next = ce_table[hash];
@@ -364,7 +364,7 @@ void _th_parse_yices_ce(struct env *env, FILE *file)
                 c += 2;
                 while (*c==' ') ++c;
                 e = convert_rat(env,_th_parse(env,c));
-                hash = (((int)e)/4)%CE_HASH_SIZE;
+                hash = e->id%CE_HASH_SIZE;
                 n = (struct ce_list *)malloc(sizeof(struct ce_list));
                 n->text = strdup(c);
                 n->next = ce_table[hash];
@@ -458,7 +458,7 @@ void _th_parse_ce(struct env *env, FILE *file)
 			if (val->type==EXP_INTEGER) {
 				val = _ex_intern_rational(val->u.integer,one);
 			}
-			hash = (((int)var)/4)%CE_HASH_SIZE;
+			hash = var->id%CE_HASH_SIZE;
 			n = (struct ce_list *)malloc(sizeof(struct ce_list));
 			n->text = strdup(line);
 			n->next = ce_table[hash];
@@ -527,7 +527,7 @@ void _th_build_yices_env()
                     fprintf(stderr, "Yices contradiction %s\n", _th_print_exp(m->e));
                     exit(1);
                 }
-                hash = (((int)s)/4)%CE_HASH_SIZE;
+                hash = s->id%CE_HASH_SIZE;
                 m->next = ce_table[hash];
                 ce_table[hash] = m;
             }
@@ -606,7 +606,7 @@ struct _ex_intern *yices_ce_value(struct env *env, struct _ex_intern *e)
     e = _th_simp(env,e);
 
     //printf("Split = %s\n", _th_print_exp(p->split));
-    hash = (((int)e)/4)%CE_HASH_SIZE;
+    hash = e->id%CE_HASH_SIZE;
     n = ce_table[hash];
     while (n && n->e != e) {
         n = n->next;
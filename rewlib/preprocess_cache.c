@@ -0,0 +1,214 @@
+/*
+ * preprocess_cache.c
+ *
+ * On disk cache of preprocessing results for the autorun mode
+ *
+ * (C) 2024, Kenneth Roe
+ *
+ * GNU Affero General Public License
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "Globals.h"
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+/*
+ * When a cache directory is given with -pc, _th_smt_autorun looks up
+ * the input before parsing it.  Entries are named by a 64 bit FNV-1a
+ * hash of the input file, the options that change what the
+ * preprocessor produces and the engine itself.  Each entry is up to
+ * three files:
+ *
+ *     <key>.state   the preprocessor verdict and the solver to run
+ *     <key>.out     the preprocessed problem for Yices or bclt
+ *     <key>.cnf     the DIMACS file for MiniSat
+ *
+ * Each file is written under a name carrying the process id and
+ * renamed into place, so runs storing the same entry at the same time
+ * never write into one another's files.  The state file is renamed last,
+ * so an entry whose state file exists is complete.
+ *
+ * A hit skips the parser, so the logic of the input is never seen.
+ * The state file therefore records whether the .out file is for bclt
+ * or for Yices rather than leaving load.c to ask the parser.
+ */
+#define CACHE_VERSION "HTP 2.1 preprocess cache 2"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+char *_th_preprocess_cache_dir = NULL;
+
+static char key[17];
+static int have_key = 0;
+
+static unsigned long long hash_bytes(unsigned long long h, unsigned char *c, int len)
+{
+    while (len--) {
+        h ^= *c++;
+        h *= FNV_PRIME;
+    }
+
+    return h;
+}
+
+static int hash_file(unsigned long long *h, char *name)
+{
+    unsigned char buffer[8192];
+    FILE *f = fopen(name, "rb");
+    int len;
+
+    if (f==NULL) return 0;
+    while ((len = fread(buffer,1,sizeof(buffer),f)) > 0) {
+        *h = hash_bytes(*h, buffer, len);
+    }
+    fclose(f);
+
+    return 1;
+}
+
+static unsigned long long hash_options(unsigned long long h)
+{
+    char options[400];
+
+    sprintf(options, "%s symmetry=%d unate=%d grouping=%d flower=%d equality=%d bigs=%d arrays=%d encoding=%d cycle_length=%d cycle_count=%d pipeline=",
+            CACHE_VERSION, _th_do_symmetry, _th_do_unate, _th_do_grouping, _th_do_break_flower,
+            _th_equality_only, _th_block_bigs, _th_lazy_arrays, _th_encoding_only,
+            _th_cycle_length_limit, _th_cycle_count_limit);
+    h = hash_bytes(h, (unsigned char *)options, strlen(options));
+
+    return hash_bytes(h, (unsigned char *)_th_get_preprocess_pipeline(), strlen(_th_get_preprocess_pipeline()));
+}
+
+static void entry_name(char *buffer, char *ext)
+{
+    sprintf(buffer, "%s/%s%s", _th_preprocess_cache_dir, key, ext);
+}
+
+static void temp_name(char *buffer, char *name)
+{
+    sprintf(buffer, "%s.%d.tmp", name, (int)getpid());
+}
+
+static int copy_file(char *from, char *to)
+{
+    char buffer[8192], tmp[300];
+    FILE *in, *out;
+    int len;
+
+    in = fopen(from, "rb");
+    if (in==NULL) return 0;
+    temp_name(tmp, to);
+    out = fopen(tmp, "wb");
+    if (out==NULL) {
+        fclose(in);
+        return 0;
+    }
+    while ((len = fread(buffer,1,sizeof(buffer),in)) > 0) {
+        fwrite(buffer,1,len,out);
+    }
+    fclose(in);
+    if (fclose(out)) {
+        remove(tmp);
+        return 0;
+    }
+    remove(to);
+
+    return !rename(tmp, to);
+}
+
+/*
+ * Looks up the preprocessing result for the input file name.  On a hit
+ * the verdict is returned, out_file and cnf_file are set to the cached
+ * copies, which the solvers can read directly, and bclt is set if the
+ * out file is for bclt.  Returns -1 on a miss.  The key is kept for
+ * _th_preprocess_cache_store.
+ */
+int _th_preprocess_cache_lookup(char *name, char *out_file, char *cnf_file, int *bclt)
+{
+    unsigned long long h = FNV_OFFSET;
+    char state_file[300];
+    FILE *f;
+    int state;
+
+    have_key = 0;
+    if (_th_preprocess_cache_dir==NULL || strlen(_th_preprocess_cache_dir) > 150) return -1;
+
+    if (!hash_file(&h, name)) return -1;
+    h = hash_options(h);
+#ifdef __linux__
+    hash_file(&h, "/proc/self/exe");
+#endif
+    sprintf(key, "%08x%08x", (unsigned)(h >> 32), (unsigned)h);
+    have_key = 1;
+
+    entry_name(state_file, ".state");
+    f = fopen(state_file, "r");
+    if (f==NULL) return -1;
+    if (fscanf(f, "state %d\n", &state) != 1 || fscanf(f, "bclt %d", bclt) != 1) state = -1;
+    fclose(f);
+    if (state < 0) return -1;
+
+    entry_name(out_file, ".out");
+    entry_name(cnf_file, ".cnf");
+    if (state==PREPROCESS_CNF) {
+        f = fopen(cnf_file, "r");
+    } else if (state==PREPROCESS_DEFAULT) {
+        f = fopen(out_file, "r");
+    } else {
+        return state;
+    }
+    if (f==NULL) return -1;
+    fclose(f);
+
+    _zone_print2("Preprocess cache hit %s for %s", key, name);
+
+    return state;
+}
+
+/*
+ * Records the verdict, the solver choice and the files written by
+ * _th_preprocess under the key of the last lookup.
+ */
+void _th_preprocess_cache_store(int state, char *out_file, char *cnf_file, int bclt)
+{
+    char entry[300], tmp[300];
+    FILE *f;
+
+    if (!have_key) return;
+    have_key = 0;
+
+#ifdef WIN32
+    _mkdir(_th_preprocess_cache_dir);
+#else
+    mkdir(_th_preprocess_cache_dir, 0777);
+#endif
+
+    if (state==PREPROCESS_CNF) {
+        entry_name(entry, ".cnf");
+        if (!copy_file(cnf_file, entry)) return;
+    } else if (state==PREPROCESS_DEFAULT) {
+        entry_name(entry, ".out");
+        if (!copy_file(out_file, entry)) return;
+    }
+
+    entry_name(entry, ".state");
+    temp_name(tmp, entry);
+    f = fopen(tmp, "w");
+    if (f==NULL) return;
+    fprintf(f, "state %d\n", state);
+    fprintf(f, "bclt %d\n", bclt);
+    if (fclose(f)) {
+        remove(tmp);
+        return;
+    }
+    remove(entry);
+    rename(tmp, entry);
+}
@@ -450,38 +450,6 @@ static struct _ex_intern *get_var(int i, struct _ex_intern *type)
     return _ex_intern_var(_th_intern(name));
 }
 
-static void mark_duplicate_subterms(struct env *env, struct _ex_intern *e)
-{
-    int i;
-
-    if (e->type==EXP_VAR || e->type==EXP_INTEGER || e->type==EXP_RATIONAL || e==_ex_true || e==_ex_false) return;
-
-    //if (e->type==EXP_APPL && e->u.appl.functor != INTERN_NOT && e->u.appl.functor != INTERN_AND &&
-    //    e->u.appl.functor != INTERN_XOR &&
-    //    e->u.appl.functor != INTERN_OR && e->u.appl.functor != INTERN_ITE) return;
-
-    if (e->type==EXP_APPL && e->user2==NULL) {
-        for (i = 0; i < e->u.appl.count; ++i) {
-            mark_duplicate_subterms(env,e->u.appl.args[i]);
-        }
-    }
-
-    if (e->user2==_ex_true) {
-        struct _ex_intern *var = get_var(var_count++, get_type(env,e));
-        e->user2 = var;
-        e->user1 = NULL;
-        var->user2 = e;
-        var->next_cache = trail;
-        _th_set_var_type(env,var->u.var,_th_get_exp_type(env,e));
-        trail = var;
-    } else if (e->user2==NULL && (e->type != EXP_APPL || e->u.appl.functor != INTERN_RAT_PLUS)) {
-        e->user2 = _ex_true;
-        e->user1 = NULL;
-        e->next_cache = trail;
-        trail = e;
-    }
-}
-
 static struct _ex_intern *int_add_subs(struct env *env, struct _ex_intern *e, struct _ex_intern *var)
 {
     int i;
@@ -540,63 +508,12 @@ static struct _ex_intern *add_subs(struct env *env, struct _ex_intern *e, struct
     return ret;
 }
 
-static int int_all_vars_printed(struct _ex_intern *e, struct _ex_intern *var)
-{
-    int i;
-
-    //printf("Checking term %s\n", _th_print_exp(e));
-    //printf("    var %s\n", _th_print_exp(e->user2));
-    //if (e->user2) printf("    var ptr %s\n", _th_print_exp(e->user2->user2));
-
-    if (e->user2 && e->user2 != var && e->user2->type == EXP_VAR && e->user2->user2->type != EXP_VAR) return 0;
-
-    if (e==_ex_true || e==_ex_false || e->type != EXP_APPL) return 1;
-
-    if (e->user2 && e->user1==e) return 1;
-
-    for (i = 0; i < e->u.appl.count; ++i) {
-        if (!int_all_vars_printed(e->u.appl.args[i],var)) return 0;
-    }
-
-    if (e->user2==NULL) {
-        e->next_cache = trail;
-        e->user2 = _ex_true;
-        trail = e;
-    }
-
-    e->user1 = e;
-
-    return 1;
-}
-
-static int all_vars_printed(struct _ex_intern *e, struct _ex_intern *var)
-{
-    struct _ex_intern *old_trail = trail;
-    int ret;
-
-    ret = int_all_vars_printed(e,var);
-
-    while (trail != old_trail && trail) {
-        struct _ex_intern *t = trail->next_cache;
-        trail->user1 = NULL;
-        trail->user2 = NULL;
-        trail->next_cache = NULL;
-        trail = t;
-    }
-
-    while (old_trail && old_trail != _ex_true) {
-        old_trail->user1 = NULL;
-        old_trail = old_trail->next_cache;
-    }
-    return ret;
-}
-
 void _th_print_state(struct env *env, struct parent_list *list, struct learn_info *info, struct _ex_intern *e, FILE *f, char *name, char *status, char *logic)
 {
     struct parent_list *l;
     int i;
-    struct add_list *terms, *term, *nterms;
-    struct _ex_intern *t;
+    struct _ex_intern *t, **order, **shared;
+    int binding_count;
 
     var_count = 0;
 
@@ -668,7 +585,29 @@ void _th_print_state(struct env *env, struct parent_list *list, struct learn_inf
         t->user2 = NULL;
     }
     trail = _ex_true;
-    mark_duplicate_subterms(env,e);
+
+    /*
+     * Each subterm that occurs more than once in e gets a let or flet
+     * variable.  _th_share_subterms returns them in post order, which is
+     * also the order the bindings are printed in.  Sums are left unbound
+     * so that difference logic atoms keep their (- x y) form.
+     */
+    i = _th_share_subterms(e,&shared);
+    order = (struct _ex_intern **)ALLOCA(sizeof(struct _ex_intern *) * (i+1));
+    binding_count = 0;
+    while (i--) {
+        t = *shared++;
+        if (t->type != EXP_APPL || t->u.appl.functor==INTERN_RAT_PLUS) continue;
+        order[binding_count] = get_var(var_count++, get_type(env,t));
+        t->user2 = order[binding_count];
+        t->user1 = NULL;
+        order[binding_count]->user2 = t;
+        _th_set_var_type(env,order[binding_count]->u.var,_th_get_exp_type(env,t));
+        t->next_cache = trail;
+        trail = t;
+        ++binding_count;
+    }
+    _th_share_release();
     //check_user2(env,"print_state3");
     while (list) {
         if (list->split) {
@@ -680,56 +619,19 @@ void _th_print_state(struct env *env, struct parent_list *list, struct learn_inf
         list = list->next;
     }
     fprintf(f, "    :formula\n");
-    terms = NULL;
-    for (i = 0; i < var_count; ++i) {
-        struct _ex_intern *var = get_var(i,NULL);
-        if (all_vars_printed(var->user2,var)) {
-            if (get_type(env,var->user2)==_ex_bool) {
-                fprintf(f, "    (flet (");
-            } else {
-                fprintf(f, "    (let (");
-            }
-            print_formula(f,env,var);
-            fprintf(f, " ");
-            print_formula(f,env,add_subs(env,var->user2,var));
-            fprintf(f, ")\n");
-            var->user2 = var;
+    for (i = 0; i < binding_count; ++i) {
+        struct _ex_intern *var = order[i];
+        if (get_type(env,var->user2)==_ex_bool) {
+            fprintf(f, "    (flet (");
         } else {
-            term = (struct add_list *)ALLOCA(sizeof(struct add_list));
-            term->next = terms;
-            terms = term;
-            term->e = var;
+            fprintf(f, "    (let (");
         }
+        print_formula(f,env,var);
+        fprintf(f, " ");
+        print_formula(f,env,add_subs(env,var->user2,var));
+        fprintf(f, ")\n");
+        var->user2 = var;
     }
-    //check_user2(env,"print_state4");
-    do {
-        nterms = NULL;
-        //printf("Here2a\n");
-        while (terms) {
-            //printf("Testing %s\n", _th_print_exp(terms->e));
-            //printf("    exp %s\n", _th_print_exp(terms->e->user2));
-            //printf("    exp %s\n", _th_print_exp(add_subs(env,terms->e->user2,terms->e)));
-            if (all_vars_printed(terms->e->user2,terms->e)) {
-                if (get_type(env,terms->e->user2)==_ex_bool) {
-                    fprintf(f, "    (flet (");
-                } else {
-                    fprintf(f, "    (let (");
-                }
-                print_formula(f,env,terms->e);
-                fprintf(f, " ");
-                print_formula(f,env,add_subs(env,terms->e->user2,terms->e));
-                fprintf(f, ")\n");
-                terms->e->user2 = terms->e;
-            } else {
-                term = (struct add_list *)ALLOCA(sizeof(struct add_list));
-                term->next = nterms;
-                nterms = term;
-                term->e = terms->e;
-            }
-            terms = terms->next;
-        }
-        terms = nterms;
-    } while (terms);
 
     //check_user2(env,"print_state5");
     if (info) {
@@ -758,7 +660,7 @@ void _th_print_state(struct env *env, struct parent_list *list, struct learn_inf
         print_as_smt(f,env,8,add_subs(env,e,NULL), 0);
     }
     fprintf(f, "    ");
-    for (i = 0; i < var_count; ++i) fprintf(f,")");
+    for (i = 0; i < binding_count; ++i) fprintf(f,")");
     fprintf(f, "\n");
 
     fprintf(f,"    )\n");
@@ -0,0 +1,253 @@
+/*
+ * profile.c
+ *
+ * Rewrite rule and builtin simplifier profiler
+ *
+ * (C) 2024, Kenneth Roe
+ *
+ * GNU Affero General Public License
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "Globals.h"
+#include "Intern.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif !defined(__i386__) && !defined(__x86_64__)
+#include <sys/time.h>
+#endif
+
+/*
+ * When profiling is turned on (-rp), every attempt to apply a rule in
+ * _th_rewrite_rule and every call to _th_builtin from the rewriter is
+ * bracketed by _th_profile_*_start and _th_profile_*_end.  The brackets
+ * form a stack that mirrors the recursion of the rewriter.  "self" cycles
+ * are charged to the entry on top of the stack, so a rule whose
+ * condition is proved by rewriting with other rules is only charged for
+ * its own matching and bookkeeping.  "total" cycles include everything
+ * done while the entry was active, including condition checks.
+ *
+ * Entries for rules are indexed by the id of the rule term and entries
+ * for builtins by the functor symbol of the term being simplified.
+ */
+int _th_rule_profiling = 0;
+
+struct profile_entry {
+    struct _ex_intern *rule;
+    unsigned functor;
+    unsigned attempts;
+    unsigned matches;
+    unsigned condition_failures;
+    unsigned uses;
+    unsigned long long self;
+    unsigned long long total;
+    unsigned long long condition;
+};
+
+struct profile_frame {
+    struct profile_entry *entry;
+    unsigned long long start;
+};
+
+static struct profile_entry **rule_entries = NULL;
+static unsigned rule_entry_size = 0;
+static struct profile_entry **builtin_entries = NULL;
+static unsigned builtin_entry_size = 0;
+
+static struct profile_frame *frames = NULL;
+static int frame_size = 0;
+static int frame_top = 0;
+static unsigned long long last_cycles;
+
+static int reported = 0;
+
+unsigned long long _th_profile_cycles()
+{
+#if defined(_MSC_VER)
+    return __rdtsc();
+#elif defined(__i386__) || defined(__x86_64__)
+    unsigned lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return (((unsigned long long)hi) << 32) | lo;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((unsigned long long)tv.tv_sec) * 1000000 + tv.tv_usec;
+#endif
+}
+
+static struct profile_entry *get_entry(struct profile_entry ***table, unsigned *size, unsigned index)
+{
+    struct profile_entry *p;
+
+    if (index >= *size) {
+        unsigned s = index * 2 + 1024;
+        *table = (struct profile_entry **)REALLOC(*table,sizeof(struct profile_entry *) * s);
+        if (*table==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
+        memset(*table + *size, 0, sizeof(struct profile_entry *) * (s - *size));
+        *size = s;
+    }
+
+    p = (*table)[index];
+    if (p==NULL) {
+        p = (struct profile_entry *)MALLOC(sizeof(struct profile_entry));
+        memset(p, 0, sizeof(struct profile_entry));
+        (*table)[index] = p;
+    }
+
+    return p;
+}
+
+static void push(struct profile_entry *p)
+{
+    unsigned long long t = _th_profile_cycles();
+
+    if (frame_top > 0) frames[frame_top-1].entry->self += t - last_cycles;
+    last_cycles = t;
+
+    if (frame_top >= frame_size) {
+        frame_size = frame_size * 2 + 256;
+        frames = (struct profile_frame *)REALLOC(frames,sizeof(struct profile_frame) * frame_size);
+        if (frames==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
+    }
+    frames[frame_top].entry = p;
+    frames[frame_top].start = t;
+    ++frame_top;
+    ++p->attempts;
+}
+
+static struct profile_entry *pop()
+{
+    unsigned long long t = _th_profile_cycles();
+    struct profile_entry *p = frames[--frame_top].entry;
+
+    p->self += t - last_cycles;
+    p->total += t - frames[frame_top].start;
+    last_cycles = t;
+
+    return p;
+}
+
+void _th_profile_rule_start(struct _ex_intern *rule)
+{
+    struct profile_entry *p = get_entry(&rule_entries, &rule_entry_size, rule->id);
+
+    p->rule = rule;
+    push(p);
+}
+
+void _th_profile_rule_end()
+{
+    pop();
+}
+
+/*
+ * Called after each call to test_condition for the rule on top of the
+ * stack.  start is the cycle count from just before the call.
+ */
+void _th_profile_condition(int success, unsigned long long start)
+{
+    struct profile_entry *p = frames[frame_top-1].entry;
+
+    ++p->matches;
+    p->condition += _th_profile_cycles() - start;
+    if (success) {
+        ++p->uses;
+    } else {
+        ++p->condition_failures;
+    }
+}
+
+void _th_profile_builtin_start(struct _ex_intern *e)
+{
+    unsigned functor = (e->type==EXP_APPL) ? e->u.appl.functor : 0;
+    struct profile_entry *p = get_entry(&builtin_entries, &builtin_entry_size, functor);
+
+    p->functor = functor;
+    push(p);
+}
+
+void _th_profile_builtin_end(int fired)
+{
+    struct profile_entry *p = pop();
+
+    if (fired) ++p->uses;
+}
+
+static int cmp(const void *i1, const void *i2)
+{
+    struct profile_entry *p1 = *(struct profile_entry **)i1;
+    struct profile_entry *p2 = *(struct profile_entry **)i2;
+
+    if (p1->self > p2->self) return -1;
+    if (p1->self < p2->self) return 1;
+    return 0;
+}
+
+static int collect(struct profile_entry **entries, struct profile_entry **table, unsigned size, int count)
+{
+    unsigned i;
+
+    for (i = 0; i < size; ++i) {
+        if (table[i] && table[i]->attempts) entries[count++] = table[i];
+    }
+
+    return count;
+}
+
+/*
+ * Prints the rules and builtins sorted by self cycles.  The report is
+ * printed from _th_shutdown_rewrite, while the terms can still be
+ * printed, or at exit if the run is cut short by the time limit.
+ */
+void _th_profile_report()
+{
+    struct profile_entry **entries;
+    unsigned long long total = 0;
+    int count, i;
+
+    if (!_th_rule_profiling || reported) return;
+    reported = 1;
+
+    while (frame_top > 0) pop();
+
+    entries = (struct profile_entry **)MALLOC(sizeof(struct profile_entry *) * (rule_entry_size + builtin_entry_size + 1));
+    count = collect(entries, rule_entries, rule_entry_size, 0);
+    count = collect(entries, builtin_entries, builtin_entry_size, count);
+    qsort(entries, count, sizeof(struct profile_entry *), cmp);
+
+    for (i = 0; i < count; ++i) {
+        total += entries[i]->self;
+    }
+
+    printf("\nRule profile (cycles in millions)\n\n");
+    printf("%10s %10s %10s %10s %10s %10s %10s %6s\n",
+           "attempts", "matches", "cond fail", "uses", "self", "total", "condition", "%self");
+    for (i = 0; i < count; ++i) {
+        struct profile_entry *p = entries[i];
+        printf("%10u %10u %10u %10u %10.2f %10.2f %10.2f %6.2f ",
+               p->attempts, p->matches, p->condition_failures, p->uses,
+               p->self / 1000000.0, p->total / 1000000.0, p->condition / 1000000.0,
+               total ? (100.0 * p->self) / total : 0.0);
+        if (p->rule) {
+            printf("%s\n", _th_print_exp(p->rule));
+        } else {
+            printf("builtin %s\n", p->functor ? _th_intern_decode(p->functor) : "<non-application>");
+        }
+    }
+    printf("\n");
+
+    FREE(entries);
+}
+
+void _th_profile_rules()
+{
+    if (!_th_rule_profiling) atexit(_th_profile_report);
+    _th_rule_profiling = 1;
+}
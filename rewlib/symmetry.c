@@ -11,95 +11,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <memory.h>
+#include <string.h>
 #include "Globals.h"
 #include "Intern.h"
 
-struct switch_list {
-    struct switch_list *next;
-    struct _ex_intern *t1, *t2;
-};
 
 static struct _ex_intern *trail;
 
-static struct _ex_intern *sv(struct env *env, struct _ex_intern *e, struct _ex_intern *v1, struct _ex_intern *v2)
-{
-    if (e==v1) return v2;
-    if (e==v2) return v1;
-
-    if (e->user2) return e->user2;
-
-    if (e->type==EXP_APPL) {
-        struct _ex_intern **args = (struct _ex_intern **)ALLOCA(sizeof(struct _ex_intern *) * e->u.appl.count);
-        int i, change;
-        change = 0;
-        for (i = 0; i < e->u.appl.count; ++i) {
-            args[i] = sv(env,e->u.appl.args[i],v1,v2);
-            if (args[i] != e->u.appl.args[i]) change = 1;
-        }
-        e->next_cache = trail;
-        trail = e;
-        if (change) {
-            return e->user2 = _ex_intern_appl_env(env,e->u.appl.functor,e->u.appl.count,args);
-        } else {
-            return e->user2 = e;
-        }
-    }
-
-    return e;
-}
-
-static struct _ex_intern *swap_vars(struct env *env, struct _ex_intern *e, struct _ex_intern *v1, struct _ex_intern *v2)
-{
-    struct _ex_intern *res;
-    
-    trail = NULL;
-
-    res = sv(env,e,v1,v2);
-
-    while (trail) {
-        trail->user2 = NULL;
-        trail = trail->next_cache;
-    }
-
-    return res;
-}
-
-static struct switch_list *symmetric_vars(struct env *env, struct _ex_intern *e)
-{
-    unsigned *fv;
-    int count;
-    int i, j;
-    struct _ex_intern **vars;
-    struct switch_list *s, *sl = NULL;
-
-    fv = _th_get_free_vars(e,&count);
-    vars = (struct _ex_intern **)ALLOCA(sizeof(struct _ex_intern *) * count);
-    for (i = 0; i < count; ++i) {
-        vars[i] = _ex_intern_var(fv[i]);
-    }
-
-    //printf("count = %d\n", count);
-    if (count > 200) return NULL;
-    for (i = 0; i < count; ++i) {
-        //printf("i = %d\n", i);
-        for (j = i+1; j < count; ++j) {
-            if (_th_get_var_type(env,vars[i]->u.var)==_th_get_var_type(env,vars[j]->u.var)) {
-                if (swap_vars(env,e,vars[i],vars[j])==e) {
-                    s = (struct switch_list *)_th_alloc(REWRITE_SPACE,sizeof(struct switch_list));
-                    s->next = sl;
-                    s->t1 = vars[i];
-                    s->t2 = vars[j];
-                    sl = s;
-                    //printf("Symmetric vars %s %s\n", _th_intern_decode(vars[i]->u.var), _th_intern_decode(vars[j]->u.var));
-                    _tree_print2("Symmetric vars %s %s", _th_intern_decode(vars[i]->u.var), _th_intern_decode(vars[j]->u.var));
-                }
-            }
-        }
-    }
-
-    return sl;
-}
-
 static struct add_list *cp(struct env *env, struct _ex_intern *e, struct add_list *tail)
 {
     struct add_list *a;
@@ -188,318 +106,608 @@ static struct add_list *collect_predicates(struct env *env, struct _ex_intern *e
     return res;
 }
 
-#define PREDICATE_PAIR_HASH 255
+/*
+ * Symmetry detection
+ *
+ * The theorem is treated as a colored graph with one vertex per
+ * distinct subterm and an edge from each application to each of its
+ * arguments.  Arguments of functors that are not commutative carry
+ * their position in the edge.  Variables are colored by their type,
+ * applications by their functor and every other leaf by its identity,
+ * so only variables of the same type can be exchanged.
+ *
+ * Generators of the automorphism group are found the way saucy and
+ * bliss do it.  The coloring is refined until it is equitable.  Then
+ * the first variable a of the first non-trivial cell is individualized
+ * and, for each b in the same cell that is not yet in the orbit of a,
+ * a search individualizes a on one side and b on the other and keeps
+ * refining until the variables are discrete.  The leaf gives a
+ * permutation of the variables, which is kept if renaming the
+ * variables of the theorem by it gives back the same term.  Then a is
+ * fixed and the next cell is processed.
+ *
+ * Colors are hashes, so the refinement of two different
+ * individualizations can be compared directly.  A collision can only
+ * make the search miss a symmetry since every permutation is checked
+ * against the theorem.
+ */
+#define SYMMETRY_MAX_GENERATORS 64
+#define SYMMETRY_MAX_DEPTH      64
+#define SYMMETRY_SEARCH_BUDGET  256
+#define SYMMETRY_LEX_LENGTH     16
+#define SYMMETRY_MAX_VARS       5000
+
+#define IND_TAG 0x9e3779b97f4a7c15ULL
+
+typedef unsigned long long color;
 
-struct pair_info {
-    struct pair_info *next;
-    struct _ex_intern *term;
-    struct add_list *matches[PREDICATE_PAIR_HASH];
+struct sym_graph {
+    int count;
+    struct _ex_intern **terms;
+    int *first_child, *children, *child_pos;
+    int *first_parent, *parents, *parent_pos;
+    color *initial;
+    int var_count;
+    int *vars;
 };
 
-struct pair_info *pairs[PREDICATE_PAIR_HASH];
+static struct sym_graph graph;
+static struct term_marks *vertex_marks = NULL;
+static int search_budget;
 
-static void build_pair_info(struct switch_list *list)
+static color mix(color x)
 {
-    int i;
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
 
-    for (i = 0; i < PREDICATE_PAIR_HASH; ++i) {
-        pairs[i] = NULL;
-    }
+static int count_vertices(struct _ex_intern *e, int *edges)
+{
+    int i, count = 1;
 
-    while (list) {
-        int hash1 = (((int)list->t1)/4)%PREDICATE_PAIR_HASH;
-        int hash2 = (((int)list->t2)/4)%PREDICATE_PAIR_HASH;
-        struct pair_info *p1;
-        struct add_list *p2;
+    if (_th_visit_term(vertex_marks,e)) return 0;
 
-        p1 = pairs[hash1];
-        while (p1) {
-            if (p1->term==list->t1) goto cont;
-            p1 = p1->next;
+    if (e->type==EXP_APPL) {
+        *edges += e->u.appl.count;
+        for (i = 0; i < e->u.appl.count; ++i) {
+            count += count_vertices(e->u.appl.args[i],edges);
         }
-        p1 = (struct pair_info *)_th_alloc(REWRITE_SPACE,sizeof(struct pair_info));
-        p1->next = pairs[hash1];
-        pairs[hash1] = p1;
-        p1->term = list->t1;
-        for (i = 0; i < PREDICATE_PAIR_HASH; ++i) {
-            p1->matches[i] = NULL;
+    }
+
+    return count;
+}
+
+static int add_vertex(struct env *env, struct _ex_intern *e)
+{
+    struct _ex_intern *t;
+    int i, v;
+
+    if (_th_term_marked(vertex_marks,e)) return (int)(long)_th_term_value(vertex_marks,e)-1;
+
+    if (e->type==EXP_APPL) {
+        for (i = 0; i < e->u.appl.count; ++i) {
+            add_vertex(env,e->u.appl.args[i]);
         }
-cont:
-        p2 = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
-        p2->next = p1->matches[hash2];
-        p1->matches[hash2] = p2;
-        p2->e = list->t2;
-        list = list->next;
     }
+
+    v = graph.count++;
+    graph.terms[v] = e;
+    _th_set_term_value(vertex_marks,e,(void *)(long)(v+1));
+
+    switch (e->type) {
+        case EXP_VAR:
+            t = _th_get_var_type(env,e->u.var);
+            graph.initial[v] = mix(((color)EXP_VAR << 32) + (t ? t->id : 0));
+            graph.vars[graph.var_count++] = v;
+            break;
+        case EXP_APPL:
+            graph.initial[v] = mix(mix(((color)EXP_APPL << 32) + e->u.appl.functor) + e->u.appl.count);
+            break;
+        default:
+            graph.initial[v] = mix(((color)e->type << 32) + e->id);
+            break;
+    }
+
+    return v;
 }
 
-static int swappable_terms(struct _ex_intern *t1, struct _ex_intern *t2)
+static int build_graph(struct env *env, struct _ex_intern *e)
 {
-    struct pair_info *p1;
-    struct add_list *p2;
-    int hash1, hash2;
-
-    if (t1->type==EXP_VAR && t1==t2) return 0;
-
-    hash1 = (((int)t1)/4)%PREDICATE_PAIR_HASH;
-    hash2 = (((int)t2)/4)%PREDICATE_PAIR_HASH;
-
-    p1 = pairs[hash1];
-    while (p1) {
-        if (p1->term==t1) goto cont;
-        p1 = p1->next;
-    }
-    goto cont1;
-cont:
-    p2 = p1->matches[hash2];
-    while (p2) {
-        if (p2->e==t2) {
-            return 1;
+    int vertices, edges = 0, v, i, j, k;
+
+    if (vertex_marks==NULL) vertex_marks = _th_new_term_marks(1);
+    _th_start_traversal(vertex_marks);
+    vertices = count_vertices(e,&edges);
+
+    graph.count = 0;
+    graph.var_count = 0;
+    graph.terms = (struct _ex_intern **)_th_alloc(REWRITE_SPACE,sizeof(struct _ex_intern *) * vertices);
+    graph.initial = (color *)_th_alloc(REWRITE_SPACE,sizeof(color) * vertices);
+    graph.vars = (int *)_th_alloc(REWRITE_SPACE,sizeof(int) * vertices);
+    graph.first_child = (int *)_th_alloc(REWRITE_SPACE,sizeof(int) * (vertices+1));
+    graph.first_parent = (int *)_th_alloc(REWRITE_SPACE,sizeof(int) * (vertices+1));
+    graph.children = (int *)_th_alloc(REWRITE_SPACE,sizeof(int) * (edges+1));
+    graph.child_pos = (int *)_th_alloc(REWRITE_SPACE,sizeof(int) * (edges+1));
+    graph.parents = (int *)_th_alloc(REWRITE_SPACE,sizeof(int) * (edges+1));
+    graph.parent_pos = (int *)_th_alloc(REWRITE_SPACE,sizeof(int) * (edges+1));
+
+    _th_start_traversal(vertex_marks);
+    add_vertex(env,e);
+
+    if (graph.var_count > SYMMETRY_MAX_VARS) return 0;
+
+    for (v = 0; v <= vertices; ++v) {
+        graph.first_parent[v] = 0;
+    }
+    k = 0;
+    for (v = 0; v < vertices; ++v) {
+        struct _ex_intern *t = graph.terms[v];
+        graph.first_child[v] = k;
+        if (t->type==EXP_APPL) {
+            int ordered = !_th_is_ac_or_c(env,t->u.appl.functor);
+            for (i = 0; i < t->u.appl.count; ++i) {
+                j = (int)(long)_th_term_value(vertex_marks,t->u.appl.args[i])-1;
+                graph.children[k] = j;
+                graph.child_pos[k] = ordered ? i+1 : 0;
+                ++graph.first_parent[j+1];
+                ++k;
+            }
         }
-        p2 = p2->next;
     }
-cont1:
-    hash1 = (((int)t2)/4)%PREDICATE_PAIR_HASH;
-    hash2 = (((int)t1)/4)%PREDICATE_PAIR_HASH;
+    graph.first_child[vertices] = k;
 
-    p1 = pairs[hash1];
-    while (p1) {
-        if (p1->term==t2) goto cont2;
-        p1 = p1->next;
+    for (v = 0; v < vertices; ++v) {
+        graph.first_parent[v+1] += graph.first_parent[v];
     }
-    return 0;
-cont2:
-    p2 = p1->matches[hash2];
-    while (p2) {
-        if (p2->e==t1) {
-            return 1;
+    for (v = 0; v < vertices; ++v) {
+        for (k = graph.first_child[v]; k < graph.first_child[v+1]; ++k) {
+            j = graph.children[k];
+            graph.parents[graph.first_parent[j]] = v;
+            graph.parent_pos[graph.first_parent[j]++] = graph.child_pos[k];
         }
-        p2 = p2->next;
     }
+    for (v = vertices; v > 0; --v) {
+        graph.first_parent[v] = graph.first_parent[v-1];
+    }
+    graph.first_parent[0] = 0;
 
-    return 0;
+    return 1;
 }
 
-struct pair_map {
-    struct pair_map *next;
-    struct _ex_intern *e1, *e2;
-};
+static int color_cmp(const void *i1, const void *i2)
+{
+    color c1 = *(color *)i1;
+    color c2 = *(color *)i2;
 
-static struct pair_map *swappable_predicates(struct env *env, struct pair_map *mapped, struct _ex_intern *p1, struct _ex_intern *p2);
+    if (c1 < c2) return -1;
+    if (c1 > c2) return 1;
+    return 0;
+}
 
-static struct pair_map *rec_check_swap(struct env *env, struct pair_map *mapped, struct _ex_intern *p1, struct _ex_intern *p2, char *block, int pos)
+static int distinct_colors(color *colors, color *sorted)
 {
-    int i;
-    struct pair_map *res;
+    int i, count;
 
-    if (pos==p1->u.appl.count) return mapped;
+    memcpy(sorted, colors, sizeof(color) * graph.count);
+    qsort(sorted, graph.count, sizeof(color), color_cmp);
+    count = (graph.count > 0);
+    for (i = 1; i < graph.count; ++i) {
+        if (sorted[i] != sorted[i-1]) ++count;
+    }
 
-    for (i = 0; i < p1->u.appl.count; ++i) {
-        if (block[i]) {
-            block[i] = 0;
-            res = swappable_predicates(env,mapped,p1->u.appl.args[pos],p2->u.appl.args[i]);
-            if (res) {
-                res = rec_check_swap(env,res,p1,p2,block,pos+1);
-                if (res) return res;
+    return count;
+}
+
+/*
+ * Refines colors until the partition is equitable.  The signature of a
+ * vertex is its color together with the multisets of the colors of its
+ * children and parents, each tagged with the argument position.  The
+ * multisets are hashed by summing, so no sorting is needed.
+ */
+static void refine(color *colors)
+{
+    color *next = (color *)MALLOC(sizeof(color) * graph.count);
+    color *sorted = (color *)MALLOC(sizeof(color) * graph.count);
+    int cells = distinct_colors(colors, sorted);
+    int v, k, n;
+
+    while (1) {
+        for (v = 0; v < graph.count; ++v) {
+            color down = 0, up = 0;
+            for (k = graph.first_child[v]; k < graph.first_child[v+1]; ++k) {
+                down += mix(colors[graph.children[k]] + graph.child_pos[k]);
+            }
+            for (k = graph.first_parent[v]; k < graph.first_parent[v+1]; ++k) {
+                up += mix(colors[graph.parents[k]] ^ ((color)graph.parent_pos[k] << 48));
             }
-            block[i] = 1;
+            next[v] = mix(mix(colors[v] + down) ^ up);
         }
+        memcpy(colors, next, sizeof(color) * graph.count);
+        n = distinct_colors(colors, sorted);
+        if (n <= cells) break;
+        cells = n;
     }
 
-    return NULL;
+    FREE(next);
+    FREE(sorted);
 }
 
-static struct pair_map *swappable_predicates(struct env *env, struct pair_map *mapped, struct _ex_intern *p1, struct _ex_intern *p2)
+static void individualize(color *colors, int v, int depth)
 {
-    if (swappable_terms(p1,p2)) {
-        struct pair_map *new_map;
-        new_map = mapped;
-        while (new_map) {
-            if (p1==new_map->e1 && p2==new_map->e2) return mapped;
-            if (p1==new_map->e1 || p2==new_map->e2) return NULL;
-            new_map = new_map->next;
-        }
-        new_map = (struct pair_map *)_th_alloc(REWRITE_SPACE,sizeof(struct pair_map));
-        new_map->next = mapped;
-        new_map->e1 = p1;
-        new_map->e2 = p2;
-        return new_map;
-    }
+    colors[v] = mix(colors[v] ^ (IND_TAG + depth));
+    refine(colors);
+}
 
-    if (p1->type==EXP_APPL && p2->type==EXP_APPL && p1->u.appl.functor==p2->u.appl.functor &&
-        p1->u.appl.count==p2->u.appl.count) {
-        int i;
-        if (_th_is_ac_or_c(env,p1->u.appl.functor)) {
-            char *block = (char *)ALLOCA(sizeof(char) * p1->u.appl.count);
-            for (i = 0; i < p1->u.appl.count; ++i) {
-                block[i] = 1;
-            }
-            //printf("AC check for %s\n", _th_print_exp(p1));
-            //printf("    and %s\n", _th_print_exp(p2));
-            mapped = rec_check_swap(env,mapped,p1,p2,block,0);
-            //printf("res %d\n", mapped);
-            return mapped;
-        } else {
-            //printf("non-AC check for %s\n", _th_print_exp(p1));
-            //printf("    and %s\n", _th_print_exp(p2));
-            for (i = 0; i < p1->u.appl.count; ++i) {
-                if (!(mapped = swappable_predicates(env,mapped,p1->u.appl.args[i],p2->u.appl.args[i]))) return NULL;
+/*
+ * Returns the first variable (in the order of the graph) whose color
+ * is shared with another variable, or -1 if the variables are
+ * discrete.
+ */
+static int target_var(color *colors)
+{
+    color *sorted = (color *)ALLOCA(sizeof(color) * graph.var_count);
+    int i, lo, hi, mid;
+
+    for (i = 0; i < graph.var_count; ++i) {
+        sorted[i] = colors[graph.vars[i]];
+    }
+    qsort(sorted, graph.var_count, sizeof(color), color_cmp);
+
+    for (i = 0; i < graph.var_count; ++i) {
+        color c = colors[graph.vars[i]];
+        lo = 0;
+        hi = graph.var_count-1;
+        while (lo < hi) {
+            mid = (lo+hi)/2;
+            if (sorted[mid] < c) {
+                lo = mid+1;
+            } else {
+                hi = mid;
             }
-            return mapped;
         }
+        if (lo+1 < graph.var_count && sorted[lo+1]==c) return graph.vars[i];
+    }
+
+    return -1;
+}
+
+static int compatible(color *left, color *right)
+{
+    color *l = (color *)MALLOC(sizeof(color) * graph.count);
+    color *r = (color *)MALLOC(sizeof(color) * graph.count);
+    int res;
+
+    memcpy(l, left, sizeof(color) * graph.count);
+    memcpy(r, right, sizeof(color) * graph.count);
+    qsort(l, graph.count, sizeof(color), color_cmp);
+    qsort(r, graph.count, sizeof(color), color_cmp);
+    res = !memcmp(l, r, sizeof(color) * graph.count);
+    FREE(l);
+    FREE(r);
+
+    return res;
+}
+
+static struct term_marks *image_marks = NULL;
+static struct term_marks *permute_marks = NULL;
+
+static struct _ex_intern *permute(struct env *env, struct _ex_intern *e)
+{
+    struct _ex_intern **args, *r;
+    int i, change;
+
+    if (e->type==EXP_VAR) {
+        r = (struct _ex_intern *)_th_term_value(image_marks,e);
+        return r ? r : e;
+    }
+    if (e->type != EXP_APPL) return e;
+
+    if (_th_term_marked(permute_marks,e)) return (struct _ex_intern *)_th_term_value(permute_marks,e);
+
+    args = (struct _ex_intern **)ALLOCA(sizeof(struct _ex_intern *) * e->u.appl.count);
+    change = 0;
+    for (i = 0; i < e->u.appl.count; ++i) {
+        args[i] = permute(env,e->u.appl.args[i]);
+        if (args[i] != e->u.appl.args[i]) change = 1;
+    }
+    r = change ? _ex_intern_appl_env(env,e->u.appl.functor,e->u.appl.count,args) : e;
+    _th_set_term_value(permute_marks,e,r);
+
+    return r;
+}
+
+/*
+ * Makes perm (indexed by position in graph.vars) the current
+ * substitution for permute.
+ */
+static void set_permutation(int *perm)
+{
+    int i;
+
+    if (image_marks==NULL) {
+        image_marks = _th_new_term_marks(1);
+        permute_marks = _th_new_term_marks(1);
+    }
+    _th_start_traversal(image_marks);
+    _th_start_traversal(permute_marks);
+    for (i = 0; i < graph.var_count; ++i) {
+        if (perm[i] != i) _th_set_term_value(image_marks,graph.terms[graph.vars[i]],graph.terms[graph.vars[perm[i]]]);
+    }
+}
+
+static color *var_colors;
+
+static int var_cmp(const void *i1, const void *i2)
+{
+    color c1 = var_colors[graph.vars[*(int *)i1]];
+    color c2 = var_colors[graph.vars[*(int *)i2]];
+
+    if (c1 < c2) return -1;
+    if (c1 > c2) return 1;
+    return 0;
+}
+
+/*
+ * At a leaf the variables are discrete on both sides, so matching
+ * colors gives the permutation.
+ */
+static int leaf_permutation(struct env *env, struct _ex_intern *e, color *left, color *right, int *perm)
+{
+    int *l = (int *)ALLOCA(sizeof(int) * graph.var_count);
+    int *r = (int *)ALLOCA(sizeof(int) * graph.var_count);
+    int i;
+
+    for (i = 0; i < graph.var_count; ++i) {
+        l[i] = r[i] = i;
+    }
+    var_colors = left;
+    qsort(l, graph.var_count, sizeof(int), var_cmp);
+    var_colors = right;
+    qsort(r, graph.var_count, sizeof(int), var_cmp);
+    for (i = 0; i < graph.var_count; ++i) {
+        if (left[graph.vars[l[i]]] != right[graph.vars[r[i]]]) return 0;
+        perm[l[i]] = r[i];
+    }
+
+    set_permutation(perm);
+
+    return permute(env,e)==e;
+}
+
+static int search(struct env *env, struct _ex_intern *e, color *left, color *right, int depth, int *perm)
+{
+    color *l, *r;
+    int a, i, found;
+
+    if (!compatible(left, right)) return 0;
+
+    a = target_var(left);
+    if (a < 0) return leaf_permutation(env,e,left,right,perm);
+    if (depth >= SYMMETRY_MAX_DEPTH) return 0;
+
+    l = (color *)MALLOC(sizeof(color) * graph.count);
+    r = (color *)MALLOC(sizeof(color) * graph.count);
+    found = 0;
+    for (i = 0; i < graph.var_count && !found && search_budget > 0; ++i) {
+        int b = graph.vars[i];
+        if (right[b] != left[a]) continue;
+        --search_budget;
+        memcpy(l, left, sizeof(color) * graph.count);
+        memcpy(r, right, sizeof(color) * graph.count);
+        individualize(l, a, depth);
+        individualize(r, b, depth);
+        found = search(env,e,l,r,depth+1,perm);
     }
+    FREE(l);
+    FREE(r);
+
+    return found;
+}
 
-    return NULL;
+static int orbit_find(int *orbit, int i)
+{
+    while (orbit[i] != i) {
+        orbit[i] = orbit[orbit[i]];
+        i = orbit[i];
+    }
+    return i;
 }
 
-struct swap_groups {
-    struct swap_groups *next;
-    struct add_list *group;
+struct generator {
+    struct generator *next;
+    int *perm;
 };
 
-static struct swap_groups *get_swap_groups(struct env *env, struct _ex_intern *e)
+static struct generator *find_generators(struct env *env, struct _ex_intern *e)
 {
-    struct add_list *predicates, *p;
-    struct switch_list *list;
-    struct swap_groups *groups = NULL, *g;
+    struct generator *generators = NULL, *g;
+    color *prefix, *left, *right;
+    int *orbit, *index, *perm;
+    int a, b, i, depth, count = 0;
+
+    prefix = (color *)MALLOC(sizeof(color) * graph.count);
+    left = (color *)MALLOC(sizeof(color) * graph.count);
+    right = (color *)MALLOC(sizeof(color) * graph.count);
+    orbit = (int *)ALLOCA(sizeof(int) * graph.var_count);
+    index = (int *)ALLOCA(sizeof(int) * graph.count);
+    perm = (int *)ALLOCA(sizeof(int) * graph.var_count);
+
+    for (i = 0; i < graph.var_count; ++i) {
+        index[graph.vars[i]] = i;
+    }
 
-    //printf("Here0\n");
-    //fflush(stdout);
-    predicates = collect_predicates(env,e);
-    //printf("Here1\n");
-    //p = predicates;
-    //while (p) {
-    //    printf("    %s\n", _th_print_exp(p->e));
-    //    p = p->next;
-    //}
-    //fflush(stdout);
-    list = symmetric_vars(env,e);
-    if (list==NULL) return NULL;
-    //printf("Here2\n");
-    //fflush(stdout);
-    build_pair_info(list);
-    //printf("Here3\n");
-    //fflush(stdout);
-
-    while (predicates) {
-        //printf("Checking %s\n", _th_print_exp(predicates->e));
-        g = groups;
-        while (g) {
-            //printf("Checking group\n");
-            p = g->group;
-            while (p) {
-                //printf("Checking term %s\n", _th_print_exp(p->e));
-                if (!swappable_predicates(env,NULL,predicates->e,p->e)) goto cont;
-                p = p->next;
+    memcpy(prefix, graph.initial, sizeof(color) * graph.count);
+    refine(prefix);
+
+    for (depth = 0; depth < SYMMETRY_MAX_DEPTH && count < SYMMETRY_MAX_GENERATORS; ++depth) {
+        a = target_var(prefix);
+        if (a < 0) break;
+
+        /*
+         * Only generators found at this level fix the prefix, so the
+         * orbits are started over for each level.
+         */
+        for (i = 0; i < graph.var_count; ++i) {
+            orbit[i] = i;
+        }
+        for (i = 0; i < graph.var_count && count < SYMMETRY_MAX_GENERATORS; ++i) {
+            b = graph.vars[i];
+            if (b==a || prefix[b] != prefix[a] || orbit_find(orbit,i)==orbit_find(orbit,index[a])) continue;
+            memcpy(left, prefix, sizeof(color) * graph.count);
+            memcpy(right, prefix, sizeof(color) * graph.count);
+            individualize(left, a, depth);
+            individualize(right, b, depth);
+            search_budget = SYMMETRY_SEARCH_BUDGET;
+            if (search(env,e,left,right,depth+1,perm)) {
+                int j;
+                g = (struct generator *)_th_alloc(REWRITE_SPACE,sizeof(struct generator));
+                g->next = generators;
+                g->perm = (int *)_th_alloc(REWRITE_SPACE,sizeof(int) * graph.var_count);
+                memcpy(g->perm, perm, sizeof(int) * graph.var_count);
+                generators = g;
+                ++count;
+                for (j = 0; j < graph.var_count; ++j) {
+                    orbit[orbit_find(orbit,j)] = orbit_find(orbit,perm[j]);
+                }
+#ifndef FAST
+                _tree_print1("Generator %d", count);
+                _tree_indent();
+                for (j = 0; j < graph.var_count; ++j) {
+                    if (perm[j] != j) {
+                        _tree_print2("%s -> %s", _th_intern_decode(graph.terms[graph.vars[j]]->u.var),
+                                     _th_intern_decode(graph.terms[graph.vars[perm[j]]]->u.var));
+                    }
+                }
+                _tree_undent();
+#endif
             }
-            p = predicates->next;
-            predicates->next = g->group;
-            g->group = predicates;
-            goto cont2;
-cont:
-            g = g->next;
         }
-        p = predicates->next;
-        g = (struct swap_groups *)_th_alloc(REWRITE_SPACE,sizeof(struct swap_groups));
-        g->next = groups;
-        groups = g;
-        g->group = predicates;
-        predicates->next = NULL;
-cont2:
-        predicates = p;
+
+        individualize(prefix, a, depth);
     }
 
-    return groups;
+    FREE(prefix);
+    FREE(left);
+    FREE(right);
+
+    return generators;
+}
+
+static int term_id_cmp(const void *i1, const void *i2)
+{
+    struct _ex_intern *t1 = *(struct _ex_intern **)i1;
+    struct _ex_intern *t2 = *(struct _ex_intern **)i2;
+
+    if (t1->id < t2->id) return -1;
+    if (t1->id > t2->id) return 1;
+    return 0;
+}
+
+/*
+ * Lex leader constraint for one generator.  The atoms are ordered by
+ * term id and the constraint says that the values of the atoms are
+ * lexicographically no larger than the values of their images:
+ *
+ *     L(i) = (x -> y) & (~x | L(i+1)) & (y | L(i+1))
+ *
+ * where x is the i-th atom moved by the generator and y its image.
+ * Only the first SYMMETRY_LEX_LENGTH moved atoms are used, which
+ * weakens the constraint but keeps it sound.  Returns NULL if the
+ * generator does not map the atoms onto themselves.
+ */
+static struct _ex_intern *lex_leader(struct env *env, struct _ex_intern **atoms, int count, int *perm)
+{
+    struct _ex_intern **x, **y, *l;
+    int i, n;
+
+    set_permutation(perm);
+
+    x = (struct _ex_intern **)ALLOCA(sizeof(struct _ex_intern *) * SYMMETRY_LEX_LENGTH);
+    y = (struct _ex_intern **)ALLOCA(sizeof(struct _ex_intern *) * SYMMETRY_LEX_LENGTH);
+    n = 0;
+    for (i = 0; i < count && n < SYMMETRY_LEX_LENGTH; ++i) {
+        struct _ex_intern *image = permute(env,atoms[i]);
+        if (image==atoms[i]) continue;
+        if (!_th_term_marked(vertex_marks,image)) return NULL;
+        x[n] = atoms[i];
+        y[n] = image;
+        ++n;
+    }
+    if (n==0) return NULL;
+
+    l = _ex_true;
+    for (i = n-1; i >= 0; --i) {
+        struct _ex_intern *nx = _ex_intern_appl1_env(env,INTERN_NOT,x[i]);
+        if (l==_ex_true) {
+            l = _ex_intern_appl2_env(env,INTERN_OR,nx,y[i]);
+        } else {
+            l = _ex_intern_appl3_env(env,INTERN_AND,
+                    _ex_intern_appl2_env(env,INTERN_OR,nx,y[i]),
+                    _ex_intern_appl2_env(env,INTERN_OR,nx,l),
+                    _ex_intern_appl2_env(env,INTERN_OR,y[i],l));
+        }
+    }
+
+    return l;
 }
 
 struct _ex_intern *_th_augment_with_symmetries(struct env *env, struct _ex_intern *e)
 {
-    struct add_list *a, *terms = NULL, *t;
-    struct swap_groups *groups, *mgroup;
-    int count = 0, i, gcount;
-    struct _ex_intern **args;
+    struct generator *generators, *g;
+    struct add_list *predicates, *p;
+    struct _ex_intern **atoms, **args, *l;
+    int count, i;
+    char *mark;
 
     _tree_print0("Symmetry analysis");
     _tree_indent();
 
-    groups = get_swap_groups(env,e);
+    mark = _th_alloc_mark(REWRITE_SPACE);
 
-    if (groups==NULL) {
+    if (!build_graph(env,e) || graph.var_count < 2) {
         _tree_print0("No symmetries");
+        _th_alloc_release(REWRITE_SPACE,mark);
         _tree_undent();
         return e;
     }
 
-    _tree_print0("Groups");
-    _tree_indent();
-    mgroup = groups;
-    while (mgroup) {
-        _tree_print0("group");
-        _tree_indent();
-        a = mgroup->group;
-        while (a) {
-            _tree_print_exp("e",a->e);
-            a = a->next;
-        }
+    generators = find_generators(env,e);
+    if (generators==NULL) {
+        _tree_print0("No symmetries");
+        _th_alloc_release(REWRITE_SPACE,mark);
         _tree_undent();
-        mgroup = mgroup->next;
+        return e;
     }
-    _tree_undent();
 
-    gcount = 0;
-    while (groups) {
-        a = groups->group;
-        i = 0;
-        while (a) {
-            ++i;
-            a = a->next;
-        }
-        if (i > gcount) {
-            gcount = i;
-            mgroup = groups;
-        }
-        groups = groups->next;
-    }
-    if (mgroup->group->next) {
-        a = mgroup->group;
-        while (a->next) {
-            t = (struct add_list *)ALLOCA(sizeof(struct add_list));
-            t->next = terms;
-            terms = t;
-            t->e = _ex_intern_appl2_env(env,INTERN_AND,a->e,_ex_intern_appl1_env(env,INTERN_NOT,a->next->e));
-            ++count;
-            a = a->next;
-        }
-    }
+    predicates = collect_predicates(env,e);
+    count = 0;
+    for (p = predicates; p; p = p->next) ++count;
+    atoms = (struct _ex_intern **)ALLOCA(sizeof(struct _ex_intern *) * (count+1));
+    count = 0;
+    for (p = predicates; p; p = p->next) atoms[count++] = p->e;
+    qsort(atoms, count, sizeof(struct _ex_intern *), term_id_cmp);
 
-#ifndef FAST
-    a = mgroup->group;
-    _tree_print0("Symmetric group");
-    _tree_indent();
-    while (a) {
-        _tree_print_exp("term", a->e);
-        a = a->next;
-    }
-    _tree_undent();
-#endif
-    //printf("Group:\n");
-    //while (a) {
-    //    printf("    %s\n", _th_print_exp(a->e));
-    //    a = a->next;
-    //}
+    i = 0;
+    for (g = generators; g; g = g->next) ++i;
+    args = (struct _ex_intern **)ALLOCA(sizeof(struct _ex_intern *) * (i+1));
 
-    args = (struct _ex_intern **)ALLOCA(sizeof(struct _ex_intern *) * (count + 1));
     i = 0;
     _tree_print0("Adding terms");
     _tree_indent();
-    while (terms) {
-        _tree_print_exp("term", terms->e);
-        args[i++] = terms->e;
-        terms = terms->next;
+    for (g = generators; g; g = g->next) {
+        l = lex_leader(env,atoms,count,g->perm);
+        if (l) {
+            args[i++] = _ex_intern_appl1_env(env,INTERN_NOT,l);
+            _tree_print_exp("term", args[i-1]);
+        }
     }
     _tree_undent();
     args[i++] = e;
 
+    _th_alloc_release(REWRITE_SPACE,mark);
+
     _tree_undent();
     return _th_flatten_top(env,_ex_intern_appl_env(env,INTERN_OR,i,args));
 }
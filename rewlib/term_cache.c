@@ -52,9 +52,14 @@ int _th_get_table_size()
     return table_size;
 }
 
+int _th_term_cache_level()
+{
+    return push_level;
+}
+
 int _th_get_term_position(struct _ex_intern *e)
 {
-    int hash = (((int)e)/4)%TERM_HASH;
+    int hash = e->id%TERM_HASH;
     struct term_lookup *t = table[hash];
     //_tree_print2("hash = %d, table = %x", hash, table);
 
@@ -180,7 +185,7 @@ void print_term_indices()
 
 int new_term(struct _ex_intern *term)
 {
-    int hash = (((int)term)/4)%TERM_HASH;
+    int hash = term->id%TERM_HASH;
     struct term_lookup *t = (struct term_lookup *)_th_alloc(TERM_CACHE_SPACE,sizeof(struct term_lookup));
     //printf("m alloc %d\n", sizeof(struct term_lookup));
     //printf("Adding term %s\n", _th_print_exp(term));
@@ -229,7 +234,7 @@ static struct term_cache *root;
 
 static struct term_detail *get_detail(struct _ex_intern *term, int pos)
 {
-    int hash = (((int)term)+pos)%TERM_DETAIL_SIZE;
+    int hash = (term->id+pos)%TERM_DETAIL_SIZE;
     struct term_detail *d = term_details[hash];
     static unsigned zero[2] = { 1, 0 };
     static struct term_detail def = { NULL, NULL, 0, zero, zero, zero, NULL, NULL };
@@ -246,7 +251,7 @@ static struct term_detail *get_detail(struct _ex_intern *term, int pos)
 
 static struct term_detail *has_detail(struct _ex_intern *term, int pos)
 {
-    int hash = (((int)term)+pos)%TERM_DETAIL_SIZE;
+    int hash = (term->id+pos)%TERM_DETAIL_SIZE;
     struct term_detail *d = term_details[hash];
 
     while (d != NULL) {
@@ -259,7 +264,7 @@ static struct term_detail *has_detail(struct _ex_intern *term, int pos)
 
 static struct term_detail *create_term_detail(struct _ex_intern *term, int pos)
 {
-    int hash = (((int)term)+pos)%TERM_DETAIL_SIZE;
+    int hash = (term->id+pos)%TERM_DETAIL_SIZE;
     struct term_detail *d = (struct term_detail *)_th_alloc(TERM_CACHE_SPACE,sizeof(struct term_detail));
     //printf("n alloc %d\n", sizeof(struct term_detail));
 
@@ -1631,7 +1636,7 @@ int _th_has_a_term(struct _ex_intern *e)
 
 struct term_data *_th_get_term_data_holder(struct _ex_intern *e, struct _ex_intern *term)
 {
-    int hash = ((((int)e)+((int)term))/4)%TERM_INFO_HASH;
+    int hash = (e->id+term->id)%TERM_INFO_HASH;
     struct term_data_info *info = term_info[hash];
 
     while (info != NULL) {
@@ -1693,6 +1698,7 @@ void _th_clear_dependency_cache()
     for (i = 0; i < TERM_HASH; ++i) {
         term_by_var[i] = NULL;
     }
+    _th_unate_pop(-1);
 }
 
 static void check_valid_list(struct term_list *list)
@@ -1943,18 +1949,6 @@ static void augment_dependency_cache(struct env *env, struct add_list *list)
     _tree_undent();
 }
 
-static int member(struct _ex_intern *e, struct term_list *l)
-{
-    while (l != NULL) {
-		if (l->e==e) {
-			return 1;
-		}
-		l = l->next;
-	}
-
-	return 0;
-}
-
 static void extract_dependencies(struct term_list *list)
 {
     struct term_list *l;
@@ -1983,6 +1977,11 @@ static void extract_dependencies(struct term_list *list)
 
     l = list;
     while (l != NULL) {
+        /* The nodes of the cache keep their lists, which only grow */
+        if (l->e->user1==(struct _ex_intern *)l) {
+            l = l->next;
+            continue;
+        }
         if (l->e->user1) {
             d = ((struct term_list *)l->e->user1)->dependencies;
         } else {
@@ -1990,7 +1989,7 @@ static void extract_dependencies(struct term_list *list)
         }
         l->dependencies = NULL;
         while (d != NULL) {
-            if (d->term->e->user2 && member(d->term->e,list)) {
+            if (d->term->e->user2) {
                 nd = (struct dependencies *)_th_alloc(REWRITE_SPACE,sizeof(struct dependencies));
                 nd->next = l->dependencies;
                 nd->reduction = d->reduction;
@@ -2012,7 +2011,7 @@ static void extract_dependencies(struct term_list *list)
             d = NULL;
         }
         while (d != NULL) {
-            if (d->term->e->user2 && member(d->term->e,list)) {
+            if (d->term->e->user2) {
                 nd = (struct dependencies *)_th_alloc(REWRITE_SPACE,sizeof(struct dependencies));
                 nd->next = l->neg_dependencies;
                 nd->reduction = d->reduction;
@@ -3064,6 +3063,7 @@ void _th_term_cache_pop(struct mark_info *td)
     //struct term_cache *tc;
 
     --push_level;
+    _th_unate_pop(push_level);
 
     //printf("Popping table size %d %d\n", table_size, td->table_size);
     //printf("Dependency tables %x %x\n", dependency_table, td->dependency_table);
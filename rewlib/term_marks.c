@@ -0,0 +1,121 @@
+/*
+ * term_marks.c
+ *
+ * Epoch stamped marks for DAG traversals of terms
+ *
+ * (C) 2024, Kenneth Roe
+ *
+ * GNU Affero General Public License
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "Globals.h"
+#include "Intern.h"
+
+/*
+ * A traversal that must visit each shared subterm once used to mark terms
+ * through the user1/user2/next_cache fields (or the mark1/mark2 bits) and
+ * chain them on a trail so that the marks could be cleared afterwards.
+ * That costs a second pass over everything visited, it tramples the
+ * rewrite cache links in next_cache, and two passes using the same fields
+ * cannot be active at the same time.
+ *
+ * A term_marks table instead keeps a stamp for each term id.  A term is
+ * marked when its stamp equals the current epoch, so starting a new
+ * traversal only bumps the epoch.  Each pass owns its own table, so
+ * traversals can interleave freely.  A table created with values set can
+ * also hold one memoized result per term.
+ *
+ * The tables are malloced and grow with the term id range; they are not
+ * affected by releases of the allocation spaces.
+ */
+struct term_marks *_th_new_term_marks(int values)
+{
+    struct term_marks *m = (struct term_marks *)MALLOC(sizeof(struct term_marks));
+
+    m->epoch = 1;
+    m->size = 0;
+    m->stamp = NULL;
+    m->value = NULL;
+    m->has_values = values;
+
+    return m;
+}
+
+static void grow(struct term_marks *m, unsigned id)
+{
+    unsigned size = _ex_term_id_limit();
+
+    if (size <= id) size = id+1;
+    size += size/4 + 1024;
+
+    m->stamp = (unsigned *)REALLOC(m->stamp,sizeof(unsigned) * size);
+    if (m->stamp==NULL) {
+        printf("Error in REALLOC\n");
+        exit(1);
+    }
+    memset(m->stamp + m->size, 0, sizeof(unsigned) * (size - m->size));
+    if (m->has_values) {
+        m->value = (void **)REALLOC(m->value,sizeof(void *) * size);
+        if (m->value==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
+    }
+    m->size = size;
+}
+
+/*
+ * Unmarks every term
+ */
+void _th_start_traversal(struct term_marks *m)
+{
+    if (++m->epoch==0) {
+        if (m->stamp) memset(m->stamp, 0, sizeof(unsigned) * m->size);
+        m->epoch = 1;
+    }
+}
+
+int _th_term_marked(struct term_marks *m, struct _ex_intern *e)
+{
+    return e->id < m->size && m->stamp[e->id]==m->epoch;
+}
+
+void _th_mark_term(struct term_marks *m, struct _ex_intern *e)
+{
+    if (e->id >= m->size) grow(m, e->id);
+    m->stamp[e->id] = m->epoch;
+}
+
+void _th_unmark_term(struct term_marks *m, struct _ex_intern *e)
+{
+    if (e->id < m->size) m->stamp[e->id] = 0;
+}
+
+/*
+ * Marks e and returns true if it was already marked
+ */
+int _th_visit_term(struct term_marks *m, struct _ex_intern *e)
+{
+    if (e->id >= m->size) grow(m, e->id);
+    if (m->stamp[e->id]==m->epoch) return 1;
+    m->stamp[e->id] = m->epoch;
+    return 0;
+}
+
+/*
+ * Returns the value stored for e in this traversal, or NULL if e is
+ * not marked
+ */
+void *_th_term_value(struct term_marks *m, struct _ex_intern *e)
+{
+    if (e->id >= m->size || m->stamp[e->id] != m->epoch) return NULL;
+    return m->value[e->id];
+}
+
+void _th_set_term_value(struct term_marks *m, struct _ex_intern *e, void *value)
+{
+    if (e->id >= m->size) grow(m, e->id);
+    m->stamp[e->id] = m->epoch;
+    m->value[e->id] = value;
+}
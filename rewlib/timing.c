@@ -0,0 +1,170 @@
+/*
+ * timing.c
+ *
+ * Per-phase timing used by the benchmark harness
+ *
+ * (C) 2024, Kenneth Roe
+ *
+ * GNU Affero General Public License
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "Globals.h"
+#ifdef WIN32
+#include <time.h>
+#else
+#include <sys/time.h>
+#endif
+
+/*
+ * Time is charged to the innermost active phase, so the phases add up
+ * to the total run time.  For example, rewriting done while
+ * preprocessing counts as rewriting only.  Phases may nest
+ * recursively; re-entering the phase that is already on top only bumps
+ * a depth count so that the recursive rewriter does not pay for a clock
+ * read on every call.
+ */
+#define PHASE_STACK_SIZE 64
+
+static char *phase_names[PHASE_COUNT] = {
+    "other", "parse", "preprocess", "rewrite", "search", "external"
+};
+
+static double phase_time[PHASE_COUNT];
+static unsigned phase_calls[PHASE_COUNT];
+
+static int phase_stack[PHASE_STACK_SIZE];
+static int phase_depth[PHASE_STACK_SIZE];
+static int phase_top = 0;
+
+static double start_time, last_time;
+static char *report_file = NULL;
+static char *report_input = NULL;
+
+static double now()
+{
+#ifdef WIN32
+    return ((double)clock()) / CLOCKS_PER_SEC;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
+static void charge()
+{
+    double t = now();
+    phase_time[phase_stack[phase_top]] += t - last_time;
+    last_time = t;
+}
+
+/*
+ * Seconds on the clock used for the phases
+ */
+double _th_phase_clock()
+{
+    return now();
+}
+
+void _th_phase_start(int phase)
+{
+    if (phase_stack[phase_top]==phase) {
+        ++phase_depth[phase_top];
+        return;
+    }
+    if (phase_top+1 >= PHASE_STACK_SIZE) {
+        fprintf(stderr, "Phase stack overflow\n");
+        exit(1);
+    }
+
+    charge();
+    ++phase_calls[phase];
+    ++phase_top;
+    phase_stack[phase_top] = phase;
+    phase_depth[phase_top] = 0;
+}
+
+void _th_phase_end(int phase)
+{
+    if (phase_top==0 || phase_stack[phase_top] != phase) {
+        fprintf(stderr, "Unbalanced end of phase %s\n", phase_names[phase]);
+        exit(1);
+    }
+    if (phase_depth[phase_top]) {
+        --phase_depth[phase_top];
+        return;
+    }
+
+    charge();
+    --phase_top;
+}
+
+static void write_report()
+{
+    FILE *f;
+    int i;
+    char *c;
+
+    if (report_file==NULL) return;
+
+    while (phase_top > 0) {
+        charge();
+        --phase_top;
+    }
+    charge();
+
+    f = fopen(report_file, "w");
+    if (f==NULL) {
+        fprintf(stderr, "Cannot open %s\n", report_file);
+        return;
+    }
+
+    fprintf(f, "{\n");
+    fprintf(f, "    \"input\": \"");
+    for (c = report_input; c && *c; ++c) {
+        if (*c=='"' || *c=='\\') fputc('\\', f);
+        fputc(*c, f);
+    }
+    fprintf(f, "\",\n");
+    fprintf(f, "    \"total\": %.6f,\n", last_time - start_time);
+    fprintf(f, "    \"phases\": {\n");
+    for (i = 0; i < PHASE_COUNT; ++i) {
+        fprintf(f, "        \"%s\": { \"seconds\": %.6f, \"calls\": %u }%s\n",
+                phase_names[i], phase_time[i], phase_calls[i], (i < PHASE_COUNT-1) ? "," : "");
+    }
+    fprintf(f, "    }\n");
+    fprintf(f, "}\n");
+
+    fclose(f);
+    report_file = NULL;
+}
+
+void _th_phase_init()
+{
+    int i;
+
+    for (i = 0; i < PHASE_COUNT; ++i) {
+        phase_time[i] = 0;
+        phase_calls[i] = 0;
+    }
+    phase_top = 0;
+    phase_stack[0] = PHASE_OTHER;
+    phase_depth[0] = 0;
+    start_time = last_time = now();
+}
+
+/*
+ * Requests a JSON summary of the phase times in file.  It is written
+ * when the program exits, including exits from the time limit check.
+ */
+void _th_phase_report(char *file)
+{
+    if (report_file==NULL) atexit(write_report);
+    report_file = file;
+}
+
+void _th_phase_input(char *name)
+{
+    report_input = name;
+}
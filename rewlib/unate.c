@@ -9,6 +9,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "Globals.h"
 #include "Intern.h"
 
@@ -30,50 +31,112 @@ struct term_info {
 
 static struct _ex_intern *term_trail;
 
-static int has_term(struct env *env, struct _ex_intern *e, struct _ex_intern *term)
+/*
+ * Occurrence index for the formula last queried by _th_term_count or
+ * _th_has_term.  Counting the occurrences of a term by recursing through
+ * the formula treats it as a tree, which can be exponentially larger than
+ * the DAG, and each containment query was a separate traversal.
+ *
+ * One pass instead orders the subterms of the formula so that every term
+ * comes before its arguments and then pushes path counts down from the
+ * root.  The count reached at a subterm is the number of times it occurs
+ * in the formula as a tree, so a single pass answers the count and the
+ * containment query for every subterm.  Counts are held in a term_marks
+ * table keyed by term id and saturate at 0x7fffffff.  The index is
+ * rebuilt when a different formula is queried.
+ */
+static struct term_marks *occurrence_marks = NULL;
+static struct term_marks *order_marks = NULL;
+static struct _ex_intern **occurrence_order = NULL;
+static int occurrence_size = 0;
+static int occurrence_count;
+static struct _ex_intern *occurrence_formula = NULL;
+static unsigned occurrence_formula_id;
+
+static void add_occurrence_order(struct _ex_intern *e)
 {
     int i;
-    
-    if (e->user2) return 0;
 
-    e->user2 = e;
-    e->next_cache = term_trail;
-    term_trail = e;
+    if (_th_visit_term(order_marks,e)) return;
 
-    if (e==term) return 1;
-    
     switch (e->type) {
         case EXP_APPL:
             for (i = 0; i < e->u.appl.count; ++i) {
-                if (has_term(env,e->u.appl.args[i],term)) return 1;
+                add_occurrence_order(e->u.appl.args[i]);
             }
-            return 0;
-            
+            break;
         case EXP_QUANT:
-            return has_term(env,e->u.quant.exp,term) ||
-                   has_term(env,e->u.quant.cond,term);
-            
-        default:
-            return 0;
+            add_occurrence_order(e->u.quant.exp);
+            add_occurrence_order(e->u.quant.cond);
+            break;
+    }
+
+    if (occurrence_count==occurrence_size) {
+        occurrence_size = occurrence_size*2 + 1024;
+        occurrence_order = (struct _ex_intern **)REALLOC(occurrence_order,sizeof(struct _ex_intern *) * occurrence_size);
+        if (occurrence_order==NULL) {
+            printf("Error in REALLOC\n");
+            exit(1);
+        }
     }
+    occurrence_order[occurrence_count++] = e;
 }
 
-int _th_has_term(struct env *env, struct _ex_intern *e, struct _ex_intern *term)
+static void add_occurrences(struct _ex_intern *e, unsigned count)
 {
-    int i;
-    
-    if (e==term) return 1;
-    
-    term_trail = NULL;
+    unsigned c = (unsigned)(size_t)_th_term_value(occurrence_marks,e);
 
-    i = has_term(env,e,term);
+    c += count;
+    if (c > 0x7fffffff || c < count) c = 0x7fffffff;
+    _th_set_term_value(occurrence_marks,e,(void *)(size_t)c);
+}
 
-    while (term_trail) {
-        term_trail->user2 = NULL;
-        term_trail = term_trail->next_cache;
+static void build_occurrence_index(struct _ex_intern *e)
+{
+    int i, j;
+    unsigned count;
+    struct _ex_intern *t;
+
+    if (e==occurrence_formula && e->id==occurrence_formula_id) return;
+
+    if (occurrence_marks==NULL) {
+        occurrence_marks = _th_new_term_marks(1);
+        order_marks = _th_new_term_marks(0);
+    }
+
+    _th_start_traversal(order_marks);
+    occurrence_count = 0;
+    add_occurrence_order(e);
+
+    _th_start_traversal(occurrence_marks);
+    _th_set_term_value(occurrence_marks,e,(void *)1);
+    for (i = occurrence_count-1; i >= 0; --i) {
+        t = occurrence_order[i];
+        count = (unsigned)(size_t)_th_term_value(occurrence_marks,t);
+        switch (t->type) {
+            case EXP_APPL:
+                for (j = 0; j < t->u.appl.count; ++j) {
+                    add_occurrences(t->u.appl.args[j],count);
+                }
+                break;
+            case EXP_QUANT:
+                add_occurrences(t->u.quant.exp,count);
+                add_occurrences(t->u.quant.cond,count);
+                break;
+        }
     }
 
-    return i;
+    occurrence_formula = e;
+    occurrence_formula_id = e->id;
+}
+
+int _th_has_term(struct env *env, struct _ex_intern *e, struct _ex_intern *term)
+{
+    if (e==term) return 1;
+
+    build_occurrence_index(e);
+
+    return _th_term_marked(occurrence_marks,term);
 }
 
 int _th_another_cond_as_subterm(struct env *env, struct _ex_intern *e, struct term_list *list)
@@ -119,15 +182,13 @@ struct term_list *_th_eliminate_composite_conds(struct env *env, struct term_lis
     return nl;
 }
 
+static struct term_marks *ite_marks = NULL;
+
 static int _my_contains_ite(struct _ex_intern *e)
 {
     int i;
 
-    if (e->user2) return 0;
-
-    e->next_cache = term_trail;
-    term_trail = e;
-    e->user2 = _ex_true;
+    if (_th_visit_term(ite_marks,e)) return 0;
 
     switch (e->type) {
         case EXP_APPL:
@@ -147,17 +208,11 @@ int _th_my_contains_ite(struct _ex_intern *e)
 {
     int res;
 
-    _th_clear_cache();
-
-    term_trail = NULL;
+    if (ite_marks==NULL) ite_marks = _th_new_term_marks(0);
+    _th_start_traversal(ite_marks);
 
     res = _my_contains_ite(e);
 
-    while (term_trail) {
-        term_trail->user2 = NULL;
-        term_trail = term_trail->next_cache;
-    }
-
     return res;
 }
 
@@ -222,24 +277,19 @@ static int member(struct _ex_intern *e, struct term_list *l)
 
 static struct term_list *get_terms(struct env *env, struct _ex_intern *e, struct term_list *rest);
 
+static struct term_marks *get_terms_marks = NULL;
+
 static struct term_list *extract_terms(struct env *env, struct _ex_intern *e, struct term_list *rest)
 {
     int i;
 
-    //printf("e->user2 = %s\n", _th_print_exp(e->user2));
-    //printf("e->user1 = %d %s\n", e->user1, _th_print_exp(e->user1));
-    if (e->user2) return rest;
-
-    e->user2 = e;
-    e->next_cache = term_trail;
-    term_trail = e;
+    if (_th_visit_term(get_terms_marks,e)) return rest;
 
     switch(e->type) {
         case EXP_APPL:
             switch (e->u.appl.functor) {
                 case INTERN_ITE:
-                    term_trail = term_trail->next_cache;
-                    e->user2 = NULL;
+                    _th_unmark_term(get_terms_marks,e);
                     rest = get_terms(env,e,rest);
                 default:
                     for (i = 0; i < e->u.appl.count; ++i) {
@@ -261,13 +311,7 @@ static struct term_list *get_terms(struct env *env, struct _ex_intern *e, struct
     int i;
     struct term_list *a;
     
-    //printf("e->user2 2 = %s\n", _th_print_exp(e->user2));
-    //printf("e->user1 = %d %s\n", e->user1, _th_print_exp(e->user1));
-    if (e->user2) return rest;
-
-    e->user2 = e;
-    e->next_cache = term_trail;
-    term_trail = e;
+    if (_th_visit_term(get_terms_marks,e)) return rest;
 
     switch(e->type) {
         case EXP_APPL:
@@ -332,8 +376,7 @@ def:
                 if (member(e,rest)) {
                     return  rest;
                 } else {
-                    term_trail = term_trail->next_cache;
-                    e->user2 = NULL;
+                    _th_unmark_term(get_terms_marks,e);
                     rest = extract_terms(env,e,rest);
                     a = (struct term_list *)_th_alloc(HEURISTIC_SPACE,sizeof(struct term_list));
                     a->next = rest;
@@ -344,48 +387,11 @@ def:
     }
 }
 
-static int my_term_count(struct env *env, struct _ex_intern *e, struct _ex_intern *term)
-{
-    int i, count;
-    struct term_data *data = _th_get_term_data_holder(e, term);
-
-    //if (data->term_count >= 0) {
-    //    return data->term_count;
-    //}
-
-    if (e==term) {
-        //data->term_count = 1;
-        return 1;
-    }
-    
-    switch (e->type) {
-        case EXP_APPL:
-            count = 0;
-            for (i = 0; i < e->u.appl.count; ++i) {
-                count += my_term_count(env,e->u.appl.args[i],term);
-            }
-            //data->term_count = count;
-            return count;
-        
-        case EXP_QUANT:
-            count = my_term_count(env,e->u.quant.exp,term)+
-                    my_term_count(env,e->u.quant.cond,term);
-            //data->term_count = count+1;
-            return count;
-        
-        default:
-            //data->term_count = 0;
-            return 0;
-    }
-}
-
 int _th_term_count(struct env *env, struct _ex_intern *e, struct _ex_intern *term)
 {
-    int count;
-    
-    count = my_term_count(env,e,term);
+    build_occurrence_index(e);
 
-    return count;
+    return (int)(size_t)_th_term_value(occurrence_marks,term);
 }
 
 static int elimination_score(struct term_list *all, struct _ex_intern *e)
@@ -1017,17 +1023,11 @@ static struct term_list *_get_terms(struct env *env, struct _ex_intern *e, struc
 {
     struct term_list *ret; 
 
-    _th_clear_cache();
-
-    term_trail = 0;
+    if (get_terms_marks==NULL) get_terms_marks = _th_new_term_marks(0);
+    _th_start_traversal(get_terms_marks);
 
     ret = get_terms(env,e,list);
 
-    while (term_trail != NULL) {
-        term_trail->user2 = NULL;
-        term_trail = term_trail->next_cache;
-    }
-
     return ret;
 }
 
@@ -1074,7 +1074,7 @@ struct term_list *_th_get_terms(struct env *env, struct _ex_intern *e,struct ter
 #ifdef XX
 static int get_term_position(struct term_lookup **table, struct _ex_intern *e)
 {
-    int hash = (((int)e)/4)%TERM_HASH;
+    int hash = e->id%TERM_HASH;
     struct term_lookup *t = table[hash];
     //_tree_print2("hash = %d, table = %x", hash, table);
 
@@ -1132,7 +1132,7 @@ static struct term_lookup **get_leaf_terms(struct env *env, struct _ex_intern *e
         if (!_th_my_contains_ite(tl->e)) {
             //printf("    Adding\n");
         //if (!_th_another_cond_as_subterm(env,tl->e,terms)) {
-            hash = (((int)tl->e)/4)%TERM_HASH;
+            hash = tl->e->id%TERM_HASH;
             t = (struct term_lookup *)_th_alloc(REWRITE_SPACE,sizeof(struct term_lookup));
             t->next = table[hash];
             table[hash] = t;
@@ -1165,239 +1165,448 @@ static int is_dependent(struct term_list *parent, struct term_list *child)
     return 0;
 }
 
-struct dtable {
-    struct dtable *next;
-    unsigned mask;
-    unsigned *false_false_implications;
-    unsigned *true_false_implications;
-    unsigned *false_true_implications;
-    unsigned *true_true_implications;
+/*
+ * Implication graph between the literals of the atoms in the term table.
+ * Literal 2*p is the atom at position p and 2*p+1 is its negation.  Each
+ * dependency in the term list gives an edge and its contrapositive, kept
+ * in the successor list of the implying literal.
+ *
+ * The term list is the dependency cache, whose dependency lists only grow
+ * at their heads until a pop of the term cache strips them.  For each
+ * position the graph remembers the head it has already read, so an update
+ * only adds the edges of the new dependencies.  The strongly connected
+ * components are kept in a union-find over the literals.  Their
+ * representative holds the list of ancestors, every literal that implies
+ * the component, so closing a set of literals is one pass over those
+ * lists.  A new edge either merges the components on the cycle it closes
+ * or adds the ancestors of its source to the components below its target,
+ * stopping at components that already have them.  A literal that implies
+ * its own negation fails, and its atom is recorded in forced_true or
+ * forced_false.  When both literals of an atom fail the dependencies are
+ * inconsistent and graph_conflict holds the atom.
+ *
+ * Every change is recorded on a trail with the push level of the term
+ * cache, and _th_unate_pop undoes the changes above the level popped to.
+ */
+struct graph_set {
+    int count, size;
+    int *lits;
 };
 
-#define FALSE_FALSE 1
-#define TRUE_FALSE  2
-#define FALSE_TRUE  3
-#define TRUE_TRUE   4
+#define GRAPH_TRAIL_EDGE     0
+#define GRAPH_TRAIL_SEEN     1
+#define GRAPH_TRAIL_ANCESTOR 2
+#define GRAPH_TRAIL_LINK     3
+#define GRAPH_TRAIL_FORCED   4
+#define GRAPH_TRAIL_CONFLICT 5
+
+struct graph_trail {
+    int level;
+    int kind;
+    int node;
+    int value;
+    struct term_list *owner;
+    struct dependencies *seen;
+};
 
-static void add_item(struct dtable **dtable, int size, int mode, unsigned parent, unsigned child)
+static int graph_terms = 0;
+static int graph_alloc = 0;
+static int graph_edges = 0;
+static int graph_conflict = -1;
+static struct graph_set *successors = NULL;
+static struct graph_set *ancestors = NULL;
+static int *graph_parent = NULL, *graph_rank = NULL;
+static unsigned *graph_mark = NULL, graph_stamp = 0;
+static unsigned *graph_visit = NULL, graph_visit_stamp = 0;
+static int *graph_queue = NULL;
+static struct term_list **graph_owner = NULL;
+static struct dependencies **graph_seen = NULL;
+static unsigned *forced_true = NULL, *forced_false = NULL;
+static struct graph_trail *graph_trail = NULL;
+static int graph_trail_count = 0, graph_trail_size = 0;
+static int graph_level;
+
+static void *graph_realloc(void *p, int size)
 {
-    unsigned pbase, pmask, cbase, cmask;
-    struct dtable *d;
-    unsigned *mask;
+    p = REALLOC(p,size);
+    if (p==NULL) {
+        printf("Error in REALLOC\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void grow_graph(int terms)
+{
+    int alloc = graph_alloc;
     int i;
 
-    pbase = parent/32;
-    pmask = 1<<(parent%32);
-    cbase = child/32;
-    cmask = 1<<(child%32);
+    if (terms <= graph_alloc) return;
+
+    while (alloc < terms) alloc = alloc * 2 + 256;
+
+    successors = (struct graph_set *)graph_realloc(successors,sizeof(struct graph_set) * alloc * 2);
+    ancestors = (struct graph_set *)graph_realloc(ancestors,sizeof(struct graph_set) * alloc * 2);
+    graph_parent = (int *)graph_realloc(graph_parent,sizeof(int) * alloc * 2);
+    graph_rank = (int *)graph_realloc(graph_rank,sizeof(int) * alloc * 2);
+    graph_mark = (unsigned *)graph_realloc(graph_mark,sizeof(unsigned) * alloc * 2);
+    graph_visit = (unsigned *)graph_realloc(graph_visit,sizeof(unsigned) * alloc * 2);
+    graph_queue = (int *)graph_realloc(graph_queue,sizeof(int) * alloc * 2);
+    graph_owner = (struct term_list **)graph_realloc(graph_owner,sizeof(struct term_list *) * alloc);
+    graph_seen = (struct dependencies **)graph_realloc(graph_seen,sizeof(struct dependencies *) * alloc);
+    forced_true = (unsigned *)graph_realloc(forced_true,sizeof(unsigned) * alloc / 32);
+    forced_false = (unsigned *)graph_realloc(forced_false,sizeof(unsigned) * alloc / 32);
+
+    for (i = graph_alloc * 2; i < alloc * 2; ++i) {
+        successors[i].count = successors[i].size = 0;
+        successors[i].lits = NULL;
+        ancestors[i].count = 1;
+        ancestors[i].size = 4;
+        ancestors[i].lits = (int *)graph_realloc(NULL,sizeof(int) * 4);
+        ancestors[i].lits[0] = i;
+        graph_parent[i] = i;
+        graph_rank[i] = 0;
+        graph_mark[i] = 0;
+        graph_visit[i] = 0;
+    }
+    for (i = graph_alloc; i < alloc; ++i) {
+        graph_owner[i] = NULL;
+        graph_seen[i] = NULL;
+    }
+    memset(forced_true + graph_alloc / 32, 0, sizeof(unsigned) * (alloc - graph_alloc) / 32);
+    memset(forced_false + graph_alloc / 32, 0, sizeof(unsigned) * (alloc - graph_alloc) / 32);
+
+    graph_alloc = alloc;
+}
 
-    d = dtable[cbase];
-    while (d) {
-        if (d->mask==cmask) break;
-        d = d->next;
+static struct graph_trail *graph_push_trail(int kind, int node, int value)
+{
+    struct graph_trail *t;
+
+    if (graph_trail_count==graph_trail_size) {
+        graph_trail_size = graph_trail_size * 2 + 256;
+        graph_trail = (struct graph_trail *)graph_realloc(graph_trail,sizeof(struct graph_trail) * graph_trail_size);
     }
-    if (d==NULL) {
-        d = (struct dtable *)_th_alloc(REWRITE_SPACE,sizeof(struct dtable));
-        d->next = dtable[cbase];
-        dtable[cbase] = d;
-        d->false_false_implications = NULL;
-        d->false_true_implications = NULL;
-        d->true_false_implications = NULL;
-        d->true_true_implications = NULL;
-        d->mask = cmask;
-    }
-
-    switch (mode) {
-        case FALSE_FALSE:
-            if (d->false_false_implications==NULL) {
-                d->false_false_implications = (unsigned *)_th_alloc(REWRITE_SPACE,sizeof(unsigned) * size);
-                for (i = 0; i < size; ++i) {
-                    d->false_false_implications[i] = 0;
-                }
-            }
-            mask = d->false_false_implications;
-            break;
-        case FALSE_TRUE:
-            if (d->false_true_implications==NULL) {
-                d->false_true_implications = (unsigned *)_th_alloc(REWRITE_SPACE,sizeof(unsigned) * size);
-                for (i = 0; i < size; ++i) {
-                    d->false_true_implications[i] = 0;
-                }
-            }
-            mask = d->false_true_implications;
-            break;
-        case TRUE_TRUE:
-            if (d->true_true_implications==NULL) {
-                d->true_true_implications = (unsigned *)_th_alloc(REWRITE_SPACE,sizeof(unsigned) * size);
-                for (i = 0; i < size; ++i) {
-                    d->true_true_implications[i] = 0;
-                }
+    t = graph_trail + graph_trail_count++;
+    t->level = graph_level;
+    t->kind = kind;
+    t->node = node;
+    t->value = value;
+
+    return t;
+}
+
+static void set_add(struct graph_set *s, int l)
+{
+    if (s->count==s->size) {
+        s->size = s->size * 2 + 4;
+        s->lits = (int *)graph_realloc(s->lits,sizeof(int) * s->size);
+    }
+    s->lits[s->count++] = l;
+}
+
+/*
+ * No path compression, so that a link can be undone
+ */
+static int graph_find(int l)
+{
+    while (graph_parent[l] != l) l = graph_parent[l];
+    return l;
+}
+
+static int graph_link(int a, int b)
+{
+    int x;
+
+    if (graph_rank[a] < graph_rank[b]) {
+        x = a;
+        a = b;
+        b = x;
+    }
+    graph_push_trail(GRAPH_TRAIL_LINK,b,graph_rank[a]);
+    graph_parent[b] = a;
+    if (graph_rank[a]==graph_rank[b]) ++graph_rank[a];
+
+    return a;
+}
+
+static void mark_ancestors(int c)
+{
+    int i;
+
+    ++graph_stamp;
+    for (i = 0; i < ancestors[c].count; ++i) {
+        graph_mark[ancestors[c].lits[i]] = graph_stamp;
+    }
+}
+
+static int has_ancestor(int c, int l)
+{
+    int i;
+
+    for (i = 0; i < ancestors[c].count; ++i) {
+        if (ancestors[c].lits[i]==l) return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * The literal l implies its own negation, so its atom takes the value
+ * that makes l false
+ */
+static void literal_fails(int l)
+{
+    int p = l/2;
+    unsigned *forced = (l&1) ? forced_true : forced_false;
+    unsigned *other = (l&1) ? forced_false : forced_true;
+
+    if (forced[p/32] & (1<<(p%32))) return;
+    graph_push_trail(GRAPH_TRAIL_FORCED,p,l&1);
+    forced[p/32] |= (1<<(p%32));
+    if ((other[p/32] & (1<<(p%32))) && graph_conflict < 0) {
+        _zone_print_exp("Both literals fail", _th_lookup_term(p));
+        graph_push_trail(GRAPH_TRAIL_CONFLICT,p,graph_conflict);
+        graph_conflict = p;
+    }
+}
+
+/*
+ * Adds the ancestors of component from to component c and to every
+ * component below it.  A component that already has all of them is not
+ * followed, as the ones below it have them too.
+ */
+static void propagate_ancestors(int from, int c)
+{
+    struct graph_set *s = ancestors + from;
+    int head = 0, tail = 0;
+    int i, j, l, m, n, old;
+
+    ++graph_visit_stamp;
+    graph_visit[c] = graph_visit_stamp;
+    graph_queue[tail++] = c;
+    while (head < tail) {
+        c = graph_queue[head++];
+        mark_ancestors(c);
+        old = ancestors[c].count;
+        for (i = 0; i < s->count; ++i) {
+            l = s->lits[i];
+            if (graph_mark[l]==graph_stamp) continue;
+            set_add(ancestors+c,l);
+            if (graph_find(l^1)==c) literal_fails(l);
+        }
+        if (ancestors[c].count==old) continue;
+        graph_push_trail(GRAPH_TRAIL_ANCESTOR,c,old);
+        for (i = 0; i < old; ++i) {
+            m = ancestors[c].lits[i];
+            if (graph_find(m) != c) continue;
+            for (j = 0; j < successors[m].count; ++j) {
+                n = graph_find(successors[m].lits[j]);
+                if (graph_visit[n]==graph_visit_stamp) continue;
+                graph_visit[n] = graph_visit_stamp;
+                graph_queue[tail++] = n;
             }
-            mask = d->true_true_implications;
-            break;
-        case TRUE_FALSE:
-            if (d->true_false_implications==NULL) {
-                d->true_false_implications = (unsigned *)_th_alloc(REWRITE_SPACE,sizeof(unsigned) * size);
-                for (i = 0; i < size; ++i) {
-                    d->true_false_implications[i] = 0;
-                }
+        }
+    }
+}
+
+/*
+ * The components on a path from the target of a new edge back to its
+ * source become one.  The source component already has the ancestors of
+ * all of them.
+ */
+static int merge_cycle(int u, int v)
+{
+    int c = graph_find(u);
+    int r = c;
+    int i, l, d, old;
+
+    for (i = 0; i < ancestors[c].count; ++i) {
+        d = graph_find(ancestors[c].lits[i]);
+        if (d != r && d != c && has_ancestor(d,v)) {
+            r = graph_link(r,d);
+        }
+    }
+
+    if (r != c) {
+        mark_ancestors(r);
+        old = ancestors[r].count;
+        for (i = 0; i < ancestors[c].count; ++i) {
+            l = ancestors[c].lits[i];
+            if (graph_mark[l] != graph_stamp) set_add(ancestors+r,l);
+        }
+        if (ancestors[r].count != old) graph_push_trail(GRAPH_TRAIL_ANCESTOR,r,old);
+    }
+
+    for (i = 0; i < ancestors[r].count; ++i) {
+        l = ancestors[r].lits[i];
+        if (graph_find(l^1)==r) literal_fails(l);
+    }
+
+    return r;
+}
+
+static void add_edge(int from, int to)
+{
+    int cf, ct, r, i, j, n;
+
+    set_add(successors+from,to);
+    graph_push_trail(GRAPH_TRAIL_EDGE,from,to);
+    ++graph_edges;
+
+    cf = graph_find(from);
+    ct = graph_find(to);
+    if (cf==ct) return;
+
+    if (has_ancestor(cf,to)) {
+        r = merge_cycle(from,to);
+        for (i = 0; i < ancestors[r].count; ++i) {
+            if (graph_find(ancestors[r].lits[i]) != r) continue;
+            for (j = 0; j < successors[ancestors[r].lits[i]].count; ++j) {
+                n = graph_find(successors[ancestors[r].lits[i]].lits[j]);
+                if (n != r) propagate_ancestors(r,n);
             }
-            mask = d->true_false_implications;
-            break;
+        }
+    } else {
+        propagate_ancestors(cf,ct);
     }
+}
+
+static void add_dependency_edges(int t1, struct dependencies *d)
+{
+    int t2 = _th_get_term_position(d->term->e);
 
-    mask[pbase] |= pmask;
+    if (t2 < 0 || t2 >= graph_terms) return;
+    if (d->reduction==_ex_true) {
+        add_edge(2*t1, 2*t2);
+        add_edge(2*t2+1, 2*t1+1);
+    } else if (d->reduction==_ex_false) {
+        add_edge(2*t1, 2*t2+1);
+        add_edge(2*t2, 2*t1+1);
+    }
 }
 
-static struct dtable **build_dependency_table(struct term_list *list)
+void _th_unate_pop(int level)
 {
-    int i;
-    int size = (_th_get_table_size()+31)/32;
-    struct dtable **dtable = (struct dtable **)_th_alloc(REWRITE_SPACE,sizeof(struct dtable *) * size);
-    struct dependencies *d;
+    struct graph_trail *t;
+    int p;
+
+    while (graph_trail_count > 0 && graph_trail[graph_trail_count-1].level > level) {
+        t = graph_trail + --graph_trail_count;
+        switch (t->kind) {
+            case GRAPH_TRAIL_EDGE:
+                --successors[t->node].count;
+                --graph_edges;
+                break;
+            case GRAPH_TRAIL_SEEN:
+                graph_owner[t->node] = t->owner;
+                graph_seen[t->node] = t->seen;
+                break;
+            case GRAPH_TRAIL_ANCESTOR:
+                ancestors[t->node].count = t->value;
+                break;
+            case GRAPH_TRAIL_LINK:
+                p = graph_parent[t->node];
+                graph_parent[t->node] = t->node;
+                graph_rank[p] = t->value;
+                break;
+            case GRAPH_TRAIL_FORCED:
+                p = t->node;
+                if (t->value) {
+                    forced_true[p/32] &= ~(1<<(p%32));
+                } else {
+                    forced_false[p/32] &= ~(1<<(p%32));
+                }
+                break;
+            case GRAPH_TRAIL_CONFLICT:
+                graph_conflict = t->value;
+                break;
+        }
+    }
+}
+
+static void update_implication_graph(struct term_list *list)
+{
+    int size = _th_get_table_size();
+    int t1, old_edges = graph_edges;
+    struct dependencies *d, *seen;
+    struct graph_trail *t;
 
-    _zone_print0("Building dependency table");
+    _zone_print0("Updating implication graph");
     _tree_indent();
-    for (i = 0; i < size; ++i) {
-        dtable[i] = NULL;
-    }
 
-    //check_valid_list(list);
+    grow_graph(size);
+    graph_terms = size;
+    graph_level = _th_term_cache_level();
 
     while (list != NULL) {
-        _zone_print_exp("Adding", list->e);
-        d = list->dependencies;
-        _tree_indent();
-        while (d != NULL) {
-            int t1, t2;
-            t1 = _th_get_term_position(list->e);
-            t2 = _th_get_term_position(d->term->e);
-            _zone_print_exp("dependency", d->term->e);
-            _zone_print2("terms %d %d", t1, t2);
-            if (t1 >= 0 && t2 >= 0) {
-                //printf("Adding offset %d %s\n", t1, _th_print_exp(list->e));
-                //printf("and %d %s\n", t2, _th_print_exp(d->term->e));
-                //fflush(stdout);
-                if (d->reduction==_ex_true) {
-                    _tree_undent();
-                    _zone_print_exp("true_true", d->term->e);
-                    _tree_indent();
-                    add_item(dtable, size, TRUE_TRUE, t1, t2);
-                    add_item(dtable, size, FALSE_FALSE, t2, t1);
-                } else if (d->reduction==_ex_false) {
-                    _tree_undent();
-                    _zone_print_exp("true_false", d->term->e);
-                    _tree_indent();
-                    add_item(dtable, size, TRUE_FALSE, t1, t2);
-                    add_item(dtable, size, TRUE_FALSE, t2, t1);
-                }
+        t1 = _th_get_term_position(list->e);
+        if (t1 >= 0 && t1 < size &&
+            (graph_owner[t1] != list || graph_seen[t1] != list->dependencies)) {
+            seen = (graph_owner[t1]==list) ? graph_seen[t1] : NULL;
+            t = graph_push_trail(GRAPH_TRAIL_SEEN,t1,0);
+            t->owner = graph_owner[t1];
+            t->seen = graph_seen[t1];
+            graph_owner[t1] = list;
+            graph_seen[t1] = list->dependencies;
+            for (d = list->dependencies; d != NULL && d != seen; d = d->next) {
+                add_dependency_edges(t1, d);
             }
-            d = d->next;
         }
-        _tree_undent();
         list = list->next;
     }
 
+    _zone_print3("%d terms, %d edges, %d new", graph_terms, graph_edges, graph_edges - old_edges);
     _tree_undent();
-    return dtable;
 }
 
-static void add_dependencies(struct dtable **dtable, struct term_info *info, int size)
+/*
+ * Adds every literal that implies a member of the set given by the atoms
+ * whose assertion (asserted) or denial (denied) is in it
+ */
+static void close_literals(unsigned *asserted, unsigned *denied, int size)
 {
-    int added = 1;
-    int i, j;
-
-    //_zone_print0("add_dependencies");
-    //_tree_indent();
-    while (added) {
-        added = 0;
-        for (i = 0; i < size; ++i) {
-            struct dtable *d = dtable[i];
-            while (d != NULL) {
-                if (info->assert_makes_true[i] & d->mask) {
-                    //_zone_print2("assert_makes_true[%d] has %x", i, d->mask);
-                    //_tree_indent();
-                    for (j = 0; j < size; ++j) {
-                        unsigned c = ((d->true_true_implications?d->true_true_implications[j]:0) | info->assert_makes_true[j]);
-                        if (c != info->assert_makes_true[j]) {
-                            //_zone_print3("assert_makes_true[%d]: %x => %x", j, info->assert_makes_true[j], c);
-                            added = 1;
-                        }
-                        info->assert_makes_true[j] = c;
-                        c = ((d->false_true_implications?d->false_true_implications[j]:0) | info->deny_makes_true[j]);
-                        if (c != info->deny_makes_true[j]) {
-                            //_zone_print3("deny_makes_true[%d]: %x => %x", j, info->deny_makes_true[j], c);
-                            added = 1;
-                        }
-                        info->deny_makes_true[j] = c;
-                    }
-                    //_tree_undent();
+    int i, j, k, l, c, count = 0;
+    unsigned x;
+
+    ++graph_stamp;
+    for (i = 0; i < size && i*32 < graph_terms; ++i) {
+        for (j = 0, x = asserted[i] | denied[i]; x; ++j, x >>= 1) {
+            if ((x&1)==0 || i*32+j >= graph_terms) continue;
+            for (l = 0; l < 2; ++l) {
+                if (((l ? denied[i] : asserted[i]) & (1<<j))==0) continue;
+                c = graph_find(2*(i*32+j)+l);
+                if (graph_mark[c] != graph_stamp && ancestors[c].count > 1) {
+                    graph_mark[c] = graph_stamp;
+                    graph_queue[count++] = c;
                 }
-                if (info->assert_makes_false[i] & d->mask) {
-                    //_zone_print2("assert_makes_false[%d] has %x", i, d->mask);
-                    //_tree_indent();
-                    for (j = 0; j < size; ++j) {
-                        unsigned c = ((d->true_true_implications?d->true_true_implications[j]:0) | info->assert_makes_false[j]);
-                        if (c != info->assert_makes_false[j]) {
-                            //_zone_print3("assert_makes_false[%d]: %x => %x", j, info->assert_makes_false[j], c);
-                            added = 1;
-                        }
-                        info->assert_makes_false[j] = c;
-                        c = ((d->false_true_implications?d->false_true_implications[j]:0) | info->deny_makes_false[j]);
-                        if (c != info->deny_makes_false[j]) {
-                            //_zone_print3("deny_makes_false[%d]: %x => %x", j, info->deny_makes_false[j], c);
-                            added = 1;
-                        }
-                        info->deny_makes_false[j] = c;
-                    }
-                    //_tree_undent();
-                }
-                if (info->deny_makes_true[i] & d->mask) {
-                    //_zone_print2("deny_makes_true[%d] has %x", i, d->mask);
-                    //_tree_indent();
-                    for (j = 0; j < size; ++j) {
-                        unsigned c = ((d->true_false_implications?d->true_false_implications[j]:0) | info->assert_makes_true[j]);
-                        if (c != info->assert_makes_true[j]) {
-                            //_zone_print3("assert_makes_true[%d]: %x => %x", j, info->assert_makes_true[j], c);
-                            added = 1;
-                        }
-                        info->assert_makes_true[j] = c;
-                        c = ((d->false_false_implications?d->false_false_implications[j]:0) | info->deny_makes_true[j]);
-                        if (c != info->deny_makes_true[j]) {
-                            //_zone_print3("deny_makes_true[%d]: %x => %x", j, info->deny_makes_true[j], c);
-                            added = 1;
-                        }
-                        info->deny_makes_true[j] = c;
-                    }
-                    //_tree_undent();
-                }
-                if (info->deny_makes_false[i] & d->mask) {
-                    //_zone_print2("deny_makes_false[%d] has %x", i, d->mask);
-                    //_tree_indent();
-                    for (j = 0; j < size; ++j) {
-                        unsigned c = ((d->true_false_implications?d->true_false_implications[j]:0) | info->assert_makes_false[j]);
-                        if (c != info->assert_makes_false[j]) {
-                            //_zone_print3("assert_makes_false[%d]: %x => %x", j, info->assert_makes_false[j], c);
-                            added = 1;
-                        }
-                        info->assert_makes_false[j] = c;
-                        c = ((d->false_false_implications?d->false_false_implications[j]:0) | info->deny_makes_false[j]);
-                        if (c != info->deny_makes_false[j]) {
-                            //_zone_print3("deny_makes_false[%d]: %x => %x", j, info->deny_makes_false[j], c);
-                            added = 1;
-                        }
-                        info->deny_makes_false[j] = c;
-                    }
-                    //_tree_undent();
-                }
-                d = d->next;
             }
         }
     }
-    //_tree_undent();
+
+    for (i = 0; i < count; ++i) {
+        c = graph_queue[i];
+        for (j = 0; j < ancestors[c].count; ++j) {
+            k = ancestors[c].lits[j]/2;
+            if (k/32 >= size) continue;
+            if (ancestors[c].lits[j]&1) {
+                denied[k/32] |= (1<<(k%32));
+            } else {
+                asserted[k/32] |= (1<<(k%32));
+            }
+        }
+    }
+}
+
+static void add_dependencies(struct term_info *info, int size)
+{
+    if (graph_edges==0) return;
+
+    close_literals(info->assert_makes_true, info->deny_makes_true, size);
+    close_literals(info->assert_makes_false, info->deny_makes_false, size);
 }
 
-static struct term_info *_find_unate(struct env *env, struct dtable **dtable, struct _ex_intern *e)
+static struct term_info *_find_unate(struct env *env, int use_graph, struct _ex_intern *e)
 {
     int pos, i, j;
     struct term_info *info;
@@ -1458,7 +1667,7 @@ static struct term_info *_find_unate(struct env *env, struct dtable **dtable, st
                 }
                 break;
             case INTERN_NOT:
-                cinfo = _find_unate(env,dtable,e->u.appl.args[0]);
+                cinfo = _find_unate(env,use_graph,e->u.appl.args[0]);
                 for (i = 0; i < size; ++i) {
                     info->assert_makes_false[i] = ((i<cinfo->vector_length)?cinfo->assert_makes_true[i]:0);
                     info->assert_makes_true[i] = ((i<cinfo->vector_length)?cinfo->assert_makes_false[i]:0);
@@ -1474,7 +1683,7 @@ static struct term_info *_find_unate(struct env *env, struct dtable **dtable, st
                     info->deny_makes_false[i] = 0;
                 }
                 for (j = 0; j < e->u.appl.count; ++j) {
-                    cinfo = _find_unate(env,dtable,e->u.appl.args[j]);
+                    cinfo = _find_unate(env,use_graph,e->u.appl.args[j]);
                     //fprintf(stderr,"Returning from _find_unate of %s\n", _th_print_exp(e->u.appl.args[j]));
                     //fflush(stderr);
                     for (i = 0; i < size; ++i) {
@@ -1493,7 +1702,7 @@ static struct term_info *_find_unate(struct env *env, struct dtable **dtable, st
                     info->deny_makes_true[i] = 0;
                 }
                 for (j = 0; j < e->u.appl.count; ++j) {
-                    cinfo = _find_unate(env,dtable,e->u.appl.args[j]);
+                    cinfo = _find_unate(env,use_graph,e->u.appl.args[j]);
                     for (i = 0; i < size; ++i) {
                         info->assert_makes_false[i] &= ((i<cinfo->vector_length)?cinfo->assert_makes_false[i]:0);
                         info->deny_makes_false[i] &= ((i<cinfo->vector_length)?cinfo->deny_makes_false[i]:0);
@@ -1503,9 +1712,9 @@ static struct term_info *_find_unate(struct env *env, struct dtable **dtable, st
                 }
                 break;
             case INTERN_ITE:
-                cinfo = _find_unate(env,dtable,e->u.appl.args[0]);
-                dinfo = _find_unate(env,dtable,e->u.appl.args[1]);
-                einfo = _find_unate(env,dtable,e->u.appl.args[2]);
+                cinfo = _find_unate(env,use_graph,e->u.appl.args[0]);
+                dinfo = _find_unate(env,use_graph,e->u.appl.args[1]);
+                einfo = _find_unate(env,use_graph,e->u.appl.args[2]);
                 //printf("e, size = %s %d\n", _th_print_exp(e), size);
                 //fflush(stdout);
                 for (i = 0; i < size; ++i) {
@@ -1531,8 +1740,8 @@ static struct term_info *_find_unate(struct env *env, struct dtable **dtable, st
             case INTERN_EQUAL:
                 if (_th_is_boolean_term(env,e->u.appl.args[0]) ||
                     _th_is_boolean_term(env,e->u.appl.args[1])) {
-                    cinfo = _find_unate(env,dtable,e->u.appl.args[0]);
-                    dinfo = _find_unate(env,dtable,e->u.appl.args[1]);
+                    cinfo = _find_unate(env,use_graph,e->u.appl.args[0]);
+                    dinfo = _find_unate(env,use_graph,e->u.appl.args[1]);
                     for (i =0; i < size; ++i) {
                         info->assert_makes_true[i] =
                             ((((i<cinfo->vector_length)?cinfo->assert_makes_true[i]:0) & ((i<dinfo->vector_length)?dinfo->assert_makes_true[i]:0)) |
@@ -1574,7 +1783,7 @@ static struct term_info *_find_unate(struct env *env, struct dtable **dtable, st
     //_zone_print_exp("exp", e);
     //fprintf(stderr, "exp %s\n", _th_print_exp(e));
     //fprintf(stderr, "info %d %d %d %d\n", info->assert_makes_false, info->assert_makes_true, info->deny_makes_false, info->deny_makes_true);
-    add_dependencies(dtable,info,size);
+    if (use_graph) add_dependencies(info,size);
     //fprintf(stderr, "after info %d %d %d %d\n", info->assert_makes_false, info->assert_makes_true, info->deny_makes_false, info->deny_makes_true);
     //fflush(stderr);
 
@@ -1825,7 +2034,6 @@ struct add_list *eliminate_unates(struct env *env, struct _ex_intern *e, struct
     struct _ex_intern *t;
     struct add_list *a, *al_orig = al;
     int added;
-    struct dtable **dependencies = build_dependency_table(list);
     int table_size = (_th_get_table_size()+31)/32;
     //struct dependencies *d;
 
@@ -1837,11 +2045,20 @@ struct add_list *eliminate_unates(struct env *env, struct _ex_intern *e, struct
     }
     _zone_print_exp("Eliminate unates", e);
     _tree_indent();
+    update_implication_graph(list);
+    if (graph_conflict >= 0) {
+        _th_reduced_exp = _ex_true;
+        a = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
+        a->next = al;
+        a->e = _th_lookup_term(graph_conflict);
+        _tree_undent();
+        return a;
+    }
     _th_clear_cache();
     term_trail = NULL;
 
     //_tree_print1("table_size = %d", table_size);
-    info = _find_unate(env,dependencies,e);
+    info = _find_unate(env,1,e);
 
     while (term_trail) {
         term_trail->user2 = NULL;
@@ -1931,6 +2148,29 @@ struct add_list *eliminate_unates(struct env *env, struct _ex_intern *e, struct
 #endif
     added = 0;
     //fprintf(stderr, "e = %s\n", _th_print_exp(e));
+    for (i = 0; i < table_size && i*32 < graph_terms; ++i) {
+        int j;
+        unsigned x = forced_true[i] | forced_false[i];
+        for (j = 0; x; ++j, x >>= 1) {
+            if ((x&1)==0) continue;
+            t = _th_lookup_term(i*32+j);
+            if (t==NULL || t->user2 || !_th_has_term(env,e,t)) continue;
+            added = 1;
+            _tree_print_exp("Adding forced", t);
+            t->next_cache = term_trail;
+            term_trail = t;
+            a = (struct add_list *)_th_alloc(REWRITE_SPACE,sizeof(struct add_list));
+            a->next = al;
+            if (forced_true[i] & (1<<j)) {
+                t->user2 = _ex_true;
+                a->e = t;
+            } else {
+                t->user2 = _ex_false;
+                a->e = _ex_intern_appl1_env(env,INTERN_NOT,t);
+            }
+            al = a;
+        }
+    }
     for (i = 0; i < table_size; ++i) {
         if (info->assert_makes_true[i]) {
             int j = 0;
@@ -2072,7 +2312,7 @@ struct _ex_intern *_th_find_unate(struct env *env, struct _ex_intern *e)
     //fflush(stderr);
 
     //_tree_print1("table_size = %d", table_size);
-    info = _find_unate(env,NULL,e);
+    info = _find_unate(env,0,e);
 
     while (term_trail) {
         term_trail->user2 = NULL;
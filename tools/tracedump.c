@@ -0,0 +1,335 @@
+/*
+ * tracedump.c
+ *
+ * Decoder for the binary trace files written when HTP is run with -bt.
+ * It rebuilds the same "indent: text" lines that the text log contains.
+ *
+ *     tracedump [-i] [-z start end] file
+ *
+ *     -i   indent lines with spaces instead of prefixing the level
+ *     -z   only print entries from zones start through end
+ *
+ * (C) 2024, Kenneth Roe
+ *
+ * GNU Affero General Public License
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../rewlib/Trace.h"
+
+struct table {
+    char **text;
+    unsigned size;
+};
+
+static struct table formats, terms, strings;
+
+static int indent_mode = 0;
+static unsigned zone_start = 0, zone_end = 0xffffffff;
+static unsigned long_size, pointer_size;
+
+static char *out;
+static int out_size, out_pos;
+
+static void add_entry(struct table *t, unsigned id, char *s)
+{
+    if (id >= t->size) {
+        unsigned size = id * 2 + 64;
+        t->text = (char **)realloc(t->text,sizeof(char *) * size);
+        memset(t->text+t->size,0,sizeof(char *) * (size-t->size));
+        t->size = size;
+    }
+    t->text[id] = s;
+}
+
+static char *get_entry(struct table *t, unsigned id)
+{
+    if (id >= t->size || t->text[id]==NULL) return "<undefined>";
+    return t->text[id];
+}
+
+static void emit(char *s, int len)
+{
+    if (out_pos + len + 1 > out_size) {
+        out_size = (out_pos + len + 1) * 2;
+        out = (char *)realloc(out,out_size);
+    }
+    memcpy(out+out_pos,s,len);
+    out_pos += len;
+    out[out_pos] = 0;
+}
+
+static int fetch(struct trace_slot *slot, int *n, void *data, int size)
+{
+    int words = (size+sizeof(unsigned)-1)/sizeof(unsigned);
+
+    if (*n + words > TRACE_PAYLOAD) return 0;
+    memcpy(data, slot->payload + *n, size);
+    *n += words;
+
+    return 1;
+}
+
+/*
+ * Mirrors trace_print in Tree.c.  Each conversion is rebuilt with a
+ * normalized length modifier and printed on its own.
+ */
+static void decode_print(struct trace_slot *slot)
+{
+    char *f = get_entry(&formats, slot->format);
+    char spec[64], buf[256];
+    int n = 0;
+
+    while (*f) {
+        int longs = 0, big = 0, sp;
+        char *start = f;
+
+        if (*f != '%') {
+            while (*f && *f != '%') ++f;
+            emit(start, f-start);
+            continue;
+        }
+        ++f;
+        if (*f=='%') {
+            emit("%", 1);
+            ++f;
+            continue;
+        }
+
+        spec[0] = '%';
+        sp = 1;
+        while (*f && strchr("-+ #0123456789.*",*f)) {
+            if (*f=='*') {
+                int w;
+                if (!fetch(slot,&n,&w,sizeof(int))) goto truncated;
+                sp += sprintf(spec+sp, "%d", w);
+            } else if (sp < 40) {
+                spec[sp++] = *f;
+            }
+            ++f;
+        }
+        while (*f && strchr("hlLqjzt",*f)) {
+            if (*f=='L' || *f=='q') big = 1;
+            if (*f!='h') ++longs;
+            ++f;
+        }
+
+        switch (*f) {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                {
+                    long long v;
+                    if (longs >= 2 || big || (longs && long_size==sizeof(long long))) {
+                        if (!fetch(slot,&n,&v,sizeof(long long))) goto truncated;
+                    } else {
+                        int w;
+                        if (!fetch(slot,&n,&w,sizeof(int))) goto truncated;
+                        v = (*f=='d' || *f=='i') ? (long long)w : (long long)(unsigned)w;
+                    }
+                    if (*f=='c') {
+                        spec[sp++] = 'c';
+                        spec[sp] = 0;
+                        snprintf(buf, sizeof(buf), spec, (int)v);
+                    } else {
+                        spec[sp++] = 'l';
+                        spec[sp++] = 'l';
+                        spec[sp++] = *f;
+                        spec[sp] = 0;
+                        snprintf(buf, sizeof(buf), spec, v);
+                    }
+                    emit(buf, strlen(buf));
+                }
+                break;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                {
+                    double v;
+                    if (!fetch(slot,&n,&v,sizeof(double))) goto truncated;
+                    spec[sp++] = *f;
+                    spec[sp] = 0;
+                    snprintf(buf, sizeof(buf), spec, v);
+                    emit(buf, strlen(buf));
+                }
+                break;
+            case 's':
+                {
+                    unsigned len;
+                    char *s;
+                    if (!fetch(slot,&n,&len,sizeof(unsigned))) goto truncated;
+                    if (len & TRACE_STRING_REF) {
+                        s = get_entry(&strings, len & ~TRACE_STRING_REF);
+                        emit(s, strlen(s));
+                    } else {
+                        s = (char *)(slot->payload + n);
+                        n += (len+sizeof(unsigned)-1)/sizeof(unsigned);
+                        if (n > TRACE_PAYLOAD) goto truncated;
+                        emit(s, len);
+                    }
+                }
+                break;
+            case 'p':
+                {
+                    unsigned long long v = 0;
+                    if (!fetch(slot,&n,&v,pointer_size)) goto truncated;
+                    sprintf(buf, "0x%llx", v);
+                    emit(buf, strlen(buf));
+                }
+                break;
+        }
+        if (*f) ++f;
+    }
+    return;
+
+truncated:
+    emit(" <truncated>", 12);
+}
+
+static void print_lines(struct trace_slot *slot)
+{
+    char *l = out, *c;
+
+    while (*l) {
+        int ind = slot->indent;
+        c = l;
+        while (*c && *c != '\n') ++c;
+        if (*c=='\n') *c++ = 0;
+        while (*l==' ') {
+            ++l;
+            ++ind;
+        }
+        if (*l) {
+            if (indent_mode) {
+                printf("%*s%s\n", ind*2, "", l);
+            } else {
+                printf("%d: %s\n", ind, l);
+            }
+        }
+        l = c;
+    }
+}
+
+static void decode_slot(struct trace_slot *slot)
+{
+    char *s;
+
+    if (slot->zone < zone_start || slot->zone > zone_end) return;
+
+    out_pos = 0;
+    emit("", 0);
+
+    switch (slot->kind & 0xff) {
+        case TRACE_PRINT:
+            decode_print(slot);
+            break;
+        case TRACE_EXP:
+            s = get_entry(&formats, slot->format);
+            emit(s, strlen(s));
+            emit(": ", 2);
+            s = slot->payload[0] ? get_entry(&terms, slot->payload[0]) : "<NULL>";
+            emit(s, strlen(s));
+            break;
+        default:
+            fprintf(stderr, "Unknown trace slot kind %d\n", slot->kind);
+            exit(1);
+    }
+
+    print_lines(slot);
+}
+
+static unsigned read_word(FILE *f)
+{
+    unsigned w;
+
+    if (fread(&w,sizeof(unsigned),1,f) != 1) {
+        fprintf(stderr, "Truncated trace file\n");
+        exit(1);
+    }
+
+    return w;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *f;
+    char magic[sizeof(TRACE_MAGIC)];
+    unsigned tag;
+
+    while (argc > 1 && argv[1][0]=='-') {
+        if (!strcmp(argv[1],"-i")) {
+            indent_mode = 1;
+            argv += 1;
+            argc -= 1;
+        } else if (argc > 3 && !strcmp(argv[1],"-z")) {
+            zone_start = atoi(argv[2]);
+            zone_end = atoi(argv[3]);
+            argv += 3;
+            argc -= 3;
+        } else {
+            break;
+        }
+    }
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: tracedump [-i] [-z start end] file\n");
+        exit(1);
+    }
+
+    f = fopen(argv[1],"rb");
+    if (f==NULL) {
+        fprintf(stderr, "Cannot open %s\n", argv[1]);
+        exit(1);
+    }
+
+    if (fread(magic,1,sizeof(magic),f) != sizeof(magic) || strcmp(magic,TRACE_MAGIC)) {
+        fprintf(stderr, "%s is not a trace file\n", argv[1]);
+        exit(1);
+    }
+    if (read_word(f) != sizeof(struct trace_slot)) {
+        fprintf(stderr, "Trace slot size mismatch\n");
+        exit(1);
+    }
+    long_size = read_word(f);
+    pointer_size = read_word(f);
+    if (pointer_size > sizeof(unsigned long long)) {
+        fprintf(stderr, "Unsupported pointer size %d\n", pointer_size);
+        exit(1);
+    }
+
+    while (fread(&tag,sizeof(unsigned),1,f)==1) {
+        unsigned id, len, count;
+        char *s;
+        struct trace_slot slot;
+
+        switch (tag) {
+            case TRACE_DEF_FORMAT:
+            case TRACE_DEF_TERM:
+            case TRACE_DEF_STRING:
+                id = read_word(f);
+                len = read_word(f);
+                s = (char *)malloc(len+1);
+                if (fread(s,1,len,f) != len) {
+                    fprintf(stderr, "Truncated trace file\n");
+                    exit(1);
+                }
+                s[len] = 0;
+                add_entry(tag==TRACE_DEF_FORMAT ? &formats : (tag==TRACE_DEF_TERM ? &terms : &strings), id, s);
+                break;
+            case TRACE_RING:
+                count = read_word(f);
+                while (count--) {
+                    if (fread(&slot,sizeof(struct trace_slot),1,f) != 1) {
+                        fprintf(stderr, "Truncated trace file\n");
+                        exit(1);
+                    }
+                    decode_slot(&slot);
+                }
+                break;
+            default:
+                fprintf(stderr, "Bad trace record tag %d\n", tag);
+                exit(1);
+        }
+    }
+
+    fclose(f);
+
+    return 0;
+}